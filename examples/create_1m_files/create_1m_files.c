@@ -133,8 +133,12 @@ int rt_create_files(struct nvfuse_handle *nvh, u32 arg)
 	rt_progress_reset();
 	gettimeofday(&tv, NULL);
 
+	nvfuse_fold_sb_counters(&nvh->nvh_sb);
 	nvh->nvh_sb.bp_set_index_tsc = 0;
 	nvh->nvh_sb.bp_set_index_count = 0;
+	nvh->nvh_sb.bp_get_index_tsc = 0;
+	nvh->nvh_sb.bp_get_index_count = 0;
+	nvh->nvh_sb.bp_master_hit_count = 0;
 	nvh->nvh_sb.nvme_io_tsc = 0;
 	nvh->nvh_sb.nvme_io_count = 0;
 
@@ -156,8 +160,13 @@ int rt_create_files(struct nvfuse_handle *nvh, u32 arg)
 
 	printf(" Finish: creating null files (0x%x) %.3f OPS (%.f sec).\n", max_inodes,
 	       max_inodes / nvfuse_time_since_now(&tv), nvfuse_time_since_now(&tv));
+	nvfuse_fold_sb_counters(&nvh->nvh_sb);
 	printf(" bp tree cpu = %f sec\n",
 	       (double)nvh->nvh_sb.bp_set_index_tsc / (double)spdk_get_ticks_hz());
+	printf(" bp tree lookup cpu = %f sec (%lu lookups, %lu master cache hits)\n",
+	       (double)nvh->nvh_sb.bp_get_index_tsc / (double)spdk_get_ticks_hz(),
+	       (unsigned long)nvh->nvh_sb.bp_get_index_count,
+	       (unsigned long)nvh->nvh_sb.bp_master_hit_count);
 	printf(" sync meta i/o = %f sec\n", (double)nvh->nvh_sb.nvme_io_tsc / (double)spdk_get_ticks_hz());
 
 	return 0;
@@ -253,6 +262,10 @@ int rt_rm_files(struct nvfuse_handle *nvh, u32 arg)
 	rt_progress_reset();
 	gettimeofday(&tv, NULL);
 
+	nvfuse_fold_sb_counters(&nvh->nvh_sb);
+	nvh->nvh_sb.bp_del_index_tsc = 0;
+	nvh->nvh_sb.bp_del_index_count = 0;
+
 	/* delete null files */
 	printf(" Start: deleting null files (0x%x).\n", max_inodes);
 	for (i = 0; i < max_inodes; i++) {
@@ -267,6 +280,10 @@ int rt_rm_files(struct nvfuse_handle *nvh, u32 arg)
 	}
 	printf(" Finish: deleting null files (0x%x) %.3f OPS (%.f sec).\n", max_inodes,
 	       max_inodes / nvfuse_time_since_now(&tv), nvfuse_time_since_now(&tv));
+	nvfuse_fold_sb_counters(&nvh->nvh_sb);
+	printf(" bp tree delete cpu = %f sec (%lu deletes)\n",
+	       (double)nvh->nvh_sb.bp_del_index_tsc / (double)spdk_get_ticks_hz(),
+	       (unsigned long)nvh->nvh_sb.bp_del_index_count);
 
 	nvfuse_check_flush_dirty(&nvh->nvh_sb, 1);
 
@@ -35,6 +35,8 @@
 #include "nvfuse_aio.h"
 #include "nvfuse_misc.h"
 #include "nvfuse_debug.h"
+#include "nvfuse_bp_tree.h"
+#include "nvfuse_dep.h"
 
 #define DEINIT_IOM	1
 #define UMOUNT		1
@@ -55,6 +57,9 @@ struct nvfuse_params *g_params = &_g_params;
 
 int perf_aio(struct nvfuse_handle *nvh, s64 file_size, s32 block_size, s32 is_rand, s32 is_read,
 	     s32 direct, s32 qdepth, s32 runtime);
+int perf_dir_lookup(struct nvfuse_handle *nvh, s32 nr);
+int perf_bptree_insert(struct nvfuse_handle *nvh, s32 nr, s32 is_rand);
+int perf_bitmap_alloc(s32 fill);
 void perf_usage(char *cmd);
 void _print_stats(struct perf_stat_aio *cur_stat, char *name);
 
@@ -224,6 +229,264 @@ AIO_ERROR:
 	return 0;
 }
 
+/*
+ * directory index lookup microbenchmark
+ * creates nr files in a directory and reports cycles per lookup for the
+ * whole lookup path and for the b+tree index alone.
+ */
+int perf_dir_lookup(struct nvfuse_handle *nvh, s32 nr)
+{
+	struct nvfuse_superblock *sb;
+	struct nvfuse_dir_entry dir_entry;
+	char str[FNAME_SIZE];
+	s32 par_ino;
+	s32 i, fd;
+	s32 res = 0;
+	u64 start_tsc, lookup_tsc;
+
+	if (nvfuse_mkdir_path(nvh, "perf_lookup_dir", 0755) < 0) {
+		printf(" Error: mkdir perf_lookup_dir\n");
+		return -1;
+	}
+
+	par_ino = nvfuse_opendir(nvh, "perf_lookup_dir");
+
+	sb = nvfuse_read_super(nvh);
+	for (i = 0; i < nr; i++) {
+		sprintf(str, "file%d", i);
+		fd = nvfuse_openfile(sb, par_ino, str, O_RDWR | O_CREAT, 0);
+		if (fd < 0) {
+			printf(" Error: open() %s\n", str);
+			res = -1;
+			nr = i;
+			goto RMFILES;
+		}
+		nvfuse_closefile(nvh, fd);
+	}
+
+	nvfuse_fold_sb_counters(sb);
+	sb->bp_get_index_tsc = 0;
+	sb->bp_get_index_count = 0;
+
+	srand(nr);
+	start_tsc = spdk_get_ticks();
+	for (i = 0; i < nr; i++) {
+		sprintf(str, "file%d", rand() % nr);
+		if (nvfuse_lookup(sb, NULL, &dir_entry, str, par_ino) < 0) {
+			printf(" Error: lookup() %s\n", str);
+			res = -1;
+			break;
+		}
+	}
+	lookup_tsc = spdk_get_ticks() - start_tsc;
+
+	nvfuse_fold_sb_counters(sb);
+	printf(" dir lookup (%d files, %s key search): %.1f cycles/lookup, index %.1f cycles/lookup\n",
+	       nr, bp_key_search_name(), (double)lookup_tsc / nr,
+	       sb->bp_get_index_count ?
+	       (double)sb->bp_get_index_tsc / sb->bp_get_index_count : 0.0);
+
+RMFILES:
+	for (i = 0; i < nr; i++) {
+		sprintf(str, "file%d", i);
+		nvfuse_rmfile(sb, par_ino, str);
+	}
+	nvfuse_release_super(sb);
+
+	if (nvfuse_rmdir_path(nvh, "perf_lookup_dir") < 0) {
+		printf(" Error: rmdir perf_lookup_dir\n");
+		return -1;
+	}
+
+	return res;
+}
+
+/* 64bit mix of the sequence number standing in for a name hash */
+static bkey_t perf_hash_key(u64 x)
+{
+	x ^= x >> 33;
+	x *= 0xff51afd7ed558ccdULL;
+	x ^= x >> 33;
+	x *= 0xc4ceb9fe1a85ec53ULL;
+	x ^= x >> 33;
+
+	/* zero is a null key */
+	return x ? x : 1;
+}
+
+/*
+ * b+tree insert microbenchmark
+ * inserts nr sequential or hashed keys into the index of an empty directory,
+ * scans them in key order with a cursor, then removes nine out of ten keys.
+ * the number of nodes in use is reported to show node fill and shrink.
+ */
+int perf_bptree_insert(struct nvfuse_handle *nvh, s32 nr, s32 is_rand)
+{
+	struct nvfuse_superblock *sb;
+	struct nvfuse_inode_ctx *dir_ictx;
+	master_node_t *master;
+	bp_iter_t it;
+	bkey_t key, prev_key = 0;
+	bitem_t value, cur_value;
+	s32 par_ino;
+	s32 dup = 0, removed = 0, scanned = 0, unordered = 0;
+	s32 insert_nodes;
+	s32 i;
+	u64 start_tsc, insert_tsc, scan_tsc, remove_tsc;
+
+	if (nvfuse_mkdir_path(nvh, "perf_bptree_dir", 0755) < 0) {
+		printf(" Error: mkdir perf_bptree_dir\n");
+		return -1;
+	}
+
+	par_ino = nvfuse_opendir(nvh, "perf_bptree_dir");
+
+	sb = nvfuse_read_super(nvh);
+	dir_ictx = nvfuse_read_inode(sb, NULL, par_ino);
+	if (dir_ictx->ictx_inode->i_bpino == 0)
+		nvfuse_create_bptree(sb, dir_ictx->ictx_inode);
+
+	master = bp_get_dir_master(sb, dir_ictx);
+	if (master == NULL) {
+		printf(" Error: b+tree of perf_bptree_dir\n");
+		nvfuse_release_inode(sb, dir_ictx, DIRTY);
+		nvfuse_release_super(sb);
+		return -1;
+	}
+
+	start_tsc = spdk_get_ticks();
+	for (i = 0; i < nr; i++) {
+		key = is_rand ? perf_hash_key(i) : (bkey_t)i + 1;
+		value = i;
+		if (B_INSERT(master, &key, &value, &cur_value, 0) < 0)
+			dup++;
+	}
+	insert_tsc = spdk_get_ticks() - start_tsc;
+	insert_nodes = master->m_ondisk->m_alloc_block;
+
+	start_tsc = spdk_get_ticks();
+	bp_iter_open(master, &it, NULL);
+	while (bp_iter_next(&it, &key, &value) == 0) {
+		if (key <= prev_key)
+			unordered++;
+		prev_key = key;
+		scanned++;
+	}
+	bp_iter_close(&it);
+	scan_tsc = spdk_get_ticks() - start_tsc;
+
+	start_tsc = spdk_get_ticks();
+	for (i = 0; i < nr; i++) {
+		if (i % 10 == 0)
+			continue;
+		key = is_rand ? perf_hash_key(i) : (bkey_t)i + 1;
+		if (B_REMOVE(master, &key) == 0)
+			removed++;
+	}
+	remove_tsc = spdk_get_ticks() - start_tsc;
+
+	printf(" b+tree insert (%d %s keys, %d duplicates): %.0f inserts/s, %.1f cycles/insert, %d nodes\n",
+	       nr, is_rand ? "hashed" : "sequential", dup, (double)nr * spdk_get_ticks_hz() / insert_tsc,
+	       (double)insert_tsc / nr, insert_nodes);
+	printf(" b+tree scan (%d keys, %d out of order): %.0f keys/s, %.1f cycles/key\n",
+	       scanned, unordered, (double)scanned * spdk_get_ticks_hz() / scan_tsc,
+	       (double)scan_tsc / (scanned ? scanned : 1));
+	printf(" b+tree remove (%d keys): %.0f removes/s, %.1f cycles/remove, %d nodes\n",
+	       removed, (double)removed * spdk_get_ticks_hz() / remove_tsc,
+	       (double)remove_tsc / (removed ? removed : 1), master->m_ondisk->m_alloc_block);
+
+	bp_write_master(master);
+	bp_put_dir_master(dir_ictx, master);
+	nvfuse_release_inode(sb, dir_ictx, DIRTY);
+	nvfuse_release_super(sb);
+
+	if (nvfuse_rmdir_path(nvh, "perf_bptree_dir") < 0) {
+		printf(" Error: rmdir perf_bptree_dir\n");
+		return -1;
+	}
+
+	return 0;
+}
+
+/*
+ * bitmap allocation microbenchmark
+ * fills a block group bitmap to the given percent with scattered used bits
+ * and allocates every free bit one at a time from scattered hints, testing
+ * a bit per step and with the word-at-a-time scan. the longest free run
+ * search used for multi-block allocation is timed as well.
+ */
+int perf_bitmap_alloc(s32 fill)
+{
+	u32 nr_bits = CLUSTER_SIZE * 8;
+	u64 *orig, *bm;
+	u32 nr_free = 0;
+	u32 hint, bit, run_start, run_len = 0;
+	u32 i;
+	u64 start_tsc, bit_tsc, word_tsc, run_tsc;
+	s32 res = 0;
+
+	orig = malloc(CLUSTER_SIZE);
+	bm = malloc(CLUSTER_SIZE);
+	if (orig == NULL || bm == NULL) {
+		printf(" Error: malloc()\n");
+		res = -1;
+		goto FREE;
+	}
+
+	srand(fill);
+	memset(orig, 0x00, CLUSTER_SIZE);
+	for (i = 0; i < nr_bits; i++) {
+		if (rand() % 100 < fill)
+			ext2fs_set_bit(i, orig);
+		else
+			nr_free++;
+	}
+
+	/* a bit per step, as the allocators used to scan */
+	memcpy(bm, orig, CLUSTER_SIZE);
+	start_tsc = spdk_get_ticks();
+	for (i = 0; i < nr_free; i++) {
+		hint = (i * 7919) % nr_bits;
+		while (ext2fs_test_bit(hint, bm))
+			hint = (hint + 1) % nr_bits;
+		ext2fs_set_bit(hint, bm);
+	}
+	bit_tsc = spdk_get_ticks() - start_tsc;
+
+	memcpy(bm, orig, CLUSTER_SIZE);
+	start_tsc = spdk_get_ticks();
+	for (i = 0; i < nr_free; i++) {
+		hint = (i * 7919) % nr_bits;
+		bit = nvfuse_bitmap_find_next_zero(bm, nr_bits, hint);
+		if (bit >= nr_bits)
+			bit = nvfuse_bitmap_find_next_zero(bm, hint, 0);
+		if (bit >= nr_bits) {
+			printf(" Error: free bit is not found\n");
+			res = -1;
+			goto FREE;
+		}
+		nvfuse_bitmap_set_range(bm, bit, 1);
+	}
+	word_tsc = spdk_get_ticks() - start_tsc;
+
+	start_tsc = spdk_get_ticks();
+	for (i = 0; i < 100; i++)
+		run_len = nvfuse_bitmap_longest_zero_run(orig, nr_bits, &run_start);
+	run_tsc = spdk_get_ticks() - start_tsc;
+
+	printf(" bitmap alloc (%d%% full, %d free bits): bit scan %.1f cycles/alloc, word scan %.1f cycles/alloc\n",
+	       fill, nr_free, (double)bit_tsc / (nr_free ? nr_free : 1),
+	       (double)word_tsc / (nr_free ? nr_free : 1));
+	printf(" bitmap longest free run (%d bits at %d): %.1f cycles/search\n",
+	       run_len, run_len ? run_start : 0, (double)run_tsc / 100);
+
+FREE:
+	free(orig);
+	free(bm);
+
+	return res;
+}
+
 void perf_usage(char *cmd)
 {
 	printf("\nOptions for NVFUSE application: \n");
@@ -234,6 +497,9 @@ void perf_usage(char *cmd)
 	printf("\t-R: random (e.g., rand or sequential)\n");
 	printf("\t-D: direct I/O \n");
 	printf("\t-W: write workload (e.g., write or read)\n");
+	printf("\t-L: directory index lookup benchmark with the given number of files\n");
+	printf("\t-K: b+tree insert/scan/remove benchmark with the given number of keys (e.g., 10000000), hashed keys with -R\n");
+	printf("\t-A: bitmap allocation benchmark with the given percent of used bits (e.g., 95)\n");
 }
 
 #define USE_AIO 1
@@ -250,6 +516,9 @@ static int is_rand = 0; /* sequential set to as default */
 static int direct_io = 0; /* buffered I/O set to as default */
 static int is_write = 0; /* write workload set to as default */
 static int runtime = 0; /* runtime in seconds */
+static int lookup_files = 0; /* dir lookup benchmark */
+static int insert_keys = 0; /* b+tree insert benchmark */
+static int bitmap_fill = -1; /* bitmap allocation benchmark */
 
 void _print_stats(struct perf_stat_aio *cur_stat, char *name)
 {
@@ -359,7 +628,13 @@ static void perf_run(void *arg1, void *arg2)
 
 	printf("\n");
 
-	if (ioengine == AIO) {
+	if (lookup_files) {
+		perf_dir_lookup(nvh, lookup_files);
+	} else if (insert_keys) {
+		perf_bptree_insert(nvh, insert_keys, is_rand);
+	} else if (bitmap_fill >= 0) {
+		perf_bitmap_alloc(bitmap_fill);
+	} else if (ioengine == AIO) {
 		perf_aio(nvh, ((s64)file_size * MB), block_size, is_rand, is_write ? WRITE : READ, direct_io,
 			       qdepth, runtime);
 	} else {
@@ -411,7 +686,7 @@ int main(int argc, char *argv[])
 
 	/* optind must be reset before using getopt() */
 	optind = 0;
-	while ((op = getopt(app_argc, app_argv, "S:B:E:Q:RDWT:")) != -1) {
+	while ((op = getopt(app_argc, app_argv, "S:B:E:Q:RDWT:L:K:A:")) != -1) {
 		switch (op) {
 		case 'S':
 			file_size = atoi(optarg);
@@ -456,6 +731,27 @@ int main(int argc, char *argv[])
 				goto INVALID_ARGS;
 			}
 			break;
+		case 'L':
+			lookup_files = atoi(optarg);
+			if (lookup_files <= 0) {
+				fprintf(stderr, "\n Invalid number of files = %d\n", lookup_files);
+				goto INVALID_ARGS;
+			}
+			break;
+		case 'K':
+			insert_keys = atoi(optarg);
+			if (insert_keys <= 0) {
+				fprintf(stderr, "\n Invalid number of keys = %d\n", insert_keys);
+				goto INVALID_ARGS;
+			}
+			break;
+		case 'A':
+			bitmap_fill = atoi(optarg);
+			if (bitmap_fill < 0 || bitmap_fill > 100) {
+				fprintf(stderr, "\n Invalid percent of used bits = %d\n", bitmap_fill);
+				goto INVALID_ARGS;
+			}
+			break;
 		default:
 			goto INVALID_ARGS;
 		}
@@ -17,6 +17,7 @@
 #include <fcntl.h>
 #include <stdlib.h>
 #include <assert.h>
+#include <dirent.h>
 
 #include "nvfuse_core.h"
 #include "nvfuse_api.h"
@@ -26,6 +27,7 @@
 #include "nvfuse_misc.h"
 #include "nvfuse_buffer_cache.h"
 #include "nvfuse_debug.h"
+#include "nvfuse_kv.h"
 #include "spdk/env.h"
 #include <rte_lcore.h>
 
@@ -71,6 +73,20 @@ int rt_gen_aio_rw(struct nvfuse_handle *nvh, s64 file_size, s32 block_size, s32
 int rt_create_max_sized_file_aio_4KB(struct nvfuse_handle *nvh, u32 is_rand);
 int rt_create_max_sized_file_aio_128KB(struct nvfuse_handle *nvh, u32 is_rand);
 int rt_create_4KB_files(struct nvfuse_handle *nvh, u32 arg);
+int rt_dir_hash_collision(struct nvfuse_handle *nvh, u32 arg);
+int rt_dir_varlen_names(struct nvfuse_handle *nvh, u32 arg);
+int rt_inline_data(struct nvfuse_handle *nvh, u32 arg);
+int rt_kv_store(struct nvfuse_handle *nvh, u32 arg);
+int rt_prealloc_interleaved(struct nvfuse_handle *nvh, u32 arg);
+int rt_extent_mapping(struct nvfuse_handle *nvh, u32 arg);
+int rt_delayed_alloc(struct nvfuse_handle *nvh, u32 arg);
+int rt_free_extent_best_fit(struct nvfuse_handle *nvh, u32 arg);
+int rt_alloc_groups(struct nvfuse_handle *nvh, u32 arg);
+int rt_unwritten_extents(struct nvfuse_handle *nvh, u32 arg);
+int rt_sparse_file(struct nvfuse_handle *nvh, u32 arg);
+int rt_discard(struct nvfuse_handle *nvh, u32 arg);
+int rt_deferred_reclaim(struct nvfuse_handle *nvh, u32 arg);
+int rt_cache_index(struct nvfuse_handle *nvh, u32 arg);
 void rt_usage(char *cmd);
 static int rt_main(void *arg);
 static void print_stats(s32 num_cores, s32 num_tc);
@@ -150,8 +166,14 @@ int rt_create_files(struct nvfuse_handle *nvh, u32 arg)
 	rt_progress_reset();
 	gettimeofday(&tv, NULL);
 
+	nvfuse_fold_sb_counters(&nvh->nvh_sb);
 	nvh->nvh_sb.bp_set_index_tsc = 0;
 	nvh->nvh_sb.bp_set_index_count = 0;
+	nvh->nvh_sb.bp_get_index_tsc = 0;
+	nvh->nvh_sb.bp_get_index_count = 0;
+	nvh->nvh_sb.bp_del_index_tsc = 0;
+	nvh->nvh_sb.bp_del_index_count = 0;
+	nvh->nvh_sb.bp_master_hit_count = 0;
 	nvh->nvh_sb.nvme_io_tsc = 0;
 	nvh->nvh_sb.nvme_io_count = 0;
 
@@ -173,6 +195,7 @@ int rt_create_files(struct nvfuse_handle *nvh, u32 arg)
 
 	printf(" Finish: creating null files (0x%x) %.3f OPS (%.f sec).\n", max_inodes,
 	       max_inodes / nvfuse_time_since_now(&tv), nvfuse_time_since_now(&tv));
+	nvfuse_fold_sb_counters(&nvh->nvh_sb);
 	printf(" bp tree cpu = %f sec\n",
 	       (double)nvh->nvh_sb.bp_set_index_tsc / (double)spdk_get_ticks_hz());
 	printf(" sync meta i/o = %f sec\n", (double)nvh->nvh_sb.nvme_io_tsc / (double)spdk_get_ticks_hz());
@@ -199,6 +222,11 @@ int rt_create_files(struct nvfuse_handle *nvh, u32 arg)
 	}
 	printf(" Finish: looking up null files (0x%x) %.3f OPS (%.f sec).\n", max_inodes,
 	       max_inodes / nvfuse_time_since_now(&tv), nvfuse_time_since_now(&tv));
+	nvfuse_fold_sb_counters(&nvh->nvh_sb);
+	printf(" bp tree lookup cpu = %f sec (%lu lookups, %lu master cache hits)\n",
+	       (double)nvh->nvh_sb.bp_get_index_tsc / (double)spdk_get_ticks_hz(),
+	       (unsigned long)nvh->nvh_sb.bp_get_index_count,
+	       (unsigned long)nvh->nvh_sb.bp_master_hit_count);
 
 	/* reset progress percent */
 	rt_progress_reset();
@@ -219,6 +247,10 @@ int rt_create_files(struct nvfuse_handle *nvh, u32 arg)
 	}
 	printf(" Finish: deleting null files (0x%x) %.3f OPS (%.f sec).\n", max_inodes,
 	       max_inodes / nvfuse_time_since_now(&tv), nvfuse_time_since_now(&tv));
+	nvfuse_fold_sb_counters(&nvh->nvh_sb);
+	printf(" bp tree delete cpu = %f sec (%lu deletes)\n",
+	       (double)nvh->nvh_sb.bp_del_index_tsc / (double)spdk_get_ticks_hz(),
+	       (unsigned long)nvh->nvh_sb.bp_del_index_count);
 
 	nvfuse_check_flush_dirty(&nvh->nvh_sb, 1);
 
@@ -280,6 +312,7 @@ int rt_create_dirs(struct nvfuse_handle *nvh, u32 arg)
 
 	printf(" Finish: creating null directories (0x%x) %.3f OPS (%.f sec). \n", max_inodes,
 	       max_inodes / nvfuse_time_since_now(&tv), nvfuse_time_since_now(&tv));
+	nvfuse_fold_sb_counters(&nvh->nvh_sb);
 	printf(" bp tree cpu = %f sec\n",
 	       (double)nvh->nvh_sb.bp_set_index_tsc / (double)spdk_get_ticks_hz());
 	printf(" sync meta i/o = %f sec\n", (double)nvh->nvh_sb.nvme_io_tsc / (double)spdk_get_ticks_hz());
@@ -793,9 +826,1690 @@ int rt_create_4KB_files(struct nvfuse_handle *nvh, u32 arg)
 
 }
 
+/* number of name hash bits kept while forcing directory index collisions */
+#define RT_COLLISION_HASH_BITS	4
+
+static s32 rt_collision_lookup(struct nvfuse_handle *nvh, inode_t par_ino, s32 start, s32 nr,
+			       s32 step, s32 expected)
+{
+	struct nvfuse_superblock *sb;
+	char str[FNAME_SIZE];
+	s32 res;
+	s32 i;
+
+	for (i = start; i < nr; i += step) {
+		sprintf(str, "file%d", i);
+		sb = nvfuse_read_super(nvh);
+		res = nvfuse_lookup(sb, NULL, NULL, str, par_ino);
+		nvfuse_release_super(sb);
+		if (res != expected) {
+			printf(" lookup %s = %d (expected %d)\n", str, res, expected);
+			return -1;
+		}
+	}
+
+	return 0;
+}
+
+static s32 rt_collision_delete(struct nvfuse_handle *nvh, inode_t par_ino, s32 start, s32 nr,
+			       s32 step)
+{
+	struct nvfuse_superblock *sb;
+	char str[FNAME_SIZE];
+	s32 res;
+	s32 i;
+
+	for (i = start; i < nr; i += step) {
+		sprintf(str, "file%d", i);
+		sb = nvfuse_read_super(nvh);
+		res = nvfuse_rmfile(sb, par_ino, str);
+		if (res < 0) {
+			printf(" rmfile error = %s \n", str);
+			return -1;
+		}
+	}
+
+	return 0;
+}
+
+/*
+ * Directory index collision stress test
+ * narrows name hashes so that most names in a directory collide and checks
+ * create, lookup and unlink through long collision chains.
+ */
+int rt_dir_hash_collision(struct nvfuse_handle *nvh, u32 arg)
+{
+	struct nvfuse_superblock *sb = nvfuse_read_super(nvh);
+	struct timeval tv;
+	char str[FNAME_SIZE];
+	s32 par_ino;
+	s32 nr;
+	s32 fd;
+	s32 res = -1;
+	s32 i;
+
+	switch (test_type) {
+	case MAX_TEST:
+	case MILL_TEST:
+		nr = 2048;
+		break;
+	case QUICK_TEST:
+		nr = 256;
+		break;
+	default:
+		printf(" Invalid test type = %d\n", test_type);
+		return -1;
+	}
+
+	if (nvfuse_mkdir_path(nvh, "collision_dir", 0755) < 0) {
+		printf(" Error: mkdir collision_dir\n");
+		return -1;
+	}
+
+	par_ino = nvfuse_opendir(nvh, "collision_dir");
+	if (par_ino <= 0) {
+		printf(" Error: opendir collision_dir\n");
+		return -1;
+	}
+
+	sb->bp_dir_hash_bits = RT_COLLISION_HASH_BITS;
+	gettimeofday(&tv, NULL);
+
+	printf(" Start: creating colliding files (0x%x, %d hash bits).\n", nr, RT_COLLISION_HASH_BITS);
+	for (i = 0; i < nr; i++) {
+		sprintf(str, "file%d", i);
+		fd = nvfuse_openfile(sb, par_ino, str, O_RDWR | O_CREAT, 0);
+		if (fd < 0) {
+			printf(" Error: open() %s\n", str);
+			goto RES;
+		}
+		nvfuse_closefile(nvh, fd);
+	}
+
+	/* every name must be found including the ones at the end of a chain */
+	if (rt_collision_lookup(nvh, par_ino, 0, nr, 1, 0) < 0)
+		goto RES;
+
+	/* a bulk loaded index must keep the collision chains intact */
+	if (nvfuse_rebuild_dir_index(nvh, par_ino) < 0) {
+		printf(" Error: rebuild index of collision_dir\n");
+		goto RES;
+	}
+
+	if (rt_collision_lookup(nvh, par_ino, 0, nr, 1, 0) < 0)
+		goto RES;
+
+	/* remove even names to punch holes in the middle of chains */
+	if (rt_collision_delete(nvh, par_ino, 0, nr, 2) < 0)
+		goto RES;
+
+	if (rt_collision_lookup(nvh, par_ino, 0, nr, 2, -1) < 0)
+		goto RES;
+
+	/* the remaining names must survive removal of their collisions */
+	if (rt_collision_lookup(nvh, par_ino, 1, nr, 2, 0) < 0)
+		goto RES;
+
+	if (rt_collision_delete(nvh, par_ino, 1, nr, 2) < 0)
+		goto RES;
+
+	/* removing a missing name must fail and leave the directory usable */
+	sprintf(str, "file%d", 0);
+	if (nvfuse_rmfile(sb, par_ino, str) == 0 || nvfuse_rmdir(sb, par_ino, str) == 0) {
+		printf(" Error: removed missing name %s\n", str);
+		goto RES;
+	}
+
+	fd = nvfuse_openfile(sb, par_ino, str, O_RDWR | O_CREAT, 0);
+	if (fd < 0) {
+		printf(" Error: open() %s after failed removal\n", str);
+		goto RES;
+	}
+	nvfuse_closefile(nvh, fd);
+
+	if (rt_collision_delete(nvh, par_ino, 0, 1, 1) < 0)
+		goto RES;
+
+	printf(" Finish: colliding files (0x%x) %.3f OPS (%0.3fs).\n", nr,
+	       nr / nvfuse_time_since_now(&tv), nvfuse_time_since_now(&tv));
+	res = 0;
+RES:
+	sb->bp_dir_hash_bits = 0;
+	nvfuse_release_super(sb);
+
+	if (res == 0 && nvfuse_rmdir_path(nvh, "collision_dir") < 0) {
+		printf(" Error: rmdir collision_dir\n");
+		res = -1;
+	}
+
+	return res;
+}
+
+/* names from 1 to FNAME_SIZE - 1 characters long */
+static void rt_varlen_name(char *str, s32 i)
+{
+	s32 len = 1 + (i * 37) % (FNAME_SIZE - 1);
+	s32 cur;
+
+	sprintf(str, "v%d_", i);
+	for (cur = strlen(str); cur < len; cur++)
+		str[cur] = 'a' + (cur % 26);
+	str[cur] = '\0';
+}
+
+static s32 rt_readdir_count(struct nvfuse_handle *nvh, inode_t par_ino)
+{
+	struct dirent dentry;
+	off_t offset = 0;
+
+	while (nvfuse_readdir(nvh, par_ino, &dentry, offset))
+		offset++;
+
+	return offset;
+}
+
+static s32 rt_varlen_lookup(struct nvfuse_handle *nvh, inode_t par_ino, s32 start, s32 nr,
+			    s32 step, s32 expected)
+{
+	struct nvfuse_superblock *sb;
+	struct nvfuse_dir_entry dir_entry;
+	char str[FNAME_SIZE];
+	s32 res;
+	s32 i;
+
+	for (i = start; i < nr; i += step) {
+		rt_varlen_name(str, i);
+		sb = nvfuse_read_super(nvh);
+		res = nvfuse_lookup(sb, NULL, &dir_entry, str, par_ino);
+		nvfuse_release_super(sb);
+		if (res != expected || (res == 0 && strcmp(dir_entry.d_filename, str))) {
+			printf(" lookup %s = %d (expected %d)\n", str, res, expected);
+			return -1;
+		}
+	}
+
+	return 0;
+}
+
+static s32 rt_varlen_delete(struct nvfuse_handle *nvh, inode_t par_ino, s32 start, s32 nr,
+			    s32 step)
+{
+	struct nvfuse_superblock *sb;
+	char str[FNAME_SIZE];
+	s32 i;
+
+	for (i = start; i < nr; i += step) {
+		rt_varlen_name(str, i);
+		sb = nvfuse_read_super(nvh);
+		if (nvfuse_rmfile(sb, par_ino, str) < 0) {
+			printf(" rmfile error = %s \n", str);
+			return -1;
+		}
+	}
+
+	return 0;
+}
+
+/* returns the room left in block 0 and the dentry block of name (or -1) */
+static s32 rt_dir_block_of(struct nvfuse_handle *nvh, inode_t par_ino, char *name, u32 *room0,
+			   u64 *size)
+{
+	struct nvfuse_superblock *sb = nvfuse_read_super(nvh);
+	struct nvfuse_inode_ctx *dir_ictx;
+	struct nvfuse_dir_block db;
+	s32 lblock = -1;
+
+	dir_ictx = nvfuse_read_inode(sb, NULL, par_ino);
+	if (nvfuse_get_dir_block(sb, dir_ictx, 0, &db) == 0) {
+		*room0 = db.db_size - nvfuse_dentry_block_used(db.db_buf, db.db_size);
+		nvfuse_release_dir_block(sb, &db, NVF_CLEAN);
+		lblock = nvfuse_find_existing_dentry(sb, dir_ictx, dir_ictx->ictx_inode, name);
+	}
+	*size = dir_ictx->ictx_inode->i_size;
+	nvfuse_release_inode(sb, dir_ictx, NVF_CLEAN);
+	nvfuse_release_super(sb);
+
+	return lblock;
+}
+
+static void rt_long_name(char *str, s32 i)
+{
+	s32 cur;
+
+	sprintf(str, "l%03d_", i);
+	for (cur = strlen(str); cur < FNAME_SIZE - 1; cur++)
+		str[cur] = 'a' + (cur % 26);
+	str[cur] = '\0';
+}
+
+/*
+ * the room left in the first block by a removal is too small for the last
+ * (long) dentry of the directory, so it has to be given to new short names
+ * instead of growing the directory.
+ */
+static s32 rt_dir_space_reuse(struct nvfuse_handle *nvh, inode_t par_ino)
+{
+	struct nvfuse_superblock *sb;
+	char str[FNAME_SIZE];
+	s32 nr_long = 2 * CLUSTER_SIZE / DIR_REC_LEN(FNAME_SIZE - 1);
+	s32 nr_short = 16;
+	s32 nr_new = 0;
+	u32 room0;
+	u64 size;
+	u64 old_size;
+	s32 fd;
+	s32 i;
+
+	for (i = 0; i < nr_short + nr_long; i++) {
+		if (i < nr_short)
+			sprintf(str, "s%02d", i);
+		else
+			rt_long_name(str, i - nr_short);
+		sb = nvfuse_read_super(nvh);
+		fd = nvfuse_openfile(sb, par_ino, str, O_RDWR | O_CREAT, 0);
+		nvfuse_release_super(sb);
+		if (fd < 0) {
+			printf(" Error: open() %s\n", str);
+			return -1;
+		}
+		nvfuse_closefile(nvh, fd);
+	}
+
+	sb = nvfuse_read_super(nvh);
+	if (nvfuse_rmfile(sb, par_ino, "s00") < 0) {
+		printf(" rmfile error = s00 \n");
+		return -1;
+	}
+
+	rt_dir_block_of(nvh, par_ino, "s01", &room0, &old_size);
+	while (room0 >= DIR_REC_LEN(3)) {
+		sprintf(str, "n%02d", nr_new++);
+		sb = nvfuse_read_super(nvh);
+		fd = nvfuse_openfile(sb, par_ino, str, O_RDWR | O_CREAT, 0);
+		nvfuse_release_super(sb);
+		if (fd < 0) {
+			printf(" Error: open() %s\n", str);
+			return -1;
+		}
+		nvfuse_closefile(nvh, fd);
+
+		if (rt_dir_block_of(nvh, par_ino, str, &room0, &size) != 0 || size != old_size) {
+			printf(" %s is not placed in the room of block 0 (size %lu -> %lu)\n", str,
+			       (unsigned long)old_size, (unsigned long)size);
+			return -1;
+		}
+	}
+
+	for (i = 1; i < nr_short + nr_long + nr_new; i++) {
+		if (i < nr_short)
+			sprintf(str, "s%02d", i);
+		else if (i < nr_short + nr_long)
+			rt_long_name(str, i - nr_short);
+		else
+			sprintf(str, "n%02d", i - nr_short - nr_long);
+		sb = nvfuse_read_super(nvh);
+		if (nvfuse_rmfile(sb, par_ino, str) < 0) {
+			printf(" rmfile error = %s \n", str);
+			return -1;
+		}
+	}
+
+	return 0;
+}
+
+/*
+ * Variable length dentry test
+ * fills a directory with names of every length, punches holes by removing
+ * every other name and checks that readdir and lookup see exactly the
+ * remaining dentries.
+ */
+int rt_dir_varlen_names(struct nvfuse_handle *nvh, u32 arg)
+{
+	struct nvfuse_superblock *sb = nvfuse_read_super(nvh);
+	struct timeval tv;
+	char str[FNAME_SIZE];
+	s32 par_ino;
+	s32 count;
+	s32 nr;
+	s32 fd;
+	s32 i;
+
+	switch (test_type) {
+	case MAX_TEST:
+	case MILL_TEST:
+		nr = 4096;
+		break;
+	case QUICK_TEST:
+		nr = 512;
+		break;
+	default:
+		printf(" Invalid test type = %d\n", test_type);
+		return -1;
+	}
+
+	if (nvfuse_mkdir_path(nvh, "varlen_dir", 0755) < 0) {
+		printf(" Error: mkdir varlen_dir\n");
+		return -1;
+	}
+
+	par_ino = nvfuse_opendir(nvh, "varlen_dir");
+	if (par_ino <= 0) {
+		printf(" Error: opendir varlen_dir\n");
+		return -1;
+	}
+
+	gettimeofday(&tv, NULL);
+
+	printf(" Start: creating files with variable length names (0x%x).\n", nr);
+	for (i = 0; i < nr; i++) {
+		rt_varlen_name(str, i);
+		fd = nvfuse_openfile(sb, par_ino, str, O_RDWR | O_CREAT, 0);
+		if (fd < 0) {
+			printf(" Error: open() %s\n", str);
+			return -1;
+		}
+		nvfuse_closefile(nvh, fd);
+	}
+	nvfuse_release_super(sb);
+
+	/* "." and ".." are listed too */
+	count = rt_readdir_count(nvh, par_ino);
+	if (count != nr + 2) {
+		printf(" readdir returns %d dentries (expected %d)\n", count, nr + 2);
+		return -1;
+	}
+
+	if (rt_varlen_lookup(nvh, par_ino, 0, nr, 1, 0) < 0)
+		return -1;
+
+	/* removal refills holes with the last dentry of the directory when it fits */
+	if (rt_varlen_delete(nvh, par_ino, 0, nr, 2) < 0)
+		return -1;
+
+	count = rt_readdir_count(nvh, par_ino);
+	if (count != nr / 2 + 2) {
+		printf(" readdir returns %d dentries (expected %d)\n", count, nr / 2 + 2);
+		return -1;
+	}
+
+	if (rt_varlen_lookup(nvh, par_ino, 0, nr, 2, -1) < 0)
+		return -1;
+
+	if (rt_varlen_lookup(nvh, par_ino, 1, nr, 2, 0) < 0)
+		return -1;
+
+	if (rt_varlen_delete(nvh, par_ino, 1, nr, 2) < 0)
+		return -1;
+
+	if (rt_readdir_count(nvh, par_ino) != 2) {
+		printf(" directory is not empty\n");
+		return -1;
+	}
+
+	if (rt_dir_space_reuse(nvh, par_ino) < 0)
+		return -1;
+
+	if (rt_readdir_count(nvh, par_ino) != 2) {
+		printf(" directory is not empty\n");
+		return -1;
+	}
+
+	printf(" Finish: variable length names (0x%x) %.3f OPS (%0.3fs).\n", nr,
+	       nr / nvfuse_time_since_now(&tv), nvfuse_time_since_now(&tv));
+
+	if (nvfuse_rmdir_path(nvh, "varlen_dir") < 0) {
+		printf(" Error: rmdir varlen_dir\n");
+		return -1;
+	}
+
+	return 0;
+}
+
+static s32 rt_dir_is_inline(struct nvfuse_handle *nvh, inode_t ino)
+{
+	struct nvfuse_superblock *sb = nvfuse_read_super(nvh);
+	struct nvfuse_inode_ctx *ictx;
+	s32 inline_data;
+
+	ictx = nvfuse_read_inode(sb, NULL, ino);
+	inline_data = !!(ictx->ictx_inode->i_flags & NVFUSE_INODE_FLAG_INLINE);
+	nvfuse_release_inode(sb, ictx, NVF_CLEAN);
+	nvfuse_release_super(sb);
+
+	return inline_data;
+}
+
+/*
+ * Inline data test
+ * a few dentries and a short symlink stay in the inode, the directory
+ * moves to blocks and gets its index as it grows, and shrinks back to
+ * an empty directory.
+ */
+int rt_inline_data(struct nvfuse_handle *nvh, u32 arg)
+{
+	struct nvfuse_superblock *sb = nvfuse_read_super(nvh);
+	struct nvfuse_dir_entry dir_entry;
+	char str[FNAME_SIZE];
+	char link[FNAME_SIZE];
+	s32 par_ino;
+	s32 nr_inline = 4;
+	s32 nr = NVFUSE_DIR_INDEX_THRESHOLD * 2;
+	s32 fd;
+	s32 i;
+
+	if (nvfuse_mkdir_path(nvh, "inline_dir", 0755) < 0) {
+		printf(" Error: mkdir inline_dir\n");
+		return -1;
+	}
+
+	par_ino = nvfuse_opendir(nvh, "inline_dir");
+	if (par_ino <= 0) {
+		printf(" Error: opendir inline_dir\n");
+		return -1;
+	}
+
+	for (i = 0; i < nr_inline; i++) {
+		rt_varlen_name(str, i);
+		fd = nvfuse_openfile(sb, par_ino, str, O_RDWR | O_CREAT, 0);
+		if (fd < 0) {
+			printf(" Error: open() %s\n", str);
+			return -1;
+		}
+		nvfuse_closefile(nvh, fd);
+	}
+
+#ifdef NVFUSE_USE_INLINE_DATA
+	if (!rt_dir_is_inline(nvh, par_ino)) {
+		printf(" Error: %d dentries are not kept in the inode\n", nr_inline);
+		return -1;
+	}
+#endif
+
+	if (rt_readdir_count(nvh, par_ino) != nr_inline + 2 ||
+	    rt_varlen_lookup(nvh, par_ino, 0, nr_inline, 1, 0) < 0) {
+		printf(" Error: inline dentries\n");
+		return -1;
+	}
+
+	/* a short symlink target is kept in the inode */
+	sprintf(link, "/inline_dir/%s", str);
+	if (nvfuse_symlink(nvh, link, par_ino, "inline_link") < 0 ||
+	    nvfuse_lookup(sb, NULL, &dir_entry, "inline_link", par_ino) < 0) {
+		printf(" Error: symlink inline_link\n");
+		return -1;
+	}
+
+	memset(str, 0x00, FNAME_SIZE);
+	if (nvfuse_readlink_ino(nvh, dir_entry.d_ino, str, strlen(link) + 1) < 0 ||
+	    strcmp(str, link)) {
+		printf(" Error: readlink inline_link = %s\n", str);
+		return -1;
+	}
+
+	if (nvfuse_rmfile(sb, par_ino, "inline_link") < 0) {
+		printf(" Error: rmfile inline_link\n");
+		return -1;
+	}
+
+	/* grow beyond the inode and the index threshold */
+	for (i = nr_inline; i < nr; i++) {
+		rt_varlen_name(str, i);
+		fd = nvfuse_openfile(sb, par_ino, str, O_RDWR | O_CREAT, 0);
+		if (fd < 0) {
+			printf(" Error: open() %s\n", str);
+			return -1;
+		}
+		nvfuse_closefile(nvh, fd);
+	}
+	nvfuse_release_super(sb);
+
+	if (rt_dir_is_inline(nvh, par_ino)) {
+		printf(" Error: %d dentries are kept in the inode\n", nr);
+		return -1;
+	}
+
+	if (rt_readdir_count(nvh, par_ino) != nr + 2 ||
+	    rt_varlen_lookup(nvh, par_ino, 0, nr, 1, 0) < 0) {
+		printf(" Error: dentries after conversion\n");
+		return -1;
+	}
+
+	if (rt_varlen_delete(nvh, par_ino, 0, nr, 1) < 0)
+		return -1;
+
+	if (rt_readdir_count(nvh, par_ino) != 2) {
+		printf(" directory is not empty\n");
+		return -1;
+	}
+
+	if (nvfuse_rmdir_path(nvh, "inline_dir") < 0) {
+		printf(" Error: rmdir inline_dir\n");
+		return -1;
+	}
+
+	return 0;
+}
+
+#define RT_KV_RECORDS	(100000)
+/* even keys from 2, key 0 cannot be stored */
+#define RT_KV_KEY(i)	(((u64)(i) + 1) * 2)
+
+/* the value of record i written by generation gen */
+static u32 rt_kv_value(char *buf, u64 i, u32 gen)
+{
+	u32 len = (i * 7 + gen) % 64 + 1;
+	u32 j;
+
+	for (j = 0; j < len; j++)
+		buf[j] = (char)(i + gen + j);
+
+	return len;
+}
+
+struct rt_kv_scan_ctx {
+	u64 last;
+	s32 count;
+	s32 error;
+};
+
+static s32 rt_kv_scan_check(u64 key, const void *value, u32 len, void *arg)
+{
+	struct rt_kv_scan_ctx *ctx = arg;
+	char buf[NVFUSE_KV_MAX_VALUE];
+	u64 i = key / 2 - 1;
+	u32 gen = (i % 3 == 0) ? 1 : 0;
+
+	if ((ctx->count && key <= ctx->last) || i % 5 == 0 ||
+	    len != rt_kv_value(buf, i, gen) || memcmp(buf, value, len)) {
+		printf(" Error: scan key = %lu len = %d\n", (unsigned long)key, len);
+		ctx->error = 1;
+		return 1;
+	}
+
+	ctx->last = key;
+	ctx->count++;
+
+	return 0;
+}
+
+/*
+ * Key-value store test
+ * records are put, overwritten with values of other sizes and partly
+ * deleted, then read back by key and by an ordered scan.
+ */
+int rt_kv_store(struct nvfuse_handle *nvh, u32 arg)
+{
+	struct rt_kv_scan_ctx ctx;
+	struct timeval tv;
+	char buf[NVFUSE_KV_MAX_VALUE];
+	char val[NVFUSE_KV_MAX_VALUE];
+	s32 kv_ino;
+	s32 nr = RT_KV_RECORDS;
+	s32 expected = 0;
+	u32 len, gen;
+	s32 i;
+
+	kv_ino = nvfuse_kv_create(nvh, "kv_store", 0644);
+	if (kv_ino <= 0 || nvfuse_kv_open(nvh, "kv_store") != kv_ino) {
+		printf(" Error: kv_create kv_store\n");
+		return -1;
+	}
+
+	/* the b+tree uses key 0 for empty pairs */
+	if (nvfuse_kv_put(nvh, kv_ino, 0, val, 1) >= 0) {
+		printf(" Error: kv_put of key 0 is accepted\n");
+		return -1;
+	}
+
+	printf(" Start: putting 0x%x records.\n", nr);
+	gettimeofday(&tv, NULL);
+
+	for (i = 0; i < nr; i++) {
+		len = rt_kv_value(val, i, 0);
+		if (nvfuse_kv_put(nvh, kv_ino, RT_KV_KEY(i), val, len) < 0) {
+			printf(" Error: kv_put %d\n", i);
+			return -1;
+		}
+	}
+
+	printf(" Finish: putting 0x%x records %.3f OPS (%0.3fs).\n", nr,
+	       nr / nvfuse_time_since_now(&tv), nvfuse_time_since_now(&tv));
+
+	/* overwrite every third record with a value of another size */
+	for (i = 0; i < nr; i += 3) {
+		len = rt_kv_value(val, i, 1);
+		if (nvfuse_kv_put(nvh, kv_ino, RT_KV_KEY(i), val, len) < 0) {
+			printf(" Error: kv_put %d\n", i);
+			return -1;
+		}
+	}
+
+	for (i = 0; i < nr; i += 5) {
+		if (nvfuse_kv_delete(nvh, kv_ino, RT_KV_KEY(i)) < 0) {
+			printf(" Error: kv_delete %d\n", i);
+			return -1;
+		}
+	}
+
+	gettimeofday(&tv, NULL);
+
+	for (i = 0; i < nr; i++) {
+		s32 ret;
+
+		ret = nvfuse_kv_get(nvh, kv_ino, RT_KV_KEY(i), buf, NVFUSE_KV_MAX_VALUE);
+		if (i % 5 == 0) {
+			if (ret >= 0) {
+				printf(" Error: deleted record %d is found\n", i);
+				return -1;
+			}
+			continue;
+		}
+
+		gen = (i % 3 == 0) ? 1 : 0;
+		len = rt_kv_value(val, i, gen);
+		if (ret != len || memcmp(buf, val, len)) {
+			printf(" Error: kv_get %d len = %d\n", i, ret);
+			return -1;
+		}
+		expected++;
+
+		/* odd keys were never put */
+		if (nvfuse_kv_get(nvh, kv_ino, RT_KV_KEY(i) + 1, buf, NVFUSE_KV_MAX_VALUE) >= 0) {
+			printf(" Error: key %lu is found\n", (unsigned long)RT_KV_KEY(i) + 1);
+			return -1;
+		}
+	}
+
+	printf(" Finish: getting 0x%x records %.3f OPS (%0.3fs).\n", nr,
+	       nr / nvfuse_time_since_now(&tv), nvfuse_time_since_now(&tv));
+
+	memset(&ctx, 0x00, sizeof(ctx));
+	if (nvfuse_kv_scan(nvh, kv_ino, 0, (u64)-1, rt_kv_scan_check, &ctx) != expected ||
+	    ctx.error || ctx.count != expected) {
+		printf(" Error: kv_scan %d records, expected %d\n", ctx.count, expected);
+		return -1;
+	}
+
+	/* a bounded scan from a key which is not in the store */
+	memset(&ctx, 0x00, sizeof(ctx));
+	if (nvfuse_kv_scan(nvh, kv_ino, 1, 21, rt_kv_scan_check, &ctx) != 8 || ctx.error) {
+		printf(" Error: bounded kv_scan %d records\n", ctx.count);
+		return -1;
+	}
+
+	if (nvfuse_rmfile_path(nvh, "kv_store") < 0) {
+		printf(" Error: rmfile kv_store\n");
+		return -1;
+	}
+
+	return 0;
+}
+
 #define RANDOM		1
 #define SEQUENTIAL	0
 
+#define RT_PREALLOC_FILES	2
+#define RT_PREALLOC_BLOCKS	(1024)
+
+/* count the places where the next logical block of fd is not the next physical block */
+static s32 rt_count_fragments(struct nvfuse_handle *nvh, s32 fd, s32 nr_blocks)
+{
+	struct nvfuse_superblock *sb = nvfuse_read_super(nvh);
+	u32 num_alloc;
+	s32 prev = 0;
+	s32 frags = 0;
+	s32 pblk;
+	s32 i;
+
+	/* blocks of buffered writes are allocated when they are flushed */
+	nvfuse_sync(nvh);
+
+	for (i = 0; i < nr_blocks; i++) {
+		pblk = nvfuse_fgetblk(sb, fd, i, 1, &num_alloc);
+		if (pblk <= 0) {
+			frags = -1;
+			break;
+		}
+		if (i && pblk != prev + 1)
+			frags++;
+		prev = pblk;
+	}
+	nvfuse_release_super(sb);
+
+	return frags;
+}
+
+int rt_prealloc_interleaved(struct nvfuse_handle *nvh, u32 arg)
+{
+	char str[FNAME_SIZE];
+	char *buf;
+	s32 fd[RT_PREALLOC_FILES];
+	s32 frags;
+	s32 i, j;
+	s32 ret = 0;
+
+	buf = nvfuse_alloc_aligned_buffer(CLUSTER_SIZE);
+	if (buf == NULL) {
+		printf(" Error: malloc()\n");
+		return -1;
+	}
+	memset(buf, 0xaa, CLUSTER_SIZE);
+
+	for (j = 0; j < RT_PREALLOC_FILES; j++) {
+		sprintf(str, "prealloc%d", j);
+		fd[j] = nvfuse_openfile_path(nvh, str, O_RDWR | O_CREAT, 0);
+		if (fd[j] < 0) {
+			printf(" Error: open() %s\n", str);
+			ret = -1;
+			goto FREE;
+		}
+	}
+
+	/* the writers append in turns, a block at a time */
+	for (i = 0; i < RT_PREALLOC_BLOCKS; i++) {
+		for (j = 0; j < RT_PREALLOC_FILES; j++) {
+			if (nvfuse_writefile(nvh, fd[j], buf, CLUSTER_SIZE,
+					     (s64)i * CLUSTER_SIZE) != CLUSTER_SIZE) {
+				printf(" Error: write() prealloc%d\n", j);
+				ret = -1;
+				goto CLOSE;
+			}
+		}
+		rt_progress_report(i, RT_PREALLOC_BLOCKS);
+	}
+
+	for (j = 0; j < RT_PREALLOC_FILES; j++) {
+		frags = rt_count_fragments(nvh, fd[j], RT_PREALLOC_BLOCKS);
+		printf(" prealloc%d: %d blocks in %d fragments\n", j, RT_PREALLOC_BLOCKS, frags + 1);
+#ifdef NVFUSE_USE_PREALLOC_WINDOW
+		/* a window per refill, plus block group boundaries */
+		if (frags < 0 || frags > 32) {
+			printf(" Error: prealloc%d is fragmented\n", j);
+			ret = -1;
+		}
+#endif
+	}
+
+CLOSE:
+	for (j = 0; j < RT_PREALLOC_FILES; j++) {
+		nvfuse_closefile(nvh, fd[j]);
+		sprintf(str, "prealloc%d", j);
+		if (nvfuse_unlink(nvh, str) < 0) {
+			printf(" Error: unlink() %s\n", str);
+			ret = -1;
+		}
+	}
+
+#ifdef NVFUSE_USE_PREALLOC_WINDOW
+	{
+		struct nvfuse_superblock *sb = nvfuse_read_super(nvh);
+
+		/* the last close gives every window back */
+		if (nvfuse_sum_sb_counter(sb, NVFUSE_SB_PA_RESERVED_BLOCKS)) {
+			printf(" Error: %ld blocks still reserved\n",
+			       (long)nvfuse_sum_sb_counter(sb, NVFUSE_SB_PA_RESERVED_BLOCKS));
+			ret = -1;
+		}
+		nvfuse_release_super(sb);
+	}
+#endif
+FREE:
+	nvfuse_free_aligned_buffer(buf);
+
+	return ret;
+}
+
+#define RT_EXTENT_BLOCKS	(16384)	/* 64MB */
+#define RT_EXTENT_IO_BLOCKS	(32)
+
+static void rt_extent_fill(char *buf, s32 lblk, s32 nr_blocks)
+{
+	s32 i;
+
+	for (i = 0; i < nr_blocks; i++)
+		memset(buf + (s64)i * CLUSTER_SIZE, (lblk + i) & 0xff, CLUSTER_SIZE);
+}
+
+static s32 rt_extent_verify(struct nvfuse_handle *nvh, s32 fd, char *buf, s32 nr_blocks)
+{
+	s32 lblk, i;
+
+	for (lblk = 0; lblk < nr_blocks; lblk += RT_EXTENT_IO_BLOCKS) {
+		if (nvfuse_readfile(nvh, fd, buf, RT_EXTENT_IO_BLOCKS * CLUSTER_SIZE,
+				    (s64)lblk * CLUSTER_SIZE) != RT_EXTENT_IO_BLOCKS * CLUSTER_SIZE) {
+			printf(" Error: read() lblk = %d\n", lblk);
+			return -1;
+		}
+
+		for (i = 0; i < RT_EXTENT_IO_BLOCKS; i++) {
+			if ((u8)buf[(s64)i * CLUSTER_SIZE] != ((lblk + i) & 0xff) ||
+			    (u8)buf[(s64)(i + 1) * CLUSTER_SIZE - 1] != ((lblk + i) & 0xff)) {
+				printf(" Error: data mismatch lblk = %d\n", lblk + i);
+				return -1;
+			}
+		}
+	}
+
+	return 0;
+}
+
+static s32 rt_extent_append(struct nvfuse_handle *nvh, s32 fd, char *buf, s32 from, s32 to)
+{
+	s32 lblk;
+
+	for (lblk = from; lblk < to; lblk += RT_EXTENT_IO_BLOCKS) {
+		rt_extent_fill(buf, lblk, RT_EXTENT_IO_BLOCKS);
+		if (nvfuse_writefile(nvh, fd, buf, RT_EXTENT_IO_BLOCKS * CLUSTER_SIZE,
+				     (s64)lblk * CLUSTER_SIZE) != RT_EXTENT_IO_BLOCKS * CLUSTER_SIZE) {
+			printf(" Error: write() lblk = %d\n", lblk);
+			return -1;
+		}
+		rt_progress_report(lblk, to);
+	}
+
+	return 0;
+}
+
+int rt_extent_mapping(struct nvfuse_handle *nvh, u32 arg)
+{
+	struct nvfuse_superblock *sb;
+	u32 num_alloc;
+	char *buf;
+	s32 half = RT_EXTENT_BLOCKS / 2;
+	s32 fd;
+	s32 ret = -1;
+
+	buf = nvfuse_alloc_aligned_buffer(RT_EXTENT_IO_BLOCKS * CLUSTER_SIZE);
+	if (buf == NULL) {
+		printf(" Error: malloc()\n");
+		return -1;
+	}
+
+	fd = nvfuse_openfile_path(nvh, "extent_file", O_RDWR | O_CREAT, 0);
+	if (fd < 0) {
+		printf(" Error: open() extent_file\n");
+		goto FREE;
+	}
+
+	if (rt_extent_append(nvh, fd, buf, 0, RT_EXTENT_BLOCKS) < 0 ||
+	    rt_extent_verify(nvh, fd, buf, RT_EXTENT_BLOCKS) < 0)
+		goto CLOSE;
+
+	/* cut in the middle of a block, the tail is unmapped */
+	if (nvfuse_ftruncate(nvh, fd, (s64)half * CLUSTER_SIZE - 1) < 0) {
+		printf(" Error: ftruncate() extent_file\n");
+		goto CLOSE;
+	}
+
+	nvfuse_sync(nvh);
+	sb = nvfuse_read_super(nvh);
+	if (nvfuse_fgetblk(sb, fd, half - 1, 1, &num_alloc) <= 0 ||
+	    nvfuse_fgetblk(sb, fd, half, 1, &num_alloc) != 0) {
+		printf(" Error: mapping after truncate\n");
+		nvfuse_release_super(sb);
+		goto CLOSE;
+	}
+	nvfuse_release_super(sb);
+
+	if (nvfuse_ftruncate(nvh, fd, (s64)half * CLUSTER_SIZE) < 0 ||
+	    rt_extent_append(nvh, fd, buf, half, RT_EXTENT_BLOCKS) < 0 ||
+	    rt_extent_verify(nvh, fd, buf, RT_EXTENT_BLOCKS) < 0)
+		goto CLOSE;
+
+	ret = 0;
+CLOSE:
+	nvfuse_closefile(nvh, fd);
+	if (nvfuse_unlink(nvh, "extent_file") < 0) {
+		printf(" Error: unlink() extent_file\n");
+		ret = -1;
+	}
+FREE:
+	nvfuse_free_aligned_buffer(buf);
+
+	return ret;
+}
+
+#define RT_DELALLOC_BLOCKS	(256)
+
+int rt_delayed_alloc(struct nvfuse_handle *nvh, u32 arg)
+{
+	struct nvfuse_superblock *sb;
+	struct statvfs before, after;
+	u32 num_alloc;
+	char *buf;
+	s32 frags;
+	s32 fd;
+	s32 ret = -1;
+
+	buf = nvfuse_alloc_aligned_buffer(RT_EXTENT_IO_BLOCKS * CLUSTER_SIZE);
+	if (buf == NULL) {
+		printf(" Error: malloc()\n");
+		return -1;
+	}
+
+	/* a temporary file removed before the flush never gets blocks */
+	fd = nvfuse_openfile_path(nvh, "delalloc_tmp", O_RDWR | O_CREAT, 0);
+	if (fd < 0) {
+		printf(" Error: open() delalloc_tmp\n");
+		goto FREE;
+	}
+
+	nvfuse_sync(nvh);
+	if (nvfuse_statvfs(nvh, NULL, &before) < 0) {
+		printf(" statfs error \n");
+		nvfuse_closefile(nvh, fd);
+		goto FREE;
+	}
+
+	if (rt_extent_append(nvh, fd, buf, 0, RT_DELALLOC_BLOCKS) < 0 ||
+	    rt_extent_verify(nvh, fd, buf, RT_DELALLOC_BLOCKS) < 0) {
+		nvfuse_closefile(nvh, fd);
+		goto FREE;
+	}
+
+	nvfuse_statvfs(nvh, NULL, &after);
+#ifdef NVFUSE_USE_DELAYED_ALLOCATION
+	sb = nvfuse_read_super(nvh);
+	if (after.f_bfree != before.f_bfree ||
+	    nvfuse_fgetblk(sb, fd, 0, 1, &num_alloc) != 0) {
+		printf(" Error: blocks are allocated before the flush (%ld -> %ld)\n",
+		       (long)before.f_bfree, (long)after.f_bfree);
+		nvfuse_release_super(sb);
+		nvfuse_closefile(nvh, fd);
+		goto FREE;
+	}
+
+	/* but every buffered block is charged */
+	if (nvfuse_sum_sb_counter(sb, NVFUSE_SB_DA_RESERVED_BLOCKS) != RT_DELALLOC_BLOCKS) {
+		printf(" Error: %ld blocks charged to %d buffered blocks\n",
+		       (long)nvfuse_sum_sb_counter(sb, NVFUSE_SB_DA_RESERVED_BLOCKS), RT_DELALLOC_BLOCKS);
+		nvfuse_release_super(sb);
+		nvfuse_closefile(nvh, fd);
+		goto FREE;
+	}
+	nvfuse_release_super(sb);
+#endif
+
+	nvfuse_closefile(nvh, fd);
+	if (nvfuse_unlink(nvh, "delalloc_tmp") < 0) {
+		printf(" Error: unlink() delalloc_tmp\n");
+		goto FREE;
+	}
+
+	nvfuse_sync(nvh);
+	nvfuse_statvfs(nvh, NULL, &after);
+	if (after.f_bfree != before.f_bfree) {
+		printf(" Error: free blocks %ld -> %ld\n", (long)before.f_bfree, (long)after.f_bfree);
+		goto FREE;
+	}
+
+#ifdef NVFUSE_USE_DELAYED_ALLOCATION
+	/* the charges go with the dropped buffers */
+	sb = nvfuse_read_super(nvh);
+	if (nvfuse_sum_sb_counter(sb, NVFUSE_SB_DA_RESERVED_BLOCKS)) {
+		printf(" Error: %ld blocks still charged\n",
+		       (long)nvfuse_sum_sb_counter(sb, NVFUSE_SB_DA_RESERVED_BLOCKS));
+		nvfuse_release_super(sb);
+		goto FREE;
+	}
+	nvfuse_release_super(sb);
+#endif
+
+	/* a flushed file is allocated in one go */
+	fd = nvfuse_openfile_path(nvh, "delalloc_file", O_RDWR | O_CREAT, 0);
+	if (fd < 0) {
+		printf(" Error: open() delalloc_file\n");
+		goto FREE;
+	}
+
+	if (rt_extent_append(nvh, fd, buf, 0, RT_DELALLOC_BLOCKS) == 0) {
+		frags = rt_count_fragments(nvh, fd, RT_DELALLOC_BLOCKS);
+		if (frags >= 0 && frags <= 4 &&
+		    rt_extent_verify(nvh, fd, buf, RT_DELALLOC_BLOCKS) == 0)
+			ret = 0;
+		else
+			printf(" Error: delalloc_file has %d fragments\n", frags + 1);
+	}
+
+	nvfuse_closefile(nvh, fd);
+	if (nvfuse_unlink(nvh, "delalloc_file") < 0) {
+		printf(" Error: unlink() delalloc_file\n");
+		ret = -1;
+	}
+FREE:
+	nvfuse_free_aligned_buffer(buf);
+
+	return ret;
+}
+
+#define RT_FEXT_HOLES		(64)
+#define RT_FEXT_HOLE_BLOCKS	(8)
+#define RT_FEXT_BLOCKS		(1024)
+
+/* a large file is placed in a free run of its own, not in the holes left by small files */
+int rt_free_extent_best_fit(struct nvfuse_handle *nvh, u32 arg)
+{
+	char str[FNAME_SIZE];
+	char *buf;
+	s32 frags;
+	s32 fd;
+	s32 i;
+	s32 ret = -1;
+
+	buf = nvfuse_alloc_aligned_buffer(RT_EXTENT_IO_BLOCKS * CLUSTER_SIZE);
+	if (buf == NULL) {
+		printf(" Error: malloc()\n");
+		return -1;
+	}
+
+	for (i = 0; i < RT_FEXT_HOLES * 2; i++) {
+		sprintf(str, "fext_small%d", i);
+		fd = nvfuse_openfile_path(nvh, str, O_RDWR | O_CREAT, 0);
+		if (fd < 0) {
+			printf(" Error: open() %s\n", str);
+			goto CLEANUP;
+		}
+		if (rt_extent_append(nvh, fd, buf, 0, RT_FEXT_HOLE_BLOCKS) < 0) {
+			nvfuse_closefile(nvh, fd);
+			goto CLEANUP;
+		}
+		nvfuse_closefile(nvh, fd);
+	}
+	nvfuse_sync(nvh);
+
+	/* punch holes of RT_FEXT_HOLE_BLOCKS blocks */
+	for (i = 0; i < RT_FEXT_HOLES * 2; i += 2) {
+		sprintf(str, "fext_small%d", i);
+		if (nvfuse_unlink(nvh, str) < 0) {
+			printf(" Error: unlink() %s\n", str);
+			goto CLEANUP;
+		}
+	}
+	nvfuse_sync(nvh);
+
+	fd = nvfuse_openfile_path(nvh, "fext_large", O_RDWR | O_CREAT, 0);
+	if (fd < 0) {
+		printf(" Error: open() fext_large\n");
+		goto CLEANUP;
+	}
+
+	/* preallocated blocks are mapped once they are written */
+	if (nvfuse_fallocate(nvh, "fext_large", 0, (s64)RT_FEXT_BLOCKS * CLUSTER_SIZE) < 0 ||
+	    rt_extent_append(nvh, fd, buf, 0, RT_FEXT_BLOCKS) < 0) {
+		printf(" Error: fallocate() fext_large\n");
+	} else {
+		frags = rt_count_fragments(nvh, fd, RT_FEXT_BLOCKS);
+		printf(" fext_large: %d blocks in %d fragments\n", RT_FEXT_BLOCKS, frags + 1);
+#ifdef NVFUSE_USE_FREE_EXTENT_INDEX
+		if (frags < 0 || frags > 4)
+			printf(" Error: fext_large is fragmented\n");
+		else
+			ret = 0;
+#else
+		ret = frags < 0 ? -1 : 0;
+#endif
+	}
+
+	nvfuse_closefile(nvh, fd);
+	if (nvfuse_unlink(nvh, "fext_large") < 0) {
+		printf(" Error: unlink() fext_large\n");
+		ret = -1;
+	}
+
+CLEANUP:
+	for (i = 1; i < RT_FEXT_HOLES * 2; i += 2) {
+		sprintf(str, "fext_small%d", i);
+		nvfuse_unlink(nvh, str);
+	}
+	nvfuse_free_aligned_buffer(buf);
+
+	return ret;
+}
+
+#define RT_AG_FILES	(32)
+#define RT_AG_BLOCKS	(64)
+
+/* files created on this core live in its slice of bgs, and so do their blocks */
+int rt_alloc_groups(struct nvfuse_handle *nvh, u32 arg)
+{
+	struct nvfuse_superblock *sb;
+	struct nvfuse_alloc_group *ag;
+	struct stat st;
+	char str[FNAME_SIZE];
+	char *buf;
+	u32 num_alloc;
+	u32 ino_bg, blk_bg;
+	s32 pblk;
+	s32 fd;
+	s32 i;
+	s32 ret = 0;
+
+	buf = nvfuse_alloc_aligned_buffer(RT_EXTENT_IO_BLOCKS * CLUSTER_SIZE);
+	if (buf == NULL) {
+		printf(" Error: malloc()\n");
+		return -1;
+	}
+
+	for (i = 0; i < RT_AG_FILES && !ret; i++) {
+		sprintf(str, "ag_file%d", i);
+		fd = nvfuse_openfile_path(nvh, str, O_RDWR | O_CREAT, 0);
+		if (fd < 0) {
+			printf(" Error: open() %s\n", str);
+			ret = -1;
+			break;
+		}
+
+		if (rt_extent_append(nvh, fd, buf, 0, RT_AG_BLOCKS) < 0 ||
+		    nvfuse_getattr(nvh, str, &st) < 0) {
+			ret = -1;
+		} else {
+			nvfuse_sync(nvh);
+
+			sb = nvfuse_read_super(nvh);
+			ag = nvfuse_get_alloc_group(sb);
+			ino_bg = st.st_ino / sb->sb_no_of_inodes_per_bg;
+			pblk = nvfuse_fgetblk(sb, fd, RT_AG_BLOCKS - 1, 1, &num_alloc);
+			blk_bg = pblk / sb->sb_no_of_blocks_per_bg;
+#ifdef NVFUSE_USE_ALLOC_GROUPS
+			if (ino_bg < ag->ag_bg_start || ino_bg >= ag->ag_bg_start + ag->ag_bg_count ||
+			    pblk <= 0 || nvfuse_get_bg_alloc_group(sb, blk_bg) != ag) {
+				printf(" Error: %s (ino %lu, block %d) is not in bgs %u-%u\n", str,
+				       (unsigned long)st.st_ino, pblk, ag->ag_bg_start,
+				       ag->ag_bg_start + ag->ag_bg_count - 1);
+				ret = -1;
+			}
+#endif
+			nvfuse_release_super(sb);
+		}
+
+		nvfuse_closefile(nvh, fd);
+	}
+
+	while (i--) {
+		sprintf(str, "ag_file%d", i);
+		if (nvfuse_unlink(nvh, str) < 0) {
+			printf(" Error: unlink() %s\n", str);
+			ret = -1;
+		}
+	}
+	nvfuse_free_aligned_buffer(buf);
+
+	return ret;
+}
+
+#define RT_UNWRITTEN_BLOCKS	(262144)	/* 1GB */
+
+/* nr_blocks from lblk read as zeroes */
+static s32 rt_unwritten_verify(struct nvfuse_handle *nvh, s32 fd, char *buf, s32 lblk, s32 nr_blocks)
+{
+	s64 i;
+
+	memset(buf, 0xff, (s64)nr_blocks * CLUSTER_SIZE);
+	if (nvfuse_readfile(nvh, fd, buf, nr_blocks * CLUSTER_SIZE,
+			    (s64)lblk * CLUSTER_SIZE) != nr_blocks * CLUSTER_SIZE) {
+		printf(" Error: read() lblk = %d\n", lblk);
+		return -1;
+	}
+
+	for (i = 0; i < (s64)nr_blocks * CLUSTER_SIZE; i++) {
+		if (buf[i]) {
+			printf(" Error: lblk = %d is not zero\n", lblk + (s32)(i / CLUSTER_SIZE));
+			return -1;
+		}
+	}
+
+	return 0;
+}
+
+int rt_unwritten_extents(struct nvfuse_handle *nvh, u32 arg)
+{
+	struct nvfuse_superblock *sb;
+	struct statvfs before, after;
+	struct timeval tv;
+	u32 num_alloc;
+	char *buf;
+	s32 mid = RT_UNWRITTEN_BLOCKS / 2;
+	s32 fd;
+	s32 i;
+	s32 ret = -1;
+
+	buf = nvfuse_alloc_aligned_buffer(RT_EXTENT_IO_BLOCKS * CLUSTER_SIZE);
+	if (buf == NULL) {
+		printf(" Error: malloc()\n");
+		return -1;
+	}
+
+	fd = nvfuse_openfile_path(nvh, "unwritten_file", O_RDWR | O_CREAT, 0);
+	if (fd < 0) {
+		printf(" Error: open() unwritten_file\n");
+		goto FREE;
+	}
+
+	nvfuse_sync(nvh);
+	if (nvfuse_statvfs(nvh, NULL, &before) < 0) {
+		printf(" statfs error \n");
+		goto CLOSE;
+	}
+
+	gettimeofday(&tv, NULL);
+	if (nvfuse_fallocate(nvh, "unwritten_file", 0, (s64)RT_UNWRITTEN_BLOCKS * CLUSTER_SIZE) < 0) {
+		printf(" Error: fallocate() unwritten_file\n");
+		goto CLOSE;
+	}
+	printf(" fallocate %dMB in %.3fs\n", RT_UNWRITTEN_BLOCKS / (MB / CLUSTER_SIZE),
+	       nvfuse_time_since_now(&tv));
+
+	nvfuse_statvfs(nvh, NULL, &after);
+	if (before.f_bfree - after.f_bfree < RT_UNWRITTEN_BLOCKS) {
+		printf(" Error: free blocks %ld -> %ld\n", (long)before.f_bfree, (long)after.f_bfree);
+		goto CLOSE;
+	}
+
+	if (rt_unwritten_verify(nvh, fd, buf, 0, RT_EXTENT_IO_BLOCKS) < 0 ||
+	    rt_unwritten_verify(nvh, fd, buf, mid, RT_EXTENT_IO_BLOCKS) < 0)
+		goto CLOSE;
+
+	/* the first write of a range makes it readable, its neighbours still read as zeroes */
+	rt_extent_fill(buf, mid, RT_EXTENT_IO_BLOCKS);
+	if (nvfuse_writefile(nvh, fd, buf, RT_EXTENT_IO_BLOCKS * CLUSTER_SIZE,
+			     (s64)mid * CLUSTER_SIZE) != RT_EXTENT_IO_BLOCKS * CLUSTER_SIZE) {
+		printf(" Error: write() lblk = %d\n", mid);
+		goto CLOSE;
+	}
+	nvfuse_sync(nvh);
+
+#ifdef NVFUSE_USE_UNWRITTEN_EXTENTS
+	sb = nvfuse_read_super(nvh);
+	if (nvfuse_fgetblk(sb, fd, mid, 1, &num_alloc) <= 0 ||
+	    nvfuse_fgetblk(sb, fd, mid - 1, 1, &num_alloc) != 0 ||
+	    nvfuse_fgetblk(sb, fd, mid + RT_EXTENT_IO_BLOCKS, 1, &num_alloc) != 0) {
+		printf(" Error: mapping around lblk = %d\n", mid);
+		nvfuse_release_super(sb);
+		goto CLOSE;
+	}
+	nvfuse_release_super(sb);
+#endif
+
+	if (nvfuse_readfile(nvh, fd, buf, RT_EXTENT_IO_BLOCKS * CLUSTER_SIZE,
+			    (s64)mid * CLUSTER_SIZE) != RT_EXTENT_IO_BLOCKS * CLUSTER_SIZE) {
+		printf(" Error: read() lblk = %d\n", mid);
+		goto CLOSE;
+	}
+	for (i = 0; i < RT_EXTENT_IO_BLOCKS; i++) {
+		if ((u8)buf[(s64)i * CLUSTER_SIZE] != ((mid + i) & 0xff)) {
+			printf(" Error: data mismatch lblk = %d\n", mid + i);
+			goto CLOSE;
+		}
+	}
+
+	if (rt_unwritten_verify(nvh, fd, buf, mid - RT_EXTENT_IO_BLOCKS, RT_EXTENT_IO_BLOCKS) < 0 ||
+	    rt_unwritten_verify(nvh, fd, buf, mid + RT_EXTENT_IO_BLOCKS, RT_EXTENT_IO_BLOCKS) < 0)
+		goto CLOSE;
+
+	ret = 0;
+CLOSE:
+	nvfuse_closefile(nvh, fd);
+	if (nvfuse_unlink(nvh, "unwritten_file") < 0) {
+		printf(" Error: unlink() unwritten_file\n");
+		ret = -1;
+	}
+FREE:
+	nvfuse_free_aligned_buffer(buf);
+
+	return ret;
+}
+
+#define RT_SPARSE_GAP		(1048576)	/* 4GB */
+
+int rt_sparse_file(struct nvfuse_handle *nvh, u32 arg)
+{
+	struct statvfs before, after;
+	nvfuse_off_t first, second, end;
+	char *buf;
+	s32 fd;
+	s32 i;
+	s32 ret = -1;
+
+	first = (nvfuse_off_t)RT_SPARSE_GAP * CLUSTER_SIZE;
+	second = (nvfuse_off_t)RT_SPARSE_GAP * 2 * CLUSTER_SIZE;
+	end = second + RT_EXTENT_IO_BLOCKS * CLUSTER_SIZE;
+
+	buf = nvfuse_alloc_aligned_buffer(RT_EXTENT_IO_BLOCKS * CLUSTER_SIZE);
+	if (buf == NULL) {
+		printf(" Error: malloc()\n");
+		return -1;
+	}
+
+	fd = nvfuse_openfile_path(nvh, "sparse_file", O_RDWR | O_CREAT, 0);
+	if (fd < 0) {
+		printf(" Error: open() sparse_file\n");
+		goto FREE;
+	}
+
+	nvfuse_sync(nvh);
+	if (nvfuse_statvfs(nvh, NULL, &before) < 0) {
+		printf(" statfs error \n");
+		goto CLOSE;
+	}
+
+	/* two runs of data far beyond the end of file */
+	rt_extent_fill(buf, RT_SPARSE_GAP, RT_EXTENT_IO_BLOCKS);
+	if (nvfuse_writefile(nvh, fd, buf, RT_EXTENT_IO_BLOCKS * CLUSTER_SIZE,
+			     first) != RT_EXTENT_IO_BLOCKS * CLUSTER_SIZE ||
+	    nvfuse_writefile(nvh, fd, buf, RT_EXTENT_IO_BLOCKS * CLUSTER_SIZE,
+			     second) != RT_EXTENT_IO_BLOCKS * CLUSTER_SIZE) {
+		printf(" Error: write() sparse_file\n");
+		goto CLOSE;
+	}
+	nvfuse_sync(nvh);
+
+	/* the skipped blocks are not allocated */
+	nvfuse_statvfs(nvh, NULL, &after);
+	if (before.f_bfree - after.f_bfree > RT_EXTENT_IO_BLOCKS * 4) {
+		printf(" Error: free blocks %ld -> %ld\n", (long)before.f_bfree, (long)after.f_bfree);
+		goto CLOSE;
+	}
+
+	if (rt_unwritten_verify(nvh, fd, buf, 0, RT_EXTENT_IO_BLOCKS) < 0 ||
+	    rt_unwritten_verify(nvh, fd, buf, RT_SPARSE_GAP - RT_EXTENT_IO_BLOCKS,
+				RT_EXTENT_IO_BLOCKS) < 0 ||
+	    rt_unwritten_verify(nvh, fd, buf, RT_SPARSE_GAP + RT_EXTENT_IO_BLOCKS,
+				RT_EXTENT_IO_BLOCKS) < 0)
+		goto CLOSE;
+
+	if (nvfuse_readfile(nvh, fd, buf, RT_EXTENT_IO_BLOCKS * CLUSTER_SIZE,
+			    first) != RT_EXTENT_IO_BLOCKS * CLUSTER_SIZE) {
+		printf(" Error: read() sparse_file\n");
+		goto CLOSE;
+	}
+	for (i = 0; i < RT_EXTENT_IO_BLOCKS; i++) {
+		if ((u8)buf[(s64)i * CLUSTER_SIZE] != ((RT_SPARSE_GAP + i) & 0xff)) {
+			printf(" Error: data mismatch lblk = %d\n", RT_SPARSE_GAP + i);
+			goto CLOSE;
+		}
+	}
+
+	if (nvfuse_lseek(nvh, fd, 0, SEEK_DATA) != first ||
+	    nvfuse_lseek(nvh, fd, 0, SEEK_HOLE) != 0 ||
+	    nvfuse_lseek(nvh, fd, first + 1, SEEK_DATA) != first + 1 ||
+	    nvfuse_lseek(nvh, fd, first, SEEK_HOLE) != first + RT_EXTENT_IO_BLOCKS * CLUSTER_SIZE ||
+	    nvfuse_lseek(nvh, fd, first + RT_EXTENT_IO_BLOCKS * CLUSTER_SIZE, SEEK_DATA) != second ||
+	    nvfuse_lseek(nvh, fd, second, SEEK_HOLE) != end ||
+	    nvfuse_lseek(nvh, fd, end, SEEK_DATA) != -1) {
+		printf(" Error: SEEK_DATA/SEEK_HOLE on sparse_file\n");
+		goto CLOSE;
+	}
+
+	ret = 0;
+CLOSE:
+	nvfuse_closefile(nvh, fd);
+	if (nvfuse_unlink(nvh, "sparse_file") < 0) {
+		printf(" Error: unlink() sparse_file\n");
+		ret = -1;
+	}
+FREE:
+	nvfuse_free_aligned_buffer(buf);
+
+	return ret;
+}
+
+#define RT_DISCARD_BLOCKS	(16384)	/* 64MB */
+
+int rt_discard(struct nvfuse_handle *nvh, u32 arg)
+{
+	struct statvfs before, after;
+	char *buf;
+	s64 trimmed;
+	s32 fd;
+	s32 ret = -1;
+
+	buf = nvfuse_alloc_aligned_buffer(RT_EXTENT_IO_BLOCKS * CLUSTER_SIZE);
+	if (buf == NULL) {
+		printf(" Error: malloc()\n");
+		return -1;
+	}
+
+	fd = nvfuse_openfile_path(nvh, "discard_file", O_RDWR | O_CREAT, 0);
+	if (fd < 0) {
+		printf(" Error: open() discard_file\n");
+		goto FREE;
+	}
+	if (rt_extent_append(nvh, fd, buf, 0, RT_DISCARD_BLOCKS) < 0)
+		goto CLOSE;
+	nvfuse_closefile(nvh, fd);
+	nvfuse_sync(nvh);
+
+	nvfuse_statvfs(nvh, NULL, &before);
+
+	/* the freed blocks are queued for discard and reused right away */
+	if (nvfuse_unlink(nvh, "discard_file") < 0) {
+		printf(" Error: unlink() discard_file\n");
+		goto FREE;
+	}
+
+	fd = nvfuse_openfile_path(nvh, "discard_file", O_RDWR | O_CREAT, 0);
+	if (fd < 0) {
+		printf(" Error: open() discard_file\n");
+		goto FREE;
+	}
+	if (rt_extent_append(nvh, fd, buf, 0, RT_DISCARD_BLOCKS) < 0)
+		goto CLOSE;
+	nvfuse_sync(nvh);
+
+	nvfuse_statvfs(nvh, NULL, &after);
+	if (before.f_bfree != after.f_bfree) {
+		printf(" Error: free blocks %ld -> %ld\n", (long)before.f_bfree, (long)after.f_bfree);
+		goto CLOSE;
+	}
+
+	/* neither the flush nor a trim of all free blocks may discard the new data */
+	trimmed = nvfuse_fstrim(nvh, 0, (s64)after.f_blocks * CLUSTER_SIZE, 0);
+	if (trimmed < 0) {
+		printf(" device does not support discard \n");
+	} else if (trimmed > (s64)after.f_bfree * CLUSTER_SIZE) {
+		printf(" Error: trimmed %ld bytes, only %ld blocks are free\n", (long)trimmed,
+		       (long)after.f_bfree);
+		goto CLOSE;
+	}
+
+	if (rt_extent_verify(nvh, fd, buf, RT_DISCARD_BLOCKS) < 0)
+		goto CLOSE;
+
+	ret = 0;
+CLOSE:
+	nvfuse_closefile(nvh, fd);
+	if (nvfuse_unlink(nvh, "discard_file") < 0) {
+		printf(" Error: unlink() discard_file\n");
+		ret = -1;
+	}
+FREE:
+	nvfuse_free_aligned_buffer(buf);
+
+	return ret;
+}
+
+#define RT_RECLAIM_BLOCKS	(262144)	/* 1GB */
+
+/* sync until the reclaimer has given back every block and inode */
+static s32 rt_reclaim_wait(struct nvfuse_handle *nvh, struct statvfs *before)
+{
+	struct statvfs after;
+	s32 i;
+
+	for (i = 0; i <= RT_RECLAIM_BLOCKS / NVFUSE_RECLAIM_BATCH + 1; i++) {
+		nvfuse_sync(nvh);
+		nvfuse_statvfs(nvh, NULL, &after);
+		if (after.f_bfree == before->f_bfree && after.f_ffree == before->f_ffree)
+			return 0;
+	}
+
+	printf(" Error: free blocks %ld -> %ld, free inodes %ld -> %ld\n", (long)before->f_bfree,
+	       (long)after.f_bfree, (long)before->f_ffree, (long)after.f_ffree);
+	return -1;
+}
+
+int rt_deferred_reclaim(struct nvfuse_handle *nvh, u32 arg)
+{
+	struct statvfs before;
+	struct timeval tv;
+	char *buf;
+	s32 mid = RT_RECLAIM_BLOCKS / 2;
+	s32 fd;
+	s32 ret = -1;
+
+	buf = nvfuse_alloc_aligned_buffer(RT_EXTENT_IO_BLOCKS * CLUSTER_SIZE);
+	if (buf == NULL) {
+		printf(" Error: malloc()\n");
+		return -1;
+	}
+
+	nvfuse_sync(nvh);
+	if (nvfuse_statvfs(nvh, NULL, &before) < 0) {
+		printf(" statfs error \n");
+		goto FREE;
+	}
+
+	/* unlink returns before the blocks of the file are freed */
+	fd = nvfuse_openfile_path(nvh, "reclaim_file", O_RDWR | O_CREAT, 0);
+	if (fd < 0) {
+		printf(" Error: open() reclaim_file\n");
+		goto FREE;
+	}
+	nvfuse_closefile(nvh, fd);
+	if (nvfuse_fallocate(nvh, "reclaim_file", 0, (s64)RT_RECLAIM_BLOCKS * CLUSTER_SIZE) < 0) {
+		printf(" Error: fallocate() reclaim_file\n");
+		goto FREE;
+	}
+	nvfuse_sync(nvh);
+
+	gettimeofday(&tv, NULL);
+	if (nvfuse_unlink(nvh, "reclaim_file") < 0) {
+		printf(" Error: unlink() reclaim_file\n");
+		goto FREE;
+	}
+	printf(" unlink %dMB in %.3fs\n", RT_RECLAIM_BLOCKS / (MB / CLUSTER_SIZE),
+	       nvfuse_time_since_now(&tv));
+
+	if (rt_reclaim_wait(nvh, &before) < 0)
+		goto FREE;
+
+	/* the blocks cut off by truncate are gone before the file grows again */
+	fd = nvfuse_openfile_path(nvh, "reclaim_file", O_RDWR | O_CREAT, 0);
+	if (fd < 0) {
+		printf(" Error: open() reclaim_file\n");
+		goto FREE;
+	}
+	if (rt_extent_append(nvh, fd, buf, 0, RT_EXTENT_IO_BLOCKS) < 0 ||
+	    nvfuse_fallocate(nvh, "reclaim_file", 0, (s64)RT_RECLAIM_BLOCKS * CLUSTER_SIZE) < 0) {
+		printf(" Error: write() reclaim_file\n");
+		goto CLOSE;
+	}
+
+	if (nvfuse_ftruncate(nvh, fd, (s64)RT_EXTENT_IO_BLOCKS * CLUSTER_SIZE) < 0) {
+		printf(" Error: ftruncate() reclaim_file\n");
+		goto CLOSE;
+	}
+
+	rt_extent_fill(buf, mid, RT_EXTENT_IO_BLOCKS);
+	if (nvfuse_writefile(nvh, fd, buf, RT_EXTENT_IO_BLOCKS * CLUSTER_SIZE,
+			     (s64)mid * CLUSTER_SIZE) != RT_EXTENT_IO_BLOCKS * CLUSTER_SIZE) {
+		printf(" Error: write() reclaim_file\n");
+		goto CLOSE;
+	}
+
+	if (rt_extent_verify(nvh, fd, buf, RT_EXTENT_IO_BLOCKS) < 0 ||
+	    rt_unwritten_verify(nvh, fd, buf, RT_EXTENT_IO_BLOCKS, RT_EXTENT_IO_BLOCKS) < 0 ||
+	    rt_unwritten_verify(nvh, fd, buf, mid - RT_EXTENT_IO_BLOCKS, RT_EXTENT_IO_BLOCKS) < 0)
+		goto CLOSE;
+
+	ret = 0;
+CLOSE:
+	nvfuse_closefile(nvh, fd);
+	if (nvfuse_unlink(nvh, "reclaim_file") < 0) {
+		printf(" Error: unlink() reclaim_file\n");
+		ret = -1;
+	}
+	if (ret == 0)
+		ret = rt_reclaim_wait(nvh, &before);
+FREE:
+	nvfuse_free_aligned_buffer(buf);
+
+	return ret;
+}
+
+#define RT_CACHE_INDEX_BLOCKS	(1024)	/* 4MB */
+
+int rt_cache_index(struct nvfuse_handle *nvh, u32 arg)
+{
+	struct timeval tv;
+	char *buf;
+	s32 half = RT_CACHE_INDEX_BLOCKS / 2;
+	s32 far = RT_RECLAIM_BLOCKS;
+	s32 fd;
+	s32 ret = -1;
+
+	buf = nvfuse_alloc_aligned_buffer(RT_EXTENT_IO_BLOCKS * CLUSTER_SIZE);
+	if (buf == NULL) {
+		printf(" Error: malloc()\n");
+		return -1;
+	}
+
+	fd = nvfuse_openfile_path(nvh, "cache_index_file", O_RDWR | O_CREAT, 0);
+	if (fd < 0) {
+		printf(" Error: open() cache_index_file\n");
+		goto FREE;
+	}
+
+	/* a few cached blocks at each end of a sparse 1GB file */
+	if (rt_extent_append(nvh, fd, buf, 0, RT_CACHE_INDEX_BLOCKS) < 0 ||
+	    rt_extent_append(nvh, fd, buf, far, far + RT_EXTENT_IO_BLOCKS) < 0)
+		goto CLOSE;
+	nvfuse_fsync(nvh, fd);
+
+	/* dropped clean buffers are read again from the disk */
+	if (nvfuse_fadvise(nvh, fd, 0, 0, POSIX_FADV_DONTNEED) < 0) {
+		printf(" Error: fadvise() cache_index_file\n");
+		goto CLOSE;
+	}
+	if (rt_extent_verify(nvh, fd, buf, RT_CACHE_INDEX_BLOCKS) < 0)
+		goto CLOSE;
+
+	/* truncate visits the cached blocks only, not every block of the file */
+	gettimeofday(&tv, NULL);
+	if (nvfuse_ftruncate(nvh, fd, (s64)half * CLUSTER_SIZE) < 0) {
+		printf(" Error: ftruncate() cache_index_file\n");
+		goto CLOSE;
+	}
+	printf(" truncate %dMB in %.3fs\n", far / (MB / CLUSTER_SIZE), nvfuse_time_since_now(&tv));
+
+	/* no stale buffer shows through once the file grows again */
+	if (rt_extent_append(nvh, fd, buf, far, far + RT_EXTENT_IO_BLOCKS) < 0)
+		goto CLOSE;
+	if (rt_unwritten_verify(nvh, fd, buf, half, RT_EXTENT_IO_BLOCKS) < 0 ||
+	    rt_unwritten_verify(nvh, fd, buf, RT_CACHE_INDEX_BLOCKS - RT_EXTENT_IO_BLOCKS,
+				RT_EXTENT_IO_BLOCKS) < 0 ||
+	    rt_extent_verify(nvh, fd, buf, half) < 0)
+		goto CLOSE;
+
+	ret = 0;
+CLOSE:
+	nvfuse_closefile(nvh, fd);
+	if (nvfuse_unlink(nvh, "cache_index_file") < 0) {
+		printf(" Error: unlink() cache_index_file\n");
+		ret = -1;
+	}
+
+	/* a closed descriptor is refused */
+	if (nvfuse_fadvise(nvh, fd, 0, 0, POSIX_FADV_DONTNEED) == 0) {
+		printf(" Error: fadvise() on a closed fd\n");
+		ret = -1;
+	}
+FREE:
+	nvfuse_free_aligned_buffer(buf);
+
+	return ret;
+}
+
 struct regression_test_ctx {
 	s32(*function)(struct nvfuse_handle *nvh, u32 arg);
 	s8 test_name[128];
@@ -811,7 +2525,21 @@ rt_ctx[] = {
 	{ rt_create_max_sized_file_aio_4KB, "Creating Maximum Sized Single File with 4KB Random AIO Read and Write.", RANDOM, 0, 0},
 	{ rt_create_max_sized_file_aio_128KB, "Creating Maximum Sized Single File with 128KB Sequential AIO Read and Write.", SEQUENTIAL, 0, 0 },
 	{ rt_create_max_sized_file_aio_128KB, "Creating Maximum Sized Single File with 128KB Random AIO Read and Write.", RANDOM, 0, 0 },
-	{ rt_create_4KB_files, "Creating 4KB files with fsync.", 0, 0, 0}
+	{ rt_create_4KB_files, "Creating 4KB files with fsync.", 0, 0, 0},
+	{ rt_dir_hash_collision, "Directory Index with Forced Hash Collisions.", 0, 0, 0},
+	{ rt_dir_varlen_names, "Variable Length Directory Entries.", 0, 0, 0},
+	{ rt_inline_data, "Inline Directories and Symlinks.", 0, 0, 0},
+	{ rt_kv_store, "Embedded Key-Value Store.", 0, 0, 0},
+	{ rt_prealloc_interleaved, "Interleaved Appends with Preallocation Windows.", 0, 0, 0},
+	{ rt_extent_mapping, "Extent Mapped File with Truncation.", 0, 0, 0},
+	{ rt_delayed_alloc, "Delayed Allocation of Buffered Writes.", 0, 0, 0},
+	{ rt_free_extent_best_fit, "Best Fit Allocation from Free Extent Trees.", 0, 0, 0},
+	{ rt_alloc_groups, "Per-core Allocation Groups.", 0, 0, 0},
+	{ rt_unwritten_extents, "Unwritten Extents of Preallocated Files.", 0, 0, 0},
+	{ rt_sparse_file, "Sparse File with SEEK_DATA and SEEK_HOLE.", 0, 0, 0},
+	{ rt_discard, "Discard of Freed Blocks Reused before the Flush.", 0, 0, 0},
+	{ rt_deferred_reclaim, "Deferred Reclamation of Unlinked and Truncated Files.", 0, 0, 0},
+	{ rt_cache_index, "Per-inode Index of Cached Blocks.", 0, 0, 0}
 };
 
 void rt_usage(char *cmd)
@@ -43,11 +43,11 @@ s32 nvfuse_lookup(struct nvfuse_superblock *sb, struct nvfuse_inode_ctx **file_i
 
 struct nvfuse_dir_entry * nvfuse_lookup_linear(struct nvfuse_superblock *sb, struct nvfuse_inode_ctx *dir_ictx, 
 												struct nvfuse_inode *dir_inode, const s8 *filename, 
-												struct nvfuse_buffer_head **dir_bh_return);
+												struct nvfuse_dir_block *db);
 
 struct nvfuse_dir_entry * nvfuse_lookup_bptree(struct nvfuse_superblock *sb, struct nvfuse_inode_ctx *ictx,
 												struct nvfuse_inode *dir_inode, const s8 *filename, 
-												struct nvfuse_buffer_head **dir_bh_return);
+												struct nvfuse_dir_block *db);
 
 s32 nvfuse_openfile_path(struct nvfuse_handle *nvh, const char *path, int flags, int mode);
 s32 nvfuse_openfile(struct nvfuse_superblock *sb, inode_t par_ino, s8 *filename, s32 flags,
@@ -76,6 +76,7 @@ s32 nvfuse_mkdir_path(struct nvfuse_handle *nvh, const char *path, mode_t mode);
 
 s32 nvfuse_rmdir(struct nvfuse_superblock *sb, inode_t par_ino, s8 *filename);
 s32 nvfuse_rmdir_path(struct nvfuse_handle *nvh, const char *path);
+s32 nvfuse_rebuild_dir_index(struct nvfuse_handle *nvh, inode_t dir_ino);
 
 s32 nvfuse_rename(struct nvfuse_handle *nvh, inode_t par_ino, s8 *name, inode_t new_par_ino,
 		  s8 *newname);
@@ -103,7 +104,10 @@ s32 nvfuse_chown(struct nvfuse_handle *nvh, const char *path, uid_t uid, gid_t g
 #endif
 s32 nvfuse_fdatasync(struct nvfuse_handle *nvh, int fd);
 s32 nvfuse_fsync(struct nvfuse_handle *nvh, int fd);
+s32 nvfuse_fadvise(struct nvfuse_handle *nvh, s32 fd, nvfuse_off_t offset, nvfuse_off_t len,
+		   s32 advice);
 s32 nvfuse_sync(struct nvfuse_handle *nvh);
+s64 nvfuse_fstrim(struct nvfuse_handle *nvh, s64 start, s64 len, s64 minlen);
 
 s32 nvfuse_fdsync_ictx(struct nvfuse_superblock *sb, struct nvfuse_inode_ctx *ictx);
 s32 nvfuse_fsync_ictx(struct nvfuse_superblock *sb, struct nvfuse_inode_ctx *ictx);
@@ -118,8 +122,7 @@ s32 nvfuse_hardlink(struct nvfuse_superblock *sb, inode_t par_ino, s8 *name, ino
 		    s8 *newname);
 s32 nvfuse_utimens(struct nvfuse_handle *nvh, const char *path, const struct timespec ts[2]);
 
-s32 nvfuse_shrink_dentry(struct nvfuse_superblock *sb, struct nvfuse_inode_ctx *ictx, u32 to_entry,
-			 u32 from_entry);
+s32 nvfuse_shrink_dentry(struct nvfuse_superblock *sb, struct nvfuse_inode_ctx *ictx, u32 to_lblock);
 
 s32 nvfuse_fallocate(struct nvfuse_handle *nvh, const char *path, s64 start, s64 length);
 s32 nvfuse_fallocate_verify(struct nvfuse_superblock *sb, struct nvfuse_inode_ctx *ictx, u32 start,
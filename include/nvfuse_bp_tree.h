@@ -112,6 +112,45 @@ typedef struct index_node {
 	master_node_t *i_master;
 } index_node_t;
 
+/* node header at the head of a node block (BP_NODE_HEAD_SIZE bytes) */
+typedef struct bp_node_head {
+	int h_root;
+	int h_flag;
+	int h_num;
+	int h_offset;
+	int h_next_node;
+	int h_prev_node;
+	int h_status;
+	char h_pad[12];
+} bp_node_head_t;
+
+/*
+ * read-only view of a node on its buffer cache page. lookups search
+ * keys in place and only pin the page, index_node_t is used to modify.
+ */
+typedef struct bp_node_view {
+	struct nvfuse_buffer_head *v_bh;
+	bp_node_head_t *v_head;
+	key_pair_t v_pair;
+} bp_node_view_t;
+
+/*
+ * ordered cursor over the pairs of a b+tree. it walks the leaf chain and
+ * pins one leaf page at a time while the next leaf is read in the
+ * background. the tree must not be used otherwise while a cursor is open.
+ */
+typedef struct bp_iter {
+	master_node_t *it_master;
+	bp_node_view_t it_view;
+	int it_index;
+
+	/* read-ahead of the next leaf */
+	int it_ra_offset;
+	struct nvfuse_buffer_head *it_ra_bh;
+	struct reactor_task *it_ra_task;
+	struct io_job *it_ra_job;
+} bp_iter_t;
+
 /* Master Node Layout */
 #define BP_NODE_HEAD_SIZE	40
 #define BP_BITMAP_START		BP_NODE_HEAD_SIZE
@@ -132,6 +171,16 @@ typedef struct index_node {
 #define BP_KEY_START BP_NODE_HEAD_SIZE
 #define BP_ITEM_START(m) (BP_KEY_START + FANOUT * BP_KEY_SIZE)
 
+/* percentage of pairs kept in the left leaf when keys are appended in order */
+#define BP_SEQ_SPLIT_RATIO	90
+
+/* nodes holding fewer pairs are merged with or refilled from a sibling */
+#ifdef NVFUSE_USE_DELAYED_REDISTRIBUTION_BPTREE
+#define BP_MIN_FILL	(FANOUT / 4)
+#else
+#define BP_MIN_FILL	(FANOUT / 2 + 1)
+#endif
+
 /***************************************************************/
 //				DATA NODE DEFINITIONS (LEAF NODE)
 /***************************************************************/
@@ -157,6 +206,19 @@ typedef struct _master_ondisk_node {
 } master_ondisk_node_t;
 
 #define MAX_STACK 128
+
+/*
+ * traversal state of a single b+tree operation. it lives on the caller's
+ * stack so that a cached master does not carry one operation's path into
+ * the next. operations on a tree are not concurrent: the directory inode
+ * lock is held across each of them and also covers the cached master.
+ */
+typedef struct bp_cursor {
+	index_node_t *c_cur;
+	offset_t c_stack[MAX_STACK];
+	int c_sp;
+} bp_cursor_t;
+
 typedef struct master_node {
 	/* ondisk pointer */
 	master_ondisk_node_t *m_ondisk;
@@ -168,9 +230,6 @@ typedef struct master_node {
 	struct nvfuse_superblock *m_sb;
 	struct nvfuse_buffer_head *m_bh;
 	int m_bitmap_ptr;
-	index_node_t *m_cur;
-	offset_t m_stack[MAX_STACK];
-	int	m_sp;
 
 	void *m_rec;
 	int m_size; // nvfuse_malloc size
@@ -183,7 +242,7 @@ typedef struct master_node {
 	int	(*insert)(struct master_node *master, bkey_t *key, bitem_t *value, bitem_t *cur_value,
 			  int update);
 	int	(*update)(struct master_node *master, bkey_t *key, bitem_t *value);
-	int	(*search)(struct master_node *master, bkey_t *key, index_node_t **d);
+	int	(*search)(struct master_node *master, bp_cursor_t *cursor, bkey_t *key, index_node_t **d);
 	int	(*range_search)(struct master_node *master, bkey_t *start, bkey_t *end);
 	int	(*remove)(struct master_node *master, bkey_t *key);
 	int	(*get_pair)(index_node_t *dp, bkey_t *key);
@@ -191,8 +250,6 @@ typedef struct master_node {
 	int	(*release_bh)(struct nvfuse_buffer_head *bh);
 	int	(*read)(struct master_node *master, index_node_t *p, int ofset, int sync, int rwlock);
 	int	(*write)(struct master_node *master, index_node_t *p, int offset);
-	void	(*push)(struct master_node *master, offset_t v);
-	offset_t	(*pop)(struct master_node *master);
 } master_node_t;
 
 
@@ -227,7 +284,7 @@ typedef struct {
 #define LOCK			1
 #define NOLOCK			0
 
-#define B_SEARCH(m, k, d) m->search(m, k, d)
+#define B_SEARCH(m, c, k, d) m->search(m, c, k, d)
 #define B_RSEARCH(m, k1, k2) m->range_search(m, k1, k2);
 #define B_RSEARCH_RB(m, k1, k2, rb) m->range_search_rb(m, k1, k2, rb)
 
@@ -246,10 +303,10 @@ typedef struct {
 #define B_DEALLOC(m, p) m->dealloc(m, p)
 #define B_WRITE(m, p, o) m->write(m, p, o)
 #define B_READ(m, p, o, s, l) m->read(m, p, o, s, l)
-#define B_POP(m) m->pop(m)
-#define B_PUSH(m,p) m->push(m,p)
+#define B_POP(c) stack_pop(c)
+#define B_PUSH(c, p) stack_push(c, (p)->i_offset)
 
-#define B_FLUSH_STACK(m) while(m->m_sp)B_POP(m);
+#define B_FLUSH_STACK(c) while((c)->c_sp)B_POP(c);
 
 void *bp_malloc(struct nvfuse_superblock *sb, int mempool_type, int num);
 void bp_free(struct nvfuse_superblock *sb, int mempool_type, int num, void *ptr);
@@ -261,6 +318,10 @@ void bp_free(struct nvfuse_superblock *sb, int mempool_type, int num, void *ptr)
 			rte_memcpy((char *)B_KEY_PAIR(a, i),(char *) B_KEY_PAIR(b, j), (n) * sizeof(bkey_t));\
 			rte_memcpy((char *)B_ITEM_PAIR(a, i),(char *) B_ITEM_PAIR(b, j), (n) * sizeof(bitem_t));
 
+#define B_PAIR_MOVE_N(a, b, i, j, n) \
+			memmove((char *)B_KEY_PAIR(a, i),(char *) B_KEY_PAIR(b, j), (n) * sizeof(bkey_t));\
+			memmove((char *)B_ITEM_PAIR(a, i),(char *) B_ITEM_PAIR(b, j), (n) * sizeof(bitem_t));
+
 #define B_PAIR_COPY(a,b,i,j) \
 			B_KEY_COPY(B_KEY_PAIR(a, i), B_KEY_PAIR(b, j)); \
 			B_ITEM_COPY(B_ITEM_PAIR(a, i), B_ITEM_PAIR(b, j));
@@ -305,6 +366,10 @@ void bp_free(struct nvfuse_superblock *sb, int mempool_type, int num, void *ptr)
 			rte_memcpy((char *)B_KEY_PAIR(a, i),(char *) B_KEY_PAIR(b, j), (n) * BP_KEY_SIZE);\
 			rte_memcpy((char *)B_ITEM_PAIR(a, i),(char *) B_ITEM_PAIR(b, j), (n) * BP_ITEM_SIZE);
 
+#define B_PAIR_MOVE_N(a, b, i, j, n) \
+			memmove((char *)B_KEY_PAIR(a, i),(char *) B_KEY_PAIR(b, j), (n) * BP_KEY_SIZE);\
+			memmove((char *)B_ITEM_PAIR(a, i),(char *) B_ITEM_PAIR(b, j), (n) * BP_ITEM_SIZE);
+
 #define B_PAIR_INIT_N(a, i, n)\
 		memset((char *)B_KEY_PAIR(a,i), 0x00, (n) * BP_KEY_SIZE);\
 		memset((char *)B_ITEM_PAIR(a,i), 0x00, (n) * BP_ITEM_SIZE);
@@ -344,7 +409,7 @@ void bp_free(struct nvfuse_superblock *sb, int mempool_type, int num, void *ptr)
 #define B_ISROOT(p) (p->i_root)
 
 int bp_remove_key(master_node_t *master, bkey_t *key);
-int search_data_node(master_node_t *master, bkey_t *str, index_node_t **d);
+int search_data_node(master_node_t *master, bp_cursor_t *cursor, bkey_t *str, index_node_t **d);
 int rsearch_data_node(master_node_t *master, bkey_t *s_key, bkey_t *e_key);
 int bp_insert_key_tree(master_node_t *master, bkey_t *key, bitem_t *value, bitem_t *cur_value,
 		       int update);
@@ -355,21 +420,34 @@ void bp_insert_value_tree(index_node_t *ip,
 int bp_key_is_null(bkey_t *buf);
 
 int bp_update_key_tree(master_node_t *master, bkey_t *key, bitem_t *value);
+int bp_bulk_load(master_node_t *master, key_pair_t *pair, int num);
 int get_pair_tree(index_node_t *dp, bkey_t *key);
-index_node_t *traverse_empty(master_node_t *master, index_node_t *ip, bkey_t *key);
+index_node_t *traverse_empty(master_node_t *master, bp_cursor_t *cursor, index_node_t *ip,
+			     bkey_t *key);
 index_node_t *bp_alloc_node(master_node_t *master, int flag, int offset, int is_new);
 int bp_release_node(master_node_t *master, index_node_t *p);
 int bp_release_bh(struct nvfuse_buffer_head *bh);
 int bp_bin_search(bkey_t *key, key_pair_t *pair, int max,
 		  int(*compare)(void *, void *, void *start, int num, int mid));
+#ifdef KEY_IS_INTEGER
+int bp_key_lower_bound(const bkey_t *keys, int n, bkey_t key);
+int bp_key_search(const bkey_t *keys, int n, bkey_t key);
+const char *bp_key_search_name(void);
+#endif
 
 struct nvfuse_buffer_head *bp_read_block(master_node_t *master, int offset, int rwlock);
 int bp_read_node(master_node_t *master, index_node_t *node, int offset, int sync, int rwlock);
+void bp_read_node_view(master_node_t *master, bp_node_view_t *view, int offset);
+int bp_view_next_offset(bp_node_view_t *view, bkey_t *key);
+int bp_view_search(bp_node_view_t *view, bkey_t *key);
+void bp_iter_open(master_node_t *master, bp_iter_t *it, bkey_t *start_key);
+int bp_iter_next(bp_iter_t *it, bkey_t *key, bitem_t *value);
+void bp_iter_close(bp_iter_t *it);
 int bp_write_node(master_node_t *master, index_node_t *node, int offset);
 int bp_distribute_node(index_node_t *p_ip, key_pair_t *pair);
 
-void stack_push(master_node_t *master, offset_t v);
-offset_t stack_pop(master_node_t *master);
+void stack_push(bp_cursor_t *cursor, offset_t v);
+offset_t stack_pop(bp_cursor_t *cursor);
 void bp_init_pair(key_pair_t *node, int num);
 
 int bp_dealloc_bitmap(master_node_t *master, index_node_t *p);
@@ -380,7 +458,8 @@ index_node_t *bp_add_root_node(master_node_t *master, index_node_t *dp, bkey_t *
 
 int key_compare(void *k1, void *k2, void *start, int num, int mid);
 key_pair_t *bp_alloc_pair(master_node_t *master, int num);
-int bp_split_tree(master_node_t *master, index_node_t *dp, bkey_t *key, bitem_t *value);
+int bp_split_tree(master_node_t *master, bp_cursor_t *cursor, index_node_t *dp, bkey_t *key,
+		  bitem_t *value);
 void bp_write_block(struct nvfuse_superblock *sb, struct nvfuse_buffer_head *bh, char *buf,
 		    int offset);
 
@@ -401,7 +480,8 @@ int bp_split_data_node(master_node_t *master,
 		       bkey_t *key,
 		       bitem_t *value,
 		       key_pair_t *pair);
-int bp_merge_key_tree(master_node_t *master, bkey_t *key, index_node_t *dp, int d_index);
+int bp_merge_key_tree(master_node_t *master, bp_cursor_t *cursor, bkey_t *key, index_node_t *dp,
+		      int d_index);
 
 int bp_redist_data_child(master_node_t *master, index_node_t *ip, index_node_t *child, int data_node);
 index_node_t *bp_next_node(master_node_t *master, index_node_t *ip, bkey_t *key);
@@ -412,10 +492,15 @@ void bp_copy_node_to_raw(index_node_t *node, char *raw);
 void bp_copy_raw_to_node(index_node_t *node, char *raw);
 
 void bp_print_node(index_node_t *node);
+void bp_merge_pair_runs(key_pair_t *dst, key_pair_t *a, int na, key_pair_t *b, int nb);
 void bubble_sort(master_node_t *master, key_pair_t *pair, int num, int(*compare)(void *src1,
 		 void *src2));
 int bp_alloc_inode_and_master(struct nvfuse_superblock *sb, master_node_t *master);
 void bp_deinit_master(master_node_t *master);
+void bp_detach_master(master_node_t *master);
+master_node_t *bp_get_dir_master(struct nvfuse_superblock *sb, struct nvfuse_inode_ctx *dir_ictx);
+void bp_put_dir_master(struct nvfuse_inode_ctx *dir_ictx, master_node_t *master);
+void bp_free_dir_master(struct nvfuse_superblock *sb, struct nvfuse_inode_ctx *dir_ictx);
 offset_t bp_alloc_bitmap(master_node_t *master, struct nvfuse_inode_ctx *ictx);
 
 s32 bp_read_master_ctx(master_node_t *master, master_ctx_t *master_ctx, s32 master_id);
@@ -88,6 +88,7 @@ struct nvfuse_buffer_head {
 /* buffer cache allocated to each physical block */
 struct nvfuse_buffer_cache {
 	struct hlist_node bc_hash;	/* hash list */
+	struct rb_node bc_rbnode;	/* hashed buffers in key order (inode, block) */
 	struct list_head bc_list;	/* main buffer list */
 	u32 bc_list_type;		/* buffer status (e.g., clean, dirty, unused) */
 
@@ -105,9 +106,11 @@ struct nvfuse_buffer_cache {
 	u32 bc_load	: 1;			/* data loaded from storage */
 	u32 bc_locked: 1;
 	u32	bc_flush: 1;
-	u32	bc_temp: 28;			/* FIXED: to be removed */
+	u32	bc_delayed: 1;			/* a free block is charged for delayed allocation */
+	u32	bc_temp: 27;			/* FIXED: to be removed */
 
 	rte_atomic32_t bc_ref;		/* reference count*/
+	rte_atomic32_t bc_pin;		/* held by the delayed allocator, the buffer is not recycled */
 
 	struct list_head bc_bh_head; /* buffer list to retrieve */
 	rte_atomic32_t bc_bh_count;
@@ -133,6 +136,8 @@ struct nvfuse_buffer_manager {
 
 	rte_atomic32_t bm_list_count[BUFFER_TYPE_NUM];
 	rte_atomic32_t bm_hash_count[HASH_NUM + 1];
+	/* the hashed buffers again, ordered so those of an inode are adjacent */
+	struct rb_root bm_rbroot;
 	s32 bm_cache_size;
 
 	u64 bm_cache_ref;
@@ -184,12 +189,17 @@ void nvfuse_move_buffer_list(struct nvfuse_superblock *sb, struct nvfuse_buffer_
 void nvfuse_move_buffer_list_nolock(struct nvfuse_superblock *sb, struct nvfuse_buffer_cache *bc,
 							 s32 buffer_type, s32 tail);
 void nvfuse_move_bc_to_unused_list(struct nvfuse_superblock *sb, u64 key);
+/* drop the cached buffers of data blocks [from, to) of an inode */
+s32 nvfuse_invalidate_bcs(struct nvfuse_superblock *sb, inode_t ino, lbno_t from, lbno_t to,
+			  s32 clean_only);
 /* return the number of dirty buffer caches (e.g., 4K dirty buffers) */
 s32 nvfuse_get_dirty_count(struct nvfuse_superblock *sb);
 /* mark the buffer head as dirty */
 void nvfuse_mark_dirty_bh(struct nvfuse_superblock *sb, struct nvfuse_buffer_head *bh);
 /* lookup the buffer cache (bc) related to a given key */
 struct nvfuse_buffer_cache *nvfuse_hash_lookup(struct nvfuse_buffer_manager *bm, u64 key);
+/* check if a data block of an inode has a buffer cache (bc) */
+s32 nvfuse_bc_cached(struct nvfuse_superblock *sb, inode_t ino, lbno_t lblock);
 /* set bh status */
 void nvfuse_set_bh_status(struct nvfuse_buffer_head *bh, s32 status);
 /* clear bh status */
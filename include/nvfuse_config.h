@@ -97,7 +97,10 @@ static inline int nvfuse_process_model_is_dataplane(void)
 #define NVFUSE_BPTREE_MEMPOOL_TOTAL_SIZE	(0x800)
 #define NVFUSE_BPTREE_MEMPOOL_CACHE_SIZE	(0x10)
 
-#define NVFUSE_BPTREE_MEMPOOL_MASTER_TOTAL_SIZE	(0x10)
+/* Maximum number of b+tree masters cached in directory inode contexts */
+#define NVFUSE_BPTREE_MASTER_CACHE_SIZE	(0x400)
+
+#define NVFUSE_BPTREE_MEMPOOL_MASTER_TOTAL_SIZE	(NVFUSE_BPTREE_MASTER_CACHE_SIZE + 0x10)
 #define NVFUSE_BPTREE_MEMPOOL_MASTER_CACHE_SIZE	(0x2)
 
 #define NVFUSE_BPTREE_MEMPOOL_INDEX_TOTAL_SIZE	(0x100)
@@ -134,14 +137,50 @@ enum bp_mempool_type {
 //#define NVFUSE_META_DIRTY_POLICY NVFUSE_META_DIRTY_SYNC_FORCE
 #define NVFUSE_META_DIRTY_POLICY NVFUSE_META_DIRTY_SYNC_DELAYED
 
-/*	*/
+/* b+tree nodes are merged or redistributed below a quarter full instead of half */
 #define NVFUSE_USE_DELAYED_REDISTRIBUTION_BPTREE
-/*	*/
+/* dir b+tree index is built once a directory has this many dentries */
 #define NVFUSE_USE_DELAYED_BPTREE_CREATION
+#define NVFUSE_DIR_INDEX_THRESHOLD (128)
 
 /* actual dir blocks are allocated lazyily */
 #define NVFUSE_USE_DELAYED_DIRECTORY_ALLOC
 
+/* small directories and short symlinks are kept in the inode (i_inline) */
+#define NVFUSE_USE_INLINE_DATA
+
+/* file data blocks come from per-inode windows reserved near the previous block */
+#define NVFUSE_USE_PREALLOC_WINDOW
+#define NVFUSE_PREALLOC_MIN_BLOCKS (64)	/* first window, doubled on every refill */
+#define NVFUSE_PREALLOC_MAX_BLOCKS (2048)	/* 8MB */
+
+/* new regular files map their blocks with an extent tree instead of indirect blocks */
+#define NVFUSE_USE_EXTENTS
+
+/* buffered writes leave file blocks unallocated until their buffers are flushed */
+#define NVFUSE_USE_DELAYED_ALLOCATION
+
+/* fallocate leaves extents unwritten, they read as zeroes until first written */
+#if defined(NVFUSE_USE_EXTENTS) && defined(NVFUSE_USE_DELAYED_ALLOCATION)
+#define NVFUSE_USE_UNWRITTEN_EXTENTS
+#endif
+
+/* data blocks are allocated best fit from in-memory free extent trees of bgs */
+#define NVFUSE_USE_FREE_EXTENT_INDEX
+
+/* standalone threads allocate inodes from their own slice of bgs, file data follows the inode */
+#define NVFUSE_USE_ALLOC_GROUPS
+#define NVFUSE_ALLOC_GROUPS (SPDK_NUM_CORES)
+
+/* freed data blocks are unmapped on the SSD in batches after each flush */
+#define NVFUSE_USE_ONLINE_DISCARD
+#define NVFUSE_DISCARD_BATCH (256)	/* unmap requests per batch */
+#define NVFUSE_DISCARD_MAX_LEN (262144)	/* blocks per request, 1GB */
+
+/* unlink and truncate of large files leave freeing their blocks to a background reclaimer */
+#define NVFUSE_USE_DEFERRED_RECLAIM
+#define NVFUSE_RECLAIM_BATCH (16384)	/* blocks freed per step, 64MB */
+
 /* Insert SLEEP to minimize CPU utilization */
 #define NVFUSE_USE_USLEEP_US 0 /* 0>: us sleep,  0: disabled */
 
@@ -158,6 +197,11 @@ enum bp_mempool_type {
 /* Directory Indexing */
 #define NVFUSE_USE_DIR_INDEXING 1
 
+/* Directory Entry Format (recorded in the superblock by mkfs) */
+#define NVFUSE_DENTRY_FORMAT_FIXED	0 /* 128 byte dentries, 32 per block */
+#define NVFUSE_DENTRY_FORMAT_VARLEN	1 /* 8 byte aligned dentries sized to the name */
+#define NVFUSE_DENTRY_FORMAT NVFUSE_DENTRY_FORMAT_VARLEN
+
 /* debug message */
 //#define printf
 #ifdef __linux__
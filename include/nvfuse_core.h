@@ -18,6 +18,8 @@
 #include "nvfuse_bp_tree.h"
 #include "nvfuse_stat.h"
 #include "rte_spinlock.h"
+#include "rte_atomic.h"
+#include "rte_memory.h"
 #include "list.h"
 #include "rbtree.h"
 
@@ -62,11 +64,22 @@
 #define NVFUSE_TYPE_DIRECTORY	6
 #define NVFUSE_TYPE_TIME		7
 #define NVFUSE_TYPE_BPTREE		8
+#define NVFUSE_TYPE_KV			9 /* embedded key-value store, see nvfuse_kv.h */
 
 /* DIR RELATED */
 #define DIR_ENTRY_SIZE sizeof(struct nvfuse_dir_entry)
 #define DIR_ENTRY_NUM (CLUSTER_SIZE/DIR_ENTRY_SIZE)
 #define FNAME_SIZE (116)
+#define DIR_ENTRY_HEAD_SIZE (DIR_ENTRY_SIZE - FNAME_SIZE)
+#define DIR_ENTRY_ALIGN (8)
+
+/* on-disk record length of a dentry with the given name length */
+#if NVFUSE_DENTRY_FORMAT == NVFUSE_DENTRY_FORMAT_VARLEN
+#define DIR_REC_LEN(name_len) \
+	((DIR_ENTRY_HEAD_SIZE + (name_len) + 1 + DIR_ENTRY_ALIGN - 1) & ~(DIR_ENTRY_ALIGN - 1))
+#else
+#define DIR_REC_LEN(name_len) DIR_ENTRY_SIZE
+#endif
 
 /* DIR ENTRY STATUS */
 #define DIR_EMPTY	(0)
@@ -117,7 +130,6 @@
 #define MVFISE_GET_BGID(sb,clu) (clu >> NVFUSE_CLU_P_BG_BITS(sb))
 #define NVFUSE_GET_BG_TO_CLU(sb, bgid) (bgid << NVFUSE_CLU_P_BG_BITS(sb))
 #define NVFUSE_NUM_CLU (DISK_SIZE >> CLUSTER_SIZE_BITS)
-#define NVFUSE_DENTRY_TO_BLK(x) ((u32)x/DIR_ENTRY_NUM)
 
 #define FALSE	0
 #define TRUE	1
@@ -146,6 +158,16 @@
 #define NVFUSE_BP_LOW_BITS 32
 #define NVFUSE_BP_COLLISION_BITS 2
 
+/*
+ * directory index: names whose hashes collide are kept in a dense chain of
+ * keys (hash | seq) and every non-final member of a chain has the chained
+ * bit set in its value.
+ */
+#define NVFUSE_DIR_HASH_SEQ_BITS 8
+#define NVFUSE_DIR_HASH_SEQ_MASK ((1ULL << NVFUSE_DIR_HASH_SEQ_BITS) - 1)
+#define NVFUSE_DIR_INDEX_CHAINED (1U << (NVFUSE_BP_LOW_BITS - 1))
+#define NVFUSE_DIR_INDEX_OFFSET_MASK (~0U >> NVFUSE_BP_COLLISION_BITS)
+
 #define NVFUSE_MAX_BITS 32
 #define NVFUSE_MAX_INODE_BITS 30
 #define NVFUSE_MAX_DIR_BITS 32
@@ -189,6 +211,66 @@ struct nvfuse_superblock_common {
 	s32 sb_max_inode_num;
 
 	struct nvfuse_app_superblock asb;
+
+	u32 sb_dentry_format; /* RDONLY */
+};
+
+/*
+ * allocation group: a slice of consecutive bgs served to one core in the
+ * standalone model, with its own allocation cursors.
+ */
+struct nvfuse_alloc_group {
+	u32 ag_bg_start;		/* first bg of the slice */
+	u32 ag_bg_count;
+	s32 ag_last_allocated_ino;
+	s32 ag_last_allocated_bgid;
+	s32 ag_last_allocated_bgid_by_ino;
+};
+
+/* counters of the superblock updated on every allocation or lookup */
+enum nvfuse_sb_counter {
+	NVFUSE_SB_FREE_BLOCKS,
+	NVFUSE_SB_USED_BLOCKS,
+	NVFUSE_SB_ASB_FREE_BLOCKS,
+	NVFUSE_SB_FREE_INODES,
+	NVFUSE_SB_ASB_FREE_INODES,
+	NVFUSE_SB_BP_SET_INDEX_TSC,
+	NVFUSE_SB_BP_SET_INDEX_COUNT,
+	NVFUSE_SB_BP_GET_INDEX_TSC,
+	NVFUSE_SB_BP_GET_INDEX_COUNT,
+	NVFUSE_SB_BP_DEL_INDEX_TSC,
+	NVFUSE_SB_BP_DEL_INDEX_COUNT,
+	NVFUSE_SB_BP_MASTER_HIT_COUNT,
+	NVFUSE_SB_NVME_IO_TSC,
+	NVFUSE_SB_NVME_IO_COUNT,
+	NVFUSE_SB_PA_RESERVED_BLOCKS,
+	NVFUSE_SB_DA_RESERVED_BLOCKS,
+	NVFUSE_SB_COUNTER_NUM
+};
+
+/*
+ * per-core deltas of the counters above, each on cache lines of its own.
+ * a core only adds to its own slot and folds it into the superblock fields
+ * with nvfuse_fold_sb_counters() once it holds NVFUSE_SB_COUNTER_BATCH or
+ * more of a free or reserved counter, so the free space checks can trust
+ * the folded value within that margin per core. nvfuse_sum_sb_counter()
+ * adds the deltas of every core for statvfs and sync without writing them.
+ */
+#define NVFUSE_SB_COUNTER_BATCH	(64)
+
+struct nvfuse_sb_percore {
+	rte_atomic64_t pc_count[NVFUSE_SB_COUNTER_NUM];
+} __rte_cache_aligned;
+
+/*
+ * blocks of a bg reserved by preallocation windows. they stay free in the
+ * DBITMAP and in the free counters until they are handed out, this map
+ * keeps the other allocators away from them.
+ */
+struct nvfuse_prealloc_map {
+	rte_spinlock_t pm_lock;	/* serializes the map, the DBITMAP and the free extent tree of the bg */
+	void *pm_bitmap;	/* one bit per block of the bg, allocated on first use */
+	u32 pm_count;		/* reserved blocks of the bg */
 };
 
 /* Super Block Structure */
@@ -215,6 +297,8 @@ struct nvfuse_superblock {
 		s32	sb_max_inode_num;
 
 		struct nvfuse_app_superblock asb;
+
+		u32 sb_dentry_format; /* RDONLY */
 	};
 
 	struct {
@@ -226,6 +310,13 @@ struct nvfuse_superblock {
 		s32 sb_last_allocated_bgid;
 		s32 sb_last_allocated_bgid_by_ino;
 
+		/* per-core allocation groups (standalone model) */
+		struct nvfuse_alloc_group sb_ag[NVFUSE_ALLOC_GROUPS];
+		s32 sb_ag_num;
+
+		/* per-core deltas of the free counters and of the stats below */
+		struct nvfuse_sb_percore sb_percore[SPDK_NUM_CORES];
+
 		struct io_target *target;
 
 		struct nvfuse_bg_descriptor *sb_bd;
@@ -237,6 +328,25 @@ struct nvfuse_superblock {
 		/* inode context cache */
 		struct nvfuse_ictx_manager *sb_ictxc;
 
+		/* free extent index of each bg, built lazily from the DBITMAPs */
+		struct nvfuse_free_extent_tree *sb_fext;
+
+		/* in-memory reservations of the preallocation windows of each bg */
+		struct nvfuse_prealloc_map *sb_pa_map;
+		s64 sb_pa_reserved_blocks;
+
+		/* blocks charged to buffered writes waiting for delayed allocation */
+		s64 sb_da_reserved_blocks;
+
+		/* freed ranges waiting to be discarded, NULL without unmap support */
+		struct nvfuse_discard_ctx *sb_discard;
+
+		/* orphan inodes whose blocks are reclaimed in the background */
+		struct list_head sb_orphan_list;
+		rte_spinlock_t sb_orphan_lock;
+		s32 sb_orphan_count;
+		s32 sb_reclaiming;
+
 		struct nvfuse_file_table *sb_file_table; /* INCLUDING FINE GRAINED LOCK */
 		//pthread_mutex_t sb_file_table_lock; /* COARSE LOCK */
 
@@ -263,6 +373,17 @@ struct nvfuse_superblock {
 
 		u64 bp_set_index_tsc;
 		u64 bp_set_index_count;
+		u64 bp_get_index_tsc;
+		u64 bp_get_index_count;
+		u64 bp_del_index_tsc;
+		u64 bp_del_index_count;
+
+		/* number of b+tree masters cached in directory inode contexts */
+		rte_atomic32_t bp_master_cached_count;
+		u64 bp_master_hit_count;
+
+		/* number of name hash bits used by directory indexes (0: all), for collision tests */
+		u32 bp_dir_hash_bits;
 
 		u64 nvme_io_tsc;
 		u64 nvme_io_count;
@@ -299,13 +420,29 @@ struct nvfuse_file_table {
 
 #define MAX_FILES_PER_DIR (0x7FFFFFFF)
 
+/*
+ * Dentries are packed from the head of a directory block and the first
+ * record whose flag is not DIR_USED ends the block. With the variable
+ * length format a record only takes DIR_REC_LEN(d_name_len) bytes on disk
+ * while in-memory copies always have room for FNAME_SIZE.
+ */
 struct nvfuse_dir_entry {
 	inode_t	d_ino;
-	u32	d_flag;
+	u8	d_flag;
+	u8	d_name_len;
+	u16	d_rec_len;
 	u32	d_version;
 	s8	d_filename[FNAME_SIZE];
 };
 
+/* a directory block or the inline dentry area of a small directory */
+struct nvfuse_dir_block {
+	struct nvfuse_inode_ctx *db_ictx;
+	struct nvfuse_buffer_head *db_bh; /* NULL for inline dentries */
+	s8 *db_buf;
+	u32 db_size;
+};
+
 #define NVFUSE_SUPERBLOCK_OFFSET  0
 #define NVFUSE_SUPERBLOCK_SIZE    1
 #define NVFUSE_BD_OFFSET     1
@@ -365,6 +502,9 @@ struct nvfuse_bg_descriptor {
 
 	/* next block pointer */
 	u32 bd_next_block;
+
+	/* inodes of this bg waiting for the reclaimer */
+	u32 bd_orphan_count;
 };
 
 /* UNIX (EXT2/3) Indirect Block Addressing */
@@ -383,6 +523,10 @@ struct nvfuse_bg_descriptor {
 						(s64)(1 << (PTRS_PER_BLOCK_BITS * 2)) * CLUSTER_SIZE + \
 						(s64)(1 << (PTRS_PER_BLOCK_BITS * 3)) * CLUSTER_SIZE)
 
+/* the last 3972 bytes of an inode are shared by xattrs and inline data */
+#define NVFUSE_INODE_XATTR_SIZE		(3972 - NVFUSE_INLINE_DATA_SIZE)
+#define NVFUSE_INLINE_DATA_SIZE		(1024)
+
 struct nvfuse_inode {
 	inode_t	i_ino; //4
 	u32	i_type; //8
@@ -399,13 +543,19 @@ struct nvfuse_inode {
 	u16	i_gid;		/* Low 16 bits of Group Id */ //54
 	u16	i_uid;		/* Low 16 bits of Owner Uid */	//56
 	u16	i_mode;		/* File mode */ //58
-	u16	resv0;	//60
-	u32 resv1[1]; //64
+	u16	i_flags;	/* NVFUSE_INODE_FLAG_* */ //60
+	u32	i_reclaim_blocks; /* blocks of an orphan that may still be mapped */ //64
 	u32 i_blocks[TINDIRECT_BLOCKS + 1]; //120
 	u32 resv2[1]; // 124
-	u8	xattr[3972]; //4096
+	u8	xattr[NVFUSE_INODE_XATTR_SIZE]; //3072
+	u8	i_inline[NVFUSE_INLINE_DATA_SIZE]; //4096
 };
 
+/* inode flags */
+#define NVFUSE_INODE_FLAG_INLINE	(1 << 0) /* data is kept in i_inline instead of blocks */
+#define NVFUSE_INODE_FLAG_EXTENTS	(1 << 1) /* i_blocks is the root of an extent tree */
+#define NVFUSE_INODE_FLAG_ORPHAN	(1 << 2) /* blocks past its end are being reclaimed */
+
 /* state bit position*/
 #define INODE_STATE_NEW		(0) /* newly allocated. inode has zeroed data */
 #define INODE_STATE_CLEAN	(1) /* clean inode loaded in memory */
@@ -436,6 +586,24 @@ struct nvfuse_inode_ctx {
 	s32 ictx_type;
 	s32 ictx_status;
 	s32 ictx_ref;
+
+	/* b+tree master kept for directory indexing (lazily allocated) */
+	master_node_t *ictx_bp_master;
+
+	/* position of the next dentry for sequential readdir (0: invalid) */
+	s64 ictx_dir_cursor;
+	u32 ictx_dir_cursor_lblk;
+	u32 ictx_dir_cursor_pos;
+
+	/* free bytes of each directory block, built on the first create (NULL: not loaded) */
+	u16 *ictx_dir_space;
+	u32 ictx_dir_space_nr;
+
+	/* preallocation window of file data blocks (see nvfuse_indirect.c) */
+	u32 ictx_pa_start;	/* next reserved block */
+	u32 ictx_pa_len;	/* reserved blocks left */
+	u32 ictx_pa_window;	/* size of the last window */
+	u32 ictx_pa_goal;	/* block after the last one given to the inode */
 };
 
 #if NVFUSE_OS == NVFUSE_OS_WINDOWS
@@ -514,6 +682,7 @@ struct nvfuse_handle {
 inode_t nvfuse_alloc_new_inode(struct nvfuse_superblock *sb, struct nvfuse_inode_ctx *ictx);
 struct nvfuse_inode_ctx *nvfuse_read_inode(struct nvfuse_superblock *sb, struct nvfuse_inode_ctx *ictx, inode_t ino);
 void nvfuse_release_inode(struct nvfuse_superblock *sb, struct nvfuse_inode_ctx *ictx, s32 dirty);
+s32 nvfuse_ictx_is_locked(struct nvfuse_superblock *sb, inode_t ino);
 s32 nvfuse_relocate_delete_inode(struct nvfuse_superblock *sb, struct nvfuse_inode_ctx *ictx);
 void nvfuse_mark_inode_dirty(struct nvfuse_inode_ctx *ictx);
 void nvfuse_free_inode_size(struct nvfuse_superblock *sb, struct nvfuse_inode_ctx *ictx, s64 size);
@@ -526,16 +695,15 @@ void nvfuse_release_ibitmap(struct nvfuse_superblock *sb, u32 bg_id, u32 ino);
 s32 nvfuse_inode_has_dirty(struct nvfuse_inode_ctx *ictx);
 
 /* Directory Indexing Functions */
-s32 nvfuse_set_dir_indexing(struct nvfuse_superblock *sb, struct nvfuse_inode *inode, s8 *filename, u32 offset);
-s32 nvfuse_get_dir_indexing(struct nvfuse_superblock *sb, struct nvfuse_inode *inode, s8 *filename, bitem_t *offset);
-s32 nvfuse_get_dir_indexing(struct nvfuse_superblock *sb, struct nvfuse_inode *inode, s8 *filename, bitem_t *offset);
-s32 nvfuse_del_dir_indexing(struct nvfuse_superblock *sb, struct nvfuse_inode *inode, s8 *filename);
-s32 nvfuse_update_dir_indexing(struct nvfuse_superblock *sb, struct nvfuse_inode *inode, s8 *filename, bitem_t *offset);
+s32 nvfuse_set_dir_indexing(struct nvfuse_superblock *sb, struct nvfuse_inode_ctx *dir_ictx, s8 *filename, u32 offset);
+s32 nvfuse_get_dir_indexing(struct nvfuse_superblock *sb, struct nvfuse_inode_ctx *dir_ictx, s8 *filename, bitem_t *offset);
+s32 nvfuse_del_dir_indexing(struct nvfuse_superblock *sb, struct nvfuse_inode_ctx *dir_ictx, s8 *filename, u32 offset);
+s32 nvfuse_update_dir_indexing(struct nvfuse_superblock *sb, struct nvfuse_inode_ctx *dir_ictx, s8 *filename, u32 old_offset, u32 new_offset);
 void nvfuse_dir_hash(s8 *filename, u32 *hash, u32 *hash2);
 
 /* Dirty Sync Functions */
 struct io_job;
-void nvfuse_flush_dirty_data(struct nvfuse_superblock *sb);
+s32 nvfuse_flush_dirty_data(struct nvfuse_superblock *sb);
 void nvfuse_sync_dirty_data(struct nvfuse_superblock *sb, s32 num_blocks);
 void io_cancel_incomplete_ios(struct nvfuse_superblock *sb, struct io_job **jobq, int job_cnt);
 s32 nvfuse_wait_aio_completion(struct nvfuse_superblock *sb, struct reactor_task *task, struct io_job **jobq, int job_cnt);
@@ -564,13 +732,14 @@ s32 nvfuse_allocate_open_file_table(struct nvfuse_superblock *sb);
 s32 nvfuse_init_file_table(struct nvfuse_superblock *sb);
 struct nvfuse_file_table *nvfuse_get_file_table(struct nvfuse_superblock *sb, s32 fid);
 void nvfuse_close_file_table(struct nvfuse_superblock *sb, s32 fid);
+s32 nvfuse_file_table_has_ino(struct nvfuse_superblock *sb, inode_t ino);
 s32 nvfuse_chmod(struct nvfuse_handle *nvh, inode_t par_ino, s8 *filename, mode_t mode);
 s32 nvfuse_path_open(struct nvfuse_handle *nvh, s8 *path, s8 *filename, struct nvfuse_dir_entry *get);
 s32 nvfuse_path_open2(struct nvfuse_handle *nvh, s8 *path, s8 *filename, struct nvfuse_dir_entry *get);
-s32 nvfuse_lseek(struct nvfuse_handle *nvh, s32 fd, u32 offset, s32 position);
+nvfuse_off_t nvfuse_lseek(struct nvfuse_handle *nvh, s32 fd, nvfuse_off_t offset, s32 position);
 s32 nvfuse_seek(struct nvfuse_superblock *sb, struct nvfuse_file_table *of, s64 offset, s32 position);
 s32 nvfuse_link(struct nvfuse_superblock *sb, u32 newino, s8 *new_filename, s32 ino);
-s32 nvfuse_find_empty_dentry(struct nvfuse_superblock *sb, struct nvfuse_inode_ctx *dir_ictx, struct nvfuse_inode *dir_inode);
+s32 nvfuse_find_empty_dentry(struct nvfuse_superblock *sb, struct nvfuse_inode_ctx *dir_ictx, struct nvfuse_inode *dir_inode, s8 *filename);
 s32 nvfuse_rm_direntry(struct nvfuse_superblock *sb, inode_t par_ino, s8 *name, u32 *ino);
 s32 nvfuse_find_existing_dentry(struct nvfuse_superblock *sb, struct nvfuse_inode_ctx *dir_ictx, struct nvfuse_inode *dir_inode, s8 *filename);
 u32 nvfuse_get_pbn(struct nvfuse_superblock *sb, struct nvfuse_inode_ctx *ictx, inode_t ino, lbno_t offset);
@@ -599,6 +768,15 @@ s32 nvfuse_dealloc_container_from_primary_process(struct nvfuse_superblock *sb,
 u32 nvfuse_get_curr_bg_id(struct nvfuse_superblock *sb, s32 is_inode);
 u32 nvfuse_get_next_bg_id(struct nvfuse_superblock *sb, s32 is_inode);
 void nvfuse_move_curr_bg_id(struct nvfuse_superblock *sb, s32 bg_id, s32 is_inode);
+s32 nvfuse_get_thread_slot(void);
+void nvfuse_add_sb_counter(struct nvfuse_superblock *sb, enum nvfuse_sb_counter counter, s64 value);
+void nvfuse_fold_sb_counters(struct nvfuse_superblock *sb);
+s64 nvfuse_sum_sb_counter(struct nvfuse_superblock *sb, enum nvfuse_sb_counter counter);
+void nvfuse_init_alloc_groups(struct nvfuse_superblock *sb);
+struct nvfuse_alloc_group *nvfuse_get_alloc_group(struct nvfuse_superblock *sb);
+struct nvfuse_alloc_group *nvfuse_get_bg_alloc_group(struct nvfuse_superblock *sb, u32 bg_id);
+u32 nvfuse_get_next_alloc_bg_id(struct nvfuse_superblock *sb, struct nvfuse_alloc_group *ag,
+				u32 first_bg_id, u32 bg_id);
 void nvfuse_send_health_check_msg_to_primary_process(struct nvfuse_handle *nvh);
 
 void nvfuse_add_bg(struct nvfuse_superblock *sb, u32 bg_id);
@@ -610,6 +788,14 @@ s32 nvfuse_check_free_block(struct nvfuse_superblock *sb, u32 num_blocks);
 
 /* block management functions */
 u32 nvfuse_alloc_dbitmap(struct nvfuse_superblock *sb, u32 bg_id, u32 *alloc_blks, u32 num_blocks);
+u32 nvfuse_reserve_dbitmap_run(struct nvfuse_superblock *sb, u32 bg_id, u32 goal, u32 max_len,
+			       u32 *start);
+void nvfuse_claim_dbitmap_run(struct nvfuse_superblock *sb, u32 start, u32 len);
+void nvfuse_unreserve_dbitmap_run(struct nvfuse_superblock *sb, u32 start, u32 len);
+s32 nvfuse_prealloc_map_init(struct nvfuse_superblock *sb);
+s32 nvfuse_reserve_delayed_block(struct nvfuse_superblock *sb);
+void nvfuse_release_delayed_blocks(struct nvfuse_superblock *sb, u32 cnt);
+void nvfuse_prealloc_map_deinit(struct nvfuse_superblock *sb);
 u32 nvfuse_free_dbitmap(struct nvfuse_superblock *sb, u32 bg_id, nvfuse_loff_t offset, u32 count);
 void nvfuse_dec_free_blocks(struct nvfuse_superblock *sb, u32 blockno, u32 cnt);
 void nvfuse_inc_free_blocks(struct nvfuse_superblock *sb, u32 blockno, u32 cnt);
@@ -622,6 +808,31 @@ struct nvfuse_bg_descriptor *nvfuse_get_bd(struct nvfuse_superblock *sb, u32 bg_
 void nvfuse_update_owner_in_bd_info(struct nvfuse_superblock *sb, s32 bg_id);
 void nvfuse_print_bg_list(struct nvfuse_superblock *sb);
 
+/* Directory Block Records */
+u32 nvfuse_dentry_rec_len(struct nvfuse_dir_entry *dir);
+struct nvfuse_dir_entry *nvfuse_dentry_first(s8 *buf);
+struct nvfuse_dir_entry *nvfuse_dentry_next(s8 *buf, u32 size, struct nvfuse_dir_entry *dir);
+struct nvfuse_dir_entry *nvfuse_dentry_last(s8 *buf, u32 size);
+struct nvfuse_dir_entry *nvfuse_dentry_find(s8 *buf, u32 size, const s8 *filename);
+u32 nvfuse_dentry_block_used(s8 *buf, u32 size);
+void nvfuse_dentry_fill(struct nvfuse_dir_entry *dir, inode_t ino, u32 version, const s8 *filename);
+void nvfuse_dentry_copy(struct nvfuse_dir_entry *to, struct nvfuse_dir_entry *from);
+struct nvfuse_dir_entry *nvfuse_dentry_append(s8 *buf, u32 size, inode_t ino, u32 version,
+		const s8 *filename);
+void nvfuse_dentry_remove(s8 *buf, u32 size, struct nvfuse_dir_entry *dir);
+
+/* Directory Blocks (inline or block based) */
+u32 nvfuse_dir_nr_blocks(struct nvfuse_inode *dir_inode);
+void nvfuse_dir_space_set(struct nvfuse_inode_ctx *dir_ictx, lbno_t lblock, u32 used);
+void nvfuse_dir_space_trim(struct nvfuse_inode_ctx *dir_ictx, u32 nr_blocks);
+void nvfuse_dir_space_free(struct nvfuse_inode_ctx *dir_ictx);
+s32 nvfuse_get_dir_block(struct nvfuse_superblock *sb, struct nvfuse_inode_ctx *dir_ictx,
+			 lbno_t lblock, struct nvfuse_dir_block *db);
+void nvfuse_release_dir_block(struct nvfuse_superblock *sb, struct nvfuse_dir_block *db, s32 dirty);
+s32 nvfuse_build_dir_index(struct nvfuse_superblock *sb, struct nvfuse_inode_ctx *dir_ictx);
+s32 nvfuse_insert_dir_indexing(struct nvfuse_superblock *sb, struct nvfuse_inode_ctx *dir_ictx,
+			       s8 *filename, u32 offset);
+
 /* Sanity Checking */
 s32 nvfuse_dir_is_invalid(struct nvfuse_dir_entry *dir);
 s32 nvfuse_is_directio(struct nvfuse_superblock *sb, s32 fid);
@@ -21,6 +21,11 @@
 s32 ext2fs_set_bit(u32 nr, void *addr);
 s32 ext2fs_clear_bit(u32 nr, void *addr);
 s32 ext2fs_test_bit(u32 nr, const void *addr);
+u32 nvfuse_bitmap_find_next_zero(const void *addr, u32 size, u32 offset);
+u32 nvfuse_bitmap_find_next_set(const void *addr, u32 size, u32 offset);
+u32 nvfuse_bitmap_longest_zero_run(const void *addr, u32 size, u32 *start);
+void nvfuse_bitmap_set_range(void *addr, u32 start, u32 len);
+void nvfuse_bitmap_clear_range(void *addr, u32 start, u32 len);
 s32 fat_dirname(const s8 *path, s8 *dest);
 s32 fat_filename(const s8 *path, s8 *dest);
 
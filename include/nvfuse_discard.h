@@ -0,0 +1,70 @@
+/*
+*	NVFUSE (NVMe based File System in Userspace)
+*	Copyright (C) 2016 Yongseok Oh <yongseok.oh@sk.com>
+*	First Writing: 30/10/2016
+*
+* This program is free software; you can redistribute it and/or modify it
+* under the terms and conditions of the GNU General Public License,
+* version 2, as published by the Free Software Foundation.
+*
+* This program is distributed in the hope it will be useful, but WITHOUT
+* ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+* FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License for
+* more details.
+*/
+
+#include "nvfuse_types.h"
+#include "nvfuse_config.h"
+#include "rbtree.h"
+#include "rte_spinlock.h"
+#include "rte_atomic.h"
+
+#ifndef __NVFUSE_DISCARD_H__
+#define __NVFUSE_DISCARD_H__
+
+/*
+ * Online discard
+ *
+ * Freed data blocks are queued in a tree of pending ranges ordered by their
+ * first block, adjacent ranges are merged. Every flush seals the ranges
+ * queued so far and, once the bitmaps freeing them are on the SSD, issues
+ * them as batches of unmap requests. Allocating blocks takes them out of
+ * the pending ranges, and waits if they are being discarded, so a discard
+ * never reaches a block that is in use again. Block numbers are absolute.
+ */
+
+struct nvfuse_discard_range {
+	struct rb_node dr_node;
+	u32 dr_start;
+	u32 dr_len;
+	u64 dr_seq;		/* flush sequence the range was freed in */
+};
+
+struct nvfuse_discard_ctx {
+	rte_spinlock_t dc_lock;
+	struct rb_root dc_pending;
+	u32 dc_nr_ranges;
+	u64 dc_pending_blocks;
+	u64 dc_seq;		/* sequence of the next flush */
+
+	/* ranges being discarded, owned by the single issuer */
+	long dc_issue_start[NVFUSE_DISCARD_BATCH];
+	int dc_issue_len[NVFUSE_DISCARD_BATCH];
+	s32 dc_issue_nr;
+	s32 dc_issuing;
+
+	/* pending plus issued ranges, lets allocations skip the lock */
+	rte_atomic32_t dc_count;
+
+	u64 dc_discarded;	/* blocks discarded since mount */
+};
+
+s32 nvfuse_discard_init(struct nvfuse_superblock *sb);
+void nvfuse_discard_deinit(struct nvfuse_superblock *sb);
+void nvfuse_discard_add(struct nvfuse_superblock *sb, u32 start, u32 len);
+void nvfuse_discard_cancel(struct nvfuse_superblock *sb, u32 start, u32 len);
+u64 nvfuse_discard_seal(struct nvfuse_superblock *sb);
+u64 nvfuse_discard_issue(struct nvfuse_superblock *sb, u64 seq);
+s64 nvfuse_discard_trim(struct nvfuse_superblock *sb, u64 start, u64 end, u32 minlen);
+
+#endif /* __NVFUSE_DISCARD_H__ */
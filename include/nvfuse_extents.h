@@ -0,0 +1,74 @@
+/*
+*	NVFUSE (NVMe based File System in Userspace)
+*	Copyright (C) 2016 Yongseok Oh <yongseok.oh@sk.com>
+*	First Writing: 30/10/2016
+*
+* This program is free software; you can redistribute it and/or modify it
+* under the terms and conditions of the GNU General Public License,
+* version 2, as published by the Free Software Foundation.
+*
+* This program is distributed in the hope it will be useful, but WITHOUT
+* ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+* FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License for
+* more details.
+*/
+
+#include "nvfuse_types.h"
+
+#ifndef __NVFUSE_EXTENTS_H__
+#define __NVFUSE_EXTENTS_H__
+
+/*
+ * Extent tree
+ *
+ * An inode with NVFUSE_INODE_FLAG_EXTENTS maps its blocks with a b+tree of
+ * extents instead of indirect blocks. The root node lives in i_blocks and
+ * the other nodes are metadata blocks of the inode. Every node starts with
+ * a header; leaf nodes (depth 0) hold extents and index nodes hold the
+ * first logical block and the location of each child. Both kinds of entries
+ * are 12 bytes and start with the logical block, which is the key.
+ *
+ * An extent with NVFUSE_EXT_UNWRITTEN set in ee_len was preallocated and
+ * never written. Lookups report it as a hole so that it reads as zeroes,
+ * and the first write of a range turns that range into a written extent.
+ */
+
+#define NVFUSE_EXT_MAGIC	0xE47F
+#define NVFUSE_EXT_MAX_DEPTH	5
+#define NVFUSE_EXT_MAX_ALLOC	PTRS_PER_BLOCK	/* blocks allocated by a single call */
+#define NVFUSE_EXT_UNWRITTEN	(1U << 31)	/* flag in ee_len */
+
+struct nvfuse_extent_header {
+	u16 eh_magic;
+	u16 eh_entries;		/* valid entries */
+	u16 eh_max;		/* capacity of the node in entries */
+	u16 eh_depth;		/* 0 for a leaf node */
+};
+
+/* leaf entry */
+struct nvfuse_extent {
+	u32 ee_block;		/* first logical block */
+	u32 ee_start;		/* first physical block */
+	u32 ee_len;		/* number of blocks, NVFUSE_EXT_UNWRITTEN */
+};
+
+/* index entry */
+struct nvfuse_extent_idx {
+	u32 ei_block;		/* first logical block of the child */
+	u32 ei_leaf;		/* physical block of the child */
+	u32 ei_unused;
+};
+
+#define NVFUSE_EXT_ENTRY_SIZE	sizeof(struct nvfuse_extent)
+#define NVFUSE_EXT_ROOT_MAX	((sizeof(((struct nvfuse_inode *)0)->i_blocks) - \
+				  sizeof(struct nvfuse_extent_header)) / NVFUSE_EXT_ENTRY_SIZE)
+#define NVFUSE_EXT_BLOCK_MAX	((CLUSTER_SIZE - sizeof(struct nvfuse_extent_header)) / \
+				 NVFUSE_EXT_ENTRY_SIZE)
+
+void nvfuse_ext_init_inode(struct nvfuse_inode *inode);
+s32 nvfuse_ext_get_block(struct nvfuse_superblock *sb, struct nvfuse_inode_ctx *ictx, s32 lblock,
+			 u32 max_blocks, u32 *num_alloc_blocks, u32 *pblock, u32 create);
+void nvfuse_ext_truncate_blocks(struct nvfuse_superblock *sb, struct nvfuse_inode_ctx *ictx,
+				u64 offset);
+
+#endif /* __NVFUSE_EXTENTS_H__ */
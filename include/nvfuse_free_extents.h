@@ -0,0 +1,57 @@
+/*
+*	NVFUSE (NVMe based File System in Userspace)
+*	Copyright (C) 2016 Yongseok Oh <yongseok.oh@sk.com>
+*	First Writing: 30/10/2016
+*
+* This program is free software; you can redistribute it and/or modify it
+* under the terms and conditions of the GNU General Public License,
+* version 2, as published by the Free Software Foundation.
+*
+* This program is distributed in the hope it will be useful, but WITHOUT
+* ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+* FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License for
+* more details.
+*/
+
+#include "nvfuse_types.h"
+#include "rbtree.h"
+
+#ifndef __NVFUSE_FREE_EXTENTS_H__
+#define __NVFUSE_FREE_EXTENTS_H__
+
+/*
+ * Free extent index
+ *
+ * Each block group keeps the runs of free data blocks of its DBITMAP in
+ * two red-black trees, one ordered by the first block of a run and one by
+ * its length. The trees are built from the bitmap the first time the group
+ * allocates or frees blocks and are updated together with the bitmap while
+ * the bitmap buffer is held, so the buffer lock protects them as well.
+ * Block numbers are relative to the start of the group.
+ */
+
+#define NVFUSE_FEXT_NO_GOAL	((u32)-1)
+
+struct nvfuse_free_extent {
+	struct rb_node fe_start_node;	/* ordered by fe_start */
+	struct rb_node fe_len_node;	/* ordered by fe_len, then fe_start */
+	u32 fe_start;
+	u32 fe_len;
+};
+
+struct nvfuse_free_extent_tree {
+	struct rb_root ft_by_start;
+	struct rb_root ft_by_len;
+	u32 ft_loaded;
+	u32 ft_count;		/* number of free extents */
+};
+
+s32 nvfuse_fext_init(struct nvfuse_superblock *sb);
+void nvfuse_fext_deinit(struct nvfuse_superblock *sb);
+void nvfuse_fext_invalidate(struct nvfuse_superblock *sb, u32 bg_id);
+struct nvfuse_free_extent_tree *nvfuse_fext_get_tree(struct nvfuse_superblock *sb, u32 bg_id,
+		void *dbitmap, u32 dtable_start);
+u32 nvfuse_fext_alloc(struct nvfuse_free_extent_tree *tree, u32 goal, u32 want, u32 *start);
+void nvfuse_fext_free(struct nvfuse_free_extent_tree *tree, u32 start, u32 len);
+
+#endif /* __NVFUSE_FREE_EXTENTS_H__ */
@@ -15,6 +15,11 @@
 
 #ifndef __NVFUSE_INDIRECT_H__
 #define __NVFUSE_INDIRECT_H__
+
+/* create argument of nvfuse_get_block() */
+#define NVFUSE_GET_BLOCK_CREATE		0x1
+#define NVFUSE_GET_BLOCK_UNWRITTEN	0x2	/* new blocks of extent files read as zeroes */
+
 int nvfuse_block_to_path(s32 block, u32 offsets[4], u32 *boundary);
 s32 nvfuse_get_block(struct nvfuse_superblock *sb, struct nvfuse_inode_ctx *ictx, s32 lblock,
 		     u32 max_blocks, u32 *num_alloc_blks, u32 *pblock, u32 create);
@@ -24,8 +29,14 @@ void nvfuse_truncate_blocks(struct nvfuse_superblock *sb, struct nvfuse_inode_ct
 
 u32 nvfuse_alloc_free_block(struct nvfuse_superblock *sb, struct nvfuse_inode *inode,
 			    u32 *alloc_blks, u32 num_blocks);
-u32 nvfuse_alloc_free_blocks(struct nvfuse_superblock *sb, struct nvfuse_inode *inode, u32 *blocks,
+u32 nvfuse_alloc_free_blocks(struct nvfuse_superblock *sb, struct nvfuse_inode_ctx *ictx, u32 *blocks,
 			     u32 num_indirect_blocks, u32 num_blocks, u32 *direct_map, s32 *error);
+u32 nvfuse_alloc_inode_blocks(struct nvfuse_superblock *sb, struct nvfuse_inode_ctx *ictx,
+			      u32 *alloc_blks, u32 num_blocks);
+void nvfuse_detach_prealloc(struct nvfuse_inode_ctx *ictx, u32 *start, u32 *len);
+void nvfuse_free_prealloc(struct nvfuse_superblock *sb, u32 start, u32 len);
+void nvfuse_release_prealloc(struct nvfuse_superblock *sb, struct nvfuse_inode_ctx *ictx);
+void nvfuse_release_all_prealloc(struct nvfuse_superblock *sb);
 void nvfuse_return_free_blocks(struct nvfuse_superblock *sb, u32 *blks, u32 num);
 s32 nvfuse_get_block(struct nvfuse_superblock *sb, struct nvfuse_inode_ctx *ictx, s32 lblock,
 		     u32 maxblocks, u32 *num_alloc_blocks, u32 *pblock, u32 create);
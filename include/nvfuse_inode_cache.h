@@ -66,7 +66,8 @@ void nvfuse_init_ictx(struct nvfuse_inode_ctx *ictx, inode_t ino);
 /* lookup ictx structure with inode number (ino) */
 struct nvfuse_inode_ctx *nvfuse_ictx_hash_lookup(struct nvfuse_ictx_manager *ictxc, inode_t ino);
 /* replace ictx buffer in list */
-struct nvfuse_inode_ctx *nvfuse_replace_ictx(struct nvfuse_superblock *sb);
+struct nvfuse_inode_ctx *nvfuse_replace_ictx(struct nvfuse_superblock *sb, u32 *pa_start,
+		u32 *pa_len);
 
 /* debug ictx list */
 void nvfuse_print_ictx_list(struct nvfuse_superblock *sb, s32 type);
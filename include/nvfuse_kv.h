@@ -0,0 +1,83 @@
+/*
+*	NVFUSE (NVMe based File System in Userspace)
+*	Copyright (C) 2016 Yongseok Oh <yongseok.oh@sk.com>
+*	First Writing: 30/10/2016
+*
+* This program is free software; you can redistribute it and/or modify it
+* under the terms and conditions of the GNU General Public License,
+* version 2, as published by the Free Software Foundation.
+*
+* This program is distributed in the hope it will be useful, but WITHOUT
+* ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+* FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License for
+* more details.
+*/
+
+#include <sys/types.h>
+#include "nvfuse_types.h"
+
+#ifndef _NVFUSE_KV_H
+#define _NVFUSE_KV_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+struct nvfuse_handle;
+
+/*
+ * Embedded key-value store
+ *
+ * A key-value store is a NVFUSE_TYPE_KV inode. Its b+tree (i_bpino) maps a
+ * 64-bit key to a value slot and keeps the keys ordered. Values are packed
+ * into slotted value blocks which are the data blocks of the store inode,
+ * so a record costs one b+tree pair and a few bytes of a value block
+ * instead of an inode and a dentry.
+ */
+
+#define NVFUSE_KV_MAX_VALUE	512	/* largest value in bytes */
+/* the b+tree marks empty pairs with key 0, so it cannot be stored */
+#define NVFUSE_KV_NULL_KEY	0
+
+/* a b+tree item is (value block << NVFUSE_KV_SLOT_BITS) | slot, slot 0 is never used */
+#define NVFUSE_KV_SLOT_BITS	8
+#define NVFUSE_KV_MAX_SLOTS	((1 << NVFUSE_KV_SLOT_BITS) - 1)
+#define NVFUSE_KV_MAX_BLOCKS	(1 << (32 - NVFUSE_KV_SLOT_BITS))
+
+#define NVFUSE_KV_ITEM(lblk, slot)	(((u32)(lblk) << NVFUSE_KV_SLOT_BITS) | (slot))
+#define NVFUSE_KV_ITEM_BLOCK(item)	((item) >> NVFUSE_KV_SLOT_BITS)
+#define NVFUSE_KV_ITEM_SLOT(item)	((item) & NVFUSE_KV_MAX_SLOTS)
+
+/*
+ * value block layout: the head and the slot array grow from the start of
+ * the block and values grow down from its end.
+ */
+struct nvfuse_kv_block_head {
+	u16 kb_nr_slots;	/* length of the slot array */
+	u16 kb_free;		/* start of the value area */
+	u16 kb_live;		/* slots holding a value */
+	u16 kb_dead;		/* bytes of the value area held by deleted values */
+};
+
+struct nvfuse_kv_slot {
+	u16 ks_off;		/* 0 for an unused slot */
+	u16 ks_len;
+};
+
+/* called for every record of a scan, a non-zero return stops the scan */
+typedef s32(*nvfuse_kv_scan_fn)(u64 key, const void *value, u32 len, void *arg);
+
+s32 nvfuse_kv_create(struct nvfuse_handle *nvh, const char *path, mode_t mode);
+s32 nvfuse_kv_open(struct nvfuse_handle *nvh, const char *path);
+s32 nvfuse_kv_put(struct nvfuse_handle *nvh, inode_t kv_ino, u64 key, const void *value,
+		  u32 len);
+s32 nvfuse_kv_get(struct nvfuse_handle *nvh, inode_t kv_ino, u64 key, void *buf, u32 size);
+s32 nvfuse_kv_delete(struct nvfuse_handle *nvh, inode_t kv_ino, u64 key);
+s32 nvfuse_kv_scan(struct nvfuse_handle *nvh, inode_t kv_ino, u64 start_key, u64 end_key,
+		   nvfuse_kv_scan_fn fn, void *arg);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* _NVFUSE_KV_H */
@@ -84,6 +84,8 @@ int reactor_cq_put_req(struct reactor_task *task, struct io_job *req);
 int reactor_sync_read_blk(struct io_target *target, long block, int count, void *buf);
 int reactor_sync_write_blk(struct io_target *target, long block, int count, void *buf);
 int reactor_sync_flush(struct io_target *target);
+int reactor_unmap_supported(struct io_target *target);
+int reactor_sync_unmap_blks(struct io_target *target, long *blocks, int *counts, int nr);
 struct io_target * reactor_construct_targets(void);
 void reactor_get_opts(const char *config_file, const char *cpumask, struct spdk_app_opts *opts, size_t opt_size);
 void blockdev_heads_init(void);
@@ -0,0 +1,48 @@
+/*
+*	NVFUSE (NVMe based File System in Userspace)
+*	Copyright (C) 2016 Yongseok Oh <yongseok.oh@sk.com>
+*	First Writing: 30/10/2016
+*
+* This program is free software; you can redistribute it and/or modify it
+* under the terms and conditions of the GNU General Public License,
+* version 2, as published by the Free Software Foundation.
+*
+* This program is distributed in the hope it will be useful, but WITHOUT
+* ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+* FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License for
+* more details.
+*/
+
+#include "nvfuse_types.h"
+#include "list.h"
+
+#ifndef __NVFUSE_RECLAIM_H__
+#define __NVFUSE_RECLAIM_H__
+
+/*
+ * Deferred reclamation
+ *
+ * Unlinking or truncating a large file only marks its inode as an orphan
+ * and records in i_reclaim_blocks how many of its blocks may still be
+ * mapped. The reclaimer then drops the buffers and frees the blocks from
+ * the end of the file, NVFUSE_RECLAIM_BATCH blocks per step, and frees the
+ * inode once an unlinked file is empty. The orphan flag, the cursor and the
+ * orphan count of the bg descriptor are kept on disk, so a later mount
+ * finds the orphans again and resumes the work.
+ */
+
+struct nvfuse_orphan {
+	struct list_head o_list;
+	inode_t o_ino;
+};
+
+void nvfuse_reclaim_init(struct nvfuse_superblock *sb);
+s32 nvfuse_reclaim_load(struct nvfuse_superblock *sb);
+void nvfuse_reclaim_deinit(struct nvfuse_superblock *sb);
+u32 nvfuse_reclaim_live_blocks(struct nvfuse_inode *inode);
+s32 nvfuse_reclaim_inode_size(struct nvfuse_superblock *sb, struct nvfuse_inode_ctx *ictx,
+			      s64 size);
+void nvfuse_reclaim_finish(struct nvfuse_superblock *sb, struct nvfuse_inode_ctx *ictx);
+void nvfuse_reclaim_orphans(struct nvfuse_superblock *sb);
+
+#endif /* __NVFUSE_RECLAIM_H__ */
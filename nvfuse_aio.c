@@ -228,6 +228,21 @@ s32 nvfuse_aio_gen_dev_reqs(struct nvfuse_superblock *sb, struct nvfuse_aio_queu
 			return -1;
 		}
 
+		if (pblk == 0) {
+			if (areq->opcode != READ) {
+				dprintf_error(AIO, " Error: unmapped block lblk = %x\n", lblk);
+				return -1;
+			}
+			/* holes and unwritten extents read as zeroes without device i/o */
+			if (num_alloc == 0)
+				num_alloc = 1;
+			memset(areq->buf + count * CLUSTER_SIZE, 0x00, (size_t)num_alloc * CLUSTER_SIZE);
+			start += (num_alloc * CLUSTER_SIZE);
+			length -= (num_alloc * CLUSTER_SIZE);
+			count += num_alloc;
+			continue;
+		}
+
 		//dprintf_info(AIO, " lblk = %d, pblk = %d, num_alloc = %d \n", lblk, pblk, num_alloc);
 		jobs[job_count]->offset = (long)pblk * CLUSTER_SIZE;
 		jobs[job_count]->bytes = (size_t)num_alloc * CLUSTER_SIZE;
@@ -256,6 +271,10 @@ s32 nvfuse_aio_gen_dev_reqs(struct nvfuse_superblock *sb, struct nvfuse_aio_queu
 	assert(job_count <= count);
 	assert(count == areq->bio_job_count);
 
+	areq->bio_job_count = job_count;
+	if (job_count == 0)
+		return 0;
+
 	count = 0;
 	while (count < job_count) {
 		nvfuse_aio_prep(jobs[count], sb->io_manager);
@@ -269,7 +288,6 @@ s32 nvfuse_aio_gen_dev_reqs(struct nvfuse_superblock *sb, struct nvfuse_aio_queu
 	}
 
 	aioq->total_bio_job_count += job_count;
-	areq->bio_job_count = job_count;
 
 	return 0;
 }
@@ -321,6 +339,10 @@ s32 nvfuse_aio_queue_submission(struct nvfuse_handle *nvh, struct nvfuse_aio_que
 			return -1;
 
 		nvfuse_aio_queue_dequeue(aioq, areq, NVFUSE_SUBMISSION_QUEUE);
+
+		/* nothing was sent to the device */
+		if (areq->bio_job_count == 0)
+			nvfuse_aio_gen_dev_cpls(areq);
 	}
 
 	return 0;
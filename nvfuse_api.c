@@ -44,6 +44,7 @@
 #include "nvfuse_inode_cache.h"
 #include "nvfuse_gettimeofday.h"
 #include "nvfuse_indirect.h"
+#include "nvfuse_extents.h"
 #include "nvfuse_bp_tree.h"
 #include "nvfuse_malloc.h"
 #include "nvfuse_api.h"
@@ -51,6 +52,8 @@
 #include "nvfuse_ipc_ring.h"
 #include "nvfuse_debug.h"
 #include "nvfuse_reactor.h"
+#include "nvfuse_discard.h"
+#include "nvfuse_reclaim.h"
 
 void nvfuse_core_usage(char *cmd)
 {
@@ -415,98 +418,72 @@ void nvfuse_destroy_handle(struct nvfuse_handle *nvh, s32 deinit_iom, s32 need_u
 	nvfuse_ipc_exit(&nvh->nvh_ipc_ctx);
 }
 
+/* the dir block holding the returned dentry is left held in db */
 struct nvfuse_dir_entry * nvfuse_lookup_linear(struct nvfuse_superblock *sb, struct nvfuse_inode_ctx *dir_ictx, 
-						struct nvfuse_inode *dir_inode, const s8 *filename, struct nvfuse_buffer_head **dir_bh_return)
+						struct nvfuse_inode *dir_inode, const s8 *filename, struct nvfuse_dir_block *db)
 {
-	struct nvfuse_buffer_head *dir_bh = NULL;
 	struct nvfuse_dir_entry *dir = NULL;
-	struct nvfuse_dir_entry *dir_last;
 	u32 dentry_blk;
-	u32 dentry_num;
 
-	for (dentry_blk = 0; dentry_blk < NVFUSE_SIZE_TO_BLK(dir_inode->i_size); dentry_blk++) {
+	for (dentry_blk = 0; dentry_blk < nvfuse_dir_nr_blocks(dir_inode); dentry_blk++) {
 		/* get dir block buffer */
-		dir_bh = nvfuse_get_bh(sb, dir_ictx, dir_inode->i_ino, dentry_blk, READ,
-					   NVFUSE_TYPE_META);
-		if (dir_bh == NULL) {
-			dprintf_error(BUFFER, "nvfuse_get_bh() \n");
+		if (nvfuse_get_dir_block(sb, dir_ictx, dentry_blk, db) < 0)
 			break;
-		}
-
-		dir = (struct nvfuse_dir_entry *)dir_bh->bh_buf;
 
-		if (dentry_blk < NVFUSE_SIZE_TO_BLK(dir_inode->i_size) - 1) {
-			dentry_num = DIR_ENTRY_NUM;
-		} else {
-			dentry_num = dir_inode->i_links_count % DIR_ENTRY_NUM;
-			if (dentry_num == 0)
-				dentry_num = DIR_ENTRY_NUM;
-		}
-
-		dir_last = dir + dentry_num;
-
-		while (dir < dir_last) {
-			/* directory entry is found */
-			if (dir->d_flag == DIR_USED && !strcmp(dir->d_filename, filename))
-				goto FOUND;
-		}
+		/* directory entry is found */
+		dir = nvfuse_dentry_find(db->db_buf, db->db_size, filename);
+		if (dir)
+			goto FOUND;
 
-		nvfuse_release_bh(sb, dir_bh, HEAD, NVF_CLEAN);
+		nvfuse_release_dir_block(sb, db, NVF_CLEAN);
 	}
 
 	/* not found */
+	db->db_buf = NULL;
 	dir = NULL;
 
 FOUND:
 
-	*dir_bh_return = dir_bh;
-
 	return dir;
 }
 
 struct nvfuse_dir_entry * nvfuse_lookup_bptree(struct nvfuse_superblock *sb, struct nvfuse_inode_ctx *dir_ictx,
 												struct nvfuse_inode *dir_inode, const s8 *filename, 
-												struct nvfuse_buffer_head **dir_bh_return)
+												struct nvfuse_dir_block *db)
 {
-	struct nvfuse_buffer_head *dir_bh = NULL;
 	struct nvfuse_dir_entry *dir = NULL;
-	u32 dentry_idx = 0;
+	u32 dentry_blk = 0;
 	s32 res;
-	
-	res = nvfuse_get_dir_indexing(sb, dir_inode, (char *)filename, &dentry_idx);
+
+	/* "." and ".." are not indexed */
+	if (!strcmp(filename, ".") || !strcmp(filename, "..")) {
+		dir = (struct nvfuse_dir_entry *)1;
+		goto NOT_FOUND;
+	}
+
+	res = nvfuse_get_dir_indexing(sb, dir_ictx, (char *)filename, &dentry_blk);
 	if (res < 0) {
 		goto NOT_FOUND;
 	}
 
-	/* dir entry found */
-	if (dentry_idx) {
-		dir_bh = nvfuse_get_bh(sb, dir_ictx, dir_inode->i_ino, 
-								NVFUSE_DENTRY_TO_BLK(dentry_idx), 
-								READ, NVFUSE_TYPE_META);
-		if (dir_bh == NULL) {
-			goto NOT_FOUND;
-		}
-		dir = ((struct nvfuse_dir_entry *)dir_bh->bh_buf) + (dentry_idx % DIR_ENTRY_NUM);
+	/* the index points out the dentry block */
+	if (nvfuse_get_dir_block(sb, dir_ictx, dentry_blk, db) < 0) {
+		goto NOT_FOUND;
+	}
 
-		/* directory entry is found */
-		if (dir->d_flag == DIR_USED && !strcmp(dir->d_filename, filename)) {
-			goto FOUND;
-		} else {
-			/* FIXME: how can we handle this exception case? */
-			dprintf_error(BPTREE, "No such file or directory = %s", filename);
-			dprintf_error(BPTREE, "B+tree has inconsistency state \n");
-			assert(0);
-		}
+	/* directory entry is found */
+	dir = nvfuse_dentry_find(db->db_buf, db->db_size, filename);
+	if (dir) {
+		goto FOUND;
 	} else {
-		/* in case of collision */
-		/* TODO: how to replace tricky code? */
-		dir = (struct nvfuse_dir_entry *)1;
+		/* another name shares the hash but this one does not exist */
+		nvfuse_release_dir_block(sb, db, NVF_CLEAN);
 	}
 
 NOT_FOUND:
+	db->db_buf = NULL;
 
 FOUND:
-	*dir_bh_return = dir_bh;
 	return dir;
 }
 
@@ -522,7 +499,7 @@ s32 nvfuse_lookup(struct nvfuse_superblock *sb,
 {
 	struct nvfuse_inode_ctx *dir_ictx;
 	struct nvfuse_inode *dir_inode = NULL;
-	struct nvfuse_buffer_head *dir_bh = NULL;
+	struct nvfuse_dir_block db;
 	struct nvfuse_dir_entry *dir = NULL;
 	s32 res = -1;
 
@@ -531,35 +508,31 @@ s32 nvfuse_lookup(struct nvfuse_superblock *sb,
 		return res;
 
 	dir_inode = dir_ictx->ictx_inode;
+	db.db_buf = NULL;
 
 #if NVFUSE_USE_DIR_INDEXING == 1
 	/* b+tree based index search */
 	if (dir_inode->i_bpino) {
-		dir = nvfuse_lookup_bptree(sb, dir_ictx, dir_inode, filename, &dir_bh);
+		dir = nvfuse_lookup_bptree(sb, dir_ictx, dir_inode, filename, &db);
 		/* not found dentry */
 		if (!dir) {
 			res = -1;
 			goto RES;
 		/* found dentry */
 		} else {
-			if (dir_bh)
+			if (db.db_buf)
 				goto FOUND;
 			else
 				goto LINEAR_SEARCH;
 		}
-
-		/* try linear search */
-	} else {
-		/* b+tree is not allocated? */
-		res = -1;
-		goto RES;
 	}
+	/* small directories are not indexed yet, try linear search */
 #endif
 
 LINEAR_SEARCH:
 
 	/* naiive linear search */
-	dir = nvfuse_lookup_linear(sb, dir_ictx, dir_inode, filename, &dir_bh);
+	dir = nvfuse_lookup_linear(sb, dir_ictx, dir_inode, filename, &db);
 	if (dir) 
 		goto FOUND;
 	else
@@ -572,7 +545,7 @@ FOUND:
 	}
 
 	if (file_entry) {
-		rte_memcpy(file_entry, dir, DIR_ENTRY_SIZE);
+		nvfuse_dentry_copy(file_entry, dir);
 	}
 
 	assert(dir->d_ino > 0 && dir->d_ino < sb->sb_no_of_inodes_per_bg * sb->sb_bg_num);
@@ -580,7 +553,8 @@ FOUND:
 
 RES:
 
-	nvfuse_release_bh(sb, dir_bh, HEAD, NVF_CLEAN);
+	if (db.db_buf)
+		nvfuse_release_dir_block(sb, &db, NVF_CLEAN);
 	nvfuse_release_inode(sb, dir_ictx, NVF_CLEAN);
 
 	return res;
@@ -655,29 +629,63 @@ struct dirent *nvfuse_readdir(struct nvfuse_handle *nvh, inode_t par_ino, struct
 {
 	struct nvfuse_inode_ctx *dir_ictx, *ictx;
 	struct nvfuse_inode *dir_inode, *inode;
-	struct nvfuse_buffer_head *dir_bh;
-	struct nvfuse_dir_entry *dir;
+	struct nvfuse_dir_block db;
+	struct nvfuse_dir_entry *dir = NULL, *next;
 	struct nvfuse_superblock *sb = nvfuse_read_super(nvh);
-	s64 dir_size;
 	struct dirent *return_dentry = NULL;
+	u32 dentry_blk, dentry_pos;
+	off_t skip;
 
 	dir_ictx = nvfuse_read_inode(sb, NULL, par_ino);
 	dir_inode = dir_ictx->ictx_inode;
-	dir_size = (s64)dir_offset * DIR_ENTRY_SIZE;
 
-	if (dir_inode->i_size <= dir_size) {
-		goto RES;
+	/*
+	 * dentries have no fixed slots, so dir_offset is the ordinal of the
+	 * dentry. The position of the next one is cached in the inode context
+	 * to serve a sequential scan without walking from the first block.
+	 */
+	if (dir_offset && dir_ictx->ictx_dir_cursor == dir_offset) {
+		dentry_blk = dir_ictx->ictx_dir_cursor_lblk;
+		dentry_pos = dir_ictx->ictx_dir_cursor_pos;
+		skip = 0;
+	} else {
+		dentry_blk = 0;
+		dentry_pos = 0;
+		skip = dir_offset;
 	}
 
-	dir_bh = nvfuse_get_bh(sb, dir_ictx, dir_inode->i_ino,
-			       NVFUSE_SIZE_TO_BLK((s64)dir_offset * DIR_ENTRY_SIZE), READ, NVFUSE_TYPE_META);
-	dir = (struct nvfuse_dir_entry *)dir_bh->bh_buf;
+	db.db_buf = NULL;
+	for (; dentry_blk < nvfuse_dir_nr_blocks(dir_inode); dentry_blk++, dentry_pos = 0) {
+		if (nvfuse_get_dir_block(sb, dir_ictx, dentry_blk, &db) < 0)
+			break;
 
-	dir += (dir_offset % DIR_ENTRY_NUM);
+		dir = nvfuse_dentry_first(db.db_buf + dentry_pos);
+		while (dir && skip) {
+			dir = nvfuse_dentry_next(db.db_buf, db.db_size, dir);
+			skip--;
+		}
+
+		if (dir)
+			break;
 
-	if (nvfuse_dir_is_invalid(dir)) {
+		nvfuse_release_dir_block(sb, &db, NVF_CLEAN);
+		db.db_buf = NULL;
+	}
+
+	if (dir == NULL) {
+		dir_ictx->ictx_dir_cursor = 0;
 		return_dentry = NULL;
 	} else {
+		next = nvfuse_dentry_next(db.db_buf, db.db_size, dir);
+		dir_ictx->ictx_dir_cursor = dir_offset + 1;
+		if (next) {
+			dir_ictx->ictx_dir_cursor_lblk = dentry_blk;
+			dir_ictx->ictx_dir_cursor_pos = (s8 *)next - db.db_buf;
+		} else {
+			dir_ictx->ictx_dir_cursor_lblk = dentry_blk + 1;
+			dir_ictx->ictx_dir_cursor_pos = 0;
+		}
+
 		dentry->d_ino = dir->d_ino;
 		strcpy(dentry->d_name, dir->d_filename);
 
@@ -694,9 +702,8 @@ struct dirent *nvfuse_readdir(struct nvfuse_handle *nvh, inode_t par_ino, struct
 		return_dentry = dentry;
 	}
 
-	nvfuse_release_bh(sb, dir_bh, 0, 0);
-RES:
-	;
+	if (db.db_buf)
+		nvfuse_release_dir_block(sb, &db, NVF_CLEAN);
 
 	nvfuse_release_inode(sb, dir_ictx, NVF_CLEAN);
 	nvfuse_release_super(sb);
@@ -852,10 +859,26 @@ s32 nvfuse_openfile_ino(struct nvfuse_superblock *sb, inode_t ino, s32 flags)
 s32 nvfuse_closefile(struct nvfuse_handle *nvh, s32 fid)
 {
 	struct nvfuse_superblock *sb = nvfuse_read_super(nvh);
+	struct nvfuse_file_table *of;
+	struct nvfuse_inode_ctx *ictx;
+	inode_t ino;
 
 	/* FIXME: flush bhs and bcs related to inode that fd points out */
 
+	of = nvfuse_get_file_table(sb, fid);
+	ino = of->ino;
+
 	nvfuse_close_file_table(sb, fid);
+
+	/* the file is done growing on its last close, give back its preallocation window */
+	if (ino && !nvfuse_file_table_has_ino(sb, ino)) {
+		ictx = nvfuse_read_inode(sb, NULL, ino);
+		if (ictx) {
+			nvfuse_release_prealloc(sb, ictx);
+			nvfuse_release_inode(sb, ictx, NVF_CLEAN);
+		}
+	}
+
 	nvfuse_release_super(sb);
 
 	return NVFUSE_SUCCESS;
@@ -868,6 +891,8 @@ s32 nvfuse_readfile_core(struct nvfuse_superblock *sb, u32 fid, s8 *buffer, s32
 	struct nvfuse_inode *inode;
 	struct nvfuse_buffer_head *bh;
 	struct nvfuse_file_table *of;
+	lbno_t lblock;
+	u32 pblock;
 
 	s32 offset, remain, rcount = 0;
 
@@ -885,20 +910,29 @@ s32 nvfuse_readfile_core(struct nvfuse_superblock *sb, u32 fid, s8 *buffer, s32
 #endif
 
 	while (count > 0 && of->rwoffset < inode->i_size) {
-
-		bh = nvfuse_get_bh(sb, ictx, inode->i_ino, NVFUSE_SIZE_TO_BLK(of->rwoffset), sync_read,
-				   NVFUSE_TYPE_DATA);
-		if (bh == NULL) {
-			dprintf_error(BUFFER, " read error \n");
-			goto RES;
-		}
-
+		lblock = NVFUSE_SIZE_TO_BLK(of->rwoffset);
 		offset = of->rwoffset & (CLUSTER_SIZE - 1);
 		remain = CLUSTER_SIZE - offset;
 
 		if (remain > count)
 			remain = count;
 
+		/* a hole reads as zeroes without i/o or a buffer */
+		if (sync_read && !nvfuse_bc_cached(sb, inode->i_ino, lblock) &&
+		    nvfuse_get_block(sb, ictx, lblock, 1, NULL, &pblock, 0) == 0 && !pblock) {
+			memset(buffer + rcount, 0x00, remain);
+			rcount += remain;
+			of->rwoffset += remain;
+			count -= remain;
+			continue;
+		}
+
+		bh = nvfuse_get_bh(sb, ictx, inode->i_ino, lblock, sync_read, NVFUSE_TYPE_DATA);
+		if (bh == NULL) {
+			dprintf_error(BUFFER, " read error \n");
+			goto RES;
+		}
+
 		if (sync_read)
 			rte_memcpy(buffer + rcount, &bh->bh_buf[offset], remain);
 
@@ -1006,7 +1040,11 @@ s32 nvfuse_writefile_core(struct nvfuse_superblock *sb, s32 fid, const s8 *user_
 	struct nvfuse_buffer_head *bh = NULL;
 	u32 offset = 0, remain = 0, wcount = 0;
 	lbno_t lblock = 0;
+#ifndef NVFUSE_USE_DELAYED_ALLOCATION
 	int ret;
+#else
+	struct nvfuse_buffer_cache *bc;
+#endif
 
 	of = nvfuse_get_file_table(sb, fid);
 
@@ -1029,14 +1067,21 @@ s32 nvfuse_writefile_core(struct nvfuse_superblock *sb, s32 fid, const s8 *user_
 		if (remain > count)
 			remain = count;
 
-		if (count && inode->i_size <= of->rwoffset) {
-			ret = nvfuse_get_block(sb, ictx, NVFUSE_SIZE_TO_BLK(inode->i_size), 1/* num block */, NULL, NULL,
-					       1);
+		/* blocks past the end of a truncated file go before it grows again */
+		if (of->rwoffset + remain > inode->i_size)
+			nvfuse_reclaim_finish(sb, ictx);
+
+#ifndef NVFUSE_USE_DELAYED_ALLOCATION
+		/* only the blocks written are allocated, skipped ones stay holes */
+		if (count) {
+			ret = nvfuse_get_block(sb, ictx, lblock, 1/* num block */, NULL, NULL,
+					       NVFUSE_GET_BLOCK_CREATE);
 			if (ret) {
 				dprintf_error(INODE, "data block allocation fails.");
 				return NVFUSE_ERROR;
 			}
 		}
+#endif
 
 		/*read modify write or partial write */
 		if (remain != CLUSTER_SIZE)
@@ -1044,6 +1089,24 @@ s32 nvfuse_writefile_core(struct nvfuse_superblock *sb, s32 fid, const s8 *user_
 		else
 			bh = nvfuse_get_bh(sb, ictx, inode->i_ino, lblock, WRITE, NVFUSE_TYPE_DATA);
 
+#ifdef NVFUSE_USE_DELAYED_ALLOCATION
+		/* a block allocated at flush time is charged now, the flush cannot run out of space */
+		bc = bh->bh_bc;
+		if (!bc->bc_pno && !bc->bc_delayed) {
+			if (nvfuse_reserve_delayed_block(sb) < 0) {
+				dprintf_error(INODE, " no free block for ino = %d lblock = %d\n",
+					      inode->i_ino, lblock);
+				nvfuse_release_bh(sb, bh, 0, NVF_CLEAN);
+				nvfuse_release_inode(sb, ictx, DIRTY);
+				if (wcount)
+					break;
+				errno = ENOSPC;
+				return NVFUSE_ERROR;
+			}
+			bc->bc_delayed = 1;
+		}
+#endif
+
 		rte_memcpy(&bh->bh_buf[offset], user_buf + wcount, remain);
 
 		wcount += remain;
@@ -1084,6 +1147,8 @@ s32 nvfuse_writefile_directio_core(struct nvfuse_superblock *sb, s32 fid, const
 	struct nvfuse_inode_ctx *ictx;
 	struct nvfuse_inode *inode;
 	struct nvfuse_file_table *of;
+	lbno_t lblock;
+	u32 remain, num_alloc;
 	u32 wcount = 0;
 	int ret;
 
@@ -1105,17 +1170,31 @@ s32 nvfuse_writefile_directio_core(struct nvfuse_superblock *sb, s32 fid, const
 
 	ictx = nvfuse_read_inode(sb, NULL, of->ino);
 	inode = ictx->ictx_inode;
-	if (count && inode->i_size <= of->rwoffset) {
-		u32 num_alloc = count >> CLUSTER_SIZE_BITS;
-		ret = nvfuse_get_block(sb, ictx, NVFUSE_SIZE_TO_BLK(inode->i_size), num_alloc/* num block */, NULL,
-				       NULL, 1);
-		if (ret) {
+
+	if (of->rwoffset + count > inode->i_size)
+		nvfuse_reclaim_finish(sb, ictx);
+
+	/*
+	 * map every block written, which fills holes and makes preallocated
+	 * blocks written. blocks skipped past the end of file stay holes.
+	 */
+	lblock = NVFUSE_SIZE_TO_BLK(of->rwoffset);
+	remain = count >> CLUSTER_SIZE_BITS;
+	while (remain) {
+		ret = nvfuse_get_block(sb, ictx, lblock, remain, &num_alloc, NULL,
+				       NVFUSE_GET_BLOCK_CREATE);
+		if (ret < 0 || num_alloc == 0) {
 			dprintf_error(INODE, "data block allocation fails.");
+			nvfuse_release_inode(sb, ictx, NVF_CLEAN);
 			return NVFUSE_ERROR;
 		}
+		lblock += num_alloc;
+		remain -= num_alloc;
+	}
 
+	if (inode->i_size < of->rwoffset + count) {
+		inode->i_size = of->rwoffset + count;
 		assert(inode->i_size < MAX_FILE_SIZE);
-		inode->i_size += count;
 		nvfuse_release_inode(sb, ictx, DIRTY);
 	} else {
 		nvfuse_release_inode(sb, ictx, NVF_CLEAN);
@@ -1141,6 +1220,7 @@ s32 nvfuse_writefile(struct nvfuse_handle *nvh, u32 fid, const s8 *user_buf, u32
 
 	wcount = nvfuse_writefile_core(sb, fid, user_buf, count, woffset);
 
+	nvfuse_reclaim_orphans(sb);
 	nvfuse_check_flush_dirty(sb, sb->sb_dirty_sync_policy);
 
 	nvfuse_release_super(sb);
@@ -1240,9 +1320,8 @@ s32 nvfuse_createfile(struct nvfuse_superblock *sb, inode_t par_ino, s8 *filenam
 	struct nvfuse_dir_entry *dir;
 	struct nvfuse_inode_ctx *new_ictx, *dir_ictx;
 	struct nvfuse_inode *new_inode, *dir_inode;
-	struct nvfuse_buffer_head *dir_bh = NULL;
-	u32 search_lblock, search_entry;
-	u32 empty_dentry;
+	struct nvfuse_dir_block db;
+	s32 search_lblock;
 	inode_t alloc_ino;
 	s32 ret;
 
@@ -1265,7 +1344,7 @@ s32 nvfuse_createfile(struct nvfuse_superblock *sb, inode_t par_ino, s8 *filenam
 	}
 
 #ifdef NVFUSE_USE_DELAYED_DIRECTORY_ALLOC
-	if (dir_inode->i_links_count == 2 && dir_inode->i_bpino == 0) {
+	if (dir_inode->i_size == 0 && !(dir_inode->i_flags & NVFUSE_INODE_FLAG_INLINE)) {
 		ret = nvfuse_make_first_directory(sb, dir_ictx, dir_inode);
 		if (ret) {
 			dprintf_error(DIRECTORY, "mkdir_first_directory()\n");
@@ -1274,28 +1353,14 @@ s32 nvfuse_createfile(struct nvfuse_superblock *sb, inode_t par_ino, s8 *filenam
 	}
 #endif
 
-	/* find an empty directory */
-	empty_dentry = nvfuse_find_empty_dentry(sb, dir_ictx, dir_inode);
-	if (empty_dentry < 0) {
+	/* find a directory block having room for the name */
+	search_lblock = nvfuse_find_empty_dentry(sb, dir_ictx, dir_inode, filename);
+	if (search_lblock < 0) {
 		return -1;
 	}
-	search_lblock = empty_dentry / DIR_ENTRY_NUM;
-	search_entry = empty_dentry % DIR_ENTRY_NUM;
-
-#ifdef NVFUSE_USE_DELAYED_BPTREE_CREATION
-	if (dir_inode->i_bpino == 0 && dir_inode->i_links_count == 2) {
-		/* create bptree related nodes for new directory's dentries */
-		ret = nvfuse_create_bptree(sb, dir_inode);
-		if (ret) {
-			dprintf_error(BPTREE, " bptree allocation fails.");
-			return NVFUSE_ERROR;
-		}
-	}
-#endif
 
 	dir_inode->i_links_count++;
-	dir_inode->i_ptr = search_lblock * DIR_ENTRY_NUM + search_entry;
-	assert(dir_inode->i_links_count == dir_inode->i_ptr + 1);
+	dir_inode->i_ptr = dir_inode->i_links_count - 1;
 
 	new_ictx = nvfuse_alloc_ictx(sb);
 	if (new_ictx == NULL)
@@ -1317,6 +1382,7 @@ s32 nvfuse_createfile(struct nvfuse_superblock *sb, inode_t par_ino, s8 *filenam
 	new_inode = new_ictx->ictx_inode;
 	new_inode->i_type = NVFUSE_TYPE_FILE;
 	new_inode->i_size = 0;
+	new_inode->i_flags = 0;
 	new_inode->i_mode = mode;
 	new_inode->i_gid = 0;
 	new_inode->i_uid = 0;
@@ -1331,31 +1397,45 @@ s32 nvfuse_createfile(struct nvfuse_superblock *sb, inode_t par_ino, s8 *filenam
 		else
 			new_inode->i_blocks[1] = new_encode_dev(dev);
 	}
+#ifdef NVFUSE_USE_EXTENTS
+	else if (!S_ISLNK(mode)) {
+		nvfuse_ext_init_inode(new_inode);
+	}
+#endif
 
 	if (new_ino)
 		*new_ino = new_inode->i_ino;
 
-	dir_bh = nvfuse_get_bh(sb, dir_ictx, dir_inode->i_ino, search_lblock, READ, NVFUSE_TYPE_META);
-	dir = (struct nvfuse_dir_entry *)dir_bh->bh_buf;
-	dir[search_entry].d_flag = DIR_USED;
-	dir[search_entry].d_ino = new_inode->i_ino;
-	dir[search_entry].d_version = new_inode->i_version;
-	strcpy(dir[search_entry].d_filename, filename);
+	if (nvfuse_get_dir_block(sb, dir_ictx, search_lblock, &db) < 0) {
+		/* give back the inode allocated for the name */
+		dir_inode->i_links_count--;
+		dir_inode->i_ptr = dir_inode->i_links_count - 1;
+		nvfuse_relocate_delete_inode(sb, new_ictx);
+		nvfuse_release_inode(sb, dir_ictx, DIRTY);
+		return NVFUSE_ERROR;
+	}
+	dir = nvfuse_dentry_append(db.db_buf, db.db_size, new_inode->i_ino, new_inode->i_version, filename);
+	assert(dir != NULL);
+	nvfuse_release_dir_block(sb, &db, DIRTY);
 
 #if NVFUSE_USE_DIR_INDEXING == 1
-	nvfuse_set_dir_indexing(sb, dir_inode, filename, dir_inode->i_ptr);
+	nvfuse_insert_dir_indexing(sb, dir_ictx, filename, search_lblock);
 #endif
 
-	nvfuse_release_bh(sb, dir_bh, 0/*tail*/, DIRTY);
-
 	nvfuse_release_inode(sb, new_ictx, DIRTY);
 	nvfuse_release_inode(sb, dir_ictx, DIRTY);
 
 	return NVFUSE_SUCCESS;
 }
 
-s32 nvfuse_shrink_dentry(struct nvfuse_superblock *sb, struct nvfuse_inode_ctx *ictx, u32 to_entry,
-			 u32 from_entry)
+/*
+ * Called after a dentry is removed from the to_lblock block. The last dentry
+ * of the directory is moved into the freed room when it fits, and the last
+ * block is freed once it has no dentries. Room that is too small for the last
+ * dentry stays in the space map of the directory and is given to the next
+ * name that fits by nvfuse_find_empty_dentry.
+ */
+s32 nvfuse_shrink_dentry(struct nvfuse_superblock *sb, struct nvfuse_inode_ctx *ictx, u32 to_lblock)
 {
 	struct nvfuse_buffer_head *dir_bh_from;
 	struct nvfuse_dir_entry *dir_from;
@@ -1364,58 +1444,60 @@ s32 nvfuse_shrink_dentry(struct nvfuse_superblock *sb, struct nvfuse_inode_ctx *
 	struct nvfuse_dir_entry *dir_to;
 
 	struct nvfuse_inode *inode;
-	s32 is_diff_block = 0;
-
-	if (to_entry == from_entry)
-		return -1;
+	u32 from_lblock;
+	u32 used;
 
 	inode = ictx->ictx_inode;
 
-	assert(to_entry < from_entry);
+	/* readdir cursor is no longer valid */
+	ictx->ictx_dir_cursor = 0;
 
-	dir_bh_from = nvfuse_get_bh(sb, ictx, inode->i_ino,
-				    NVFUSE_SIZE_TO_BLK((s64)from_entry * DIR_ENTRY_SIZE), READ, NVFUSE_TYPE_META);
-
-	dir_from = (struct nvfuse_dir_entry *)dir_bh_from->bh_buf;
-	dir_from += (from_entry % DIR_ENTRY_NUM);
-	assert(dir_from->d_flag != DIR_DELETED);
-
-	is_diff_block = (NVFUSE_SIZE_TO_BLK((s64)to_entry * DIR_ENTRY_SIZE) != 
-					NVFUSE_SIZE_TO_BLK((s64)from_entry * DIR_ENTRY_SIZE)) ? 1 : 0;
-
-	if (is_diff_block) {
-		dir_bh_to = nvfuse_get_bh(sb, ictx, inode->i_ino,
-				  NVFUSE_SIZE_TO_BLK((s64)to_entry * DIR_ENTRY_SIZE), READ, NVFUSE_TYPE_META);
-		dir_to = (struct nvfuse_dir_entry *)dir_bh_to->bh_buf;
-	} else {
-		dir_to = (struct nvfuse_dir_entry *)dir_bh_from->bh_buf;
-	}
+	/* an inline directory has a single block */
+	if (inode->i_flags & NVFUSE_INODE_FLAG_INLINE)
+		return 0;
 
-	dir_to += (to_entry % DIR_ENTRY_NUM);
-	assert(dir_to->d_flag == DIR_DELETED);
+	from_lblock = NVFUSE_SIZE_TO_BLK(inode->i_size) - 1;
+	assert(to_lblock <= from_lblock);
 
-	rte_memcpy(dir_to, dir_from, DIR_ENTRY_SIZE);
+	dir_bh_from = nvfuse_get_bh(sb, ictx, inode->i_ino, from_lblock, READ, NVFUSE_TYPE_META);
+	dir_from = nvfuse_dentry_last(dir_bh_from->bh_buf, CLUSTER_SIZE);
 
-	dir_from->d_flag = DIR_DELETED; /* FIXME: zeroing ?*/
-	//printf(" shrink_dentry: deleted = %s \n", dir_from->d_filename);
+	if (dir_from && to_lblock != from_lblock) {
+		dir_bh_to = nvfuse_get_bh(sb, ictx, inode->i_ino, to_lblock, READ, NVFUSE_TYPE_META);
+		used = nvfuse_dentry_block_used(dir_bh_to->bh_buf, CLUSTER_SIZE);
 
+		if (used + nvfuse_dentry_rec_len(dir_from) <= CLUSTER_SIZE) {
+			dir_to = (struct nvfuse_dir_entry *)(dir_bh_to->bh_buf + used);
+			memcpy(dir_to, dir_from, nvfuse_dentry_rec_len(dir_from));
+			nvfuse_dentry_remove(dir_bh_from->bh_buf, CLUSTER_SIZE, dir_from);
+			used += nvfuse_dentry_rec_len(dir_to);
 
 #if NVFUSE_USE_DIR_INDEXING == 1
-	nvfuse_del_dir_indexing(sb, inode, dir_to->d_filename);
-	nvfuse_set_dir_indexing(sb, inode, dir_to->d_filename, to_entry);
-
-	/*{
-		u32 offset;
-		nvfuse_get_dir_indexing(sb, inode, dir_to->d_filename, &offset);
-		if (offset != to_entry) {
-			printf(" b+tree inconsistency \n");
-		}
-	}*/
+			nvfuse_update_dir_indexing(sb, ictx, dir_to->d_filename, from_lblock, to_lblock);
 #endif
+			nvfuse_release_bh(sb, dir_bh_to, 0, DIRTY);
+			nvfuse_dir_space_set(ictx, from_lblock,
+					     nvfuse_dentry_block_used(dir_bh_from->bh_buf, CLUSTER_SIZE));
+			dir_from = nvfuse_dentry_first(dir_bh_from->bh_buf);
+			nvfuse_release_bh(sb, dir_bh_from, 0, DIRTY);
+		} else {
+			/* the room is too small for the last dentry and is left to new names */
+			nvfuse_release_bh(sb, dir_bh_to, 0, NVF_CLEAN);
+			nvfuse_release_bh(sb, dir_bh_from, 0, NVF_CLEAN);
+		}
+		nvfuse_dir_space_set(ictx, to_lblock, used);
+	} else {
+		nvfuse_dir_space_set(ictx, from_lblock,
+				     nvfuse_dentry_block_used(dir_bh_from->bh_buf, CLUSTER_SIZE));
+		nvfuse_release_bh(sb, dir_bh_from, 0, NVF_CLEAN);
+	}
 
-	nvfuse_release_bh(sb, dir_bh_from, 0, DIRTY);
-	if (is_diff_block)
-		nvfuse_release_bh(sb, dir_bh_to, 0, DIRTY);
+	/* free the last block once it is empty (block 0 keeps "." and "..") */
+	if (dir_from == NULL && from_lblock) {
+		nvfuse_free_inode_size(sb, ictx, (u64)from_lblock * CLUSTER_SIZE);
+		inode->i_size -= CLUSTER_SIZE;
+		nvfuse_dir_space_trim(ictx, from_lblock);
+	}
 
 	return 0;
 }
@@ -1425,31 +1507,32 @@ s32 nvfuse_rmfile(struct nvfuse_superblock *sb, inode_t par_ino, s8 *filename)
 	struct nvfuse_inode_ctx *dir_ictx, *ictx;
 	struct nvfuse_inode *dir_inode, *inode = NULL;
 	struct nvfuse_dir_entry *dir = NULL;
-	struct nvfuse_buffer_head *dir_bh = NULL;
-	u32 found_entry;
-	u32 search_lblock, search_entry;
+	struct nvfuse_dir_block db;
+	s32 found_entry;
 
 	dir_ictx = nvfuse_read_inode(sb, NULL, par_ino);
 	dir_inode = dir_ictx->ictx_inode;
 
 	/* find an existing dentry */
 	found_entry = nvfuse_find_existing_dentry(sb, dir_ictx, dir_inode, filename);
-	if (found_entry < 0)
-		return 0;
+	if (found_entry < 0) {
+		nvfuse_release_inode(sb, dir_ictx, NVF_CLEAN);
+		return NVFUSE_ERROR;
+	}
 
-	search_lblock = found_entry / DIR_ENTRY_NUM;
-	search_entry = found_entry % DIR_ENTRY_NUM;
-	dir_bh = nvfuse_get_bh(sb, dir_ictx, dir_inode->i_ino, search_lblock, READ,
-						   NVFUSE_TYPE_META);
-	dir = (struct nvfuse_dir_entry *)dir_bh->bh_buf;
-	dir += search_entry;
+	if (nvfuse_get_dir_block(sb, dir_ictx, found_entry, &db) < 0) {
+		nvfuse_release_inode(sb, dir_ictx, NVF_CLEAN);
+		return NVFUSE_ERROR;
+	}
+	dir = nvfuse_dentry_find(db.db_buf, db.db_size, filename);
+	assert(dir != NULL);
 
 	ictx = nvfuse_read_inode(sb, NULL, dir->d_ino);
 	inode = ictx->ictx_inode;
 
 	if (inode == NULL || inode->i_ino == 0) {
 		dprintf_error(INODE, " inode file (%s) is not found.\n", filename);
-		nvfuse_release_bh(sb, dir_bh, 0/*tail*/, NVF_CLEAN);
+		nvfuse_release_dir_block(sb, &db, NVF_CLEAN);
 		return NVFUSE_ERROR;
 	}
 
@@ -1459,7 +1542,7 @@ s32 nvfuse_rmfile(struct nvfuse_superblock *sb, inode_t par_ino, s8 *filename)
 	}
 
 #if NVFUSE_USE_DIR_INDEXING == 1
-	nvfuse_del_dir_indexing(sb, dir_inode, filename);
+	nvfuse_del_dir_indexing(sb, dir_ictx, filename, found_entry);
 #endif
 
 	inode->i_links_count--;
@@ -1467,30 +1550,34 @@ s32 nvfuse_rmfile(struct nvfuse_superblock *sb, inode_t par_ino, s8 *filename)
 #ifdef VERIFY_BEFORE_RM_FILE
 		nvfuse_fallocate_verify(sb, ictx, 0, NVFUSE_SIZE_TO_BLK(inode->i_size));
 #endif
-		nvfuse_free_inode_size(sb, ictx, 0/*size*/);
-		nvfuse_relocate_delete_inode(sb, ictx);
+		/* delete the b+tree inode of a key-value store */
+		if (inode->i_bpino) {
+			struct nvfuse_inode_ctx *bp_ictx;
+			bp_ictx = nvfuse_read_inode(sb, NULL, inode->i_bpino);
+			nvfuse_free_inode_size(sb, bp_ictx, 0);
+			nvfuse_relocate_delete_inode(sb, bp_ictx);
+		}
+		/* the blocks of a large file are left to the reclaimer */
+		if (nvfuse_reclaim_inode_size(sb, ictx, 0))
+			nvfuse_release_inode(sb, ictx, DIRTY);
+		else
+			nvfuse_relocate_delete_inode(sb, ictx);
 	} else {
 		nvfuse_release_inode(sb, ictx, DIRTY);
 	}
 
 	dir_inode->i_links_count--;
 	dir_inode->i_ptr = dir_inode->i_links_count - 1;
-	dir->d_flag = DIR_DELETED;
-
-	nvfuse_release_bh(sb, dir_bh, 0/*tail*/, DIRTY);
+	nvfuse_dentry_remove(db.db_buf, db.db_size, dir);
 
-	/* Shrink directory entry that last entry is moved to delete entry. */
-	nvfuse_shrink_dentry(sb, dir_ictx, found_entry, dir_inode->i_links_count);
+	nvfuse_release_dir_block(sb, &db, DIRTY);
 
-	/* Free block reclaimation is necessary but test is required. */
-	if ((dir_inode->i_links_count * DIR_ENTRY_SIZE) % CLUSTER_SIZE == 0) {
-		//nvfuse_truncate_blocks(sb, dir_ictx, (u64)dir_inode->i_links_count * DIR_ENTRY_SIZE);
-		nvfuse_free_inode_size(sb, dir_ictx, (u64)dir_inode->i_links_count * DIR_ENTRY_SIZE);
-		dir_inode->i_size -= CLUSTER_SIZE;
-	}
+	/* Refill the hole with the last dentry and free the last block once it is empty. */
+	nvfuse_shrink_dentry(sb, dir_ictx, found_entry);
 
 	nvfuse_release_inode(sb, dir_ictx, DIRTY);
 
+	nvfuse_reclaim_orphans(sb);
 	nvfuse_check_flush_dirty(sb, sb->sb_dirty_sync_policy);
 	nvfuse_release_super(sb);
 
@@ -1531,30 +1618,31 @@ s32 nvfuse_rmdir(struct nvfuse_superblock *sb, inode_t par_ino, s8 *filename)
 	struct nvfuse_dir_entry *dir = NULL;
 	struct nvfuse_inode_ctx *dir_ictx, *ictx;
 	struct nvfuse_inode *dir_inode = NULL, *inode = NULL;
-	struct nvfuse_buffer_head *dir_bh = NULL;
-	u32 found_entry;
-	u32 search_lblock, search_entry;
+	struct nvfuse_dir_block db;
+	s32 found_entry;
 
 	dir_ictx = nvfuse_read_inode(sb, NULL, par_ino);
 	dir_inode = dir_ictx->ictx_inode;
 
 	/* find an existing dentry */
 	found_entry = nvfuse_find_existing_dentry(sb, dir_ictx, dir_inode, filename);
-	if (found_entry < 0)
-		return 0;
+	if (found_entry < 0) {
+		nvfuse_release_inode(sb, dir_ictx, NVF_CLEAN);
+		return NVFUSE_ERROR;
+	}
 
-	search_lblock = found_entry / DIR_ENTRY_NUM;
-	search_entry = found_entry % DIR_ENTRY_NUM;
-	dir_bh = nvfuse_get_bh(sb, dir_ictx, dir_inode->i_ino, search_lblock, READ,
-						   NVFUSE_TYPE_META);
-	dir = (struct nvfuse_dir_entry *)dir_bh->bh_buf;
-	dir += search_entry;
+	if (nvfuse_get_dir_block(sb, dir_ictx, found_entry, &db) < 0) {
+		nvfuse_release_inode(sb, dir_ictx, NVF_CLEAN);
+		return NVFUSE_ERROR;
+	}
+	dir = nvfuse_dentry_find(db.db_buf, db.db_size, filename);
+	assert(dir != NULL);
 
 	ictx = nvfuse_read_inode(sb, NULL, dir->d_ino);
 	inode = ictx->ictx_inode;
 	if (inode == NULL || inode->i_ino == 0) {
 		dprintf_error(INODE, " dir (%s) is not found this directory\n", filename);
-		nvfuse_release_bh(sb, dir_bh, 0/*tail*/, NVF_CLEAN);
+		nvfuse_release_dir_block(sb, &db, NVF_CLEAN);
 		return NVFUSE_ERROR;
 	}
 
@@ -1578,12 +1666,12 @@ s32 nvfuse_rmdir(struct nvfuse_superblock *sb, inode_t par_ino, s8 *filename)
 		return NVFUSE_ERROR;
 	}
 
-	dir->d_flag = DIR_DELETED;
+	nvfuse_dentry_remove(db.db_buf, db.db_size, dir);
 	dir_inode->i_links_count--;
 	dir_inode->i_ptr = dir_inode->i_links_count - 1;
 
 #if NVFUSE_USE_DIR_INDEXING == 1
-	nvfuse_del_dir_indexing(sb, dir_inode, filename);
+	nvfuse_del_dir_indexing(sb, dir_ictx, filename, found_entry);
 #endif
 	/* delete allocated b+tree inode */
 	if (inode->i_bpino) {
@@ -1597,17 +1685,10 @@ s32 nvfuse_rmdir(struct nvfuse_superblock *sb, inode_t par_ino, s8 *filename)
 	nvfuse_free_inode_size(sb, ictx, 0);
 	nvfuse_relocate_delete_inode(sb, ictx);
 
-	nvfuse_release_bh(sb, dir_bh, 0/*tail*/, DIRTY);
-
-	/* Shrink directory entry that last entry is moved to delete entry. */
-	nvfuse_shrink_dentry(sb, dir_ictx, found_entry, dir_inode->i_links_count);
+	nvfuse_release_dir_block(sb, &db, DIRTY);
 
-	/* Free block reclaimation is necessary but test is required. */
-	if ((dir_inode->i_links_count * DIR_ENTRY_SIZE) % CLUSTER_SIZE == 0) {
-		//nvfuse_truncate_blocks(sb, dir_ictx, (u64)dir_inode->i_links_count * DIR_ENTRY_SIZE);
-		nvfuse_free_inode_size(sb, dir_ictx, (u64)dir_inode->i_links_count * DIR_ENTRY_SIZE);
-		dir_inode->i_size -= CLUSTER_SIZE;
-	}
+	/* Refill the hole with the last dentry and free the last block once it is empty. */
+	nvfuse_shrink_dentry(sb, dir_ictx, found_entry);
 
 	/* Parent Directory Modification */
 	nvfuse_release_inode(sb, dir_ictx, DIRTY);
@@ -1644,37 +1725,95 @@ s32 nvfuse_rmdir_path(struct nvfuse_handle *nvh, const char *path)
 	return res;
 }
 
+/*
+ * drop the b+tree index of a directory and bulk load a new one from its
+ * dentries, which packs the nodes fragmented by incremental inserts.
+ */
+s32 nvfuse_rebuild_dir_index(struct nvfuse_handle *nvh, inode_t dir_ino)
+{
+	struct nvfuse_superblock *sb;
+	struct nvfuse_inode_ctx *dir_ictx, *bp_ictx;
+	struct nvfuse_inode *dir_inode;
+	s32 res = 0;
+
+	nvfuse_lock();
+
+	sb = nvfuse_read_super(nvh);
+
+	dir_ictx = nvfuse_read_inode(sb, NULL, dir_ino);
+	dir_inode = dir_ictx->ictx_inode;
+	if (dir_inode->i_type != NVFUSE_TYPE_DIRECTORY) {
+		dprintf_error(DIRECTORY, " ino %d is not a directory\n", dir_ino);
+		nvfuse_release_inode(sb, dir_ictx, NVF_CLEAN);
+		res = NVFUSE_ERROR;
+		goto RES;
+	}
+
+	/* inline directories are always searched linearly */
+	if (dir_inode->i_flags & NVFUSE_INODE_FLAG_INLINE) {
+		nvfuse_release_inode(sb, dir_ictx, NVF_CLEAN);
+		goto RES;
+	}
+
+	if (dir_inode->i_bpino) {
+		bp_free_dir_master(sb, dir_ictx);
+		bp_ictx = nvfuse_read_inode(sb, NULL, dir_inode->i_bpino);
+		nvfuse_free_inode_size(sb, bp_ictx, 0);
+		nvfuse_relocate_delete_inode(sb, bp_ictx);
+		dir_inode->i_bpino = 0;
+	}
+
+	res = nvfuse_build_dir_index(sb, dir_ictx);
+
+	nvfuse_release_inode(sb, dir_ictx, DIRTY);
+	nvfuse_check_flush_dirty(sb, sb->sb_dirty_sync_policy);
+RES:
+	nvfuse_release_super(sb);
+	nvfuse_unlock();
+
+	return res;
+}
+
 s32 nvfuse_make_first_directory(struct nvfuse_superblock *sb, struct nvfuse_inode_ctx *ictx,
 				struct nvfuse_inode *inode)
 {
-	struct nvfuse_buffer_head *dir_bh;
+	struct nvfuse_buffer_head *dir_bh = NULL;
 	struct nvfuse_dir_entry *dir;
-	s32 ret;
+	s8 *buf;
+	u32 size;
 
 	assert(inode->i_size == 0);
 
-	ret = nvfuse_get_block(sb, ictx, NVFUSE_SIZE_TO_BLK(inode->i_size), 1/* num block */, NULL, NULL,
-			       1);
-	if (ret) {
+#ifdef NVFUSE_USE_INLINE_DATA
+	/* "." and ".." are kept in the inode until the directory outgrows it */
+	inode->i_flags |= NVFUSE_INODE_FLAG_INLINE;
+	buf = (s8 *)inode->i_inline;
+	size = NVFUSE_INLINE_DATA_SIZE;
+#else
+	if (nvfuse_get_block(sb, ictx, NVFUSE_SIZE_TO_BLK(inode->i_size), 1/* num block */, NULL, NULL,
+			     1)) {
 		dprintf_error(INODE, "data block allocation fails.");
 		return NVFUSE_ERROR;
 	}
 	inode->i_size = CLUSTER_SIZE;
 
+	dir_bh = nvfuse_get_bh(sb, ictx, inode->i_ino, 0, WRITE, NVFUSE_TYPE_META);
+	buf = dir_bh->bh_buf;
+	size = CLUSTER_SIZE;
+#endif
+
 	nvfuse_mark_inode_dirty(ictx);
 
-	dir_bh = nvfuse_get_bh(sb, ictx, inode->i_ino, 0, WRITE, NVFUSE_TYPE_META);
-	dir = (struct nvfuse_dir_entry *)dir_bh->bh_buf;
+	memset(buf, 0x00, size);
 
-	strcpy(dir[0].d_filename, "."); // current dir
-	dir[0].d_ino = inode->i_ino;
-	dir[0].d_flag = DIR_USED;
+	dir = nvfuse_dentry_append(buf, size, inode->i_ino, 0, "."); // current dir
+	assert(dir != NULL);
 
-	strcpy(dir[1].d_filename, ".."); // parent dir
-	dir[1].d_ino = inode->i_ino;
-	dir[1].d_flag = DIR_USED;
+	dir = nvfuse_dentry_append(buf, size, inode->i_ino, 0, ".."); // parent dir
+	assert(dir != NULL);
 
-	nvfuse_release_bh(sb, dir_bh, 0, DIRTY);
+	if (dir_bh)
+		nvfuse_release_bh(sb, dir_bh, 0, DIRTY);
 
 	return 0;
 }
@@ -1685,9 +1824,8 @@ s32 nvfuse_mkdir(struct nvfuse_superblock *sb, const inode_t par_ino, const s8 *
 	struct nvfuse_dir_entry *dir;
 	struct nvfuse_inode_ctx *new_ictx, *dir_ictx;
 	struct nvfuse_inode *new_inode = NULL, *dir_inode = NULL;
-	struct nvfuse_buffer_head *dir_bh = NULL;
-	u32 search_lblock = 0, search_entry = 0;
-	u32 empty_dentry;
+	struct nvfuse_dir_block db;
+	s32 search_lblock;
 	inode_t alloc_ino;
 	s32 ret;
 
@@ -1717,7 +1855,7 @@ s32 nvfuse_mkdir(struct nvfuse_superblock *sb, const inode_t par_ino, const s8 *
 	assert(dir_inode->i_ptr + 1 == dir_inode->i_links_count);
 
 #ifdef NVFUSE_USE_DELAYED_DIRECTORY_ALLOC
-	if (dir_inode->i_links_count == 2 && dir_inode->i_bpino == 0) {
+	if (dir_inode->i_size == 0 && !(dir_inode->i_flags & NVFUSE_INODE_FLAG_INLINE)) {
 		ret = nvfuse_make_first_directory(sb, dir_ictx, dir_inode);
 		if (ret) {
 			dprintf_error(INODE, "mkdir_first_directory()\n");
@@ -1726,28 +1864,14 @@ s32 nvfuse_mkdir(struct nvfuse_superblock *sb, const inode_t par_ino, const s8 *
 	}
 #endif
 
-	/* find an empty directory */
-	empty_dentry = nvfuse_find_empty_dentry(sb, dir_ictx, dir_inode);
-	if (empty_dentry < 0) {
+	/* find a directory block having room for the name */
+	search_lblock = nvfuse_find_empty_dentry(sb, dir_ictx, dir_inode, (s8 *)dirname);
+	if (search_lblock < 0) {
 		return -1;
 	}
-	search_lblock = empty_dentry / DIR_ENTRY_NUM;
-	search_entry = empty_dentry % DIR_ENTRY_NUM;
-
-#ifdef NVFUSE_USE_DELAYED_BPTREE_CREATION
-	if (dir_inode->i_bpino == 0 && dir_inode->i_links_count == 2) {
-		/* create bptree related nodes for new directory's dentries */
-		ret = nvfuse_create_bptree(sb, dir_inode);
-		if (ret) {
-			dprintf_error(BPTREE, " bptree allocation fails.");
-			return NVFUSE_ERROR;
-		}
-	}
-#endif
 
 	dir_inode->i_links_count++;
-	dir_inode->i_ptr = search_lblock * DIR_ENTRY_NUM + search_entry;
-	assert(dir_inode->i_links_count == dir_inode->i_ptr + 1);
+	dir_inode->i_ptr = dir_inode->i_links_count - 1;
 
 	new_ictx = nvfuse_alloc_ictx(sb);
 	if (new_ictx == NULL)
@@ -1768,11 +1892,8 @@ s32 nvfuse_mkdir(struct nvfuse_superblock *sb, const inode_t par_ino, const s8 *
 
 	new_inode = new_ictx->ictx_inode;
 	new_inode->i_type = NVFUSE_TYPE_DIRECTORY;
-#ifndef NVFUSE_USE_DELAYED_DIRECTORY_ALLOC
-	new_inode->i_size = CLUSTER_SIZE;
-#else
 	new_inode->i_size = 0;
-#endif
+	new_inode->i_flags = 0;
 	new_inode->i_ptr = 1;
 	new_inode->i_mode = (mode & 0777) | S_IFDIR;
 	new_inode->i_gid = 0;
@@ -1785,21 +1906,27 @@ s32 nvfuse_mkdir(struct nvfuse_superblock *sb, const inode_t par_ino, const s8 *
 	if (new_ino)
 		*new_ino = new_inode->i_ino;
 
-	dir_bh = nvfuse_get_bh(sb, dir_ictx, dir_inode->i_ino, search_lblock, READ, NVFUSE_TYPE_META);
-	dir = (struct nvfuse_dir_entry *)dir_bh->bh_buf;
-	dir[search_entry].d_flag = DIR_USED;
-	dir[search_entry].d_ino = new_inode->i_ino;
-	dir[search_entry].d_version = new_inode->i_version;
-	strcpy(dir[search_entry].d_filename, dirname);
+	if (nvfuse_get_dir_block(sb, dir_ictx, search_lblock, &db) < 0) {
+		/* give back the inode allocated for the name */
+		dir_inode->i_links_count--;
+		dir_inode->i_ptr = dir_inode->i_links_count - 1;
+		nvfuse_relocate_delete_inode(sb, new_ictx);
+		nvfuse_release_inode(sb, dir_ictx, DIRTY);
+		return NVFUSE_ERROR;
+	}
+	dir = nvfuse_dentry_append(db.db_buf, db.db_size, new_inode->i_ino, new_inode->i_version, dirname);
+	assert(dir != NULL);
+	nvfuse_release_dir_block(sb, &db, DIRTY);
 
 #if NVFUSE_USE_DIR_INDEXING == 1
-	nvfuse_set_dir_indexing(sb, dir_inode, (char *)dirname, dir_inode->i_ptr);
+	nvfuse_insert_dir_indexing(sb, dir_ictx, (char *)dirname, search_lblock);
 #endif
 
-#ifndef NVFUSE_USE_DELAYED_DIRECTORY_ALLOC
+	/* an inline directory costs no block, so there is nothing to delay */
+#if defined(NVFUSE_USE_INLINE_DATA) || !defined(NVFUSE_USE_DELAYED_DIRECTORY_ALLOC)
 	ret = nvfuse_make_first_directory(sb, new_ictx, new_inode);
 	if (ret) {
-		dprintf_error(DIR, "mkdir_first_directory()\n");
+		dprintf_error(DIRECTORY, "mkdir_first_directory()\n");
 		return -1;
 	}
 #endif
@@ -1815,8 +1942,6 @@ s32 nvfuse_mkdir(struct nvfuse_superblock *sb, const inode_t par_ino, const s8 *
 	new_inode->i_bpino = 0; /* marked as unallocated */
 #endif
 
-	nvfuse_release_bh(sb, dir_bh, 0 /*tail*/, DIRTY);
-
 	nvfuse_release_inode(sb, dir_ictx, DIRTY);
 	nvfuse_release_inode(sb, new_ictx, DIRTY);
 
@@ -2046,12 +2171,15 @@ s32 nvfuse_ftruncate(struct nvfuse_handle *nvh, s32 fid, nvfuse_off_t size)
 	ictx = nvfuse_read_inode(sb, NULL, ft->ino);
 	inode = ictx->ictx_inode;
 
-	nvfuse_free_inode_size(sb, ictx, size);
+	nvfuse_reclaim_inode_size(sb, ictx, size);
 
 	assert(size < MAX_FILE_SIZE);
 	inode->i_size = size;
+	/* writes take the file size from the file table */
+	ft->size = size;
 	nvfuse_release_inode(sb, ictx, DIRTY);
 
+	nvfuse_reclaim_orphans(sb);
 	nvfuse_check_flush_dirty(sb, sb->sb_dirty_sync_policy);
 
 	return res;
@@ -2083,6 +2211,23 @@ s32 nvfuse_symlink(struct nvfuse_handle *nvh, const char *link, inode_t parent,
 		return res;
 	}
 
+#ifdef NVFUSE_USE_INLINE_DATA
+	/* a short target is kept in the inode without a data block */
+	if (strlen(link) + 1 <= NVFUSE_INLINE_DATA_SIZE) {
+		struct nvfuse_inode_ctx *ictx;
+		struct nvfuse_inode *inode;
+
+		ictx = nvfuse_read_inode(sb, NULL, ino);
+		inode = ictx->ictx_inode;
+		memcpy(inode->i_inline, link, strlen(link) + 1);
+		inode->i_flags |= NVFUSE_INODE_FLAG_INLINE;
+		inode->i_size = strlen(link) + 1;
+		nvfuse_release_inode(sb, ictx, DIRTY);
+
+		goto RES;
+	}
+#endif
+
 	fid = nvfuse_openfile_ino(sb, ino, O_WRONLY);
 
 	bytes = nvfuse_writefile(nvh, fid, link, strlen(link) + 1, 0);
@@ -2092,10 +2237,13 @@ s32 nvfuse_symlink(struct nvfuse_handle *nvh, const char *link, inode_t parent,
 		return -1;
 	}
 
-	nvfuse_check_flush_dirty(sb, sb->sb_dirty_sync_policy);
-
 	nvfuse_closefile(nvh, fid);
 
+#ifdef NVFUSE_USE_INLINE_DATA
+RES:
+#endif
+	nvfuse_check_flush_dirty(sb, sb->sb_dirty_sync_policy);
+
 	nvfuse_release_super(sb);
 
 	nvfuse_unlock();
@@ -2121,6 +2269,8 @@ s32 nvfuse_readlink_ino(struct nvfuse_handle *nvh, inode_t ino, char *buf, size_
 	unsigned int bytes;
 	int fid;
 	struct nvfuse_superblock *sb;
+	struct nvfuse_inode_ctx *ictx;
+	struct nvfuse_inode *inode;
 
 	sb = nvfuse_read_super(nvh);
 
@@ -2131,6 +2281,21 @@ s32 nvfuse_readlink_ino(struct nvfuse_handle *nvh, inode_t ino, char *buf, size_
 
 	nvfuse_lock();
 
+	ictx = nvfuse_read_inode(sb, NULL, ino);
+	inode = ictx->ictx_inode;
+	if (inode->i_flags & NVFUSE_INODE_FLAG_INLINE) {
+		/* the inline target is not terminated, leave room for the NUL */
+		bytes = 0;
+		if (size) {
+			bytes = size - 1 < inode->i_size ? size - 1 : inode->i_size;
+			memcpy(buf, inode->i_inline, bytes);
+			buf[bytes] = '\0';
+		}
+		nvfuse_release_inode(sb, ictx, NVF_CLEAN);
+		goto RES;
+	}
+	nvfuse_release_inode(sb, ictx, NVF_CLEAN);
+
 	fid = nvfuse_openfile_ino(sb, ino, O_RDONLY);
 
 	bytes = nvfuse_readfile(nvh, fid, buf, size, 0);
@@ -2139,9 +2304,9 @@ s32 nvfuse_readlink_ino(struct nvfuse_handle *nvh, inode_t ino, char *buf, size_
 		return -1;
 	}
 
-	printf(" read link = %s \n", buf);
 	nvfuse_closefile(nvh, fid);
 
+RES:
 	nvfuse_release_super(sb);
 
 	nvfuse_unlock();
@@ -2343,19 +2508,23 @@ RET:
 s32 nvfuse_statvfs(struct nvfuse_handle *nvh, const char *path, struct statvfs *buf)
 {
 	struct nvfuse_superblock *sb;
+	s64 free_blocks;
+	s64 free_inodes;
 
 	if ((buf == NULL)) return -1;
 	buf->f_bsize = CLUSTER_SIZE;    /* file system block size */
 	//buf->f_frsize = 0;   /* fragment size */
 
 	sb = nvfuse_read_super(nvh);
+	free_blocks = nvfuse_sum_sb_counter(sb, NVFUSE_SB_FREE_BLOCKS);
+	free_inodes = nvfuse_sum_sb_counter(sb, NVFUSE_SB_FREE_INODES);
 
 	buf->f_blocks = (fsblkcnt_t)sb->sb_no_of_blocks;	/* size of fs in f_frsize units */
-	buf->f_bfree = (fsblkcnt_t)sb->sb_free_blocks;		/* # free blocks */
-	buf->f_bavail = (fsblkcnt_t)sb->sb_free_blocks;		/* # free blocks for non-root */
-	buf->f_files = sb->sb_max_inode_num - sb->sb_free_inodes;    /* # inodes */
-	buf->f_ffree = sb->sb_free_inodes;    /* # free inodes */
-	buf->f_favail = sb->sb_free_inodes;   /* # free inodes for non-root */
+	buf->f_bfree = (fsblkcnt_t)free_blocks;		/* # free blocks */
+	buf->f_bavail = (fsblkcnt_t)free_blocks;		/* # free blocks for non-root */
+	buf->f_files = sb->sb_max_inode_num - free_inodes;    /* # inodes */
+	buf->f_ffree = free_inodes;    /* # free inodes */
+	buf->f_favail = free_inodes;   /* # free inodes for non-root */
 	buf->f_flag = 0;     /* mount flags */
 
 	buf->f_namemax = FNAME_SIZE - 1; /* maximum filename length */
@@ -2531,6 +2700,63 @@ s32 nvfuse_fsync(struct nvfuse_handle *nvh, int fd)
 	return 0;
 }
 
+/*
+ * only POSIX_FADV_DONTNEED does anything, it drops the clean buffers of
+ * the range. dirty buffers stay until they are written out. len 0 means up
+ * to the end of the file.
+ */
+s32 nvfuse_fadvise(struct nvfuse_handle *nvh, s32 fd, nvfuse_off_t offset, nvfuse_off_t len,
+		   s32 advice)
+{
+	struct nvfuse_superblock *sb;
+	struct nvfuse_file_table *ft;
+	struct nvfuse_inode_ctx *ictx;
+	u64 from, to;
+
+	if (offset < 0 || len < 0) {
+		dprintf_error(API, " invalid fadvise range %ld+%ld \n", (long)offset, (long)len);
+		return NVFUSE_ERROR;
+	}
+
+	if (advice != POSIX_FADV_DONTNEED)
+		return 0;
+
+	if (fd < START_OPEN_FILE || fd >= MAX_OPEN_FILE) {
+		dprintf_error(API, " invalid fd = %d \n", fd);
+		return NVFUSE_ERROR;
+	}
+
+	sb = nvfuse_read_super(nvh);
+	ft = nvfuse_get_file_table(sb, fd);
+	if (!ft->used || ft->ino == 0) {
+		dprintf_error(API, " fd = %d is not open \n", fd);
+		nvfuse_release_super(sb);
+		return NVFUSE_ERROR;
+	}
+
+	ictx = nvfuse_read_inode(sb, NULL, ft->ino);
+	if (ictx == NULL) {
+		dprintf_error(API, " read inode error (ino = %d) \n", ft->ino);
+		nvfuse_release_super(sb);
+		return NVFUSE_ERROR;
+	}
+
+	/* only whole blocks inside the range are dropped */
+	from = NVFUSE_SIZE_TO_BLK(offset + CLUSTER_SIZE - 1);
+	if (len == 0 || offset + len >= ictx->ictx_inode->i_size)
+		to = NVFUSE_SIZE_TO_BLK(ictx->ictx_inode->i_size + CLUSTER_SIZE - 1);
+	else
+		to = NVFUSE_SIZE_TO_BLK(offset + len);
+
+	if (from < to)
+		nvfuse_invalidate_bcs(sb, ft->ino, from, to, 1);
+
+	nvfuse_release_inode(sb, ictx, NVF_CLEAN);
+	nvfuse_release_super(sb);
+
+	return 0;
+}
+
 s32 _nvfuse_fsync_ictx(struct nvfuse_superblock *sb, struct nvfuse_inode_ctx *ictx)
 {
 	struct list_head *dirty_head, *flushing_head;
@@ -2645,11 +2871,61 @@ s32 nvfuse_sync(struct nvfuse_handle *nvh)
 {
 	struct nvfuse_superblock *sb;
 	sb = nvfuse_read_super(nvh);
+	nvfuse_reclaim_orphans(sb);
 	nvfuse_check_flush_dirty(sb, DIRTY_FLUSH_FORCE);
 	nvfuse_release_super(sb);
 	return 0;
 }
 
+/*
+ * discard the runs of at least minlen free bytes within [start, start + len)
+ * of the containers owned by this process. returns the number of bytes
+ * discarded.
+ */
+s64 nvfuse_fstrim(struct nvfuse_handle *nvh, s64 start, s64 len, s64 minlen)
+{
+#ifdef NVFUSE_USE_ONLINE_DISCARD
+	struct nvfuse_superblock *sb;
+	struct nvfuse_discard_ctx *dc;
+	u64 start_blk, end_blk;
+	u64 discarded;
+
+	if (start < 0 || len <= 0 || minlen < 0) {
+		dprintf_error(API, " invalid trim range %ld+%ld \n", (long)start, (long)len);
+		return NVFUSE_ERROR;
+	}
+
+	sb = nvfuse_read_super(nvh);
+	dc = sb->sb_discard;
+	if (dc == NULL) {
+		dprintf_error(API, " device does not support unmap \n");
+		nvfuse_release_super(sb);
+		return NVFUSE_ERROR;
+	}
+
+	start_blk = (start + CLUSTER_SIZE - 1) >> CLUSTER_SIZE_BITS;
+	end_blk = (u64)(start + len) >> CLUSTER_SIZE_BITS;
+	if (end_blk > (u64)sb->sb_bg_num * sb->sb_no_of_blocks_per_bg)
+		end_blk = (u64)sb->sb_bg_num * sb->sb_no_of_blocks_per_bg;
+
+	discarded = dc->dc_discarded;
+	if (start_blk < end_blk)
+		nvfuse_discard_trim(sb, start_blk, end_blk,
+				    (minlen + CLUSTER_SIZE - 1) >> CLUSTER_SIZE_BITS);
+
+	/* the queued runs are discarded once pending frees are written */
+	nvfuse_flush_dirty_data(sb);
+	discarded = dc->dc_discarded - discarded;
+
+	nvfuse_release_super(sb);
+
+	return (s64)discarded << CLUSTER_SIZE_BITS;
+#else
+	dprintf_error(API, " online discard is not enabled \n");
+	return NVFUSE_ERROR;
+#endif
+}
+
 s32 nvfuse_fallocate_verify(struct nvfuse_superblock *sb, struct nvfuse_inode_ctx *ictx, u32 start,
 			    u32 max_block)
 {
@@ -2701,6 +2977,12 @@ s32 nvfuse_fallocate(struct nvfuse_handle *nvh, const char *path, s64 start, s64
 	u32 curr_block;
 	u32 max_block;
 	u32 remain_block;
+	u32 create = NVFUSE_GET_BLOCK_CREATE;
+
+#ifdef NVFUSE_USE_UNWRITTEN_EXTENTS
+	/* no data is written, the blocks read as zeroes until they are */
+	create |= NVFUSE_GET_BLOCK_UNWRITTEN;
+#endif
 
 	res = nvfuse_path_resolve(nvh, path, filename, &dir_entry);
 	if (res < 0)
@@ -2726,6 +3008,8 @@ s32 nvfuse_fallocate(struct nvfuse_handle *nvh, const char *path, s64 start, s64
 		dprintf_info(API, " file name = %s, ino = %d \n", filename, dir_entry.d_ino);
 
 		if (ictx->ictx_inode->i_size < (start + length)) {
+			nvfuse_reclaim_finish(sb, ictx);
+
 			curr_block = start / CLUSTER_SIZE;
 			max_block = CEIL(length, CLUSTER_SIZE);
 			remain_block = max_block;
@@ -2737,7 +3021,7 @@ s32 nvfuse_fallocate(struct nvfuse_handle *nvh, const char *path, s64 start, s64
 			while (remain_block) {
 				u32 num_alloc_blks = 0;
 
-				res = nvfuse_get_block(sb, ictx, curr_block, remain_block, &num_alloc_blks, NULL, 1 /*create*/);
+				res = nvfuse_get_block(sb, ictx, curr_block, remain_block, &num_alloc_blks, NULL, create);
 				if (res < 0) {
 					dprintf_warn(INODE, " nvfuse_get_block()\n");
 				}
@@ -26,6 +26,9 @@
 #include <rte_memcpy.h>
 #include <rte_mempool.h>
 #endif
+#if defined(__x86_64__) && defined(__GNUC__)
+#include <immintrin.h>
+#endif
 #include "nvfuse_core.h"
 #include "nvfuse_dep.h"
 #include "nvfuse_bp_tree.h"
@@ -73,6 +76,7 @@ master_node_t *bp_init_master(struct nvfuse_superblock *sb)
 	master = (master_node_t *)bp_malloc(sb, BP_MEMPOOL_MASTER, 1);
 	if (master == NULL) {
 		dprintf_error(BPTREE, " Error: malloc()\n");
+		return NULL;
 	}
 
 	memset(master, 0x00, sizeof(master_node_t));
@@ -89,21 +93,95 @@ master_node_t *bp_init_master(struct nvfuse_superblock *sb)
 	master->release_bh = bp_release_bh;
 	master->read = bp_read_node;
 	master->write = bp_write_node;
-	master->push = stack_push;
-	master->pop = stack_pop;
 	master->dealloc = bp_dealloc_bitmap;
 
 	return master;
 }
 
-void bp_deinit_master(master_node_t *master)
+/* release the b+tree inode while keeping the in-memory master structure */
+void bp_detach_master(master_node_t *master)
 {
 	nvfuse_release_inode(master->m_sb, master->m_ictx,
 			     test_bit(&master->m_ictx->ictx_status, INODE_STATE_DIRTY) ? 1 : 0);
 
+	master->m_ictx = NULL;
+	master->m_bh = NULL;
+	master->m_buf = NULL;
+	master->m_ondisk = NULL;
+}
+
+void bp_deinit_master(master_node_t *master)
+{
+	bp_detach_master(master);
 	bp_free(master->m_sb, BP_MEMPOOL_MASTER, 1, master);
 }
 
+/*
+ * Return the b+tree master of a directory with its master block read in.
+ * Only the allocation of the master structure is cached: it is kept in the
+ * directory inode context until the context is replaced. The b+tree inode
+ * and the master block are still read (bp_read_master) and released by
+ * every operation because buffer cache locks are exclusive and are also
+ * taken by the dirty flusher, so they cannot stay pinned.
+ *
+ * m_ictx, m_bh and m_ondisk of the cached master are set here for each
+ * operation. The caller holds the locked directory inode context until
+ * bp_put_dir_master(), so operations on one directory index run one at a
+ * time and never see each other's fields.
+ */
+master_node_t *bp_get_dir_master(struct nvfuse_superblock *sb, struct nvfuse_inode_ctx *dir_ictx)
+{
+	master_node_t *master;
+
+	assert(rte_spinlock_is_locked(&dir_ictx->ictx_lock));
+	assert(test_bit(&dir_ictx->ictx_status, INODE_STATE_LOCK));
+	assert(dir_ictx->ictx_inode->i_bpino);
+
+	master = dir_ictx->ictx_bp_master;
+	if (master) {
+		nvfuse_add_sb_counter(sb, NVFUSE_SB_BP_MASTER_HIT_COUNT, 1);
+	} else {
+		master = bp_init_master(sb);
+		if (master == NULL)
+			return NULL;
+
+		/* the mempool holds only a few masters beyond the cached ones */
+		if (rte_atomic32_add_return(&sb->bp_master_cached_count, 1) <=
+		    NVFUSE_BPTREE_MASTER_CACHE_SIZE)
+			dir_ictx->ictx_bp_master = master;
+		else
+			rte_atomic32_dec(&sb->bp_master_cached_count);
+	}
+
+	master->m_ino = dir_ictx->ictx_inode->i_bpino;
+	master->m_sb = sb;
+	bp_read_master(master);
+
+	return master;
+}
+
+void bp_put_dir_master(struct nvfuse_inode_ctx *dir_ictx, master_node_t *master)
+{
+	assert(test_bit(&dir_ictx->ictx_status, INODE_STATE_LOCK));
+
+	if (dir_ictx->ictx_bp_master == master)
+		bp_detach_master(master);
+	else
+		bp_deinit_master(master);
+}
+
+/* called when a directory inode context leaves the inode cache */
+void bp_free_dir_master(struct nvfuse_superblock *sb, struct nvfuse_inode_ctx *dir_ictx)
+{
+	if (dir_ictx->ictx_bp_master == NULL)
+		return;
+
+	bp_free(sb, BP_MEMPOOL_MASTER, 1, dir_ictx->ictx_bp_master);
+	dir_ictx->ictx_bp_master = NULL;
+	assert(rte_atomic32_read(&sb->bp_master_cached_count) > 0);
+	rte_atomic32_dec(&sb->bp_master_cached_count);
+}
+
 s32 bp_read_master_ctx(master_node_t *master, master_ctx_t *master_ctx, s32 master_id)
 {
 	if (master_id == 0) {
@@ -420,6 +498,125 @@ static int comp_item(void *k1, void *k2)
 }
 #endif
 
+#ifdef KEY_IS_INTEGER
+/*
+ * Integer key search without key_compare() calls. A branchless binary
+ * search narrows the node down to a single cache line of keys, which is
+ * then scanned with AVX-512 or AVX2 if the cpu supports them.
+ */
+#define BP_SEARCH_LINE_KEYS	(64 / sizeof(bkey_t))
+
+#define BP_SEARCH_SCALAR	0
+#define BP_SEARCH_AVX2		1
+#define BP_SEARCH_AVX512	2
+
+static int bp_search_isa = -1;
+
+static int bp_search_isa_detect(void)
+{
+#if defined(__x86_64__) && defined(__GNUC__)
+	__builtin_cpu_init();
+	if (__builtin_cpu_supports("avx512f"))
+		return BP_SEARCH_AVX512;
+	if (__builtin_cpu_supports("avx2"))
+		return BP_SEARCH_AVX2;
+#endif
+	return BP_SEARCH_SCALAR;
+}
+
+const char *bp_key_search_name(void)
+{
+	if (bp_search_isa < 0)
+		bp_search_isa = bp_search_isa_detect();
+
+	switch (bp_search_isa) {
+	case BP_SEARCH_AVX512:
+		return "avx512";
+	case BP_SEARCH_AVX2:
+		return "avx2";
+	default:
+		return "scalar";
+	}
+}
+
+/* number of keys less than key in keys[0..n) */
+static inline int bp_count_less_scalar(const bkey_t *keys, int n, bkey_t key)
+{
+	int count = 0;
+	int i;
+
+	for (i = 0; i < n; i++)
+		count += (keys[i] < key);
+
+	return count;
+}
+
+#if defined(__x86_64__) && defined(__GNUC__)
+__attribute__((target("avx2")))
+static int bp_count_less_avx2(const bkey_t *keys, int n, bkey_t key)
+{
+	/* flip the sign bits as there is no unsigned 64bit compare */
+	const __m256i sign = _mm256_set1_epi64x((long long)0x8000000000000000ULL);
+	__m256i k = _mm256_xor_si256(_mm256_set1_epi64x((long long)key), sign);
+	__m256i v, lt;
+	int count = 0;
+	int i;
+
+	for (i = 0; i + 4 <= n; i += 4) {
+		v = _mm256_xor_si256(_mm256_loadu_si256((const __m256i *)(keys + i)), sign);
+		lt = _mm256_cmpgt_epi64(k, v);
+		count += __builtin_popcount(_mm256_movemask_pd(_mm256_castsi256_pd(lt)));
+	}
+
+	return count + bp_count_less_scalar(keys + i, n - i, key);
+}
+
+__attribute__((target("avx512f")))
+static int bp_count_less_avx512(const bkey_t *keys, int n, bkey_t key)
+{
+	__mmask8 valid = (__mmask8)((1U << n) - 1);
+	__m512i v;
+
+	v = _mm512_maskz_loadu_epi64(valid, keys);
+	return __builtin_popcount(_mm512_mask_cmplt_epu64_mask(valid, v,
+				  _mm512_set1_epi64((long long)key)));
+}
+#endif
+
+/* index of the first key not less than key in keys[0..n) or n */
+int bp_key_lower_bound(const bkey_t *keys, int n, bkey_t key)
+{
+	const bkey_t *base = keys;
+	int half;
+
+	while (n > BP_SEARCH_LINE_KEYS) {
+		half = n >> 1;
+		/* compiled to cmov */
+		base = (base[half] < key) ? base + half : base;
+		n -= half;
+	}
+
+	if (bp_search_isa < 0)
+		bp_search_isa = bp_search_isa_detect();
+
+#if defined(__x86_64__) && defined(__GNUC__)
+	if (bp_search_isa == BP_SEARCH_AVX512)
+		return (base - keys) + bp_count_less_avx512(base, n, key);
+	if (bp_search_isa == BP_SEARCH_AVX2)
+		return (base - keys) + bp_count_less_avx2(base, n, key);
+#endif
+	return (base - keys) + bp_count_less_scalar(base, n, key);
+}
+
+/* index of the key in keys[0..n) or -1 */
+int bp_key_search(const bkey_t *keys, int n, bkey_t key)
+{
+	int i = bp_key_lower_bound(keys, n, key);
+
+	return (i < n && keys[i] == key) ? i : -1;
+}
+#endif
+
 int bp_bin_search(bkey_t *key, key_pair_t *pair, int max,
 		  int (*compare)(void *, void *, void *start, int num, int mid))
 {
@@ -454,6 +651,19 @@ int bp_bin_search(bkey_t *key, key_pair_t *pair, int max,
 	return -1;
 }
 
+/*
+ * number of pairs left in a full leaf when the key is inserted by a split.
+ * appending past the last key of the rightmost leaf means keys arrive in
+ * order, so the left node is kept almost full instead of half empty.
+ */
+static int bp_split_point(index_node_t *dp, bkey_t *key)
+{
+	if (!B_NEXT(dp) && B_KEY_CMP(key, B_KEY_GET(dp, dp->i_num - 1)) > 0)
+		return (dp->i_num + 1) * BP_SEQ_SPLIT_RATIO / 100;
+
+	return dp->i_num - dp->i_num / 2;
+}
+
 index_node_t *bp_add_root_node(master_node_t *master, index_node_t *dp, bkey_t *key, bitem_t *value)
 {
 	index_node_t *parent_ip;
@@ -461,7 +671,6 @@ index_node_t *bp_add_root_node(master_node_t *master, index_node_t *dp, bkey_t *
 	index_node_t *node = NULL;
 	key_pair_t *pair;
 	key_pair_t *src, *dst;
-	int offset = 0;
 	int alloc_num;
 
 	dp_left = B_dALLOC(master, 0, ALLOC_CREATE);
@@ -482,11 +691,8 @@ index_node_t *bp_add_root_node(master_node_t *master, index_node_t *dp, bkey_t *
 
 	bp_merge_key2(pair, key, value, dp->i_num + 1);
 
-	offset = (dp->i_num) / 2;
-	dp->i_num -= offset;
-	dp_left->i_num = dp->i_num;
-	dp_right->i_num += offset;
-	dp_right->i_num++;
+	dp_left->i_num = bp_split_point(dp, key);
+	dp_right->i_num = dp->i_num + 1 - dp_left->i_num;
 
 	bp_init_pair(dp_left->i_pair, FANOUT);
 	bp_init_pair(dp_right->i_pair, FANOUT);
@@ -614,11 +820,8 @@ int bp_split_data_node(master_node_t *master,
 	index_node_t *dp_left = dp, *dp_right;
 	index_node_t *node = NULL;
 	key_pair_t *pair_array;
-	int i, offset = 0, count = 0;
+	int i, count = 0;
 	int alloc_num = dp->i_num + 1;
-#if 0
-	int seq_detection = 1;
-#endif
 
 	pair_array = bp_alloc_pair(master, alloc_num);
 	if (pair_array == NULL)
@@ -635,30 +838,12 @@ int bp_split_data_node(master_node_t *master,
 		}
 	}
 
-#if 0
-	for (i = 0; i < dp->i_num - 1; i++) {
-		u64 key1 = *B_KEY_GET(dp, i);
-		u64 key2 = *B_KEY_GET(dp, (i + 1));
-
-		if (key1 != key2 - 1) {
-			seq_detection = 0;
-			break;
-		}
-		seq_detection = 1;
-	}
-
-	if (seq_detection) {
-		dprintf_warn(BPTREE, " Need to optimize that data node contains consecutive keys \n");
-	}
-#endif
-
 	B_PAIR_COPY_N(pair_array, dp->i_pair, 0, 0, dp->i_num);
 	bp_merge_key2(pair_array, key, value, dp->i_num + 1);
 
-	offset = (dp->i_num) / 2;
-	dp->i_num -= offset;
-	dp_right->i_num += offset;
-	dp_right->i_num++;
+	count = bp_split_point(dp, key);
+	dp_right->i_num = dp->i_num + 1 - count;
+	dp->i_num = count;
 
 	//init
 	bp_init_pair(dp_left->i_pair, FANOUT);
@@ -717,7 +902,8 @@ int bp_split_data_node(master_node_t *master,
 }
 
 
-int bp_split_tree(master_node_t *master, index_node_t *dp, bkey_t *key, bitem_t *value)
+int bp_split_tree(master_node_t *master, bp_cursor_t *cursor, index_node_t *dp, bkey_t *key,
+		  bitem_t *value)
 {
 	index_node_t *new_child = NULL;
 	index_node_t *ip = NULL;
@@ -729,7 +915,7 @@ int bp_split_tree(master_node_t *master, index_node_t *dp, bkey_t *key, bitem_t
 	int alloc_num;
 
 	median = bp_alloc_pair(master, 1);
-	ip_offset = B_POP(master);
+	ip_offset = B_POP(cursor);
 	ip = B_iALLOC(master, ip_offset, ALLOC_READ);
 	B_READ(master, ip, ip->i_offset, 1, 0);
 
@@ -773,8 +959,7 @@ int bp_split_tree(master_node_t *master, index_node_t *dp, bkey_t *key, bitem_t
 				bp_merge_key2(pair_arr, B_KEY_GET(new_child, new_child->i_num), (u32 *)(&new_child->i_offset),
 					      ip->i_num + 1);
 			}
-
-			bubble_sort(master, pair_arr, count, compare_str);
+			/* pair_arr is kept sorted by bp_merge_key2() */
 
 			B_WRITE(master, new_child, new_child->i_offset);
 			B_RELEASE_BH(master, new_child->i_bh);
@@ -790,11 +975,11 @@ int bp_split_tree(master_node_t *master, index_node_t *dp, bkey_t *key, bitem_t
 			break;
 		if (ip->i_root)
 			break;
-		if (!master->m_sp)
+		if (!cursor->c_sp)
 			break;
 
 		B_RELEASE_BH(master, ip->i_bh);
-		ip_offset = B_POP(master);
+		ip_offset = B_POP(cursor);
 		B_READ(master, ip, ip_offset, 1, 0);
 	}
 
@@ -860,43 +1045,50 @@ void bp_insert_value_tree(index_node_t *ip,
 		dprintf_warn(BPTREE, " Warning: key is mismatched\n");
 }
 
+/* lookups walk node views and neither allocate nodes nor copy headers */
 int bp_find_key(master_node_t *master, bkey_t *key, bitem_t *value)
 {
+	bp_node_view_t view;
+	key_pair_t *pair = &view.v_pair;
+	int offset;
 	int index;
 
-	index = B_SEARCH(master, key, NULL);
+	bp_read_node_view(master, &view, master->m_ondisk->m_root);
+
+	while (view.v_head->h_flag != DATA_FLAG) {
+		offset = bp_view_next_offset(&view, key);
+		B_RELEASE_BH(master, view.v_bh);
+		bp_read_node_view(master, &view, offset);
+	}
+
+	index = bp_view_search(&view, key);
 	if (index >= 0) {
-		B_ITEM_COPY(value, B_ITEM_PAIR(master->m_cur->i_pair, index));
+		B_ITEM_COPY(value, B_ITEM_PAIR(pair, index));
 	} else
 		*value = 0;
 
-	B_FLUSH_STACK(master);
-	B_RELEASE_BH(master, master->m_cur->i_bh);
-	B_RELEASE(master, master->m_cur);
-	master->m_cur = 0;
+	B_RELEASE_BH(master, view.v_bh);
 
 	return index;
 }
 
 int bp_update_key_tree(master_node_t *master, bkey_t *key, bitem_t *value)
 {
+	bp_cursor_t cursor;
 	int index;
 
-	index = B_SEARCH(master, key, NULL);
+	cursor.c_sp = 0;
+	index = B_SEARCH(master, &cursor, key, NULL);
 	if (index < 0) {
 		dprintf_error(BPTREE, "not found \n");
-		goto RES;
+	} else {
+		bp_insert_value_tree(cursor.c_cur, index, key, value);
+		B_WRITE(master, cursor.c_cur, cursor.c_cur->i_offset);
 	}
 
-	bp_insert_value_tree(master->m_cur, index, key, value);
-	B_WRITE(master, master->m_cur, master->m_cur->i_offset);
-	B_FLUSH_STACK(master);
-	B_RELEASE_BH(master, master->m_cur->i_bh);
-	B_RELEASE(master, master->m_cur);
-	master->m_cur = 0;
-
-RES:
-	;
+	B_FLUSH_STACK(&cursor);
+	B_RELEASE_BH(master, cursor.c_cur->i_bh);
+	B_RELEASE(master, cursor.c_cur);
 
 	return 0;
 
@@ -948,22 +1140,25 @@ int bp_insert_key_tree(master_node_t *master,
 		       bitem_t *cur_value,
 		       int update)
 {
+	bp_cursor_t cursor;
 	int index, res = 0;
 	index_node_t *root;
 	index_node_t *dp;
 
+	cursor.c_sp = 0;
+
 	/* root node allocation */
 	root = B_dALLOC(master, master->m_ondisk->m_root, ALLOC_READ);
 	/* read root node from disk */
 	B_READ(master, root, root->i_offset, HEAD_SYNC, NOLOCK);
 	/* keep current node pointer temporalily to quickly retrieve */
-	master->m_cur = root;
+	cursor.c_cur = root;
 
-	dp = traverse_empty(master, root, key);
+	dp = traverse_empty(master, &cursor, root, key);
 	index = B_GET_PAIR(master, dp, key);
 	if (index >= 0) {
 		if (cur_value != NULL)
-			B_ITEM_COPY(cur_value, B_ITEM_PAIR(master->m_cur->i_pair, index));
+			B_ITEM_COPY(cur_value, B_ITEM_PAIR(cursor.c_cur->i_pair, index));
 
 		res = -1;
 		if (update && !B_KEY_CMP(B_KEY_PAIR(dp->i_pair, index), key)) {
@@ -974,9 +1169,8 @@ int bp_insert_key_tree(master_node_t *master,
 		}
 
 		B_RELEASE_BH(master, dp->i_bh);
-		B_FLUSH_STACK(master);
-		B_RELEASE(master, master->m_cur);
-		master->m_cur = 0;
+		B_FLUSH_STACK(&cursor);
+		B_RELEASE(master, cursor.c_cur);
 
 		//return res;
 		goto RES;
@@ -990,7 +1184,7 @@ int bp_insert_key_tree(master_node_t *master,
 		B_RELEASE_BH(master, root->i_bh);
 		B_RELEASE(master, root);
 	} else if (dp->i_num == FANOUT) {
-		bp_split_tree(master, dp, key, value);
+		bp_split_tree(master, &cursor, dp, key, value);
 	} else {
 		bp_merge_key(master, dp, key, value);
 		B_WRITE(master, dp, dp->i_offset);
@@ -998,8 +1192,7 @@ int bp_insert_key_tree(master_node_t *master,
 		B_RELEASE(master, dp);
 	}
 
-	master->m_cur = 0;
-	B_FLUSH_STACK(master);
+	B_FLUSH_STACK(&cursor);
 	master->m_key_count++;
 
 RES:
@@ -1009,6 +1202,139 @@ RES:
 }
 
 
+/* size of the next node when packing the remaining entries of a level */
+static int bp_bulk_chunk(int remain, int cap)
+{
+	int min = cap / 2;
+
+	if (remain <= cap)
+		return remain;
+
+	/* keep the last node of a level from underflowing */
+	if (remain < cap + min)
+		return remain - min;
+
+	return cap;
+}
+
+/*
+ * build a b+tree bottom-up from pairs sorted by key. leaves are packed with
+ * FANOUT keys and allocated sequentially, then each index level is built on
+ * the (max key, offset) list of the level below until a single root is left.
+ * the tree must be empty, its root leaf is reused as the first leaf.
+ */
+int bp_bulk_load(master_node_t *master, key_pair_t *pair, int num)
+{
+	index_node_t *node, *prev = NULL;
+	bkey_t *keys;
+	bitem_t *offsets;
+	int level_num, nodes = 0;
+	int pos = 0, count;
+	int i;
+
+	node = B_dALLOC(master, master->m_ondisk->m_root, ALLOC_READ);
+	B_READ(master, node, node->i_offset, HEAD_SYNC, NOLOCK);
+	if (!B_ISLEAF(node) || node->i_num) {
+		dprintf_error(BPTREE, " bulk load requires an empty tree\n");
+		B_RELEASE_BH(master, node->i_bh);
+		B_RELEASE(master, node);
+		return -1;
+	}
+
+	for (i = 1; i < num; i++) {
+		if (B_KEY_CMP(B_KEY_PAIR(pair, i - 1), B_KEY_PAIR(pair, i)) >= 0) {
+			dprintf_error(BPTREE, " bulk load keys are not sorted at %d\n", i);
+			B_RELEASE_BH(master, node->i_bh);
+			B_RELEASE(master, node);
+			return -1;
+		}
+	}
+
+	level_num = num / FANOUT + 1;
+	keys = (bkey_t *)malloc(BP_KEY_SIZE * level_num);
+	offsets = (bitem_t *)malloc(BP_ITEM_SIZE * level_num);
+	if (keys == NULL || offsets == NULL) {
+		dprintf_error(BPTREE, " cannot allocate memory \n");
+		free(keys);
+		free(offsets);
+		B_RELEASE_BH(master, node->i_bh);
+		B_RELEASE(master, node);
+		return -1;
+	}
+
+	/* leaf level, linked in key order */
+	do {
+		count = bp_bulk_chunk(num - pos, FANOUT);
+		if (node == NULL) {
+			node = B_dALLOC(master, 0, ALLOC_CREATE);
+			B_READ(master, node, node->i_offset, 0, 0);
+		}
+
+		bp_init_pair(node->i_pair, FANOUT);
+		B_PAIR_COPY_N(node->i_pair, pair, 0, pos, count);
+		node->i_num = count;
+		node->i_root = (pos == 0 && count == num);
+		B_NEXT(node) = 0;
+
+		if (prev) {
+			B_PREV(node) = prev->i_offset;
+			B_NEXT(prev) = node->i_offset;
+			B_WRITE(master, prev, prev->i_offset);
+			B_RELEASE_BH(master, prev->i_bh);
+			B_RELEASE(master, prev);
+		}
+
+		if (count)
+			B_KEY_COPY(&keys[nodes], B_KEY_GET(node, count - 1));
+		offsets[nodes++] = node->i_offset;
+		pos += count;
+		prev = node;
+		node = NULL;
+	} while (pos < num);
+
+	B_WRITE(master, prev, prev->i_offset);
+	B_RELEASE_BH(master, prev->i_bh);
+	B_RELEASE(master, prev);
+
+	/* index levels, the list of the level below is rewritten in place */
+	while (nodes > 1) {
+		level_num = nodes;
+		nodes = 0;
+		pos = 0;
+
+		do {
+			count = bp_bulk_chunk(level_num - pos, FANOUT);
+			node = B_iALLOC(master, 0, ALLOC_CREATE);
+			B_READ(master, node, node->i_offset, 0, 0);
+
+			bp_init_pair(node->i_pair, FANOUT);
+			for (i = 0; i < count; i++) {
+				B_KEY_COPY(B_KEY_GET(node, i), &keys[pos + i]);
+				B_ITEM_COPY(B_ITEM_GET(node, i), &offsets[pos + i]);
+			}
+			node->i_num = count - 1;
+			node->i_root = (pos == 0 && count == level_num);
+
+			B_KEY_COPY(&keys[nodes], &keys[pos + count - 1]);
+			offsets[nodes++] = node->i_offset;
+			pos += count;
+
+			B_WRITE(master, node, node->i_offset);
+			B_RELEASE_BH(master, node->i_bh);
+			B_RELEASE(master, node);
+		} while (pos < level_num);
+	}
+
+	master->m_ondisk->m_root = offsets[0];
+	nvfuse_mark_dirty_bh(master->m_sb, master->m_bh);
+	master->m_key_count += num;
+
+	free(keys);
+	free(offsets);
+
+	return 0;
+}
+
 int bp_redist_data_child(master_node_t *master, index_node_t *ip, index_node_t *child, int data_node)
 {
 	index_node_t *child2;
@@ -1042,29 +1368,18 @@ int bp_redist_data_child(master_node_t *master, index_node_t *ip, index_node_t *
 		return 0;
 	}
 
-	if (data_node) {
-		//collect keys and items
-		B_PAIR_COPY_N(pair, child->i_pair, 0, 0, child->i_num);
-
-		child2 = B_dALLOC(master, *B_ITEM_GET(ip, target2), ALLOC_READ);
-		B_READ(master, child2, child2->i_offset, 1, 0);
+	child2 = B_dALLOC(master, *B_ITEM_GET(ip, target2), ALLOC_READ);
+	B_READ(master, child2, child2->i_offset, 1, 0);
 
-		B_PAIR_COPY_N(pair, child2->i_pair, child->i_num, 0, child2->i_num);
+	//collect keys and items in order
+	if (data_node) {
+		bp_merge_pair_runs(pair, child->i_pair, child->i_num, child2->i_pair, child2->i_num);
 		count = child->i_num + child2->i_num;
-
 	} else {
-		//collect keys and items
-		B_PAIR_COPY_N(pair, child->i_pair, 0, 0, child->i_num + 1);
-
-		child2 = B_dALLOC(master, *B_ITEM_GET(ip, target2), ALLOC_READ);
-		B_READ(master, child2, child2->i_offset, 1, 0);
-
-		B_PAIR_COPY_N(pair, child2->i_pair, child->i_num + 1, 0, child2->i_num + 1);
+		bp_merge_pair_runs(pair, child->i_pair, child->i_num + 1, child2->i_pair, child2->i_num + 1);
 		count = child->i_num + 1 + child2->i_num + 1;
 	}
 
-	bubble_sort(master, pair, count, compare_str);
-
 	max_count = data_node ? FANOUT : (FANOUT + 1);
 
 	if (count < max_count) { //merge child1 and child2
@@ -1196,14 +1511,15 @@ int bp_redist_data_child(master_node_t *master, index_node_t *ip, index_node_t *
 	B_RELEASE(master, child2);
 	B_RELEASE(master, child);
 
-	if (ip->i_num + 1 >= (FANOUT / 2 + 1))//INDEX_MIN_WAY
+	if (ip->i_num + 1 >= BP_MIN_FILL)
 		return 0;
 	else
 		return 1; //under flow
 }
 
 
-int bp_merge_key_tree(master_node_t *master, bkey_t *key, index_node_t *dp, int d_index)
+int bp_merge_key_tree(master_node_t *master, bp_cursor_t *cursor, bkey_t *key, index_node_t *dp,
+		      int d_index)
 {
 	index_node_t *index_temp = NULL;
 	index_node_t *ip = dp;
@@ -1219,7 +1535,7 @@ int bp_merge_key_tree(master_node_t *master, bkey_t *key, index_node_t *dp, int
 	}
 
 	while (1) {
-		ip_offset = B_POP(master);
+		ip_offset = B_POP(cursor);
 		ip = B_iALLOC(master, ip_offset, ALLOC_READ);
 		B_READ(master, ip, ip->i_offset, 1, 0);
 
@@ -1277,6 +1593,7 @@ int bp_merge_key_tree(master_node_t *master, bkey_t *key, index_node_t *dp, int
 	return ret;
 }
 
+#ifndef KEY_IS_INTEGER
 static int bp_compare_index_node(void *k1, void *k2, void *start, int num, int mid)
 {
 	bkey_t  *key1 = (bkey_t *) k1;
@@ -1304,6 +1621,216 @@ static int bp_compare_index_node(void *k1, void *k2, void *start, int num, int m
 
 	return ret2;
 }
+#endif
+
+static void bp_set_node_view(master_node_t *master, bp_node_view_t *view,
+			     struct nvfuse_buffer_head *bh, int offset)
+{
+	char *buf;
+
+	view->v_bh = bh;
+	buf = bh->bh_buf + BP_NODE_SIZE * (offset % BP_CLUSTER_PER_NODE);
+
+	view->v_head = (bp_node_head_t *)buf;
+	view->v_pair.i_key = (bkey_t *)(buf + BP_KEY_START);
+	view->v_pair.i_item = (bitem_t *)(buf + BP_ITEM_START(master));
+
+	if (view->v_head->h_flag != INDEX_FLAG && view->v_head->h_flag != DATA_FLAG) {
+		dprintf_error(BPTREE, " Error: Invalid or Corrupted node data (offset = %d)\n", offset);
+		assert(0);
+	}
+}
+
+void bp_read_node_view(master_node_t *master, bp_node_view_t *view, int offset)
+{
+	bp_set_node_view(master, view, bp_read_block(master, offset, READ_LOCK), offset);
+}
+
+/* child offset to follow in an index node, same as bp_next_node() */
+int bp_view_next_offset(bp_node_view_t *view, bkey_t *key)
+{
+	key_pair_t *pair = &view->v_pair;
+	int num = view->v_head->h_num;
+	int key_num;
+
+	if (B_KEY_CMP(key, B_KEY_PAIR(pair, num - 1)) > 0)
+		return *B_ITEM_PAIR(pair, num);
+
+#ifdef KEY_IS_INTEGER
+	key_num = bp_key_lower_bound(pair->i_key, num, *key);
+#else
+	key_num = bp_bin_search(key, pair, num, bp_compare_index_node);
+#endif
+	return *B_ITEM_PAIR(pair, key_num);
+}
+
+/* index of the key in a data node or -1, same as get_pair_tree() */
+int bp_view_search(bp_node_view_t *view, bkey_t *key)
+{
+#ifdef KEY_IS_INTEGER
+	return bp_key_search(view->v_pair.i_key, view->v_head->h_num, *key);
+#else
+	return bp_bin_search(key, &view->v_pair, view->v_head->h_num - 1, key_compare);
+#endif
+}
+
+/* index of the first key not less than the given one in a data node */
+static int bp_view_lower_bound(bp_node_view_t *view, bkey_t *key)
+{
+#ifdef KEY_IS_INTEGER
+	return bp_key_lower_bound(view->v_pair.i_key, view->v_head->h_num, *key);
+#else
+	key_pair_t *pair = &view->v_pair;
+	int i;
+
+	for (i = 0; i < view->v_head->h_num; i++) {
+		if (B_KEY_CMP(B_KEY_PAIR(pair, i), key) >= 0)
+			break;
+	}
+	return i;
+#endif
+}
+
+/* start reading the next leaf of a cursor into the buffer cache without waiting */
+static void bp_iter_readahead(bp_iter_t *it, int offset)
+{
+	master_node_t *master = it->it_master;
+	struct nvfuse_superblock *sb = master->m_sb;
+	struct nvfuse_buffer_head *bh;
+	struct io_job *job;
+
+	it->it_ra_offset = offset;
+	it->it_ra_bh = NULL;
+	it->it_ra_task = NULL;
+	if (!offset)
+		return;
+
+#if (NVFUSE_OS == NVFUSE_OS_LINUX)
+	bh = nvfuse_get_bh(sb, master->m_ictx, master->m_ino, offset / BP_CLUSTER_PER_NODE, 0,
+			   NVFUSE_TYPE_META);
+	if (bh == NULL)
+		return;
+
+	it->it_ra_bh = bh;
+	if (bh->bh_bc->bc_load || bh->bh_bc->bc_dirty)
+		return;
+
+	nvfuse_make_jobs(sb, &it->it_ra_job, 1);
+	job = it->it_ra_job;
+	job->offset = (s64)bh->bh_bc->bc_pno * CLUSTER_SIZE;
+	job->bytes = (size_t)CLUSTER_SIZE;
+	job->ret = 0;
+	job->req_type = SPDK_BDEV_IO_TYPE_READ;
+	job->buf = bh->bh_buf;
+	job->complete = 0;
+	job->iov[0].iov_base = bh->bh_buf;
+	job->iov[0].iov_len = (size_t)CLUSTER_SIZE;
+	job->iovcnt = 1;
+	job->cb = reactor_bio_cb;
+
+	it->it_ra_task = reactor_alloc_task(sb->target, 1);
+	assert(it->it_ra_task);
+	reactor_submit_reqs(sb->target, it->it_ra_task, &it->it_ra_job, 1);
+#endif
+}
+
+/*
+ * wait for the read-ahead leaf of a cursor, NULL if none was started or
+ * the read failed. a failed leaf is left unloaded for a synchronous read.
+ */
+static struct nvfuse_buffer_head *bp_iter_readahead_wait(bp_iter_t *it)
+{
+	struct nvfuse_superblock *sb = it->it_master->m_sb;
+	struct nvfuse_buffer_head *bh = it->it_ra_bh;
+
+	if (it->it_ra_task) {
+		nvfuse_wait_aio_completion(sb, it->it_ra_task, &it->it_ra_job, 1);
+		if (it->it_ra_job->ret < 0) {
+			dprintf_warn(BPTREE, " read-ahead of node %d failed \n", it->it_ra_offset);
+			B_RELEASE_BH(it->it_master, bh);
+			bh = NULL;
+		} else {
+			bh->bh_bc->bc_load = 1;
+		}
+		nvfuse_release_jobs(sb, &it->it_ra_job, 1);
+		reactor_free_task(sb->target, it->it_ra_task);
+		it->it_ra_task = NULL;
+	}
+	it->it_ra_bh = NULL;
+
+	return bh;
+}
+
+/*
+ * open a cursor at the first pair whose key is not less than start_key, or
+ * at the first pair of the tree if start_key is NULL. a scan is resumed by
+ * opening a new cursor past the last key returned.
+ */
+void bp_iter_open(master_node_t *master, bp_iter_t *it, bkey_t *start_key)
+{
+	bp_node_view_t *view = &it->it_view;
+	int offset;
+
+	it->it_master = master;
+	bp_read_node_view(master, view, master->m_ondisk->m_root);
+
+	while (view->v_head->h_flag != DATA_FLAG) {
+		if (start_key)
+			offset = bp_view_next_offset(view, start_key);
+		else
+			offset = view->v_pair.i_item[0];
+		B_RELEASE_BH(master, view->v_bh);
+		bp_read_node_view(master, view, offset);
+	}
+
+	it->it_index = start_key ? bp_view_lower_bound(view, start_key) : 0;
+	bp_iter_readahead(it, view->v_head->h_next_node);
+}
+
+/* copy out the pair under the cursor and advance, -1 past the last pair */
+int bp_iter_next(bp_iter_t *it, bkey_t *key, bitem_t *value)
+{
+	master_node_t *master = it->it_master;
+	bp_node_view_t *view = &it->it_view;
+	key_pair_t *pair = &view->v_pair;
+	struct nvfuse_buffer_head *bh;
+	int offset;
+
+	while (it->it_index >= view->v_head->h_num) {
+		offset = view->v_head->h_next_node;
+		if (!offset)
+			return -1;
+
+		B_RELEASE_BH(master, view->v_bh);
+
+		assert(it->it_ra_offset == offset);
+		bh = bp_iter_readahead_wait(it);
+		if (bh)
+			bp_set_node_view(master, view, bh, offset);
+		else
+			bp_read_node_view(master, view, offset);
+
+		it->it_index = 0;
+		bp_iter_readahead(it, view->v_head->h_next_node);
+	}
+
+	B_KEY_COPY(key, B_KEY_PAIR(pair, it->it_index));
+	B_ITEM_COPY(value, B_ITEM_PAIR(pair, it->it_index));
+	it->it_index++;
+
+	return 0;
+}
+
+void bp_iter_close(bp_iter_t *it)
+{
+	struct nvfuse_buffer_head *bh;
+
+	bh = bp_iter_readahead_wait(it);
+	if (bh)
+		B_RELEASE_BH(it->it_master, bh);
+
+	B_RELEASE_BH(it->it_master, it->it_view.v_bh);
+}
 
 index_node_t *bp_next_node(master_node_t *master, index_node_t *ip, bkey_t *key)
 {
@@ -1313,7 +1840,11 @@ index_node_t *bp_next_node(master_node_t *master, index_node_t *ip, bkey_t *key)
 	if (B_KEY_CMP(key, B_KEY_GET(ip, ip->i_num - 1)) > 0) {
 		offset = *B_ITEM_GET(ip, ip->i_num);
 	} else {
+#ifdef KEY_IS_INTEGER
+		key_num = bp_key_lower_bound(ip->i_pair->i_key, ip->i_num, *key);
+#else
 		key_num = bp_bin_search(key, ip->i_pair, ip->i_num, bp_compare_index_node);
+#endif
 		offset = ip->i_pair->i_item[key_num];
 	}
 
@@ -1323,10 +1854,11 @@ index_node_t *bp_next_node(master_node_t *master, index_node_t *ip, bkey_t *key)
 	return ip;
 }
 
-index_node_t *traverse_empty(master_node_t *master, index_node_t *ip, bkey_t *key)
+index_node_t *traverse_empty(master_node_t *master, bp_cursor_t *cursor, index_node_t *ip,
+			     bkey_t *key)
 {
 	while (!B_ISLEAF(ip)) {
-		B_PUSH(master, ip->i_offset);
+		B_PUSH(cursor, ip);
 		ip = bp_next_node(master, ip, key);
 
 		if (ip->i_offset == 0)
@@ -1338,53 +1870,26 @@ index_node_t *traverse_empty(master_node_t *master, index_node_t *ip, bkey_t *ke
 	return (index_node_t *)ip;
 }
 
+/* number of keys between s_key and e_key inclusive */
 int rsearch_data_node(master_node_t *master, bkey_t *s_key, bkey_t *e_key)
 {
-	index_node_t *ip;
-	int index;
-
-	ip = B_iALLOC(master, master->m_ondisk->m_root, ALLOC_READ);
-	B_READ(master, ip, ip->i_offset, 1, 1);
-
-	while (!B_ISLEAF(ip)) {
-		B_PUSH(master, ip->i_offset);
-		ip = bp_next_node(master, ip, s_key);
-	}
-
-	if (B_ISLEAF(ip)) {
-		master->m_cur = ip;
-		index = B_GET_PAIR(master, ip, s_key);
-	}
-
-	if (index < 0)
-		index = 0;
-
-	while (1) {
-		if (B_KEY_CMP(s_key, B_KEY_GET(ip, index)) <= 0)
-			break;
-		index++;
-	}
-
-	while (1) {
-		//dprintf_info(BPTREE, " key item : %d,%d\n", *B_KEY_GET(ip, index), *B_ITEM_GET(ip, index));
-		index++;
-		if (index == ip->i_num) {
-			B_READ(master, ip, B_NEXT(ip), 1, 1);
-			index = 0;
-		}
+	bp_iter_t it;
+	bkey_t key;
+	bitem_t value;
+	int count = 0;
 
-		if (B_KEY_CMP(e_key, B_KEY_GET(ip, index)) < 0)
+	bp_iter_open(master, &it, s_key);
+	while (bp_iter_next(&it, &key, &value) == 0) {
+		if (B_KEY_CMP(&key, e_key) > 0)
 			break;
+		count++;
 	}
+	bp_iter_close(&it);
 
-	B_FLUSH_STACK(master);
-	B_RELEASE(master, master->m_cur);
-	master->m_cur = 0;
-
-	return 0;
+	return count;
 }
 
-int search_data_node(master_node_t *master, bkey_t *key, index_node_t **d)
+int search_data_node(master_node_t *master, bp_cursor_t *cursor, bkey_t *key, index_node_t **d)
 {
 	index_node_t *ip;
 
@@ -1392,24 +1897,25 @@ int search_data_node(master_node_t *master, bkey_t *key, index_node_t **d)
 	B_READ(master, ip, ip->i_offset, 1, READ_LOCK);
 
 	while (!B_ISLEAF(ip)) {
-		B_PUSH(master, ip->i_offset);
+		B_PUSH(cursor, ip);
 		ip = bp_next_node(master, ip, key);
 	}
 
-	if (B_ISLEAF(ip)) {
-		if (d)
-			*d = ip;
-		master->m_cur = ip;
-		return B_GET_PAIR(master, ip, key);
-	}
+	if (d)
+		*d = ip;
+	cursor->c_cur = ip;
 
-	return -1;
+	return B_GET_PAIR(master, ip, key);
 }
 
 int get_pair_tree(index_node_t *dp, bkey_t *key)
 {
 	int key_num;
+#ifdef KEY_IS_INTEGER
+	key_num = bp_key_search(dp->i_pair->i_key, dp->i_num, *key);
+#else
 	key_num = bp_bin_search(key, dp->i_pair, dp->i_num - 1, key_compare);
+#endif
 
 	if (key_num < 0)
 		return key_num;
@@ -1419,21 +1925,23 @@ int get_pair_tree(index_node_t *dp, bkey_t *key)
 
 int bp_remove_key(master_node_t *master, bkey_t *key)
 {
+	bp_cursor_t cursor;
 	index_node_t *dp;
 	int res = 0;
 	int  i;
 
-	i = B_SEARCH(master, key, &dp);
+	cursor.c_sp = 0;
+	i = B_SEARCH(master, &cursor, key, &dp);
 	if (i < 0) {
 		dprintf_error(BPTREE, "not found [%lu] in remove key\n", (long)*key);
 		res = -1;
-		goto RES;
+		goto RELEASE;
 	}
 
 	if (B_KEY_CMP(B_KEY_GET(dp, i), key)) {
 		dprintf_error(BPTREE, " invalid key = %lu\n", (long)*key);
 		res = -1;
-		goto RES;
+		goto RELEASE;
 	}
 
 	for (; i < dp->i_num - 1; i++) {
@@ -1442,30 +1950,26 @@ int bp_remove_key(master_node_t *master, bkey_t *key)
 	B_PAIR_INIT(dp->i_pair, i);
 	dp->i_num--;
 
-#ifdef NVFUSE_USE_DELAYED_REDISTRIBUTION_BPTREE
-	if (dp->i_num >= 1)
-#else
-	if (dp->i_num >= (FANOUT / 2 + 1))
-#endif
-	{
-		//INDEX_MIN_WAY
-		B_WRITE(master, master->m_cur, master->m_cur->i_offset);
-		if (dp != master->m_cur)
-			B_RELEASE(master, dp);
-		B_RELEASE_BH(master, master->m_cur->i_bh);
-		B_RELEASE(master, master->m_cur);
-		master->m_cur = 0;
+	if (dp->i_num >= BP_MIN_FILL || B_ISROOT(dp)) {
+		B_WRITE(master, dp, dp->i_offset);
+		B_RELEASE_BH(master, dp->i_bh);
+		B_RELEASE(master, dp);
 	} else {
 		//dprintf_info(BPTREE, " key merge num = %d\n ", dp->i_num);
-		bp_merge_key_tree(master, key, dp, i);
+		bp_merge_key_tree(master, &cursor, key, dp, i);
 	}
 
-	B_FLUSH_STACK(master);
+	B_FLUSH_STACK(&cursor);
 
 	master->m_key_count--;
 
-RES:
-	;
+	return res;
+
+RELEASE:
+	B_FLUSH_STACK(&cursor);
+	B_RELEASE_BH(master, dp->i_bh);
+	B_RELEASE(master, dp);
+
 	return res;
 }
 
@@ -1759,33 +2263,33 @@ int bp_release_node(master_node_t *master, index_node_t *p)
 	return 0;
 }
 
-void stack_push(master_node_t *master, offset_t v)
+void stack_push(bp_cursor_t *cursor, offset_t v)
 {
 	int i;
 
-	for (i = 0; i < master->m_sp; i++) {
-		if (master->m_stack[i] == v)
+	for (i = 0; i < cursor->c_sp; i++) {
+		if (cursor->c_stack[i] == v)
 			dprintf_error(BPTREE, " stack debug \n");
 	}
-	master->m_stack[master->m_sp++] = v;
-	if (master->m_sp >= MAX_STACK) {
+	cursor->c_stack[cursor->c_sp++] = v;
+	if (cursor->c_sp >= MAX_STACK) {
 		dprintf_error(BPTREE, " b+tree stack overflow \n");
 		assert(0);
 	}
 }
 
-offset_t stack_pop(master_node_t *master)
+offset_t stack_pop(bp_cursor_t *cursor)
 {
 	offset_t temp;
-	master->m_sp--;
+	cursor->c_sp--;
 
-	if (master->m_sp < 0) {
+	if (cursor->c_sp < 0) {
 		dprintf_error(BPTREE, " stack underflow ");
 		assert(0);
 	}
 
-	temp = master->m_stack[master->m_sp];
-	master->m_stack[master->m_sp] = 0;
+	temp = cursor->c_stack[cursor->c_sp];
+	cursor->c_stack[cursor->c_sp] = 0;
 	return temp;
 }
 
@@ -1814,7 +2318,7 @@ __inline int key_compare(void *k1, void *k2, void *start, int num, int mid)
 #endif
 int bp_merge_key2(key_pair_t *pair, bkey_t *key, bitem_t *value, int max)
 {
-	int i = 0, j = 0;
+	int i = 0;
 
 	for (i = max - 2; i >= 0; i--) {
 		if (!B_KEY_ISNULL(B_KEY_PAIR(pair, i)) && B_KEY_CMP(B_KEY_PAIR(pair, i), key) < 0) {
@@ -1824,9 +2328,10 @@ int bp_merge_key2(key_pair_t *pair, bkey_t *key, bitem_t *value, int max)
 
 	i++;
 
-	for (j = max - 1; j > i; j--) {
-		B_PAIR_COPY(pair, pair, j, j - 1);
-		B_PAIR_INIT(pair, j - 1);
+	/* shift the larger pairs by one slot at once */
+	if (max - 1 > i) {
+		B_PAIR_MOVE_N(pair, pair, i + 1, i, max - 1 - i);
+		B_PAIR_INIT(pair, i);
 	}
 
 	if (B_KEY_ISNULL(B_KEY_PAIR(pair, i))) {
@@ -1910,6 +2415,45 @@ void bp_release_pair(master_node_t *master, key_pair_t *pair, int num)
 	bp_free(master->m_sb, BP_MEMPOOL_PAIR, 1, (void *)pair);
 }
 
+/*
+ * merge two sorted pair runs into dst in linear time. sibling nodes hold
+ * disjoint key ranges, so this is normally two block copies.
+ */
+void bp_merge_pair_runs(key_pair_t *dst, key_pair_t *a, int na, key_pair_t *b, int nb)
+{
+	int i = 0, j = 0, k = 0;
+
+	if (!na || !nb || B_KEY_CMP(B_KEY_PAIR(a, na - 1), B_KEY_PAIR(b, 0)) < 0) {
+		B_PAIR_COPY_N(dst, a, 0, 0, na);
+		B_PAIR_COPY_N(dst, b, na, 0, nb);
+		return;
+	}
+
+	if (B_KEY_CMP(B_KEY_PAIR(b, nb - 1), B_KEY_PAIR(a, 0)) < 0) {
+		B_PAIR_COPY_N(dst, b, 0, 0, nb);
+		B_PAIR_COPY_N(dst, a, nb, 0, na);
+		return;
+	}
+
+	while (i < na && j < nb) {
+		if (B_KEY_CMP(B_KEY_PAIR(a, i), B_KEY_PAIR(b, j)) <= 0) {
+			B_PAIR_COPY(dst, a, k, i);
+			i++;
+		} else {
+			B_PAIR_COPY(dst, b, k, j);
+			j++;
+		}
+		k++;
+	}
+
+	if (i < na) {
+		B_PAIR_COPY_N(dst, a, k, i, na - i);
+	}
+	if (j < nb) {
+		B_PAIR_COPY_N(dst, b, k, j, nb - j);
+	}
+}
+
 void bubble_sort(master_node_t *master, key_pair_t *pair, int num, int(*compare)(void *src1,
 		 void *src2))
 {
@@ -80,6 +80,61 @@ void nvfuse_move_buffer_list(struct nvfuse_superblock *sb,
 #endif
 }
 
+/*
+ * every hashed buffer is also kept in bm_rbroot ordered by its key. the
+ * inode number is the high half of the key, so the buffers of an inode are
+ * found without probing the hash for each of its blocks.
+ */
+static void nvfuse_bc_index_insert(struct nvfuse_buffer_manager *bm, struct nvfuse_buffer_cache *bc)
+{
+	struct rb_node **new = &bm->bm_rbroot.rb_node, *parent = NULL;
+	struct nvfuse_buffer_cache *this;
+
+	while (*new) {
+		this = rb_entry(*new, struct nvfuse_buffer_cache, bc_rbnode);
+		parent = *new;
+		assert(bc->bc_bno != this->bc_bno);
+		if (bc->bc_bno < this->bc_bno)
+			new = &(*new)->rb_left;
+		else
+			new = &(*new)->rb_right;
+	}
+
+	rb_link_node(&bc->bc_rbnode, parent, new);
+	rb_insert_color(&bc->bc_rbnode, &bm->bm_rbroot);
+}
+
+static void nvfuse_bc_index_erase(struct nvfuse_buffer_manager *bm, struct nvfuse_buffer_cache *bc)
+{
+	/* buffers that never had a key sit in the unused hash only */
+	if (RB_EMPTY_NODE(&bc->bc_rbnode))
+		return;
+
+	rb_erase(&bc->bc_rbnode, &bm->bm_rbroot);
+	rb_init_node(&bc->bc_rbnode);
+}
+
+/* the first hashed buffer whose key is not below key */
+static struct nvfuse_buffer_cache *nvfuse_bc_index_ceil(struct nvfuse_buffer_manager *bm, u64 key)
+{
+	struct rb_node *node = bm->bm_rbroot.rb_node;
+	struct nvfuse_buffer_cache *bc, *found = NULL;
+
+	while (node) {
+		bc = rb_entry(node, struct nvfuse_buffer_cache, bc_rbnode);
+		if (bc->bc_bno < key) {
+			node = node->rb_right;
+		} else {
+			found = bc;
+			if (bc->bc_bno == key)
+				break;
+			node = node->rb_left;
+		}
+	}
+
+	return found;
+}
+
 void nvfuse_init_bc(struct nvfuse_superblock *sb, struct nvfuse_buffer_cache *bc)
 {
 	bc->bc_bno = 0;
@@ -88,12 +143,14 @@ void nvfuse_init_bc(struct nvfuse_superblock *sb, struct nvfuse_buffer_cache *bc
 	bc->bc_lbno = 0;
 	bc->bc_load = 0;
 	bc->bc_pno = 0;
+	bc->bc_delayed = 0;
 
 	/* init spinlock */
 	SPINLOCK_INIT(&bc->bc_lock);
 
 	/* init ref count */
 	rte_atomic32_init(&bc->bc_ref);
+	rte_atomic32_init(&bc->bc_pin);
 	bc->bc_temp = 0;
 
 	memset(bc->bc_buf, 0x00, CLUSTER_SIZE);
@@ -135,7 +192,8 @@ struct nvfuse_buffer_cache *nvfuse_replace_buffer_cache(struct nvfuse_superblock
 	remove_ptr = (struct list_head *)(&bm->bm_list[type])->prev;
 	do {
 		bc = list_entry(remove_ptr, struct nvfuse_buffer_cache, bc_list);
-		if (rte_atomic32_read(&bc->bc_ref) == 0 && rte_atomic32_read(&bc->bc_bh_count) == 0) {
+		if (rte_atomic32_read(&bc->bc_ref) == 0 && rte_atomic32_read(&bc->bc_bh_count) == 0 &&
+		    rte_atomic32_read(&bc->bc_pin) == 0) {
 			break;
 		}
 		remove_ptr = remove_ptr->prev;
@@ -150,6 +208,7 @@ struct nvfuse_buffer_cache *nvfuse_replace_buffer_cache(struct nvfuse_superblock
 	list_del(&bc->bc_list);
 	/* remove hlist */
 	hlist_del(&bc->bc_hash);
+	nvfuse_bc_index_erase(bm, bc);
 
 	rte_atomic32_dec(&bm->bm_list_count[type]);
 	if (type == BUFFER_TYPE_UNUSED)
@@ -176,6 +235,22 @@ struct nvfuse_buffer_cache *nvfuse_hash_lookup(struct nvfuse_buffer_manager *bm,
 	return NULL;
 }
 
+/* whether a data block of ino has a buffer, without creating one */
+s32 nvfuse_bc_cached(struct nvfuse_superblock *sb, inode_t ino, lbno_t lblock)
+{
+	struct nvfuse_buffer_manager *bm = sb->sb_bm;
+	struct nvfuse_buffer_cache *bc;
+	u64 key;
+
+	nvfuse_make_pbno_key(ino, lblock, &key, NVFUSE_BP_TYPE_DATA);
+
+	SPINLOCK_LOCK(&bm->bm_lock);
+	bc = nvfuse_hash_lookup(bm, key);
+	SPINLOCK_UNLOCK(&bm->bm_lock);
+
+	return bc != NULL;
+}
+
 struct nvfuse_buffer_cache *nvfuse_find_bc(struct nvfuse_superblock *sb, u64 key, lbno_t lblock)
 {
 	struct nvfuse_buffer_manager *bm = sb->sb_bm;
@@ -219,6 +294,7 @@ struct nvfuse_buffer_cache *nvfuse_find_bc(struct nvfuse_superblock *sb, u64 key
 			/* initialize key and type values*/
 			bc->bc_bno = key;
 			bc->bc_list_type = status;
+			nvfuse_bc_index_insert(bm, bc);
 
 			/* bc is shared among bhs */
 			INIT_LIST_HEAD(&bc->bc_bh_head);
@@ -313,11 +389,14 @@ struct nvfuse_buffer_cache *nvfuse_get_bc(struct nvfuse_superblock *sb, struct n
 		return NULL;
 	}
 
-	if (!bc->bc_pno) {
+	/* a loaded buffer without an address holds data waiting for delayed allocation */
+	if (!bc->bc_pno && !bc->bc_load) {
 		pbno_t new_pno;
 		/* logical to physical address translation */
 		new_pno = nvfuse_get_pbn(sb, ictx, ino, lblock);
+#ifndef NVFUSE_USE_DELAYED_ALLOCATION
 		assert(new_pno);
+#endif
 		bc->bc_pno = new_pno;
 	}
 
@@ -333,16 +412,24 @@ struct nvfuse_buffer_cache *nvfuse_get_bc(struct nvfuse_superblock *sb, struct n
 			}
 		}
 	} else if (!bc->bc_pno && sync_read && !bc->bc_load) {
+#ifdef NVFUSE_USE_DELAYED_ALLOCATION
+		/* the block is not allocated yet, so it reads as zeroes */
+		memset(bc->bc_buf, 0x00, CLUSTER_SIZE);
+		bc->bc_load = 1;
+#else
 		/* FIXME: how can we handle this case? */
 		dprintf_error(BUFFER, " Error: bc has no pblock addr \n");
 		bc->bc_pno = nvfuse_get_pbn(sb, ictx, ino, lblock);
 		assert(0);
+#endif
 	}
 
 	assert(bc->bc_ino == ino);
 	assert(bc->bc_lbno == lblock);
 	assert(rte_atomic32_read(&bc->bc_ref) >= 1);
+#ifndef NVFUSE_USE_DELAYED_ALLOCATION
 	assert(bc->bc_pno);
+#endif
 
 	return bc;
 }
@@ -427,9 +514,7 @@ struct nvfuse_buffer_head *nvfuse_get_new_bh(struct nvfuse_superblock *sb,
 
 	bc = bh->bh_bc;
 
-	if (bc->bc_pno) {
-		memset(bc->bc_buf, 0x00, CLUSTER_SIZE);
-	}
+	memset(bc->bc_buf, 0x00, CLUSTER_SIZE);
 
 	/* this buffer will be update and then written out to disk later */
 	nvfuse_mark_dirty_bh(sb, bh);
@@ -449,30 +534,82 @@ struct nvfuse_buffer_cache *nvfuse_alloc_bc(struct nvfuse_superblock *sb)
 	memset(bc, 0x00, sizeof(struct nvfuse_buffer_cache));
 
 	SPINLOCK_INIT(&bc->bc_lock);
+	rb_init_node(&bc->bc_rbnode);
 
 	return bc;
 }
 
+static void nvfuse_move_bc_to_unused_list_nolock(struct nvfuse_superblock *sb,
+						 struct nvfuse_buffer_cache *bc)
+{
+	SPINLOCK_LOCK(&bc->bc_lock);
+
+	nvfuse_remove_bhs_in_bc(sb, bc);
+#ifdef NVFUSE_USE_DELAYED_ALLOCATION
+	/* the data is dropped before its block was allocated */
+	if (bc->bc_delayed)
+		nvfuse_release_delayed_blocks(sb, 1);
+#endif
+	/* FIXME: reinitialization is necessary */
+	bc->bc_load = 0;
+	bc->bc_pno = 0;
+	bc->bc_dirty = 0;
+	bc->bc_delayed = 0;
+	rte_atomic32_init(&bc->bc_ref);
+
+	SPINLOCK_UNLOCK(&bc->bc_lock);
+
+	nvfuse_move_buffer_list_nolock(sb, bc, BUFFER_TYPE_UNUSED, INSERT_HEAD);
+}
+
 void nvfuse_move_bc_to_unused_list(struct nvfuse_superblock *sb, u64 key) {
 	struct nvfuse_buffer_cache *bc;
 
 	SPINLOCK_LOCK(&sb->sb_bm->bm_lock);
 	bc = (struct nvfuse_buffer_cache *)nvfuse_hash_lookup(sb->sb_bm, key);
-	if (bc) {
-		SPINLOCK_LOCK(&bc->bc_lock);
+	if (bc)
+		nvfuse_move_bc_to_unused_list_nolock(sb, bc);
+	SPINLOCK_UNLOCK(&sb->sb_bm->bm_lock);
+}
 
-		nvfuse_remove_bhs_in_bc(sb, bc);
-		/* FIXME: reinitialization is necessary */
-		bc->bc_load = 0;
-		bc->bc_pno = 0;
-		bc->bc_dirty = 0;
-		rte_atomic32_init(&bc->bc_ref);
+/*
+ * move the buffers of data blocks [from, to) of ino to the unused list,
+ * walking only the blocks that are cached. with clean_only, dirty buffers
+ * and buffers in use are left alone. returns the number of buffers moved.
+ */
+s32 nvfuse_invalidate_bcs(struct nvfuse_superblock *sb, inode_t ino, lbno_t from, lbno_t to,
+			  s32 clean_only)
+{
+	struct nvfuse_buffer_manager *bm = sb->sb_bm;
+	struct nvfuse_buffer_cache *bc;
+	struct rb_node *next;
+	u64 key, end;
+	s32 count = 0;
 
-		SPINLOCK_UNLOCK(&bc->bc_lock);
+	if (from >= to)
+		return 0;
+
+	nvfuse_make_pbno_key(ino, from, &key, NVFUSE_BP_TYPE_DATA);
+	end = key + (to - from);
+
+	SPINLOCK_LOCK(&bm->bm_lock);
+	bc = nvfuse_bc_index_ceil(bm, key);
+	while (bc && bc->bc_bno < end) {
+		/* a buffer moved to the unused list keeps its key and stays indexed */
+		next = rb_next(&bc->bc_rbnode);
+
+		if (bc->bc_list_type != BUFFER_TYPE_UNUSED &&
+		    (!clean_only || (bc->bc_list_type == BUFFER_TYPE_CLEAN &&
+				     !rte_atomic32_read(&bc->bc_bh_count)))) {
+			nvfuse_move_bc_to_unused_list_nolock(sb, bc);
+			count++;
+		}
 
-		nvfuse_move_buffer_list_nolock(sb, bc, BUFFER_TYPE_UNUSED, INSERT_HEAD);
+		bc = next ? rb_entry(next, struct nvfuse_buffer_cache, bc_rbnode) : NULL;
 	}
-	SPINLOCK_UNLOCK(&sb->sb_bm->bm_lock);
+	SPINLOCK_UNLOCK(&bm->bm_lock);
+
+	return count;
 }
 
 s32 nvfuse_remove_buffer_cache(struct nvfuse_superblock *sb, s32 nr_buffers)
@@ -505,6 +642,12 @@ s32 nvfuse_remove_buffer_cache(struct nvfuse_superblock *sb, s32 nr_buffers)
 
 		SPINLOCK_LOCK(&bc->bc_lock);
 
+		/* the delayed allocator still looks at it */
+		if (rte_atomic32_read(&bc->bc_pin)) {
+			SPINLOCK_UNLOCK(&bc->bc_lock);
+			continue;
+		}
+
 		if (rte_atomic32_read(&bc->bc_bh_count)) {
 			dprintf_error(BUFFER, " removing bhs in bc is not considered.\n");
 			assert(0);
@@ -515,6 +658,7 @@ s32 nvfuse_remove_buffer_cache(struct nvfuse_superblock *sb, s32 nr_buffers)
 		assert(!bc->bc_dirty);
 		list_del(&bc->bc_list);
 		hlist_del(&bc->bc_hash);
+		nvfuse_bc_index_erase(bm, bc);
 
 		SPINLOCK_UNLOCK(&bc->bc_lock);
 
@@ -655,6 +799,7 @@ int nvfuse_init_buffer_cache(struct nvfuse_superblock *sb, s32 buffer_size)
 		INIT_HLIST_HEAD(&bm->bm_hash[i]);
 		rte_atomic32_set(&bm->bm_hash_count[i], 0);
 	}
+	bm->bm_rbroot = RB_ROOT;
 
 	if (nvfuse_process_model_is_standalone()) {
 		s32 recommended_size;
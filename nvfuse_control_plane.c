@@ -38,6 +38,7 @@
 #include "nvfuse_control_plane.h"
 #include "nvfuse_buffer_cache.h"
 #include "nvfuse_mkfs.h"
+#include "nvfuse_free_extents.h"
 
 #if NVFUSE_OS == NVFUSE_OS_LINUX
 #include <libaio.h>
@@ -566,6 +567,7 @@ s32 nvfuse_destroy_containers_for_app_unregistration(struct nvfuse_handle *nvh,
 		/* clear data bitmap tables */
 		dbitmap_bh = nvfuse_get_bh(sb, NULL, DBITMAP_INO, container_id, READ, NVFUSE_TYPE_META);
 		memset(dbitmap_bh->bh_buf, 0x00, CLUSTER_SIZE);
+		nvfuse_fext_invalidate(sb, container_id);
 		nvfuse_release_bh(sb, dbitmap_bh, 0, DIRTY);
 
 		/* clear inode bitmap tables */
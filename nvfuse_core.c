@@ -58,6 +58,9 @@
 #include "nvfuse_debug.h"
 #include "nvfuse_flushwork.h"
 #include "nvfuse_reactor.h"
+#include "nvfuse_free_extents.h"
+#include "nvfuse_discard.h"
+#include "nvfuse_reclaim.h"
 
 struct nvfuse_inode_ctx *nvfuse_read_inode(struct nvfuse_superblock *sb,
 		struct nvfuse_inode_ctx *ictx_given, inode_t ino)
@@ -142,6 +145,7 @@ s32 nvfuse_relocate_delete_inode(struct nvfuse_superblock *sb, struct nvfuse_ino
 	inode->i_deleted = 1;
 	inode->i_ino = 0;
 	inode->i_size = 0;
+	inode->i_flags = 0;
 
 	nvfuse_release_inode(sb, ictx, DIRTY);
 	nvfuse_inc_free_inodes(sb, ino);
@@ -179,7 +183,7 @@ u32 nvfuse_find_free_inode(struct nvfuse_superblock *sb, struct nvfuse_inode_ctx
 		if (nvfuse_process_model_is_dataplane())
 			bg_id = nvfuse_get_next_bg_id(sb, 1 /*inode type*/);
 		else
-			bg_id = (bg_id + 1) % sb->sb_bg_num;
+			bg_id = nvfuse_get_next_alloc_bg_id(sb, nvfuse_get_alloc_group(sb), last_id, bg_id);
 
 		hint_ino = 0;
 		count++;
@@ -210,14 +214,19 @@ u32 nvfuse_find_free_inode(struct nvfuse_superblock *sb, struct nvfuse_inode_ctx
 void nvfuse_free_inode_size(struct nvfuse_superblock *sb, struct nvfuse_inode_ctx *ictx, s64 size)
 {
 	struct nvfuse_inode *inode;
-	lbno_t offset;
 	u32 num_block, trun_num_block;
 	s32 res;
-	u64 key;
 	s32 unused_count = 0;
 
 	inode = ictx->ictx_inode;
 
+	/* blocks reserved ahead of the file size go back first */
+	nvfuse_release_prealloc(sb, ictx);
+
+	/* inline data has no blocks to free */
+	if (inode->i_flags & NVFUSE_INODE_FLAG_INLINE)
+		return;
+
 	num_block = NVFUSE_SIZE_TO_BLK(inode->i_size);
 	trun_num_block = NVFUSE_SIZE_TO_BLK(size);
 	if (inode->i_size & (CLUSTER_SIZE - 1))
@@ -231,17 +240,8 @@ void nvfuse_free_inode_size(struct nvfuse_superblock *sb, struct nvfuse_inode_ct
 	if (!num_block || num_block <= trun_num_block)
 		return;
 
-	/*
-	 * Too slow when large inode is deleted.
-	 * FIXME: buffers will be managed by RBtree or other structures.
-	 */
-
-	for (offset = num_block - 1; offset >= trun_num_block; offset--) {
-		nvfuse_make_pbno_key(inode->i_ino, offset, &key, NVFUSE_BP_TYPE_DATA);
-		nvfuse_move_bc_to_unused_list(sb, key);
-		if (offset == 0)
-			break;
-	}
+	/* only the blocks that are cached are visited */
+	unused_count = nvfuse_invalidate_bcs(sb, inode->i_ino, trun_num_block, num_block, 0);
 
 	if (!sb->sb_nvh->nvh_params.preallocation && nvfuse_process_model_is_dataplane()) {
 		dprintf_error(BUFFER, " dataplane mode is not supported.\n");
@@ -272,6 +272,7 @@ inode_t nvfuse_alloc_new_inode(struct nvfuse_superblock *sb, struct nvfuse_inode
 	inode_t hint_ino = 0;
 	inode_t last_allocated_ino = 0;
 	s32 container_id;
+	struct nvfuse_alloc_group *ag = NULL;
 
 	if (nvfuse_process_model_is_dataplane() && !nvfuse_check_free_inode(sb)) {
 		container_id = nvfuse_alloc_container_from_primary_process(sb->sb_nvh, CONTAINER_NEW_ALLOC);
@@ -284,7 +285,17 @@ inode_t nvfuse_alloc_new_inode(struct nvfuse_superblock *sb, struct nvfuse_inode
 		}
 	}
 
-	last_allocated_ino = sb->sb_last_allocated_ino;
+	if (nvfuse_process_model_is_standalone()) {
+		ag = nvfuse_get_alloc_group(sb);
+		last_allocated_ino = ag->ag_last_allocated_ino;
+
+		/* the cursor left the slice of the core, look at home again first */
+		if (last_allocated_ino / sb->sb_no_of_inodes_per_bg < ag->ag_bg_start ||
+		    last_allocated_ino / sb->sb_no_of_inodes_per_bg >= ag->ag_bg_start + ag->ag_bg_count)
+			last_allocated_ino = ag->ag_bg_start * sb->sb_no_of_inodes_per_bg;
+	} else {
+		last_allocated_ino = sb->sb_last_allocated_ino;
+	}
 	hint_ino = nvfuse_find_free_inode(sb, ictx, last_allocated_ino);
 	if (hint_ino) {
 		search_block = hint_ino / INODE_ENTRY_NUM;
@@ -331,7 +342,9 @@ RES:
 	nvfuse_release_bh(sb, bh, 0, DIRTY);
 
 	/* keep hit information to rapidly find a free inode */
-	if (!spdk_process_is_primary() || nvfuse_process_model_is_standalone()) {
+	if (nvfuse_process_model_is_standalone()) {
+		ag->ag_last_allocated_ino = alloc_ino + 1;
+	} else if (!spdk_process_is_primary()) {
 		sb->sb_last_allocated_ino = alloc_ino + 1;
 	}
 
@@ -366,6 +379,12 @@ void nvfuse_release_ibitmap(struct nvfuse_superblock *sb, u32 bg_id, u32 ino)
 	nvfuse_release_bh(sb, bh, 0, DIRTY);
 }
 
+/* a bg with blocks reserved by preallocation windows is not given back yet */
+static s32 nvfuse_bg_has_reservation(struct nvfuse_superblock *sb, u32 bg_id)
+{
+	return sb->sb_pa_map && sb->sb_pa_map[bg_id].pm_count;
+}
+
 void nvfuse_inc_free_inodes(struct nvfuse_superblock *sb, inode_t ino)
 {
 	struct nvfuse_bg_descriptor *bd = NULL;
@@ -378,9 +397,9 @@ void nvfuse_inc_free_inodes(struct nvfuse_superblock *sb, inode_t ino)
 	assert(bd->bd_id == bg_id);
 
 	bd->bd_free_inodes++;
-	sb->sb_free_inodes++;
+	nvfuse_add_sb_counter(sb, NVFUSE_SB_FREE_INODES, 1);
 	if (!spdk_process_is_primary()) {
-		sb->asb.asb_free_inodes++;
+		nvfuse_add_sb_counter(sb, NVFUSE_SB_ASB_FREE_INODES, 1);
 	}
 	assert(bd->bd_free_inodes <= bd->bd_max_inodes);
 	nvfuse_release_bh(sb, bd_bh, 0, DIRTY);
@@ -389,7 +408,7 @@ void nvfuse_inc_free_inodes(struct nvfuse_superblock *sb, inode_t ino)
 	if (!sb->sb_nvh->nvh_params.preallocation && nvfuse_process_model_is_dataplane()) {
 		//dprintf_info(INODE, "bd free blocks = %d(/%d) inode = %d(/%d)\n", bd->bd_free_blocks + (bd->bd_dtable_start % sb->sb_no_of_blocks_per_bg), bd->bd_max_blocks, bd->bd_free_inodes, bd->bd_max_inodes);
 		if (bd->bd_free_blocks + (bd->bd_dtable_start % sb->sb_no_of_blocks_per_bg) == bd->bd_max_blocks &&
-		    bd->bd_free_inodes == bd->bd_max_inodes) {
+		    bd->bd_free_inodes == bd->bd_max_inodes && !nvfuse_bg_has_reservation(sb, bg_id)) {
 			//dprintf_info(INODE, " Deallocate bg = %d \n", bg_id);
 			nvfuse_remove_bg(sb, bg_id);
 		}
@@ -409,9 +428,9 @@ void nvfuse_dec_free_inodes(struct nvfuse_superblock *sb, inode_t ino)
 	assert(bd->bd_id == bg_id);
 
 	bd->bd_free_inodes--;
-	sb->sb_free_inodes--;
+	nvfuse_add_sb_counter(sb, NVFUSE_SB_FREE_INODES, -1);
 	if (!spdk_process_is_primary()) {
-		sb->asb.asb_free_inodes--;
+		nvfuse_add_sb_counter(sb, NVFUSE_SB_ASB_FREE_INODES, -1);
 	}
 	assert(bd->bd_free_inodes >= 0);
 	nvfuse_release_bh(sb, bd_bh, 0, DIRTY);
@@ -429,27 +448,18 @@ void nvfuse_inc_free_blocks(struct nvfuse_superblock *sb, u32 blockno, u32 cnt)
 	assert(bd->bd_id == bg_id);
 
 	bd->bd_free_blocks += cnt;
-
-	SPINLOCK_LOCK(&sb->sb_lock);
-
-	sb->sb_free_blocks += cnt;
-	sb->sb_no_of_used_blocks -= cnt;
-	if (!spdk_process_is_primary())
-		sb->asb.asb_free_blocks += cnt;
-
 	assert(bd->bd_free_blocks <= bd->bd_max_blocks);
-	assert(sb->sb_free_blocks <= sb->sb_no_of_blocks);
-	if (!spdk_process_is_primary())
-		assert(sb->asb.asb_free_blocks <= sb->sb_no_of_blocks);
-	assert(sb->sb_no_of_used_blocks >= 0);
 
-	SPINLOCK_UNLOCK(&sb->sb_lock);
+	nvfuse_add_sb_counter(sb, NVFUSE_SB_FREE_BLOCKS, cnt);
+	nvfuse_add_sb_counter(sb, NVFUSE_SB_USED_BLOCKS, -(s64)cnt);
+	if (!spdk_process_is_primary())
+		nvfuse_add_sb_counter(sb, NVFUSE_SB_ASB_FREE_BLOCKS, cnt);
 
 	/* removal of unused bg to primary process (e.g., control plane)*/
 	if (!sb->sb_nvh->nvh_params.preallocation && nvfuse_process_model_is_dataplane()) {
 		dprintf_info(BLOCK, " bd free blocks = %d(/%d) inode = %d(/%d)\n", bd->bd_free_blocks + (bd->bd_dtable_start % sb->sb_no_of_blocks_per_bg), bd->bd_max_blocks, bd->bd_free_inodes, bd->bd_max_inodes);
 		if (bd->bd_free_blocks + (bd->bd_dtable_start % sb->sb_no_of_blocks_per_bg) == bd->bd_max_blocks &&
-		    bd->bd_free_inodes == bd->bd_max_inodes) {
+		    bd->bd_free_inodes == bd->bd_max_inodes && !nvfuse_bg_has_reservation(sb, bg_id)) {
 			dprintf_info(BLOCK, " Deallocate bg = %d \n", bg_id);
 			nvfuse_remove_bg(sb, bg_id);
 		}
@@ -479,8 +489,8 @@ u32 nvfuse_scan_free_ibitmap(struct nvfuse_superblock *sb, struct nvfuse_inode_c
 	struct nvfuse_buffer_head *bd_bh;
 	struct nvfuse_buffer_head *bh;
 	void *buf;
-	u32 count = 0;
-	u32 free_inode = hint_free_inode;
+	u32 nr_inodes = sb->sb_no_of_inodes_per_bg;
+	u32 free_inode = hint_free_inode % nr_inodes;
 	u32 found = 0;
 
 	bd_bh = nvfuse_get_bh(sb, ictx, BD_INO, bg_id, READ, NVFUSE_TYPE_META);
@@ -490,14 +500,16 @@ u32 nvfuse_scan_free_ibitmap(struct nvfuse_superblock *sb, struct nvfuse_inode_c
 	bh = nvfuse_get_bh(sb, ictx, IBITMAP_INO, bg_id, READ, NVFUSE_TYPE_META);
 	buf = bh->bh_buf;
 
-	while (bd->bd_free_inodes && count < sb->sb_no_of_inodes_per_bg) {
-		if (!ext2fs_test_bit(free_inode, buf)) {
+	if (bd->bd_free_inodes) {
+		/* search from the hint to the end, then wrap around */
+		free_inode = nvfuse_bitmap_find_next_zero(buf, nr_inodes, free_inode);
+		if (free_inode >= nr_inodes)
+			free_inode = nvfuse_bitmap_find_next_zero(buf, hint_free_inode % nr_inodes, 0);
+
+		if (free_inode < nr_inodes) {
 			dprintf_info(INODE, " bg = %d free block %d found \n", bg_id, free_inode);
 			found = 1;
-			break;
 		}
-		free_inode = (free_inode + 1) % sb->sb_no_of_inodes_per_bg;
-		count++;
 	}
 
 	if (found && free_inode < sb->sb_no_of_inodes_per_bg) {
@@ -620,6 +632,241 @@ u32 nvfuse_get_curr_bg_id(struct nvfuse_superblock *sb, s32 is_inode)
 	return curr_bg_id;
 }
 
+/* slot of the calling thread, lcores keep their own id */
+static __thread s32 nvfuse_thread_slot = -1;
+static rte_atomic32_t nvfuse_thread_count;
+
+s32 nvfuse_get_thread_slot(void)
+{
+	u32 lcore_id;
+
+	if (nvfuse_thread_slot < 0) {
+		lcore_id = rte_lcore_id();
+		if (lcore_id != LCORE_ID_ANY)
+			nvfuse_thread_slot = lcore_id;
+		else
+			nvfuse_thread_slot = rte_atomic32_add_return(&nvfuse_thread_count, 1);
+	}
+
+	return nvfuse_thread_slot;
+}
+
+/* counters checked by nvfuse_check_free_block() and nvfuse_check_free_inode() */
+static inline s32 nvfuse_sb_counter_is_bounded(enum nvfuse_sb_counter counter)
+{
+	switch (counter) {
+	case NVFUSE_SB_FREE_BLOCKS:
+	case NVFUSE_SB_ASB_FREE_BLOCKS:
+	case NVFUSE_SB_FREE_INODES:
+	case NVFUSE_SB_ASB_FREE_INODES:
+	case NVFUSE_SB_PA_RESERVED_BLOCKS:
+	case NVFUSE_SB_DA_RESERVED_BLOCKS:
+		return 1;
+	default:
+		return 0;
+	}
+}
+
+/* add value to a counter of the superblock without touching shared cache lines */
+void nvfuse_add_sb_counter(struct nvfuse_superblock *sb, enum nvfuse_sb_counter counter, s64 value)
+{
+	struct nvfuse_sb_percore *pc = sb->sb_percore + nvfuse_get_thread_slot() % SPDK_NUM_CORES;
+	s64 count;
+
+	count = rte_atomic64_add_return(&pc->pc_count[counter], value);
+
+	/* keep the part the other cores cannot see within a batch */
+	if (nvfuse_sb_counter_is_bounded(counter) && llabs(count) >= NVFUSE_SB_COUNTER_BATCH)
+		nvfuse_fold_sb_counters(sb);
+}
+
+/* value of a counter folded into the superblock fields so far */
+static s64 nvfuse_read_sb_counter_folded(struct nvfuse_superblock *sb, enum nvfuse_sb_counter counter)
+{
+	switch (counter) {
+	case NVFUSE_SB_FREE_BLOCKS:
+		return sb->sb_free_blocks;
+	case NVFUSE_SB_USED_BLOCKS:
+		return sb->sb_no_of_used_blocks;
+	case NVFUSE_SB_ASB_FREE_BLOCKS:
+		return sb->asb.asb_free_blocks;
+	case NVFUSE_SB_FREE_INODES:
+		return sb->sb_free_inodes;
+	case NVFUSE_SB_ASB_FREE_INODES:
+		return sb->asb.asb_free_inodes;
+	case NVFUSE_SB_BP_SET_INDEX_TSC:
+		return sb->bp_set_index_tsc;
+	case NVFUSE_SB_BP_SET_INDEX_COUNT:
+		return sb->bp_set_index_count;
+	case NVFUSE_SB_BP_GET_INDEX_TSC:
+		return sb->bp_get_index_tsc;
+	case NVFUSE_SB_BP_GET_INDEX_COUNT:
+		return sb->bp_get_index_count;
+	case NVFUSE_SB_BP_DEL_INDEX_TSC:
+		return sb->bp_del_index_tsc;
+	case NVFUSE_SB_BP_DEL_INDEX_COUNT:
+		return sb->bp_del_index_count;
+	case NVFUSE_SB_BP_MASTER_HIT_COUNT:
+		return sb->bp_master_hit_count;
+	case NVFUSE_SB_NVME_IO_TSC:
+		return sb->nvme_io_tsc;
+	case NVFUSE_SB_NVME_IO_COUNT:
+		return sb->nvme_io_count;
+	case NVFUSE_SB_PA_RESERVED_BLOCKS:
+		return sb->sb_pa_reserved_blocks;
+	case NVFUSE_SB_DA_RESERVED_BLOCKS:
+		return sb->sb_da_reserved_blocks;
+	default:
+		assert(0);
+		return 0;
+	}
+}
+
+/* folded value of a counter plus what the calling core added since its last fold */
+static s64 nvfuse_read_sb_counter_local(struct nvfuse_superblock *sb, enum nvfuse_sb_counter counter)
+{
+	struct nvfuse_sb_percore *pc = sb->sb_percore + nvfuse_get_thread_slot() % SPDK_NUM_CORES;
+
+	return nvfuse_read_sb_counter_folded(sb, counter) + rte_atomic64_read(&pc->pc_count[counter]);
+}
+
+/* exact value of a counter, the slots of the other cores are only read */
+s64 nvfuse_sum_sb_counter(struct nvfuse_superblock *sb, enum nvfuse_sb_counter counter)
+{
+	s64 sum;
+	s32 i;
+
+	SPINLOCK_LOCK(&sb->sb_lock);
+	sum = nvfuse_read_sb_counter_folded(sb, counter);
+	for (i = 0; i < SPDK_NUM_CORES; i++)
+		sum += rte_atomic64_read(&sb->sb_percore[i].pc_count[counter]);
+	SPINLOCK_UNLOCK(&sb->sb_lock);
+
+	return sum;
+}
+
+/*
+ * move what the calling core added since its last fold into the superblock
+ * fields. the fields alone may be off by the deltas other cores still hold,
+ * so they are only checked through nvfuse_sum_sb_counter().
+ */
+void nvfuse_fold_sb_counters(struct nvfuse_superblock *sb)
+{
+	struct nvfuse_sb_percore *pc = sb->sb_percore + nvfuse_get_thread_slot() % SPDK_NUM_CORES;
+	s64 delta[NVFUSE_SB_COUNTER_NUM];
+	s32 c;
+
+	SPINLOCK_LOCK(&sb->sb_lock);
+
+	/* threads sharing a slot may add meanwhile, only what was read is moved */
+	for (c = 0; c < NVFUSE_SB_COUNTER_NUM; c++) {
+		delta[c] = rte_atomic64_read(&pc->pc_count[c]);
+		if (delta[c])
+			rte_atomic64_sub(&pc->pc_count[c], delta[c]);
+	}
+
+	sb->sb_free_blocks += delta[NVFUSE_SB_FREE_BLOCKS];
+	sb->sb_no_of_used_blocks += delta[NVFUSE_SB_USED_BLOCKS];
+	sb->asb.asb_free_blocks += delta[NVFUSE_SB_ASB_FREE_BLOCKS];
+	sb->sb_free_inodes += delta[NVFUSE_SB_FREE_INODES];
+	sb->asb.asb_free_inodes += delta[NVFUSE_SB_ASB_FREE_INODES];
+
+	sb->bp_set_index_tsc += delta[NVFUSE_SB_BP_SET_INDEX_TSC];
+	sb->bp_set_index_count += delta[NVFUSE_SB_BP_SET_INDEX_COUNT];
+	sb->bp_get_index_tsc += delta[NVFUSE_SB_BP_GET_INDEX_TSC];
+	sb->bp_get_index_count += delta[NVFUSE_SB_BP_GET_INDEX_COUNT];
+	sb->bp_del_index_tsc += delta[NVFUSE_SB_BP_DEL_INDEX_TSC];
+	sb->bp_del_index_count += delta[NVFUSE_SB_BP_DEL_INDEX_COUNT];
+	sb->bp_master_hit_count += delta[NVFUSE_SB_BP_MASTER_HIT_COUNT];
+	sb->nvme_io_tsc += delta[NVFUSE_SB_NVME_IO_TSC];
+	sb->nvme_io_count += delta[NVFUSE_SB_NVME_IO_COUNT];
+	sb->sb_pa_reserved_blocks += delta[NVFUSE_SB_PA_RESERVED_BLOCKS];
+	sb->sb_da_reserved_blocks += delta[NVFUSE_SB_DA_RESERVED_BLOCKS];
+
+	SPINLOCK_UNLOCK(&sb->sb_lock);
+}
+
+/*
+ * split the bgs into slices of consecutive bgs, one per allocation group.
+ * the first groups get one more bg when they cannot be split evenly.
+ */
+void nvfuse_init_alloc_groups(struct nvfuse_superblock *sb)
+{
+	struct nvfuse_alloc_group *ag;
+	u32 start = 0;
+	s32 i;
+
+	sb->sb_ag_num = NVFUSE_ALLOC_GROUPS < sb->sb_bg_num ? NVFUSE_ALLOC_GROUPS : sb->sb_bg_num;
+#ifndef NVFUSE_USE_ALLOC_GROUPS
+	sb->sb_ag_num = 1;
+#endif
+
+	for (i = 0; i < sb->sb_ag_num; i++) {
+		ag = sb->sb_ag + i;
+		ag->ag_bg_start = start;
+		ag->ag_bg_count = sb->sb_bg_num / sb->sb_ag_num + (i < sb->sb_bg_num % sb->sb_ag_num);
+		ag->ag_last_allocated_ino = start * sb->sb_no_of_inodes_per_bg;
+		ag->ag_last_allocated_bgid = start;
+		ag->ag_last_allocated_bgid_by_ino = 0;
+		start += ag->ag_bg_count;
+	}
+	assert(start == sb->sb_bg_num);
+}
+
+/* allocation group of the calling thread, new inodes are taken from its slice */
+struct nvfuse_alloc_group *nvfuse_get_alloc_group(struct nvfuse_superblock *sb)
+{
+	return sb->sb_ag + nvfuse_get_thread_slot() % sb->sb_ag_num;
+}
+
+/* allocation group whose slice holds bg_id, data blocks of an inode come from it */
+struct nvfuse_alloc_group *nvfuse_get_bg_alloc_group(struct nvfuse_superblock *sb, u32 bg_id)
+{
+	u32 count = sb->sb_bg_num / sb->sb_ag_num;
+	u32 big = sb->sb_bg_num % sb->sb_ag_num;
+
+	assert(bg_id < sb->sb_bg_num);
+
+	/* the first big groups have count + 1 bgs */
+	if (bg_id < big * (count + 1))
+		return sb->sb_ag + bg_id / (count + 1);
+
+	return sb->sb_ag + big + (bg_id - big * (count + 1)) / count;
+}
+
+/*
+ * next bg to look at in the walk started at first_bg_id: the rest of the
+ * slice of ag, then the bgs of the other groups. returns first_bg_id when
+ * every bg has been visited.
+ */
+u32 nvfuse_get_next_alloc_bg_id(struct nvfuse_superblock *sb, struct nvfuse_alloc_group *ag,
+				u32 first_bg_id, u32 bg_id)
+{
+	u32 start = ag->ag_bg_start;
+	u32 end = ag->ag_bg_start + ag->ag_bg_count;
+	u32 next;
+
+	if (first_bg_id < start || first_bg_id >= end)
+		return (bg_id + 1) % sb->sb_bg_num;
+
+	if (bg_id >= start && bg_id < end) {
+		next = start + (bg_id - start + 1) % ag->ag_bg_count;
+		if (next != first_bg_id)
+			return next;
+
+		/* the slice is full, spill over to the other groups */
+		if (ag->ag_bg_count == sb->sb_bg_num)
+			return first_bg_id;
+		return end % sb->sb_bg_num;
+	}
+
+	next = (bg_id + 1) % sb->sb_bg_num;
+	if (next == start)
+		return first_bg_id;
+
+	return next;
+}
+
 void nvfuse_dec_free_blocks(struct nvfuse_superblock *sb, u32 blockno, u32 cnt)
 {
 	struct nvfuse_bg_descriptor *bd = NULL;
@@ -631,24 +878,14 @@ void nvfuse_dec_free_blocks(struct nvfuse_superblock *sb, u32 blockno, u32 cnt)
 	bd = (struct nvfuse_bg_descriptor *)bd_bh->bh_buf;
 	assert(bd->bd_id == bg_id);
 
-	SPINLOCK_LOCK(&sb->sb_lock);
-	//SPINLOCK_LOCK(&bd_bh->bh_lock);
-
 	bd->bd_free_blocks -= cnt;
-	sb->sb_free_blocks -= cnt;
-	sb->sb_no_of_used_blocks += cnt;
-
-	if (!spdk_process_is_primary())
-		sb->asb.asb_free_blocks -= cnt;
-
 	assert(bd->bd_free_blocks >= 0);
-	assert(sb->sb_free_blocks >= 0);
+
+	nvfuse_add_sb_counter(sb, NVFUSE_SB_FREE_BLOCKS, -(s64)cnt);
+	nvfuse_add_sb_counter(sb, NVFUSE_SB_USED_BLOCKS, cnt);
 	if (!spdk_process_is_primary())
-		assert(sb->asb.asb_free_blocks >= 0);
-	assert(sb->sb_no_of_used_blocks <= sb->sb_no_of_blocks);
+		nvfuse_add_sb_counter(sb, NVFUSE_SB_ASB_FREE_BLOCKS, -(s64)cnt);
 
-	SPINLOCK_UNLOCK(&sb->sb_lock);
-	//SPINLOCK_UNLOCK(&bd_bh->bh_lock);
 	nvfuse_release_bh(sb, bd_bh, 0, DIRTY);
 }
 
@@ -674,24 +911,56 @@ u32 nvfuse_get_free_blocks(struct nvfuse_superblock *sb, u32 bg_id)
 	return free_blocks;
 }
 
-s32 nvfuse_check_free_inode(struct nvfuse_superblock *sb)
+/*
+ * the free space checks first look at the folded counters and the deltas
+ * of the calling core. every other core holds less than a batch of each
+ * counter unfolded, so the deltas of all cores are summed only when the
+ * request does not fit in what is left after that margin.
+ */
+#define NVFUSE_SB_COUNTER_MARGIN	((s64)(SPDK_NUM_CORES - 1) * NVFUSE_SB_COUNTER_BATCH)
+
+typedef s64 (*nvfuse_sb_counter_reader)(struct nvfuse_superblock *sb, enum nvfuse_sb_counter counter);
+
+static s64 nvfuse_free_inodes_read(struct nvfuse_superblock *sb, nvfuse_sb_counter_reader read)
 {
 	if (!spdk_process_is_primary())
-		return sb->asb.asb_free_inodes ? 1 : 0;
+		return read(sb, NVFUSE_SB_ASB_FREE_INODES);
 	else
-		return sb->sb_free_inodes ? 1 : 0;
+		return read(sb, NVFUSE_SB_FREE_INODES);
 }
 
-s32 nvfuse_check_free_block(struct nvfuse_superblock *sb, u32 num_blocks)
+/* blocks reserved by preallocation windows and buffered writes are still counted as free */
+static s64 nvfuse_free_blocks_read(struct nvfuse_superblock *sb, nvfuse_sb_counter_reader read)
 {
-	s32 ret;
+	s64 free_blocks;
 
 	if (spdk_process_is_primary())
-		ret = (sb->sb_free_blocks >= (s64)num_blocks) ? 1 : 0;
+		free_blocks = read(sb, NVFUSE_SB_FREE_BLOCKS);
 	else
-		ret = (sb->asb.asb_free_blocks >= (s64)num_blocks) ? 1 : 0;
+		free_blocks = read(sb, NVFUSE_SB_ASB_FREE_BLOCKS);
 
-	return ret;
+	free_blocks -= read(sb, NVFUSE_SB_PA_RESERVED_BLOCKS);
+	free_blocks -= read(sb, NVFUSE_SB_DA_RESERVED_BLOCKS);
+
+	return free_blocks;
+}
+
+s32 nvfuse_check_free_inode(struct nvfuse_superblock *sb)
+{
+	if (nvfuse_free_inodes_read(sb, nvfuse_read_sb_counter_local) - NVFUSE_SB_COUNTER_MARGIN >= 1)
+		return 1;
+
+	return nvfuse_free_inodes_read(sb, nvfuse_sum_sb_counter) >= 1 ? 1 : 0;
+}
+
+s32 nvfuse_check_free_block(struct nvfuse_superblock *sb, u32 num_blocks)
+{
+	/* the free and the two reserved counters each have their margin */
+	if (nvfuse_free_blocks_read(sb, nvfuse_read_sb_counter_local) - 3 * NVFUSE_SB_COUNTER_MARGIN >=
+	    (s64)num_blocks)
+		return 1;
+
+	return nvfuse_free_blocks_read(sb, nvfuse_sum_sb_counter) >= (s64)num_blocks ? 1 : 0;
 }
 
 void nvfuse_free_blocks(struct nvfuse_superblock *sb, u32 block_to_delete, u32 count)
@@ -724,181 +993,280 @@ RESET:
 	}
 }
 
-s32 nvfuse_set_dir_indexing(struct nvfuse_superblock *sb, struct nvfuse_inode *inode, s8 *filename,
-			    u32 offset)
+static bkey_t nvfuse_dir_index_key(struct nvfuse_superblock *sb, s8 *filename)
 {
-	bkey_t key;
 	u32 dir_hash[2];
-	u32 collision = ~0;
-	u32 cur_offset;
+	bkey_t key;
+
+	nvfuse_dir_hash(filename, dir_hash, dir_hash + 1);
+	key = (u64)dir_hash[0] | ((u64)dir_hash[1]) << 32;
+	if (sb->bp_dir_hash_bits)
+		key &= ~0ULL << (64 - sb->bp_dir_hash_bits);
+
+	/* zero keys mark empty slots in b+tree nodes */
+	key |= NVFUSE_DIR_HASH_SEQ_MASK + 1;
+
+	return key & ~NVFUSE_DIR_HASH_SEQ_MASK;
+}
+
+/* check whether the dentry block pointed out by the index has the given name */
+static s32 nvfuse_dir_index_match(struct nvfuse_superblock *sb, struct nvfuse_inode_ctx *dir_ictx,
+				  u32 offset, s8 *filename)
+{
+	struct nvfuse_dir_block db;
+	s32 match;
+
+	if (nvfuse_get_dir_block(sb, dir_ictx, offset, &db) < 0)
+		return 0;
+
+	match = (nvfuse_dentry_find(db.db_buf, db.db_size, filename) != NULL);
+	nvfuse_release_dir_block(sb, &db, NVF_CLEAN);
+
+	return match;
+}
+
+/*
+ * find the chain member whose value points out the given dentry block
+ * returns its sequence number and value or -1 if not found
+ */
+static s32 nvfuse_dir_index_find_offset(master_node_t *master, bkey_t base, u32 offset,
+					bitem_t *value)
+{
+	bkey_t key;
+	u32 seq;
+
+	for (seq = 0; seq <= NVFUSE_DIR_HASH_SEQ_MASK; seq++) {
+		key = base | seq;
+		if (bp_find_key(master, &key, value) < 0)
+			break;
+
+		if ((*value & NVFUSE_DIR_INDEX_OFFSET_MASK) == offset)
+			return seq;
+
+		if (!(*value & NVFUSE_DIR_INDEX_CHAINED))
+			break;
+	}
+
+	return -1;
+}
+
+s32 nvfuse_set_dir_indexing(struct nvfuse_superblock *sb, struct nvfuse_inode_ctx *dir_ictx,
+			    s8 *filename, u32 offset)
+{
+	bkey_t base, key;
+	bitem_t cur_offset;
+	u32 seq;
+	s32 res = 0;
 	u64 start_tsc = spdk_get_ticks();
 	u64 end_tsc;
 	master_node_t *master;
 
-	assert(inode->i_bpino);
+	/* the directory is not indexed yet */
+	if (dir_ictx->ictx_inode->i_bpino == 0)
+		return 0;
 
-	master = bp_init_master(sb);
-	master->m_ino = inode->i_bpino;
-	master->m_sb = sb;
-	bp_read_master(master);
+	master = bp_get_dir_master(sb, dir_ictx);
+	if (master == NULL)
+		return -1;
 
-	collision >>= NVFUSE_BP_COLLISION_BITS;
-	offset &= collision;
+	offset &= NVFUSE_DIR_INDEX_OFFSET_MASK;
+	base = nvfuse_dir_index_key(sb, filename);
 
-	nvfuse_dir_hash(filename, dir_hash, dir_hash + 1);
-	key = (u64)dir_hash[0] | ((u64)dir_hash[1]) << 32;
-	if (B_INSERT(master, &key, &offset, &cur_offset, 0) < 0) {
-		u32 c = cur_offset >> (NVFUSE_BP_LOW_BITS - NVFUSE_BP_COLLISION_BITS);
-		c++;
+	/* append the name to the end of its collision chain */
+	for (seq = 0; seq <= NVFUSE_DIR_HASH_SEQ_MASK; seq++) {
+		key = base | seq;
+		if (B_INSERT(master, &key, &offset, &cur_offset, 0) == 0)
+			break;
 
-		dprintf_warn(DIRECTORY, " file name collision = %08x%08x, %d\n", dir_hash[0], dir_hash[1], c);
+		if (!(cur_offset & NVFUSE_DIR_INDEX_CHAINED)) {
+			cur_offset |= NVFUSE_DIR_INDEX_CHAINED;
+			B_UPDATE(master, &key, &cur_offset);
+		}
+	}
 
-		c <<= (NVFUSE_BP_LOW_BITS - NVFUSE_BP_COLLISION_BITS);
-		/* if collision occurs, offset is set to 0 */
-		cur_offset = 0;
-		cur_offset = c | cur_offset;
-		//collision
-		B_UPDATE(master, &key, &cur_offset);
+	if (seq > NVFUSE_DIR_HASH_SEQ_MASK) {
+		dprintf_error(DIRECTORY, " collision chain of %s is full\n", filename);
+		res = -1;
+	} else if (seq) {
+		dprintf_info(DIRECTORY, " file name collision = %016lx (%s), chain = %d\n",
+			     (unsigned long)base, filename, seq);
 	}
+
 	bp_write_master(master);
-	bp_deinit_master(master);
+	bp_put_dir_master(dir_ictx, master);
 
 	end_tsc = spdk_get_ticks();
 	assert((end_tsc - start_tsc) > 0);
-	sb->bp_set_index_tsc += (end_tsc - start_tsc);
-	sb->bp_set_index_count++;
+	nvfuse_add_sb_counter(sb, NVFUSE_SB_BP_SET_INDEX_TSC, end_tsc - start_tsc);
+	nvfuse_add_sb_counter(sb, NVFUSE_SB_BP_SET_INDEX_COUNT, 1);
 
-	return 0;
+	return res;
 }
 
-s32 nvfuse_get_dir_indexing(struct nvfuse_superblock *sb, struct nvfuse_inode *inode, s8 *filename,
-			    bitem_t *offset)
+s32 nvfuse_get_dir_indexing(struct nvfuse_superblock *sb, struct nvfuse_inode_ctx *dir_ictx,
+			    s8 *filename, bitem_t *offset)
 {
-	bkey_t key;
-	u32 dir_hash[2];
-	u32 collision = ~0;
-	u32 c;
-	int res = 0;
+	bkey_t base, key;
+	bitem_t value;
+	u32 seq;
+	int res = -1;
+	u64 start_tsc;
 	master_node_t *master;
 
-	assert(inode->i_bpino);
-
-	master = bp_init_master(sb);
-	master->m_ino = inode->i_bpino;
-	master->m_sb = sb;
-	bp_read_master(master);
-
 	if (!strcmp(filename, ".") || !strcmp(filename, "..")) {
 		*offset = 0;
 		return 0;
 	}
 
-	collision >>= NVFUSE_BP_COLLISION_BITS;
-	nvfuse_dir_hash(filename, dir_hash, dir_hash + 1);
-	key = (u64)dir_hash[0] | ((u64)dir_hash[1]) << 32;
-	if (bp_find_key(master, &key, offset) < 0) {
-		res = -1;
-		goto RES;
+	start_tsc = spdk_get_ticks();
+
+	master = bp_get_dir_master(sb, dir_ictx);
+	if (master == NULL)
+		return -1;
+
+	base = nvfuse_dir_index_key(sb, filename);
+
+	for (seq = 0; seq <= NVFUSE_DIR_HASH_SEQ_MASK; seq++) {
+		key = base | seq;
+		if (bp_find_key(master, &key, &value) < 0)
+			break;
+
+		/*
+		 * a name without collisions is returned as is and verified by
+		 * the caller, chain members are verified here.
+		 */
+		if (seq == 0 && !(value & NVFUSE_DIR_INDEX_CHAINED)) {
+			*offset = value & NVFUSE_DIR_INDEX_OFFSET_MASK;
+			res = 0;
+			break;
+		}
+
+		if (nvfuse_dir_index_match(sb, dir_ictx, value & NVFUSE_DIR_INDEX_OFFSET_MASK, filename)) {
+			*offset = value & NVFUSE_DIR_INDEX_OFFSET_MASK;
+			res = 0;
+			break;
+		}
+
+		if (!(value & NVFUSE_DIR_INDEX_CHAINED))
+			break;
 	}
 
-	c = *offset;
-	c >>= (NVFUSE_BP_LOW_BITS - NVFUSE_BP_COLLISION_BITS);
-	if (c)
-		*offset = 0;
-	else
-		*offset &= collision;
-RES:
-	;
 	B_RELEASE_BH(master, master->m_bh);
-	bp_deinit_master(master);
+	bp_put_dir_master(dir_ictx, master);
+
+	nvfuse_add_sb_counter(sb, NVFUSE_SB_BP_GET_INDEX_TSC, spdk_get_ticks() - start_tsc);
+	nvfuse_add_sb_counter(sb, NVFUSE_SB_BP_GET_INDEX_COUNT, 1);
+
 	return res;
 }
 
-s32 nvfuse_update_dir_indexing(struct nvfuse_superblock *sb, struct nvfuse_inode *inode,
-						   s8 *filename, bitem_t *offset)
+/* move the index entry of a dentry relocated within the directory */
+s32 nvfuse_update_dir_indexing(struct nvfuse_superblock *sb, struct nvfuse_inode_ctx *dir_ictx,
+			       s8 *filename, u32 old_offset, u32 new_offset)
 {
-	bkey_t key;
-	u32 dir_hash[2];
-	u32 collision = ~0;
-	u32 c;
-	int res = 0;
-
+	bkey_t base, key;
+	bitem_t value;
+	s32 seq;
 	master_node_t *master;
 
-	assert(inode->i_bpino);
+	if (dir_ictx->ictx_inode->i_bpino == 0)
+		return 0;
 
-	master = bp_init_master(sb);
-	master->m_ino = inode->i_bpino;
-	master->m_sb = sb;
-	bp_read_master(master);
+	master = bp_get_dir_master(sb, dir_ictx);
+	if (master == NULL)
+		return -1;
 
-	if (!strcmp(filename, ".") || !strcmp(filename, "..")) {
-		*offset = 0;
-		return 0;
+	base = nvfuse_dir_index_key(sb, filename);
+	seq = nvfuse_dir_index_find_offset(master, base, old_offset & NVFUSE_DIR_INDEX_OFFSET_MASK, &value);
+	if (seq < 0) {
+		dprintf_error(DIRECTORY, " %s (offset %d) is not in the index\n", filename, old_offset);
+		B_RELEASE_BH(master, master->m_bh);
+		bp_put_dir_master(dir_ictx, master);
+		return -1;
 	}
 
-	collision >>= NVFUSE_BP_COLLISION_BITS;
-	nvfuse_dir_hash(filename, dir_hash, dir_hash + 1);
-	key = (u64)dir_hash[0] | ((u64)dir_hash[1]) << 32;
-	if (bp_find_key(master, &key, offset) < 0) {
-		res = -1;
-		goto RES;
-	}
+	key = base | seq;
+	value = (value & NVFUSE_DIR_INDEX_CHAINED) | (new_offset & NVFUSE_DIR_INDEX_OFFSET_MASK);
+	B_UPDATE(master, &key, &value);
 
-	c = *offset;
-	c >>= (NVFUSE_BP_LOW_BITS - NVFUSE_BP_COLLISION_BITS);
-	if (c)
-		*offset = 0;
-	else
-		*offset &= collision;
-RES:
-	;
+	bp_write_master(master);
+	bp_put_dir_master(dir_ictx, master);
 
-	bp_deinit_master(master);
-	return res;
+	return 0;
 }
 
-s32 nvfuse_del_dir_indexing(struct nvfuse_superblock *sb, struct nvfuse_inode *inode, s8 *filename)
+s32 nvfuse_del_dir_indexing(struct nvfuse_superblock *sb, struct nvfuse_inode_ctx *dir_ictx,
+			    s8 *filename, u32 offset)
 {
-	u32 dir_hash[2];
-	bkey_t key;
-	bitem_t offset = 0;
-	u32 collision = ~0;
-	u32 c;
+	bkey_t base, key;
+	bitem_t value, last_value, prev_value = 0;
+	s32 seq, last;
+	u64 start_tsc = spdk_get_ticks();
 	master_node_t *master = NULL;
 
-	assert(inode->i_bpino);
-
-	master = bp_init_master(sb);
-	master->m_ino = inode->i_bpino;
-	master->m_sb = sb;
-	bp_read_master(master);
-
-	collision >>= NVFUSE_BP_COLLISION_BITS;
+	if (dir_ictx->ictx_inode->i_bpino == 0)
+		return 0;
 
-	nvfuse_dir_hash(filename, dir_hash, dir_hash + 1);
-	key = (u64)dir_hash[0] | ((u64)dir_hash[1]) << 32;
+	master = bp_get_dir_master(sb, dir_ictx);
+	if (master == NULL)
+		return -1;
 
-	if (bp_find_key(master, &key, &offset) < 0) {
-		dprintf_error(DIRECTORY, " find key %lu \n", (unsigned long)key);
+	base = nvfuse_dir_index_key(sb, filename);
+	seq = nvfuse_dir_index_find_offset(master, base, offset & NVFUSE_DIR_INDEX_OFFSET_MASK, &value);
+	if (seq < 0) {
+		dprintf_error(DIRECTORY, " find key %lu \n", (unsigned long)base);
+		B_RELEASE_BH(master, master->m_bh);
+		bp_put_dir_master(dir_ictx, master);
 		return -1;
 	}
 
-	c = offset;
-	c >>= (NVFUSE_BP_LOW_BITS - NVFUSE_BP_COLLISION_BITS);
-	if (c == 0)
+	/* find the last chain member to keep the chain dense */
+	last = seq;
+	last_value = value;
+	while (last_value & NVFUSE_DIR_INDEX_CHAINED) {
+		prev_value = last_value;
+		last++;
+		key = base | last;
+		if (bp_find_key(master, &key, &last_value) < 0) {
+			dprintf_error(DIRECTORY, " broken collision chain %lu \n", (unsigned long)base);
+			break;
+		}
+	}
+
+	if (last == seq) {
+		key = base | seq;
 		B_REMOVE(master, &key);
-	else {
-		c--;
-		c <<= (NVFUSE_BP_LOW_BITS - NVFUSE_BP_COLLISION_BITS);
-		offset &= collision;
-		offset = c | offset;
-		//collision
-		B_UPDATE(master, &key, &offset);
+		if (seq) {
+			/* the previous member becomes the end of the chain */
+			key = base | (seq - 1);
+			bp_find_key(master, &key, &prev_value);
+			prev_value &= ~NVFUSE_DIR_INDEX_CHAINED;
+			B_UPDATE(master, &key, &prev_value);
+		}
+	} else {
+		/* move the last member into the removed slot */
+		key = base | last;
+		B_REMOVE(master, &key);
+
+		key = base | seq;
+		value = last_value & NVFUSE_DIR_INDEX_OFFSET_MASK;
+		if (last - 1 != seq)
+			value |= NVFUSE_DIR_INDEX_CHAINED;
+		B_UPDATE(master, &key, &value);
+
+		if (last - 1 != seq) {
+			key = base | (last - 1);
+			prev_value &= ~NVFUSE_DIR_INDEX_CHAINED;
+			B_UPDATE(master, &key, &prev_value);
+		}
 	}
 
 	bp_write_master(master);
-	bp_deinit_master(master);
+	bp_put_dir_master(dir_ictx, master);
+
+	nvfuse_add_sb_counter(sb, NVFUSE_SB_BP_DEL_INDEX_TSC, spdk_get_ticks() - start_tsc);
+	nvfuse_add_sb_counter(sb, NVFUSE_SB_BP_DEL_INDEX_COUNT, 1);
+
 	return 0;
 }
 
@@ -975,6 +1343,7 @@ void nvfuse_sync_dirty_data(struct nvfuse_superblock *sb, s32 num_blocks)
 
 		assert(bc->bc_dirty);
 		assert(bc->bc_flush);
+		assert(bc->bc_pno);
 
 		jobs[count]->offset = (s64)bc->bc_pno * CLUSTER_SIZE;
 		jobs[count]->bytes = (size_t)CLUSTER_SIZE;
@@ -1124,6 +1493,11 @@ s32 nvfuse_remove_bg(struct nvfuse_superblock *sb, u32 bg_id)
 		nvfuse_update_sb_with_bd_info(sb, bg_id, root_container, 0/* dec */);
 	}
 
+#ifdef NVFUSE_USE_ONLINE_DISCARD
+	/* the container goes back to the primary, its next owner reuses the blocks */
+	nvfuse_discard_cancel(sb, bg_id * sb->sb_no_of_blocks_per_bg, sb->sb_no_of_blocks_per_bg);
+#endif
+
 	ret = nvfuse_dealloc_container_from_primary_process(sb, bg_id);
 	if (ret < 0)
 		return ret;
@@ -1286,6 +1660,7 @@ void nvfuse_send_health_check_msg_to_primary_process(struct nvfuse_handle *nvh)
 
 s32 nvfuse_sync_superblock(struct nvfuse_superblock *sb)
 {
+	struct nvfuse_superblock *disk_sb;
 	s8 *buf;
 	s32 res;
 
@@ -1296,6 +1671,15 @@ s32 nvfuse_sync_superblock(struct nvfuse_superblock *sb)
 	}
 
 	nvfuse_copy_mem_sb_to_disk_sb((struct nvfuse_superblock *)buf, sb);
+	disk_sb = (struct nvfuse_superblock *)buf;
+	disk_sb->sb_free_blocks = nvfuse_sum_sb_counter(sb, NVFUSE_SB_FREE_BLOCKS);
+	disk_sb->sb_no_of_used_blocks = nvfuse_sum_sb_counter(sb, NVFUSE_SB_USED_BLOCKS);
+	disk_sb->sb_free_inodes = nvfuse_sum_sb_counter(sb, NVFUSE_SB_FREE_INODES);
+	disk_sb->asb.asb_free_blocks = nvfuse_sum_sb_counter(sb, NVFUSE_SB_ASB_FREE_BLOCKS);
+	disk_sb->asb.asb_free_inodes = nvfuse_sum_sb_counter(sb, NVFUSE_SB_ASB_FREE_INODES);
+	assert(disk_sb->sb_free_blocks >= 0 && disk_sb->sb_free_blocks <= sb->sb_no_of_blocks);
+	assert(disk_sb->sb_free_inodes >= 0);
+
 	res = nvfuse_write_cluster(buf, INIT_NVFUSE_SUPERBLOCK_NO, sb->target);
 	if (res) {
 		dprintf_error(SB, "Error: Syncing superblock fails \n");
@@ -1351,7 +1735,22 @@ void nvfuse_close_file_table(struct nvfuse_superblock *sb, s32 fid)
 }
 
 
-s32 nvfuse_init_file_table(struct nvfuse_superblock *sb)
+/* whether an open file still refers to ino */
+s32 nvfuse_file_table_has_ino(struct nvfuse_superblock *sb, inode_t ino)
+{
+	struct nvfuse_file_table *ft;
+	s32 i;
+
+	for (i = START_OPEN_FILE; i < MAX_OPEN_FILE; i++) {
+		ft = nvfuse_get_file_table(sb, i);
+		if (ft->used && ft->ino == ino)
+			return 1;
+	}
+
+	return 0;
+}
+
+s32 nvfuse_init_file_table(struct nvfuse_superblock *sb)
 {
 	int fd;
 
@@ -1391,6 +1790,7 @@ s32 nvfuse_mount(struct nvfuse_handle *nvh)
 	SPINLOCK_INIT(&sb->sb_lock);
 	sb->target = nvh->nvh_target;
 	sb->sb_nvh = nvh;
+	memset(sb->sb_percore, 0x00, sizeof(sb->sb_percore));
 
 	if (!spdk_process_is_primary()) {
 		nvh->nvh_ipc_ctx.my_channel_id = nvfuse_get_channel_id(&nvh->nvh_ipc_ctx);
@@ -1620,6 +2020,19 @@ s32 nvfuse_mount(struct nvfuse_handle *nvh)
 	}
 	memset(sb->sb_bd, 0x00, sizeof(struct nvfuse_bg_descriptor) * sb->sb_bg_num);
 
+	if (nvfuse_fext_init(sb) < 0)
+		return -1;
+
+#ifdef NVFUSE_USE_PREALLOC_WINDOW
+	if (nvfuse_prealloc_map_init(sb) < 0)
+		return -1;
+#endif
+
+#ifdef NVFUSE_USE_ONLINE_DISCARD
+	if (nvfuse_discard_init(sb) < 0)
+		return -1;
+#endif
+
 	buf = nvfuse_alloc_aligned_buffer(CLUSTER_SIZE);
 	if (buf == NULL) {
 		dprintf_error(MOUNT, " malloc error \n");
@@ -1636,6 +2049,10 @@ s32 nvfuse_mount(struct nvfuse_handle *nvh)
 	}
 	nvfuse_free_aligned_buffer(buf);
 
+	nvfuse_init_alloc_groups(sb);
+
+	nvfuse_reclaim_init(sb);
+
 	/* initilization of bg list */
 	INIT_LIST_HEAD(&sb->sb_bg_list);
 	sb->sb_bg_list_count = 0;
@@ -1713,6 +2130,10 @@ s32 nvfuse_mount(struct nvfuse_handle *nvh)
 		sb->sb_state = FS_STATE_INITIALIZED;
 	}
 
+	/* resume reclaiming the orphans left by the previous mount */
+	if (nvfuse_reclaim_load(sb) < 0)
+		return -1;
+
 	sb->sb_dirty_sync_policy = NVFUSE_META_DIRTY_POLICY;
 
 	switch (sb->sb_dirty_sync_policy) {
@@ -1778,6 +2199,7 @@ s32 nvfuse_umount(struct nvfuse_handle *nvh)
 	gettimeofday(&sb->sb_time_end, NULL);
 	timeval_subtract(&sb->sb_time_total, &sb->sb_time_end, &sb->sb_time_start);
 
+	nvfuse_release_all_prealloc(sb);
 	nvfuse_check_flush_dirty(sb, DIRTY_FLUSH_FORCE);
 
 	sb->sb_state = FS_STATE_UMOUNTED;
@@ -1837,6 +2259,14 @@ s32 nvfuse_umount(struct nvfuse_handle *nvh)
 	nvfuse_stop_flushworker();
 #endif
 
+	nvfuse_fext_deinit(sb);
+#ifdef NVFUSE_USE_PREALLOC_WINDOW
+	nvfuse_prealloc_map_deinit(sb);
+#endif
+	nvfuse_reclaim_deinit(sb);
+#ifdef NVFUSE_USE_ONLINE_DISCARD
+	nvfuse_discard_deinit(sb);
+#endif
 	spdk_dma_free(sb->sb_bd);
 	nvfuse_free_file_table(sb);
 
@@ -1969,6 +2399,12 @@ s32 nvfuse_scan_superblock(struct nvfuse_handle *nvh, struct nvfuse_superblock *
 	if (read_sb->sb_signature == NVFUSE_SB_SIGNATURE) {
 		nvfuse_copy_disk_sb_to_sb(cur_sb, read_sb);
 		res = 0;
+
+		if (cur_sb->sb_dentry_format != NVFUSE_DENTRY_FORMAT) {
+			dprintf_error(MOUNT, " dentry format (%d) is not supported (expected %d). \n",
+				      cur_sb->sb_dentry_format, NVFUSE_DENTRY_FORMAT);
+			res = -1;
+		}
 	} else {
 		dprintf_error(MOUNT, " super block signature is mismatched. \n");
 		abort();
@@ -2019,35 +2455,166 @@ u32 nvfuse_create_bptree(struct nvfuse_superblock *sb, struct nvfuse_inode *inod
 	return 0;
 }
 
+/* name hash and dentry block of an entry collected for bulk loading */
+struct nvfuse_dir_index_ent {
+	bkey_t base;
+	u32 offset;
+};
+
+static int nvfuse_dir_index_ent_cmp(const void *a, const void *b)
+{
+	const struct nvfuse_dir_index_ent *x = a, *y = b;
+
+	if (x->base != y->base)
+		return x->base < y->base ? -1 : 1;
+
+	return x->offset < y->offset ? -1 : x->offset > y->offset;
+}
+
+/*
+ * create the b+tree of a directory and index all of its dentries. names are
+ * collected and sorted by hash first so the tree is bulk loaded with packed
+ * nodes, colliding names get consecutive sequence numbers as in set_dir_indexing.
+ */
+s32 nvfuse_build_dir_index(struct nvfuse_superblock *sb, struct nvfuse_inode_ctx *dir_ictx)
+{
+	struct nvfuse_inode *dir_inode = dir_ictx->ictx_inode;
+	struct nvfuse_dir_index_ent *ent = NULL, *new_ent;
+	struct nvfuse_dir_entry *dir;
+	struct nvfuse_dir_block db;
+	master_node_t *master;
+	key_pair_t pair;
+	u32 dentry_blk;
+	s32 nr = 0, max = 0, num = 0;
+	s32 i, seq = 0;
+	s32 ret = -1;
+
+	if (nvfuse_create_bptree(sb, dir_inode)) {
+		dprintf_error(DIRECTORY, " bptree allocation fails.");
+		return -1;
+	}
+
+	for (dentry_blk = 0; dentry_blk < nvfuse_dir_nr_blocks(dir_inode); dentry_blk++) {
+		if (nvfuse_get_dir_block(sb, dir_ictx, dentry_blk, &db) < 0)
+			goto RES;
+
+		for (dir = nvfuse_dentry_first(db.db_buf); dir;
+		     dir = nvfuse_dentry_next(db.db_buf, db.db_size, dir)) {
+			if (!strcmp(dir->d_filename, ".") || !strcmp(dir->d_filename, ".."))
+				continue;
+
+			if (nr == max) {
+				max = max ? max * 2 : NVFUSE_DIR_INDEX_THRESHOLD;
+				new_ent = realloc(ent, sizeof(*ent) * max);
+				if (new_ent == NULL) {
+					dprintf_error(DIRECTORY, " cannot allocate memory \n");
+					nvfuse_release_dir_block(sb, &db, NVF_CLEAN);
+					goto RES;
+				}
+				ent = new_ent;
+			}
+
+			ent[nr].base = nvfuse_dir_index_key(sb, dir->d_filename);
+			ent[nr].offset = dentry_blk & NVFUSE_DIR_INDEX_OFFSET_MASK;
+			nr++;
+		}
+
+		nvfuse_release_dir_block(sb, &db, NVF_CLEAN);
+	}
+
+	qsort(ent, nr, sizeof(*ent), nvfuse_dir_index_ent_cmp);
+
+	pair.i_key = (bkey_t *)malloc(sizeof(bkey_t) * (nr + 1));
+	pair.i_item = (bitem_t *)malloc(sizeof(bitem_t) * (nr + 1));
+	if (pair.i_key == NULL || pair.i_item == NULL) {
+		dprintf_error(DIRECTORY, " cannot allocate memory \n");
+		free(pair.i_key);
+		free(pair.i_item);
+		goto RES;
+	}
+
+	/* number collision chains, every member but the last is marked chained */
+	ret = 0;
+	for (i = 0; i < nr; i++) {
+		seq = (i && ent[i].base == ent[i - 1].base) ? seq + 1 : 0;
+		if (seq > NVFUSE_DIR_HASH_SEQ_MASK) {
+			dprintf_error(DIRECTORY, " collision chain of %016lx is full\n",
+				      (unsigned long)ent[i].base);
+			ret = -1;
+			continue;
+		}
+
+		pair.i_key[num] = ent[i].base | seq;
+		pair.i_item[num] = ent[i].offset;
+		if (i + 1 < nr && ent[i + 1].base == ent[i].base && seq < NVFUSE_DIR_HASH_SEQ_MASK)
+			pair.i_item[num] |= NVFUSE_DIR_INDEX_CHAINED;
+		num++;
+	}
+
+	master = bp_get_dir_master(sb, dir_ictx);
+	if (master == NULL) {
+		free(pair.i_key);
+		free(pair.i_item);
+		ret = -1;
+		goto RES;
+	}
+	if (bp_bulk_load(master, &pair, num) < 0)
+		ret = -1;
+	bp_write_master(master);
+	bp_put_dir_master(dir_ictx, master);
+
+	free(pair.i_key);
+	free(pair.i_item);
+
+	dprintf_info(DIRECTORY, " dir ino %d is indexed with %d entries\n",
+		     dir_inode->i_ino, num);
+RES:
+	free(ent);
+
+	return ret;
+}
+
+/*
+ * index a new dentry, small directories are searched linearly and get their
+ * b+tree once they hold NVFUSE_DIR_INDEX_THRESHOLD entries.
+ */
+s32 nvfuse_insert_dir_indexing(struct nvfuse_superblock *sb, struct nvfuse_inode_ctx *dir_ictx,
+			       s8 *filename, u32 offset)
+{
+	struct nvfuse_inode *dir_inode = dir_ictx->ictx_inode;
+
+	if (dir_inode->i_bpino)
+		return nvfuse_set_dir_indexing(sb, dir_ictx, filename, offset);
+
+#ifdef NVFUSE_USE_DELAYED_BPTREE_CREATION
+	if (dir_inode->i_links_count < NVFUSE_DIR_INDEX_THRESHOLD)
+		return 0;
+#endif
+
+	return nvfuse_build_dir_index(sb, dir_ictx);
+}
+
 s32 nvfuse_dir(struct nvfuse_handle *nvh)
 {
 	struct nvfuse_inode_ctx *dir_ictx, *ictx;
 	struct nvfuse_inode *dir_inode, *inode;
-	struct nvfuse_buffer_head *dir_bh = NULL;
+	struct nvfuse_dir_block db;
 	struct nvfuse_dir_entry *dir = NULL;
 	struct nvfuse_superblock *sb;
-	s64 read_bytes;
-	s64 dir_size;
+	u32 dentry_blk;
+	s64 free_blocks;
 
 	sb = nvfuse_read_super(nvh);
 
 	dir_ictx = nvfuse_read_inode(sb, NULL, nvfuse_get_cwd_ino(nvh));
 	dir_inode = dir_ictx->ictx_inode;
 
-	dir_size = dir_inode->i_size;
-
-	for (read_bytes = 0; read_bytes < dir_size ; read_bytes += DIR_ENTRY_SIZE) {
-		if (!(read_bytes & (CLUSTER_SIZE - 1))) {
-			if (dir_bh != NULL) {
-				nvfuse_release_bh(sb, dir_bh, 0, 0);
-				dir_bh = NULL;
-			}
-			dir_bh = nvfuse_get_bh(sb, dir_ictx, dir_inode->i_ino, NVFUSE_SIZE_TO_BLK(read_bytes), READ,
-					       NVFUSE_TYPE_META);
-			dir = (struct nvfuse_dir_entry *)dir_bh->bh_buf;
-		}
+	for (dentry_blk = 0; dentry_blk < nvfuse_dir_nr_blocks(dir_inode); dentry_blk++) {
+		if (nvfuse_get_dir_block(sb, dir_ictx, dentry_blk, &db) < 0)
+			break;
 
-		if (dir->d_flag == DIR_USED) {
+		for (dir = nvfuse_dentry_first(db.db_buf); dir;
+		     dir = nvfuse_dentry_next(db.db_buf, db.db_size, dir)) {
 			ictx = nvfuse_read_inode(sb, NULL, dir->d_ino);
 			inode = ictx->ictx_inode;
 
@@ -2055,17 +2622,18 @@ s32 nvfuse_dir(struct nvfuse_handle *nvh)
 
 			nvfuse_release_inode(sb, ictx, NVF_CLEAN);
 		}
-		dir++;
+
+		nvfuse_release_dir_block(sb, &db, NVF_CLEAN);
 	}
 
-	nvfuse_release_bh(sb, dir_bh, 0, 0);
 	nvfuse_release_inode(sb, dir_ictx, NVF_CLEAN);
 	nvfuse_release_super(sb);
 
-	dprintf_info(DIRECTORY, "\nfree blocks	  = %ld, num  blocks  = %ld\n", (unsigned long)sb->sb_free_blocks,
+	free_blocks = nvfuse_sum_sb_counter(sb, NVFUSE_SB_FREE_BLOCKS);
+	dprintf_info(DIRECTORY, "\nfree blocks	  = %ld, num  blocks  = %ld\n", (unsigned long)free_blocks,
 	       (unsigned long)sb->sb_no_of_blocks);
 	dprintf_info(DIRECTORY, "Disk Util     = %2.2f %%\n",
-	       ((double)(sb->sb_no_of_blocks - sb->sb_free_blocks) / (double)sb->sb_no_of_blocks) * 100);
+	       ((double)(sb->sb_no_of_blocks - free_blocks) / (double)sb->sb_no_of_blocks) * 100);
 
 	return NVFUSE_SUCCESS;
 }
@@ -2073,73 +2641,26 @@ s32 nvfuse_dir(struct nvfuse_handle *nvh)
 s32 nvfuse_truncate(struct nvfuse_superblock *sb, inode_t par_ino, s8 *filename,
 		    nvfuse_off_t trunc_size)
 {
-	struct nvfuse_inode_ctx *dir_ictx, *ictx;
-	struct nvfuse_inode *dir_inode, *inode = NULL;
-	struct nvfuse_dir_entry *dir = NULL;
-	struct nvfuse_buffer_head *dir_bh = NULL;
-
-	s64 read_bytes = 0;
-	s64 start = 0;
-	u32 offset = 0;
-	s64 dir_size = 0;
-
-	dir_ictx = nvfuse_read_inode(sb, NULL, par_ino);
-	dir_inode = dir_ictx->ictx_inode;
-	dir_size = dir_inode->i_size;
-
-#if NVFUSE_USE_DIR_INDEXING == 1
-	if (nvfuse_get_dir_indexing(sb, dir_inode, filename, &offset) < 0) {
-		dprintf_error(BPTREE, "filename (%s) is not in the index.\n", filename);
-		offset = 0;
-	}
-#endif
-
-	start = (s64)offset * DIR_ENTRY_SIZE;
-	if ((start & (CLUSTER_SIZE - 1))) {
-		dir_bh = nvfuse_get_bh(sb, dir_ictx, dir_inode->i_ino, NVFUSE_SIZE_TO_BLK(start), READ,
-				       NVFUSE_TYPE_META);
-		dir = (struct nvfuse_dir_entry *)dir_bh->bh_buf;
-		dir += (offset % DIR_ENTRY_NUM);
-	}
-
-	for (read_bytes = start; read_bytes < dir_size; read_bytes += DIR_ENTRY_SIZE) {
-		if (!(read_bytes & (CLUSTER_SIZE - 1))) {
-			if (dir_bh)
-				nvfuse_release_bh(sb, dir_bh, 0/*tail*/, 0/*dirty*/);
-
-			dir_bh = nvfuse_get_bh(sb, dir_ictx, dir_inode->i_ino, NVFUSE_SIZE_TO_BLK(read_bytes), READ,
-					       NVFUSE_TYPE_META);
-			dir = (struct nvfuse_dir_entry *)dir_bh->bh_buf;
-		}
-
-		if (dir->d_flag == DIR_USED) {
-			if (!strcmp(dir->d_filename, filename)) {
-				ictx = nvfuse_read_inode(sb, NULL, dir->d_ino);
-				inode = ictx->ictx_inode;
-				break;
-			}
-		}
-		dir++;
-	}
+	struct nvfuse_inode_ctx *ictx = NULL;
+	struct nvfuse_inode *inode = NULL;
 
-	if (inode == NULL || inode->i_ino == 0) {
+	if (nvfuse_lookup(sb, &ictx, NULL, filename, par_ino) < 0 || ictx == NULL) {
 		dprintf_error(INODE, " file (%s) is not found in this directory\n", filename);
-		nvfuse_release_bh(sb, dir_bh, 0/*tail*/, NVF_CLEAN);
 		return NVFUSE_ERROR;
 	}
+	inode = ictx->ictx_inode;
 
 	if (inode->i_type == NVFUSE_TYPE_DIRECTORY) {
+		nvfuse_release_inode(sb, ictx, NVF_CLEAN);
 		return error_msg(" rmfile() is supported for a file.");
 	}
 
-	nvfuse_free_inode_size(sb, ictx, trunc_size);
+	nvfuse_reclaim_inode_size(sb, ictx, trunc_size);
 	inode->i_size = trunc_size;
 	assert(inode->i_size < MAX_FILE_SIZE);
 	nvfuse_release_inode(sb, ictx, DIRTY);
 
-	nvfuse_release_bh(sb, dir_bh, 0/*tail*/, NVF_CLEAN);
-	nvfuse_release_inode(sb, dir_ictx, NVF_CLEAN);
-
+	nvfuse_reclaim_orphans(sb);
 	nvfuse_check_flush_dirty(sb, sb->sb_dirty_sync_policy);
 	nvfuse_release_super(sb);
 
@@ -2151,7 +2672,7 @@ s32 nvfuse_truncate_ino(struct nvfuse_superblock *sb, inode_t ino, s64 trunc_siz
 	struct nvfuse_inode_ctx *ictx;
 
 	ictx = nvfuse_read_inode(sb, NULL, ino);
-	nvfuse_free_inode_size(sb, ictx, trunc_size);
+	nvfuse_reclaim_inode_size(sb, ictx, trunc_size);
 	nvfuse_release_inode(sb, ictx, DIRTY);
 
 	return NVFUSE_SUCCESS;
@@ -2159,67 +2680,22 @@ s32 nvfuse_truncate_ino(struct nvfuse_superblock *sb, inode_t ino, s64 trunc_siz
 
 s32 nvfuse_chmod(struct nvfuse_handle *nvh, inode_t par_ino, s8 *filename, mode_t mode)
 {
-	struct nvfuse_inode_ctx *dir_ictx, *ictx = NULL;
-	struct nvfuse_inode *dir_inode, *inode = NULL;
-	struct nvfuse_dir_entry *dir = NULL;
-	struct nvfuse_buffer_head *dir_bh = NULL;
+	struct nvfuse_inode_ctx *ictx = NULL;
+	struct nvfuse_inode *inode = NULL;
 	struct nvfuse_superblock *sb = nvfuse_read_super(nvh);
-	u64 start = 0;
-	s64 read_bytes = 0;
-	u32 offset = 0;
 	s32 mask;
-	s64 dir_size = 0;
-
-	dir_ictx = nvfuse_read_inode(sb, NULL, par_ino);
-	dir_inode = dir_ictx->ictx_inode;
-
-#if NVFUSE_USE_DIR_INDEXING == 1
-	if (nvfuse_get_dir_indexing(sb, dir_inode, filename, &offset) < 0) {
-		dprintf_error(BPTREE, " Such file %s is not in the directory.\n", filename);
-	}
-#endif
-
-	dir_size = dir_inode->i_size;
-	start = (s64)offset * DIR_ENTRY_SIZE;
-
-	if (start & (CLUSTER_SIZE - 1)) {
-		dir_bh = nvfuse_get_bh(sb, dir_ictx, dir_inode->i_ino, NVFUSE_SIZE_TO_BLK(start), READ,
-				       NVFUSE_TYPE_META);
-		dir = (struct nvfuse_dir_entry *)dir_bh->bh_buf;
-		dir += (offset % DIR_ENTRY_NUM);
-	}
-
-	for (read_bytes = start; read_bytes < dir_size; read_bytes += DIR_ENTRY_SIZE) {
-		if (!(read_bytes & (CLUSTER_SIZE - 1))) {
-			if (dir_bh)
-				nvfuse_release_bh(sb, dir_bh, 0, 0);
-
-			dir_bh = nvfuse_get_bh(sb, dir_ictx, dir_inode->i_ino, NVFUSE_SIZE_TO_BLK(read_bytes), READ,
-					       NVFUSE_TYPE_META);
-			dir = (struct nvfuse_dir_entry *)dir_bh->bh_buf;
-		}
-
-		if (dir->d_flag == DIR_USED) {
-			if (!strcmp(dir->d_filename, filename)) {
-				ictx = nvfuse_read_inode(sb, NULL, dir->d_ino);
-				inode = ictx->ictx_inode;
-				break;
-			}
-		}
-		dir++;
-	}
 
-	if (inode->i_ino == 0)
+	if (nvfuse_lookup(sb, &ictx, NULL, filename, par_ino) < 0 || ictx == NULL) {
+		dprintf_error(INODE, " Such file %s is not in the directory.\n", filename);
 		return NVFUSE_ERROR;
+	}
+	inode = ictx->ictx_inode;
 
 	mask = S_IRWXU | S_IRWXG | S_IRWXO | S_ISUID | S_ISGID | S_ISVTX;
 	inode->i_mode = (inode->i_mode & ~mask) | (mode & mask);
 
 	nvfuse_release_inode(sb, ictx, DIRTY);
 
-	nvfuse_release_bh(sb, dir_bh, 0, NVF_CLEAN);
-	nvfuse_release_inode(sb, dir_ictx, NVF_CLEAN);
-
 	nvfuse_check_flush_dirty(sb, sb->sb_dirty_sync_policy);
 
 	nvfuse_release_super(sb);
@@ -2352,10 +2828,64 @@ RES:
 	return res;
 }
 
-s32 nvfuse_lseek(struct nvfuse_handle *nvh, s32 fd, u32 offset, s32 position)
+/*
+ * the first data (SEEK_DATA) or hole (SEEK_HOLE) at or after offset. a block
+ * is data once it is mapped to a written block, so dirty buffers are flushed
+ * first to get their delayed allocation done. the end of file counts as a
+ * hole. returns -1 if offset is not inside the file or no data follows it.
+ */
+static nvfuse_off_t nvfuse_seek_data_hole(struct nvfuse_superblock *sb,
+		struct nvfuse_file_table *of, nvfuse_off_t offset, s32 position)
+{
+	struct nvfuse_inode_ctx *ictx;
+	nvfuse_off_t size, res = -1;
+	u32 lblock, last;
+	u32 num, pblock;
+
+	ictx = nvfuse_read_inode(sb, NULL, of->ino);
+	if (ictx->ictx_data_dirty_count) {
+		nvfuse_release_inode(sb, ictx, NVF_CLEAN);
+		nvfuse_check_flush_dirty(sb, DIRTY_FLUSH_FORCE);
+		ictx = nvfuse_read_inode(sb, NULL, of->ino);
+	}
+
+	size = ictx->ictx_inode->i_size;
+	if (offset < 0 || offset >= size)
+		goto RELEASE;
+
+	if (position == SEEK_HOLE)
+		res = size;
+
+	lblock = NVFUSE_SIZE_TO_BLK(offset);
+	last = NVFUSE_SIZE_TO_BLK(size + CLUSTER_SIZE - 1);
+	while (lblock < last) {
+		if (nvfuse_get_block(sb, ictx, lblock, last - lblock, &num, &pblock, 0) < 0) {
+			res = -1;
+			break;
+		}
+
+		if ((pblock != 0) == (position == SEEK_DATA)) {
+			res = (nvfuse_off_t)lblock * CLUSTER_SIZE;
+			if (res < offset)
+				res = offset;
+			break;
+		}
+
+		/* holes of indirect mapped files are skipped block by block */
+		lblock += num ? num : 1;
+	}
+
+RELEASE:
+	nvfuse_release_inode(sb, ictx, NVF_CLEAN);
+
+	return res;
+}
+
+nvfuse_off_t nvfuse_lseek(struct nvfuse_handle *nvh, s32 fd, nvfuse_off_t offset, s32 position)
 {
 	struct nvfuse_file_table *of;
 	struct nvfuse_superblock *sb;
+	nvfuse_off_t res;
 
 	sb = nvfuse_read_super(nvh);
 
@@ -2367,10 +2897,19 @@ s32 nvfuse_lseek(struct nvfuse_handle *nvh, s32 fd, u32 offset, s32 position)
 		of->rwoffset += offset;
 	else if (position == SEEK_END)        /* SEEK_END */
 		of->rwoffset = of->size - offset;
+	else if (position == SEEK_DATA || position == SEEK_HOLE) {
+		res = nvfuse_seek_data_hole(sb, of, offset, position);
+		if (res < 0) {
+			nvfuse_release_super(sb);
+			return NVFUSE_ERROR;
+		}
+		of->rwoffset = res;
+	}
 
+	res = of->rwoffset;
 	nvfuse_release_super(sb);
 
-	return (NVFUSE_SUCCESS);
+	return res;
 }
 
 s32 nvfuse_seek(struct nvfuse_superblock *sb, struct nvfuse_file_table *of, s64 offset, s32 position)
@@ -2385,16 +2924,103 @@ s32 nvfuse_seek(struct nvfuse_superblock *sb, struct nvfuse_file_table *of, s64
 	return (NVFUSE_SUCCESS);
 }
 
+#ifdef NVFUSE_USE_PREALLOC_WINDOW
+s32 nvfuse_prealloc_map_init(struct nvfuse_superblock *sb)
+{
+	u32 size = sizeof(struct nvfuse_prealloc_map) * sb->sb_bg_num;
+	s32 i;
+
+	sb->sb_pa_map = (struct nvfuse_prealloc_map *)malloc(size);
+	if (sb->sb_pa_map == NULL) {
+		dprintf_error(MOUNT, " malloc error \n");
+		return -1;
+	}
+	memset(sb->sb_pa_map, 0x00, size);
+	for (i = 0; i < sb->sb_bg_num; i++)
+		SPINLOCK_INIT(&sb->sb_pa_map[i].pm_lock);
+	sb->sb_pa_reserved_blocks = 0;
+
+	return 0;
+}
+
+void nvfuse_prealloc_map_deinit(struct nvfuse_superblock *sb)
+{
+	s32 i;
+
+	if (sb->sb_pa_map == NULL)
+		return;
+
+	for (i = 0; i < sb->sb_bg_num; i++)
+		free(sb->sb_pa_map[i].pm_bitmap);
+
+	free(sb->sb_pa_map);
+	sb->sb_pa_map = NULL;
+}
+
+/* narrow the free run [*pos, *end) of bg_id to its first part no window has reserved, pm_lock held */
+static void nvfuse_skip_reserved(struct nvfuse_superblock *sb, u32 bg_id, u32 *pos, u32 *end)
+{
+	struct nvfuse_prealloc_map *pm = sb->sb_pa_map + bg_id;
+
+	if (!pm->pm_count)
+		return;
+
+	*pos = nvfuse_bitmap_find_next_zero(pm->pm_bitmap, *end, *pos);
+	if (*pos < *end)
+		*end = nvfuse_bitmap_find_next_set(pm->pm_bitmap, *end, *pos);
+}
+#endif
+
+/*
+ * the bitmap buffers are shared by every thread, so the bits of a bg are
+ * changed together with its reserved map and free extent tree under the
+ * lock of its preallocation map.
+ */
+static inline void nvfuse_lock_bg_blocks(struct nvfuse_superblock *sb, u32 bg_id)
+{
+#ifdef NVFUSE_USE_PREALLOC_WINDOW
+	SPINLOCK_LOCK(&sb->sb_pa_map[bg_id].pm_lock);
+#endif
+}
+
+static inline void nvfuse_unlock_bg_blocks(struct nvfuse_superblock *sb, u32 bg_id)
+{
+#ifdef NVFUSE_USE_PREALLOC_WINDOW
+	SPINLOCK_UNLOCK(&sb->sb_pa_map[bg_id].pm_lock);
+#endif
+}
+
+#ifdef NVFUSE_USE_ONLINE_DISCARD
+/* take the blocks just allocated out of the pending discards, run by run */
+static void nvfuse_discard_cancel_blks(struct nvfuse_superblock *sb, u32 *blks, u32 nr)
+{
+	u32 i, j;
+
+	for (i = 0; i < nr; i = j) {
+		for (j = i + 1; j < nr && blks[j] == blks[j - 1] + 1; j++)
+			;
+		nvfuse_discard_cancel(sb, blks[i], j - i);
+	}
+}
+#endif
+
 u32 nvfuse_alloc_dbitmap(struct nvfuse_superblock *sb, u32 bg_id, u32 *alloc_blks, u32 num_blocks)
 {
 	struct nvfuse_bg_descriptor *bd;
 	struct nvfuse_buffer_head *bd_bh, *bh;
 	struct nvfuse_buffer_cache *bd_bc, *bc;
-	u32 free_block = 0;
-	u32 cnt = 0;
+	u32 nr_blocks = sb->sb_no_of_blocks_per_bg;
+	u32 free_block, start, end, limit;
+	u32 dtable_start;
+	u32 wrapped = 0;
 	void *buf;
+	u32 *blks = alloc_blks;
 	u32 alloc_cnt = 0;
 	u32 bg_start;
+	u32 len, i;
+#ifdef NVFUSE_USE_FREE_EXTENT_INDEX
+	struct nvfuse_free_extent_tree *tree;
+#endif
 
 	bd_bh = nvfuse_get_bh(sb, NULL, BD_INO, bg_id, READ, NVFUSE_TYPE_META);
 	bd_bc = (struct nvfuse_buffer_cache *)bd_bh->bh_bc;
@@ -2406,36 +3032,92 @@ u32 nvfuse_alloc_dbitmap(struct nvfuse_superblock *sb, u32 bg_id, u32 *alloc_blk
 
 	//SPINLOCK_LOCK(&bd_bc->bc_lock);
 	//SPINLOCK_LOCK(&bc->bc_lock);
-	free_block = bd->bd_next_block % sb->sb_no_of_blocks_per_bg;
+	nvfuse_lock_bg_blocks(sb, bg_id);
+	bg_start = bd->bd_bg_start;
+	dtable_start = bd->bd_dtable_start % nr_blocks;
+	start = bd->bd_next_block % nr_blocks;
+	if (start < dtable_start)
+		start = dtable_start;
+
+#ifdef NVFUSE_USE_FREE_EXTENT_INDEX
+	/* take best fitting runs from the free extent tree of the group */
+	tree = nvfuse_fext_get_tree(sb, bg_id, buf, dtable_start);
+	if (tree) {
+		while (num_blocks) {
+			len = nvfuse_fext_alloc(tree, NVFUSE_FEXT_NO_GOAL, num_blocks, &free_block);
+			if (!len)
+				break;
 
-	while (cnt++ < sb->sb_no_of_blocks_per_bg) {
-		if (!free_block) {
-			free_block = bd->bd_dtable_start % sb->sb_no_of_blocks_per_bg;
-			cnt += (bd->bd_dtable_start % sb->sb_no_of_blocks_per_bg - 1);
-		}
+			assert(nvfuse_bitmap_find_next_set(buf, free_block + len, free_block) ==
+			       free_block + len);
+			nvfuse_bitmap_set_range(buf, free_block, len);
+			for (i = 0; i < len; i++)
+				*alloc_blks++ = bg_start + free_block + i;
 
-		if (!ext2fs_test_bit(free_block, buf)) {
-			bd->bd_next_block = free_block; // keep track of hit information to quickly lookup free blocks.
-			ext2fs_set_bit(free_block, buf); // right approach?
+			num_blocks -= len;
+			alloc_cnt += len;
+			bd->bd_next_block = (free_block + len) % nr_blocks;
+		}
+		goto RELEASE;
+	}
+#endif
 
-			*alloc_blks = bd->bd_bg_start + free_block;
-			alloc_blks++;
-			num_blocks--;
-			alloc_cnt++;
-			if (num_blocks == 0)
+	/*
+	 * scan a word at a time from the last hit to the end of the group,
+	 * then from the data table start up to the last hit, and take runs
+	 * of free blocks as a whole.
+	 */
+	free_block = start;
+	limit = nr_blocks;
+	while (num_blocks) {
+		free_block = nvfuse_bitmap_find_next_zero(buf, limit, free_block);
+		if (free_block >= limit) {
+			if (wrapped || start == dtable_start)
 				break;
+			wrapped = 1;
+			limit = start;
+			free_block = dtable_start;
+			continue;
 		}
-		free_block = (free_block + 1) % sb->sb_no_of_blocks_per_bg;
+
+		end = nvfuse_bitmap_find_next_set(buf, limit, free_block);
+#ifdef NVFUSE_USE_PREALLOC_WINDOW
+		nvfuse_skip_reserved(sb, bg_id, &free_block, &end);
+		if (free_block == end)
+			continue;
+#endif
+		len = end - free_block;
+		if (len > num_blocks)
+			len = num_blocks;
+
+		nvfuse_bitmap_set_range(buf, free_block, len);
+		for (i = 0; i < len; i++)
+			*alloc_blks++ = bg_start + free_block + i;
+
+		num_blocks -= len;
+		alloc_cnt += len;
+		free_block += len;
+
+		/* keep track of hit information to quickly lookup free blocks. */
+		bd->bd_next_block = free_block % nr_blocks;
 	}
 
-	bg_start = bd->bd_bg_start;
+#ifdef NVFUSE_USE_FREE_EXTENT_INDEX
+RELEASE:
+#endif
+	nvfuse_unlock_bg_blocks(sb, bg_id);
 	//SPINLOCK_UNLOCK(&bc->bc_lock);
 	//SPINLOCK_UNLOCK(&bd_bc->bc_lock);
 
+#ifdef NVFUSE_USE_ONLINE_DISCARD
+	/* the blocks are ours now, a pending discard of them may wait outside the lock */
+	nvfuse_discard_cancel_blks(sb, blks, alloc_cnt);
+#endif
+
 	if (alloc_cnt) {
 		nvfuse_release_bh(sb, bh, 0, DIRTY);
 		nvfuse_release_bh(sb, bd_bh, 0, DIRTY);
-		nvfuse_dec_free_blocks(sb, bg_start + free_block, alloc_cnt);
+		nvfuse_dec_free_blocks(sb, bg_start, alloc_cnt);
 	} else {
 		nvfuse_release_bh(sb, bh, 0, NVF_CLEAN);
 		nvfuse_release_bh(sb, bd_bh, 0, NVF_CLEAN);
@@ -2444,50 +3126,242 @@ u32 nvfuse_alloc_dbitmap(struct nvfuse_superblock *sb, u32 bg_id, u32 *alloc_blk
 	return alloc_cnt;
 }
 
-u32 nvfuse_free_dbitmap(struct nvfuse_superblock *sb, u32 bg_id, nvfuse_loff_t offset, u32 count)
+#ifdef NVFUSE_USE_PREALLOC_WINDOW
+/*
+ * reserve a run of up to max_len free blocks in a block group, looking from
+ * the goal block (or the last hit if goal is 0) to the end of the group and
+ * then from the data table start. the first run of max_len blocks is taken,
+ * otherwise the longest run seen. returns the run length, *start is its
+ * first block.
+ *
+ * the run is only marked in the in-memory map of the group and charged to
+ * sb_pa_reserved_blocks, the DBITMAP and the free counters are updated by
+ * nvfuse_claim_dbitmap_run() as blocks are handed out. a crash leaves
+ * nothing of the reservation behind.
+ */
+u32 nvfuse_reserve_dbitmap_run(struct nvfuse_superblock *sb, u32 bg_id, u32 goal, u32 max_len,
+			       u32 *start)
 {
+	struct nvfuse_prealloc_map *pm = sb->sb_pa_map + bg_id;
 	struct nvfuse_bg_descriptor *bd;
 	struct nvfuse_buffer_head *bd_bh, *bh;
-	struct nvfuse_buffer_cache *bd_bc, *bc;
-	u32 bg_start;
+	u32 nr_blocks = sb->sb_no_of_blocks_per_bg;
+	u32 dtable_start, first, limit;
+	u32 pos, end;
+	u32 best = 0, best_len = 0;
+	u32 wrapped = 0;
 	void *buf;
-	int flag = 0;
-	int i;
+#ifdef NVFUSE_USE_FREE_EXTENT_INDEX
+	struct nvfuse_free_extent_tree *tree = NULL;
+#endif
 
 	bd_bh = nvfuse_get_bh(sb, NULL, BD_INO, bg_id, READ, NVFUSE_TYPE_META);
-	if (bd_bh == NULL) {
-		dprintf_error(BUFFER, "buffer cannot be ontained.\n");
-		assert(0);
-	}
-	bd_bc = (struct nvfuse_buffer_cache *)bd_bh->bh_bc;
-	bd = (struct nvfuse_bg_descriptor *)bd_bc->bc_buf;
+	bd = (struct nvfuse_bg_descriptor *)bd_bh->bh_buf;
 	assert(bd->bd_id == bg_id);
 
 	bh = nvfuse_get_bh(sb, NULL, DBITMAP_INO, bg_id, READ, NVFUSE_TYPE_META);
-	if (bh == NULL) {
-		dprintf_error(BUFFER, "buffer cannot be ontained.\n");
-		assert(0);
-	}
-	bc = (struct nvfuse_buffer_cache *)bh->bh_bc;
-	buf = bc->bc_buf;
-
-	//SPINLOCK_LOCK(&bd_bc->bc_lock);
-	//SPINLOCK_LOCK(&bc->bc_lock);
-	for (i = 0; i < count; i++) {
-		if (ext2fs_test_bit(offset + i, buf)) {
-			ext2fs_clear_bit(offset + i, buf);
+	buf = bh->bh_buf;
 
-			/* keep track of hit information to quickly lookup free blocks. */
-			bd->bd_next_block = offset;
-			flag = 1;
-		} else {
-			dprintf_error(BLOCK, " ERROR: block was already cleared. ");
-			assert(0);
+	nvfuse_lock_bg_blocks(sb, bg_id);
+	if (pm->pm_bitmap == NULL) {
+		pm->pm_bitmap = malloc(nr_blocks / 8);
+		if (pm->pm_bitmap == NULL) {
+			dprintf_error(BLOCK, " malloc error \n");
+			goto RELEASE;
 		}
+		memset(pm->pm_bitmap, 0x00, nr_blocks / 8);
 	}
 
-	bg_start = bd->bd_bg_start;
-
+	dtable_start = bd->bd_dtable_start % nr_blocks;
+	if (goal && goal / nr_blocks == bg_id)
+		first = goal % nr_blocks;
+	else
+		first = bd->bd_next_block % nr_blocks;
+	if (first < dtable_start)
+		first = dtable_start;
+
+#ifdef NVFUSE_USE_FREE_EXTENT_INDEX
+	/* blocks right from the goal, or the best fitting run */
+	tree = nvfuse_fext_get_tree(sb, bg_id, buf, dtable_start);
+	if (tree) {
+		if (goal && goal / nr_blocks == bg_id)
+			best_len = nvfuse_fext_alloc(tree, first, max_len, &best);
+		else
+			best_len = nvfuse_fext_alloc(tree, NVFUSE_FEXT_NO_GOAL, max_len, &best);
+		if (best_len)
+			assert(nvfuse_bitmap_find_next_set(buf, best + best_len, best) == best + best_len);
+		goto RESERVE;
+	}
+#endif
+
+	pos = first;
+	limit = nr_blocks;
+	while (best_len < max_len) {
+		pos = nvfuse_bitmap_find_next_zero(buf, limit, pos);
+		if (pos >= limit) {
+			if (wrapped || first == dtable_start)
+				break;
+			wrapped = 1;
+			limit = first;
+			pos = dtable_start;
+			continue;
+		}
+
+		end = nvfuse_bitmap_find_next_set(buf, limit, pos);
+		nvfuse_skip_reserved(sb, bg_id, &pos, &end);
+		if (end - pos > best_len) {
+			best = pos;
+			best_len = end - pos;
+		}
+		pos = end;
+	}
+
+	if (best_len > max_len)
+		best_len = max_len;
+
+#ifdef NVFUSE_USE_FREE_EXTENT_INDEX
+RESERVE:
+#endif
+	if (best_len) {
+		assert(nvfuse_bitmap_find_next_set(pm->pm_bitmap, best + best_len, best) == best + best_len);
+		nvfuse_bitmap_set_range(pm->pm_bitmap, best, best_len);
+		pm->pm_count += best_len;
+		*start = bd->bd_bg_start + best;
+		nvfuse_add_sb_counter(sb, NVFUSE_SB_PA_RESERVED_BLOCKS, best_len);
+	}
+
+RELEASE:
+	nvfuse_unlock_bg_blocks(sb, bg_id);
+	nvfuse_release_bh(sb, bh, 0, NVF_CLEAN);
+	nvfuse_release_bh(sb, bd_bh, 0, NVF_CLEAN);
+
+	return best_len;
+}
+
+/* allocate the first len blocks of a run reserved by nvfuse_reserve_dbitmap_run() */
+void nvfuse_claim_dbitmap_run(struct nvfuse_superblock *sb, u32 start, u32 len)
+{
+	u32 nr_blocks = sb->sb_no_of_blocks_per_bg;
+	u32 bg_id = start / nr_blocks;
+	u32 offset = start % nr_blocks;
+	struct nvfuse_prealloc_map *pm = sb->sb_pa_map + bg_id;
+	struct nvfuse_bg_descriptor *bd;
+	struct nvfuse_buffer_head *bd_bh, *bh;
+
+	bd_bh = nvfuse_get_bh(sb, NULL, BD_INO, bg_id, READ, NVFUSE_TYPE_META);
+	bd = (struct nvfuse_bg_descriptor *)bd_bh->bh_buf;
+	assert(bd->bd_id == bg_id);
+
+	bh = nvfuse_get_bh(sb, NULL, DBITMAP_INO, bg_id, READ, NVFUSE_TYPE_META);
+
+	nvfuse_lock_bg_blocks(sb, bg_id);
+	assert(nvfuse_bitmap_find_next_zero(pm->pm_bitmap, offset + len, offset) == offset + len);
+	assert(nvfuse_bitmap_find_next_set(bh->bh_buf, offset + len, offset) == offset + len);
+
+	nvfuse_bitmap_clear_range(pm->pm_bitmap, offset, len);
+	pm->pm_count -= len;
+
+	/* the run already left the free extent tree when it was reserved */
+	nvfuse_bitmap_set_range(bh->bh_buf, offset, len);
+	bd->bd_next_block = (offset + len) % nr_blocks;
+	nvfuse_unlock_bg_blocks(sb, bg_id);
+#ifdef NVFUSE_USE_ONLINE_DISCARD
+	nvfuse_discard_cancel(sb, start, len);
+#endif
+
+	nvfuse_release_bh(sb, bh, 0, DIRTY);
+	nvfuse_release_bh(sb, bd_bh, 0, DIRTY);
+	nvfuse_dec_free_blocks(sb, start, len);
+	nvfuse_add_sb_counter(sb, NVFUSE_SB_PA_RESERVED_BLOCKS, -(s64)len);
+}
+
+/* give an unused reserved run back to the other allocators, no block is written */
+void nvfuse_unreserve_dbitmap_run(struct nvfuse_superblock *sb, u32 start, u32 len)
+{
+	u32 nr_blocks = sb->sb_no_of_blocks_per_bg;
+	u32 bg_id = start / nr_blocks;
+	u32 offset = start % nr_blocks;
+	struct nvfuse_prealloc_map *pm = sb->sb_pa_map + bg_id;
+
+	/* the allocators look at the map and the tree under the same lock */
+	nvfuse_lock_bg_blocks(sb, bg_id);
+	assert(nvfuse_bitmap_find_next_zero(pm->pm_bitmap, offset + len, offset) == offset + len);
+	nvfuse_bitmap_clear_range(pm->pm_bitmap, offset, len);
+	pm->pm_count -= len;
+
+#ifdef NVFUSE_USE_FREE_EXTENT_INDEX
+	if (sb->sb_fext)
+		nvfuse_fext_free(sb->sb_fext + bg_id, offset, len);
+#endif
+	nvfuse_unlock_bg_blocks(sb, bg_id);
+
+	nvfuse_add_sb_counter(sb, NVFUSE_SB_PA_RESERVED_BLOCKS, -(s64)len);
+}
+#endif
+
+u32 nvfuse_free_dbitmap(struct nvfuse_superblock *sb, u32 bg_id, nvfuse_loff_t offset, u32 count)
+{
+	struct nvfuse_bg_descriptor *bd;
+	struct nvfuse_buffer_head *bd_bh, *bh;
+	struct nvfuse_buffer_cache *bd_bc, *bc;
+	u32 bg_start;
+	void *buf;
+	int flag = 0;
+#ifdef NVFUSE_USE_FREE_EXTENT_INDEX
+	struct nvfuse_free_extent_tree *tree;
+#endif
+
+	bd_bh = nvfuse_get_bh(sb, NULL, BD_INO, bg_id, READ, NVFUSE_TYPE_META);
+	if (bd_bh == NULL) {
+		dprintf_error(BUFFER, "buffer cannot be ontained.\n");
+		assert(0);
+	}
+	bd_bc = (struct nvfuse_buffer_cache *)bd_bh->bh_bc;
+	bd = (struct nvfuse_bg_descriptor *)bd_bc->bc_buf;
+	assert(bd->bd_id == bg_id);
+
+	bh = nvfuse_get_bh(sb, NULL, DBITMAP_INO, bg_id, READ, NVFUSE_TYPE_META);
+	if (bh == NULL) {
+		dprintf_error(BUFFER, "buffer cannot be ontained.\n");
+		assert(0);
+	}
+	bc = (struct nvfuse_buffer_cache *)bh->bh_bc;
+	buf = bc->bc_buf;
+
+	//SPINLOCK_LOCK(&bd_bc->bc_lock);
+	//SPINLOCK_LOCK(&bc->bc_lock);
+	nvfuse_lock_bg_blocks(sb, bg_id);
+	if (count) {
+		if (nvfuse_bitmap_find_next_zero(buf, offset + count, offset) != offset + count) {
+			dprintf_error(BLOCK, " ERROR: block was already cleared. ");
+			assert(0);
+		}
+#ifdef NVFUSE_USE_FREE_EXTENT_INDEX
+		/* built before the bitmap changes, then the run is added */
+		tree = nvfuse_fext_get_tree(sb, bg_id, buf, bd->bd_dtable_start % sb->sb_no_of_blocks_per_bg);
+#endif
+		nvfuse_bitmap_clear_range(buf, offset, count);
+#ifdef NVFUSE_USE_FREE_EXTENT_INDEX
+		if (tree)
+			nvfuse_fext_free(tree, offset, count);
+#endif
+#ifdef NVFUSE_USE_ONLINE_DISCARD
+		/*
+		 * discarded after the next flush has written the bitmap. queued
+		 * before the lock is dropped, so an allocator taking the blocks
+		 * again always finds the range to cancel.
+		 */
+		nvfuse_discard_add(sb, bd->bd_bg_start + offset, count);
+#endif
+
+		/* keep track of hit information to quickly lookup free blocks. */
+		bd->bd_next_block = offset;
+		flag = 1;
+	}
+
+	bg_start = bd->bd_bg_start;
+	nvfuse_unlock_bg_blocks(sb, bg_id);
+
 	//SPINLOCK_UNLOCK(&bc->bc_lock);
 	//SPINLOCK_UNLOCK(&bd_bc->bc_lock);
 
@@ -2508,9 +3382,8 @@ s32 nvfuse_link(struct nvfuse_superblock *sb, u32 newino, s8 *new_filename, s32
 	struct nvfuse_dir_entry *dir;
 	struct nvfuse_inode_ctx *dir_ictx, *ictx;
 	struct nvfuse_inode *dir_inode, *inode;
-	struct nvfuse_buffer_head *dir_bh = NULL;
-	s32 search_lblock = 0, search_entry = 0;
-	u32 empty_dentry;
+	struct nvfuse_dir_block db;
+	s32 search_lblock;
 
 	if (strlen(new_filename) < 1 || strlen(new_filename) >= FNAME_SIZE) {
 		dprintf_error(API, "the file size is %d greater than %d\n", (int)strlen(new_filename), FNAME_SIZE);
@@ -2530,34 +3403,32 @@ s32 nvfuse_link(struct nvfuse_superblock *sb, u32 newino, s8 *new_filename, s32
 		return -1;
 	}
 
-	/* find an empty directory */
-	empty_dentry = nvfuse_find_empty_dentry(sb, dir_ictx, dir_inode);
-	if (empty_dentry < 0) {
+	/* find a directory block having room for the name */
+	search_lblock = nvfuse_find_empty_dentry(sb, dir_ictx, dir_inode, new_filename);
+	if (search_lblock < 0) {
 		return -1;
 	}
-	search_lblock = dir_inode->i_ptr / DIR_ENTRY_NUM;
-	search_entry = dir_inode->i_ptr % DIR_ENTRY_NUM;
 
-	dir_inode->i_ptr = search_lblock * DIR_ENTRY_NUM + search_entry;
+	if (nvfuse_get_dir_block(sb, dir_ictx, search_lblock, &db) < 0) {
+		nvfuse_release_inode(sb, dir_ictx, NVF_CLEAN);
+		return NVFUSE_ERROR;
+	}
+
 	dir_inode->i_links_count++;
+	dir_inode->i_ptr = dir_inode->i_links_count - 1;
 
 	ictx = nvfuse_read_inode(sb, NULL, ino);
 	inode = ictx->ictx_inode;
 	inode->i_links_count++;
 
-	dir_bh = nvfuse_get_bh(sb, dir_ictx, dir_inode->i_ino, search_lblock, READ, NVFUSE_TYPE_META);
-	dir = (struct nvfuse_dir_entry *)dir_bh->bh_buf;
-	dir[search_entry].d_flag = DIR_USED;
-	dir[search_entry].d_ino = ino;
-	dir[search_entry].d_version = inode->i_version;
-	strcpy(dir[search_entry].d_filename, new_filename);
+	dir = nvfuse_dentry_append(db.db_buf, db.db_size, ino, inode->i_version, new_filename);
+	assert(dir != NULL);
+	nvfuse_release_dir_block(sb, &db, DIRTY);
 
 #if NVFUSE_USE_DIR_INDEXING == 1
-	nvfuse_set_dir_indexing(sb, dir_inode, new_filename, dir_inode->i_ptr);
+	nvfuse_insert_dir_indexing(sb, dir_ictx, new_filename, search_lblock);
 #endif
 
-	nvfuse_release_bh(sb, dir_bh, 0, DIRTY);
-
 	nvfuse_release_inode(sb, dir_ictx, DIRTY);
 	nvfuse_release_inode(sb, ictx, DIRTY);
 
@@ -2566,132 +3437,199 @@ s32 nvfuse_link(struct nvfuse_superblock *sb, u32 newino, s8 *new_filename, s32
 	return NVFUSE_SUCCESS;
 }
 
-s32 nvfuse_find_empty_dentry(struct nvfuse_superblock *sb, struct nvfuse_inode_ctx *dir_ictx, struct nvfuse_inode *dir_inode)
+/* move inline dentries out to the first block of the directory */
+static s32 nvfuse_convert_inline_dir(struct nvfuse_superblock *sb, struct nvfuse_inode_ctx *dir_ictx,
+				     struct nvfuse_inode *dir_inode)
 {
-	struct nvfuse_buffer_head *dir_bh = NULL;
-	struct nvfuse_dir_entry *dir;
-	u32 search_lblock, search_entry;
-	u32 dir_num;
-	s32 num_block;
-	u32 new_entry, flag = 0;
-	s32 i;
+	struct nvfuse_buffer_head *dir_bh;
+	s32 ret;
+
+	assert(dir_inode->i_size == 0);
+
+	ret = nvfuse_get_block(sb, dir_ictx, 0, 1/* num block */, NULL, NULL, 1);
+	if (ret) {
+		dprintf_error(BLOCK, " data block allocation fails.");
+		return NVFUSE_ERROR;
+	}
 
-	search_lblock = (dir_inode->i_links_count - 1) / DIR_ENTRY_NUM;
-	search_entry = (dir_inode->i_links_count - 1) % DIR_ENTRY_NUM;
+	dir_bh = nvfuse_get_new_bh(sb, dir_ictx, dir_inode->i_ino, 0, NVFUSE_TYPE_META);
+	memset(dir_bh->bh_buf, 0x00, CLUSTER_SIZE);
+	memcpy(dir_bh->bh_buf, dir_inode->i_inline,
+	       nvfuse_dentry_block_used((s8 *)dir_inode->i_inline, NVFUSE_INLINE_DATA_SIZE));
+	nvfuse_release_bh(sb, dir_bh, INSERT_HEAD, DIRTY);
 
-RETRY:
+	memset(dir_inode->i_inline, 0x00, NVFUSE_INLINE_DATA_SIZE);
+	dir_inode->i_flags &= ~NVFUSE_INODE_FLAG_INLINE;
+	dir_inode->i_size = CLUSTER_SIZE;
 
-	dir_num = (dir_inode->i_size / DIR_ENTRY_SIZE);
-	if (dir_num == dir_inode->i_links_count) {
-		search_entry = -1;
-		num_block = 0;
-	} else {
-		if (search_entry == DIR_ENTRY_NUM - 1) {
-			search_entry = -1;
+	return 0;
+}
+
+/* reads every block of the directory once to learn how much room each one has */
+static s32 nvfuse_dir_space_load(struct nvfuse_superblock *sb, struct nvfuse_inode_ctx *dir_ictx,
+				 struct nvfuse_inode *dir_inode)
+{
+	struct nvfuse_dir_block db;
+	u32 nr_blocks = nvfuse_dir_nr_blocks(dir_inode);
+	u16 *space;
+	u32 lblock;
+
+	nvfuse_dir_space_free(dir_ictx);
+
+	space = (u16 *)malloc(sizeof(u16) * nr_blocks);
+	if (space == NULL) {
+		dprintf_error(DIRECTORY, " dir space map allocation fails.");
+		return NVFUSE_ERROR;
+	}
+
+	for (lblock = 0; lblock < nr_blocks; lblock++) {
+		if (nvfuse_get_dir_block(sb, dir_ictx, lblock, &db) < 0) {
+			free(space);
+			return NVFUSE_ERROR;
 		}
-		num_block = dir_num / DIR_ENTRY_NUM;
+		space[lblock] = CLUSTER_SIZE - nvfuse_dentry_block_used(db.db_buf, db.db_size);
+		nvfuse_release_dir_block(sb, &db, NVF_CLEAN);
 	}
 
-	// find an empty dentry
-	for (i = 0; i < num_block; i++) {
-		dir_bh = nvfuse_get_bh(sb, dir_ictx, dir_inode->i_ino, search_lblock, READ, NVFUSE_TYPE_META);
-		dir = (struct nvfuse_dir_entry *)dir_bh->bh_buf;
+	dir_ictx->ictx_dir_space = space;
+	dir_ictx->ictx_dir_space_nr = nr_blocks;
 
-		for (new_entry = 0; new_entry < DIR_ENTRY_NUM; new_entry++) {
-			search_entry++;
-			if (search_entry == DIR_ENTRY_NUM) {
-				search_entry = 0;
-			}
+	return 0;
+}
 
-			if (nvfuse_dir_is_invalid(dir + search_entry)) {
-				nvfuse_release_bh(sb, dir_bh, 0, 0);
-				flag = 1;
-				goto FIND;
-			}
-		}
-		nvfuse_release_bh(sb, dir_bh, 0, 0);
-		dir_bh = NULL;
-		search_entry = -1;
-		search_lblock++;
-		if (search_lblock == NVFUSE_SIZE_TO_BLK(dir_inode->i_size))
-			search_lblock = 0;
+/* appends the room of a new last block to the space map */
+static void nvfuse_dir_space_grow(struct nvfuse_inode_ctx *dir_ictx, u32 nr_blocks, u32 room)
+{
+	u16 *space;
+
+	if (dir_ictx->ictx_dir_space == NULL)
+		return;
+
+	/* the map is built again on the next create if it cannot grow */
+	if (dir_ictx->ictx_dir_space_nr + 1 != nr_blocks) {
+		nvfuse_dir_space_free(dir_ictx);
+		return;
 	}
 
-	dir_num = (dir_inode->i_size / DIR_ENTRY_SIZE);
-	num_block = dir_num / DIR_ENTRY_NUM;
-	search_lblock = num_block;
+	space = (u16 *)realloc(dir_ictx->ictx_dir_space, sizeof(u16) * nr_blocks);
+	if (space == NULL) {
+		nvfuse_dir_space_free(dir_ictx);
+		return;
+	}
 
-	if (!flag) { // allocate new direcct block
-		s32 ret;
-		nvfuse_release_bh(sb, dir_bh, 0, 0);
-		ret = nvfuse_get_block(sb, dir_ictx, NVFUSE_SIZE_TO_BLK(dir_inode->i_size), 1/* num block */, NULL,
-				       NULL, 1);
-		if (ret) {
-			dprintf_error(BLOCK, " data block allocation fails.");
+	space[nr_blocks - 1] = room;
+	dir_ictx->ictx_dir_space = space;
+	dir_ictx->ictx_dir_space_nr = nr_blocks;
+}
+
+/*
+ * Removals close up the gap inside a block, so the room of a directory block
+ * is the tail after its last dentry. The room of every block is kept in
+ * ictx_dir_space and a name goes to the first block it fits in, which reuses
+ * the room left in earlier blocks when nvfuse_shrink_dentry could not fill it
+ * with the last dentry. The room taken by the name is charged here since all
+ * callers append it right away. An inline directory is converted to block
+ * form when it outgrows the inode.
+ * returns the logical block the dentry is to be appended to.
+ */
+s32 nvfuse_find_empty_dentry(struct nvfuse_superblock *sb, struct nvfuse_inode_ctx *dir_ictx,
+			     struct nvfuse_inode *dir_inode, s8 *filename)
+{
+	struct nvfuse_buffer_head *dir_bh = NULL;
+	struct nvfuse_dir_block db;
+	u32 rec_len = DIR_REC_LEN(strlen(filename));
+	lbno_t lblock;
+	u32 used;
+	s32 ret;
+
+	/* readdir cursor is no longer valid */
+	dir_ictx->ictx_dir_cursor = 0;
+
+	if (dir_inode->i_flags & NVFUSE_INODE_FLAG_INLINE) {
+		if (nvfuse_get_dir_block(sb, dir_ictx, 0, &db) < 0)
 			return NVFUSE_ERROR;
+		used = nvfuse_dentry_block_used(db.db_buf, db.db_size);
+		nvfuse_release_dir_block(sb, &db, NVF_CLEAN);
+
+		if (used + rec_len <= db.db_size)
+			return 0;
+
+		if (nvfuse_convert_inline_dir(sb, dir_ictx, dir_inode) < 0)
+			return NVFUSE_ERROR;
+
+		/* the first block has room for the dentry */
+		return 0;
+	}
+
+	if (dir_inode->i_size) {
+		if (dir_ictx->ictx_dir_space_nr != nvfuse_dir_nr_blocks(dir_inode) &&
+		    nvfuse_dir_space_load(sb, dir_ictx, dir_inode) < 0)
+			return NVFUSE_ERROR;
+
+		for (lblock = 0; lblock < dir_ictx->ictx_dir_space_nr; lblock++) {
+			if (dir_ictx->ictx_dir_space[lblock] >= rec_len) {
+				dir_ictx->ictx_dir_space[lblock] -= rec_len;
+				return lblock;
+			}
 		}
+	}
 
-		dir_bh = nvfuse_get_new_bh(sb, dir_ictx, dir_inode->i_ino, NVFUSE_SIZE_TO_BLK(dir_inode->i_size),
-					   NVFUSE_TYPE_META);
-		nvfuse_release_bh(sb, dir_bh, INSERT_HEAD, DIRTY);
-		assert(dir_inode->i_size < MAX_FILE_SIZE);
-		dir_inode->i_size += CLUSTER_SIZE;
-		goto RETRY;
+	/* allocate new directory block */
+	ret = nvfuse_get_block(sb, dir_ictx, NVFUSE_SIZE_TO_BLK(dir_inode->i_size), 1/* num block */, NULL,
+			       NULL, 1);
+	if (ret) {
+		dprintf_error(BLOCK, " data block allocation fails.");
+		return NVFUSE_ERROR;
 	}
 
-FIND:
+	dir_bh = nvfuse_get_new_bh(sb, dir_ictx, dir_inode->i_ino, NVFUSE_SIZE_TO_BLK(dir_inode->i_size),
+				   NVFUSE_TYPE_META);
+	/* a zeroed block has no dentries */
+	memset(dir_bh->bh_buf, 0x00, CLUSTER_SIZE);
+	nvfuse_release_bh(sb, dir_bh, INSERT_HEAD, DIRTY);
+	assert(dir_inode->i_size < MAX_FILE_SIZE);
+	dir_inode->i_size += CLUSTER_SIZE;
 
-	return search_lblock * DIR_ENTRY_NUM + search_entry;
+	nvfuse_dir_space_grow(dir_ictx, NVFUSE_SIZE_TO_BLK(dir_inode->i_size), CLUSTER_SIZE - rec_len);
+
+	return NVFUSE_SIZE_TO_BLK(dir_inode->i_size) - 1;
 }
 
 
+/* returns the logical block holding the dentry or -1 if not found */
 s32 nvfuse_find_existing_dentry(struct nvfuse_superblock *sb, struct nvfuse_inode_ctx *dir_ictx, struct nvfuse_inode *dir_inode, s8 *filename)
 {
-	struct nvfuse_dir_entry *dir = NULL;
-	struct nvfuse_buffer_head *dir_bh = NULL;
-
-	s64 read_bytes = 0;
-	s64 start = 0;
+	struct nvfuse_dir_block db;
 	u32 offset = 0;
-	s64 dir_size = 0;
-	u32 found_entry = -1;
+	u32 dentry_blk;
+	u32 end_blk;
+	s32 found_entry = -1;
+
+	end_blk = nvfuse_dir_nr_blocks(dir_inode);
 
 #if NVFUSE_USE_DIR_INDEXING == 1
-	if (nvfuse_get_dir_indexing(sb, dir_inode, filename, &offset) < 0) {
-		dprintf_info(DIRECTORY, " dir (%s) is not in the index.\n", filename);
-		offset = 0;
-		/* linear search */
-	} else {
-		/* quick search */
+	/* small directories are not indexed and scanned */
+	if (dir_inode->i_bpino) {
+		if (nvfuse_get_dir_indexing(sb, dir_ictx, filename, &offset) < 0) {
+			dprintf_info(DIRECTORY, " dir (%s) is not in the index.\n", filename);
+			return found_entry;
+		}
+
+		/* the index points out the dentry block ("." and ".." live in block 0) */
+		end_blk = offset + 1;
 	}
 #endif
 
-	dir_size = dir_inode->i_size;
-	start = (s64)offset * DIR_ENTRY_SIZE;
-	if ((start & (CLUSTER_SIZE - 1))) {
-		dir_bh = nvfuse_get_bh(sb, dir_ictx, dir_inode->i_ino, NVFUSE_SIZE_TO_BLK(start), READ,
-				       NVFUSE_TYPE_META);
-		dir = (struct nvfuse_dir_entry *)dir_bh->bh_buf;
-		dir += (offset % DIR_ENTRY_NUM);
-	}
+	for (dentry_blk = offset; dentry_blk < end_blk; dentry_blk++) {
+		if (nvfuse_get_dir_block(sb, dir_ictx, dentry_blk, &db) < 0)
+			break;
 
-	for (read_bytes = start; read_bytes < dir_size; read_bytes += DIR_ENTRY_SIZE) {
-		if (!(read_bytes & (CLUSTER_SIZE - 1))) {
-			if (dir_bh)
-				nvfuse_release_bh(sb, dir_bh, 0/*tail*/, 0/*dirty*/);
-			dir_bh = nvfuse_get_bh(sb, dir_ictx, dir_inode->i_ino, NVFUSE_SIZE_TO_BLK(read_bytes), READ,
-					       NVFUSE_TYPE_META);
-			dir = (struct nvfuse_dir_entry *)dir_bh->bh_buf;
-		}
+		if (nvfuse_dentry_find(db.db_buf, db.db_size, filename))
+			found_entry = dentry_blk;
 
-		if (dir->d_flag == DIR_USED) {
-			if (!strcmp(dir->d_filename, filename)) {
-				found_entry = read_bytes / DIR_ENTRY_SIZE;
-				nvfuse_release_bh(sb, dir_bh, 0/*tail*/, 0/*dirty*/);
-				break;
-			}
-		}
-		dir++;
+		nvfuse_release_dir_block(sb, &db, NVF_CLEAN);
+		if (found_entry >= 0)
+			break;
 	}
 
 	return found_entry;
@@ -2704,31 +3642,32 @@ s32 nvfuse_rm_direntry(struct nvfuse_superblock *sb, inode_t par_ino, s8 *name,
 	struct nvfuse_inode *dir_inode = NULL;
 	struct nvfuse_inode *inode = NULL;
 	struct nvfuse_dir_entry *dir = NULL;
-	struct nvfuse_buffer_head *dir_bh = NULL;
-	u32 found_entry;
-	u32 search_lblock, search_entry;
+	struct nvfuse_dir_block db;
+	s32 found_entry;
 
 	dir_ictx = nvfuse_read_inode(sb, NULL, par_ino);
 	dir_inode = dir_ictx->ictx_inode;
 
 	/* find an existing dentry */
 	found_entry = nvfuse_find_existing_dentry(sb, dir_ictx, dir_inode, name);
-	if (found_entry < 0)
+	if (found_entry < 0) {
+		nvfuse_release_inode(sb, dir_ictx, NVF_CLEAN);
 		return 0;
+	}
 
-	search_lblock = found_entry / DIR_ENTRY_NUM;
-	search_entry = found_entry % DIR_ENTRY_NUM;
-	dir_bh = nvfuse_get_bh(sb, dir_ictx, dir_inode->i_ino, search_lblock, READ,
-						   NVFUSE_TYPE_META);
-	dir = (struct nvfuse_dir_entry *)dir_bh->bh_buf;
-	dir += search_entry;
+	if (nvfuse_get_dir_block(sb, dir_ictx, found_entry, &db) < 0) {
+		nvfuse_release_inode(sb, dir_ictx, NVF_CLEAN);
+		return NVFUSE_ERROR;
+	}
+	dir = nvfuse_dentry_find(db.db_buf, db.db_size, name);
+	assert(dir != NULL);
 
 	ictx = nvfuse_read_inode(sb, NULL, dir->d_ino);
 	inode = ictx->ictx_inode;
 
 	if (inode == NULL || inode->i_ino == 0) {
 		dprintf_error(INODE, " file (%s) is not found this directory\n", name);
-		nvfuse_release_bh(sb, dir_bh, 0/*tail*/, NVF_CLEAN);
+		nvfuse_release_dir_block(sb, &db, NVF_CLEAN);
 		return NVFUSE_ERROR;
 	}
 
@@ -2739,12 +3678,18 @@ s32 nvfuse_rm_direntry(struct nvfuse_superblock *sb, inode_t par_ino, s8 *name,
 	inode->i_links_count--;
 
 #if NVFUSE_USE_DIR_INDEXING == 1
-	nvfuse_del_dir_indexing(sb, dir_inode, name);
+	nvfuse_del_dir_indexing(sb, dir_ictx, name, found_entry);
 #endif
 
-	dir->d_flag = DIR_DELETED;
+	nvfuse_dentry_remove(db.db_buf, db.db_size, dir);
+	dir_inode->i_links_count--;
+	dir_inode->i_ptr = dir_inode->i_links_count - 1;
+
+	nvfuse_release_dir_block(sb, &db, DIRTY);
+
+	/* Refill the hole with the last dentry and free the last block once it is empty. */
+	nvfuse_shrink_dentry(sb, dir_ictx, found_entry);
 
-	nvfuse_release_bh(sb, dir_bh, 0, DIRTY);
 	nvfuse_release_inode(sb, dir_ictx, DIRTY);
 
 	nvfuse_release_inode(sb, ictx, DIRTY);
@@ -2831,7 +3776,235 @@ int nvfuse_read_block(char *buf, unsigned long block, struct io_target *target)
 	return nvfuse_read_cluster(buf, block, target);
 }
 
-void nvfuse_flush_dirty_data(struct nvfuse_superblock *sb) 
+/* an inode locked up the call stack is left alone by flushes and the reclaimer */
+s32 nvfuse_ictx_is_locked(struct nvfuse_superblock *sb, inode_t ino)
+{
+	struct nvfuse_inode_ctx *ictx;
+	s32 locked = 0;
+
+	SPINLOCK_LOCK(&sb->sb_ictxc->ictxc_lock);
+	ictx = nvfuse_ictx_hash_lookup(sb->sb_ictxc, ino);
+	if (ictx && test_bit(&ictx->ictx_status, INODE_STATE_LOCK))
+		locked = 1;
+	SPINLOCK_UNLOCK(&sb->sb_ictxc->ictxc_lock);
+
+	return locked;
+}
+
+#ifdef NVFUSE_USE_DELAYED_ALLOCATION
+/*
+ * charge a free block to a buffered write of a block without an address.
+ * the charge is dropped when the block is allocated at flush time or the
+ * buffer is thrown away. returns -1 if no free block is left.
+ */
+s32 nvfuse_reserve_delayed_block(struct nvfuse_superblock *sb)
+{
+	s32 container_id;
+
+	/* charged first, so writers racing for the last blocks see each other */
+	nvfuse_add_sb_counter(sb, NVFUSE_SB_DA_RESERVED_BLOCKS, 1);
+	if (nvfuse_check_free_block(sb, 0))
+		return 0;
+
+	if (nvfuse_process_model_is_dataplane()) {
+		container_id = nvfuse_alloc_container_from_primary_process(sb->sb_nvh, CONTAINER_NEW_ALLOC);
+		if (container_id > 0) {
+			/* insert allocated container to process */
+			nvfuse_add_bg(sb, container_id);
+			if (nvfuse_check_free_block(sb, 0))
+				return 0;
+		}
+	}
+
+	nvfuse_add_sb_counter(sb, NVFUSE_SB_DA_RESERVED_BLOCKS, -1);
+	return -1;
+}
+
+void nvfuse_release_delayed_blocks(struct nvfuse_superblock *sb, u32 cnt)
+{
+	if (cnt)
+		nvfuse_add_sb_counter(sb, NVFUSE_SB_DA_RESERVED_BLOCKS, -(s64)cnt);
+}
+
+/* number of buffers of bcs[0..nr) charged by nvfuse_reserve_delayed_block() */
+static u32 nvfuse_count_delayed(struct nvfuse_buffer_cache **bcs, s32 nr)
+{
+	u32 cnt = 0;
+	s32 i;
+
+	for (i = 0; i < nr; i++)
+		cnt += bcs[i]->bc_delayed;
+
+	return cnt;
+}
+
+/* false if the buffer was truncated, unlinked or allocated after it was collected */
+static s32 nvfuse_delayed_bc_is_valid(struct nvfuse_buffer_cache *bc)
+{
+	s32 valid;
+
+	SPINLOCK_LOCK(&bc->bc_lock);
+	valid = bc->bc_dirty && !bc->bc_pno;
+	SPINLOCK_UNLOCK(&bc->bc_lock);
+
+	return valid;
+}
+
+static void nvfuse_unpin_bcs(struct nvfuse_buffer_cache **bcs, s32 nr)
+{
+	s32 i;
+
+	for (i = 0; i < nr; i++)
+		rte_atomic32_dec(&bcs[i]->bc_pin);
+}
+
+static int nvfuse_cmp_bc_bno(const void *a, const void *b)
+{
+	const struct nvfuse_buffer_cache *bc_a = *(struct nvfuse_buffer_cache * const *)a;
+	const struct nvfuse_buffer_cache *bc_b = *(struct nvfuse_buffer_cache * const *)b;
+
+	if (bc_a->bc_bno < bc_b->bc_bno)
+		return -1;
+
+	return bc_a->bc_bno > bc_b->bc_bno;
+}
+
+/* map a run of buffers holding consecutive blocks of ictx */
+static s32 nvfuse_alloc_delayed_run(struct nvfuse_superblock *sb, struct nvfuse_inode_ctx *ictx,
+				    struct nvfuse_buffer_cache **bcs, s32 nr)
+{
+	struct nvfuse_buffer_cache *bc;
+	u32 lblk, pblk, num;
+	s32 done = 0;
+	u32 i;
+
+	/* the allocator must not see the blocks it is about to hand out as taken */
+	nvfuse_release_delayed_blocks(sb, nvfuse_count_delayed(bcs, nr));
+
+	while (done < nr) {
+		lblk = bcs[done]->bc_lbno;
+
+		/* allocated blocks need not be contiguous, so look the run up again */
+		if (nvfuse_get_block(sb, ictx, lblk, nr - done, NULL, NULL, 1) < 0 ||
+		    nvfuse_get_block(sb, ictx, lblk, nr - done, &num, &pblk, 0) < 0 || !pblk) {
+			dprintf_error(BUFFER, " delayed allocation fails (ino = %d lblk = %d)\n",
+				      ictx->ictx_ino, lblk);
+			/* the buffers left keep their charge for the next flush */
+			nvfuse_add_sb_counter(sb, NVFUSE_SB_DA_RESERVED_BLOCKS,
+					      nvfuse_count_delayed(bcs + done, nr - done));
+			return -1;
+		}
+
+		for (i = 0; i < num; i++) {
+			bc = bcs[done + i];
+			SPINLOCK_LOCK(&bc->bc_lock);
+			bc->bc_pno = pblk + i;
+			bc->bc_delayed = 0;
+			SPINLOCK_UNLOCK(&bc->bc_lock);
+		}
+		done += num;
+	}
+
+	return 0;
+}
+
+/*
+ * Buffered writes leave file blocks unallocated. Before dirty buffers are
+ * written out, the blocks of every inode are allocated at once for all of
+ * its dirty buffers, which keeps the runs of the file contiguous and never
+ * allocates blocks for files removed before the flush. buffers whose blocks
+ * cannot be allocated stay dirty without an address and -1 is returned.
+ * The collected buffers are pinned so that they keep their key until they
+ * are looked at again under the inode lock.
+ */
+static s32 nvfuse_alloc_delayed_blocks(struct nvfuse_superblock *sb)
+{
+	struct nvfuse_buffer_manager *bm = sb->sb_bm;
+	struct nvfuse_buffer_cache **bcs;
+	struct nvfuse_buffer_cache *bc;
+	struct nvfuse_inode_ctx *ictx;
+	s32 max_bcs, nr = 0;
+	s32 i, j, k, l, m, end;
+	s32 ret = 0;
+	u32 live;
+
+	max_bcs = nvfuse_get_dirty_count(sb);
+	if (!max_bcs)
+		return 0;
+
+	bcs = malloc(sizeof(struct nvfuse_buffer_cache *) * max_bcs);
+	if (bcs == NULL) {
+		dprintf_error(BUFFER, " malloc error\n");
+		return -1;
+	}
+
+	SPINLOCK_LOCK(&bm->bm_lock);
+	list_for_each_entry(bc, &bm->bm_list[BUFFER_TYPE_DIRTY], bc_list) {
+		if (!bc->bc_pno && nr < max_bcs) {
+			rte_atomic32_inc(&bc->bc_pin);
+			bcs[nr++] = bc;
+		}
+	}
+	SPINLOCK_UNLOCK(&bm->bm_lock);
+
+	/* sorted by inode, then by block */
+	qsort(bcs, nr, sizeof(struct nvfuse_buffer_cache *), nvfuse_cmp_bc_bno);
+
+	for (i = 0; i < nr; i = j) {
+		for (j = i + 1; j < nr && bcs[j]->bc_ino == bcs[i]->bc_ino; j++)
+			;
+
+		if (nvfuse_ictx_is_locked(sb, bcs[i]->bc_ino)) {
+			nvfuse_unpin_bcs(bcs + i, j - i);
+			continue;
+		}
+
+		ictx = nvfuse_read_inode(sb, NULL, bcs[i]->bc_ino);
+		if (ictx == NULL) {
+			nvfuse_unpin_bcs(bcs + i, j - i);
+			ret = -1;
+			continue;
+		}
+
+		/* truncate and unlink hold the inode, so what is left now stays */
+		for (k = m = i; k < j; k++) {
+			if (nvfuse_delayed_bc_is_valid(bcs[k]))
+				bcs[m++] = bcs[k];
+			else
+				rte_atomic32_dec(&bcs[k]->bc_pin);
+		}
+
+		/* buffers past the end of an orphan are dropped by the reclaimer */
+		live = nvfuse_reclaim_live_blocks(ictx->ictx_inode);
+		for (end = m; end > i && bcs[end - 1]->bc_lbno >= live; end--)
+			;
+
+		for (k = i; k < end; k = l) {
+			for (l = k + 1; l < end && bcs[l]->bc_lbno == bcs[l - 1]->bc_lbno + 1; l++)
+				;
+
+			/* the other runs and inodes are still written out */
+			if (nvfuse_alloc_delayed_run(sb, ictx, bcs + k, l - k) < 0)
+				ret = -1;
+		}
+
+		/* the next flush reserves a new window from where this one ended */
+		nvfuse_release_prealloc(sb, ictx);
+		nvfuse_release_inode(sb, ictx, DIRTY);
+		nvfuse_unpin_bcs(bcs + i, m - i);
+	}
+
+	free(bcs);
+
+	return ret;
+}
+#endif
+
+/*
+ * write every dirty buffer out. returns NVFUSE_ERROR if blocks could not be
+ * allocated for some buffered writes, those buffers are kept dirty.
+ */
+s32 nvfuse_flush_dirty_data(struct nvfuse_superblock *sb) 
 {
 	struct nvfuse_buffer_manager *bm = sb->sb_bm;
 	struct list_head *dirty_head, *flushing_head;
@@ -2839,6 +4012,18 @@ void nvfuse_flush_dirty_data(struct nvfuse_superblock *sb)
 	struct nvfuse_buffer_cache *bc;
 	s32 dirty_count = 0;
 	s32 flushing_count = 0;
+	s32 ret = NVFUSE_SUCCESS;
+#ifdef NVFUSE_USE_ONLINE_DISCARD
+	u64 discard_seq;
+
+	/* ranges freed so far have their bitmaps written by this flush */
+	discard_seq = nvfuse_discard_seal(sb);
+#endif
+
+#ifdef NVFUSE_USE_DELAYED_ALLOCATION
+	if (nvfuse_alloc_delayed_blocks(sb) < 0)
+		ret = NVFUSE_ERROR;
+#endif
 
 	while ((dirty_count = nvfuse_get_dirty_count(sb)) != 0) {
 		dirty_head = &bm->bm_list[BUFFER_TYPE_DIRTY];
@@ -2853,6 +4038,11 @@ void nvfuse_flush_dirty_data(struct nvfuse_superblock *sb)
 			SPINLOCK_LOCK(&bc->bc_lock);
 
 			assert(bc->bc_dirty);
+			if (!bc->bc_pno) {
+				/* still waiting for delayed allocation */
+				SPINLOCK_UNLOCK(&bc->bc_lock);
+				continue;
+			}
 			bc->bc_flush = 1;
 			//list_move(&bc->bc_list, flushing_head);
 			nvfuse_move_buffer_list_nolock(sb, bc, BUFFER_TYPE_FLUSHING, INSERT_HEAD);
@@ -2865,6 +4055,9 @@ void nvfuse_flush_dirty_data(struct nvfuse_superblock *sb)
 		}
 		SPINLOCK_UNLOCK(&bm->bm_lock);
 
+		if (!flushing_count)
+			break;
+
 		/* sync dirty data to SSD */
 		nvfuse_sync_dirty_data(sb, flushing_count);
 
@@ -2890,6 +4083,12 @@ void nvfuse_flush_dirty_data(struct nvfuse_superblock *sb)
 
 	/* flush cmd to nvme ssd */
 	reactor_sync_flush(sb->target);
+
+#ifdef NVFUSE_USE_ONLINE_DISCARD
+	nvfuse_discard_issue(sb, discard_seq);
+#endif
+
+	return ret;
 }
 
 void nvfuse_check_flush_dirty(struct nvfuse_superblock *sb, s32 force)
@@ -2913,7 +4112,8 @@ void nvfuse_check_flush_dirty(struct nvfuse_superblock *sb, s32 force)
 	start_tsc = spdk_get_ticks();
 
 #if 1
-	nvfuse_flush_dirty_data(sb);
+	if (nvfuse_flush_dirty_data(sb) < 0)
+		dprintf_warn(FLUSHWORK, " dirty buffers without blocks are left for the next flush\n");
 #else
 	//printf(" launch primary lcore = %d dirty = %d \n", rte_lcore_id(), dirty_count);
 	nvfuse_queuework();
@@ -2925,8 +4125,8 @@ void nvfuse_check_flush_dirty(struct nvfuse_superblock *sb, s32 force)
 #endif
 	dprintf_info(FLUSHWORK, " Flush complets \n");
 
-	sb->nvme_io_tsc += (spdk_get_ticks() - start_tsc);
-	sb->nvme_io_count ++;
+	nvfuse_add_sb_counter(sb, NVFUSE_SB_NVME_IO_TSC, spdk_get_ticks() - start_tsc);
+	nvfuse_add_sb_counter(sb, NVFUSE_SB_NVME_IO_COUNT, 1);
 
 #ifdef DEBUG_FLUSH_DIRTY_INODE
 	/* FIXME: it is necessary to analyze why dirties are left here. */
@@ -2963,6 +4163,186 @@ void nvfuse_release_super(struct nvfuse_superblock *sb)
 	return;
 }
 
+u32 nvfuse_dentry_rec_len(struct nvfuse_dir_entry *dir)
+{
+#if NVFUSE_DENTRY_FORMAT == NVFUSE_DENTRY_FORMAT_VARLEN
+	return dir->d_rec_len;
+#else
+	/* the record length field of the fixed format can be left zero */
+	return DIR_ENTRY_SIZE;
+#endif
+}
+
+struct nvfuse_dir_entry *nvfuse_dentry_first(s8 *buf)
+{
+	struct nvfuse_dir_entry *dir = (struct nvfuse_dir_entry *)buf;
+
+	if (dir->d_flag != DIR_USED)
+		return NULL;
+
+	return dir;
+}
+
+struct nvfuse_dir_entry *nvfuse_dentry_next(s8 *buf, u32 size, struct nvfuse_dir_entry *dir)
+{
+	u32 rec_len = nvfuse_dentry_rec_len(dir);
+	u32 pos = (s8 *)dir - buf + rec_len;
+
+	if (rec_len == 0 || pos + DIR_ENTRY_HEAD_SIZE > size)
+		return NULL;
+
+	return nvfuse_dentry_first(buf + pos);
+}
+
+struct nvfuse_dir_entry *nvfuse_dentry_last(s8 *buf, u32 size)
+{
+	struct nvfuse_dir_entry *dir, *last = NULL;
+
+	for (dir = nvfuse_dentry_first(buf); dir; dir = nvfuse_dentry_next(buf, size, dir))
+		last = dir;
+
+	return last;
+}
+
+struct nvfuse_dir_entry *nvfuse_dentry_find(s8 *buf, u32 size, const s8 *filename)
+{
+	struct nvfuse_dir_entry *dir;
+
+	for (dir = nvfuse_dentry_first(buf); dir; dir = nvfuse_dentry_next(buf, size, dir)) {
+		if (!strcmp(dir->d_filename, filename))
+			return dir;
+	}
+
+	return NULL;
+}
+
+/* bytes taken by the dentries packed at the head of a directory block */
+u32 nvfuse_dentry_block_used(s8 *buf, u32 size)
+{
+	struct nvfuse_dir_entry *last = nvfuse_dentry_last(buf, size);
+
+	if (last == NULL)
+		return 0;
+
+	return (s8 *)last - buf + nvfuse_dentry_rec_len(last);
+}
+
+void nvfuse_dentry_fill(struct nvfuse_dir_entry *dir, inode_t ino, u32 version, const s8 *filename)
+{
+	u32 name_len = strlen(filename);
+
+	dir->d_ino = ino;
+	dir->d_flag = DIR_USED;
+	dir->d_name_len = name_len;
+	dir->d_rec_len = DIR_REC_LEN(name_len);
+	dir->d_version = version;
+	memcpy(dir->d_filename, filename, name_len + 1);
+}
+
+/* copy a dentry without touching bytes beyond its on-disk record */
+void nvfuse_dentry_copy(struct nvfuse_dir_entry *to, struct nvfuse_dir_entry *from)
+{
+	memcpy(to, from, DIR_ENTRY_HEAD_SIZE);
+	strcpy(to->d_filename, from->d_filename);
+}
+
+/* returns NULL if the block does not have room for the name */
+struct nvfuse_dir_entry *nvfuse_dentry_append(s8 *buf, u32 size, inode_t ino, u32 version,
+		const s8 *filename)
+{
+	struct nvfuse_dir_entry *dir;
+	u32 used = nvfuse_dentry_block_used(buf, size);
+
+	if (used + DIR_REC_LEN(strlen(filename)) > size)
+		return NULL;
+
+	dir = (struct nvfuse_dir_entry *)(buf + used);
+	nvfuse_dentry_fill(dir, ino, version, filename);
+
+	return dir;
+}
+
+/* remove a dentry and slide the following records down to keep the block packed */
+void nvfuse_dentry_remove(s8 *buf, u32 size, struct nvfuse_dir_entry *dir)
+{
+	u32 used = nvfuse_dentry_block_used(buf, size);
+	u32 pos = (s8 *)dir - buf;
+	u32 rec_len = nvfuse_dentry_rec_len(dir);
+
+	assert(pos + rec_len <= used);
+
+	memmove(buf + pos, buf + pos + rec_len, used - pos - rec_len);
+	memset(buf + used - rec_len, 0x00, rec_len);
+}
+
+u32 nvfuse_dir_nr_blocks(struct nvfuse_inode *dir_inode)
+{
+	if (dir_inode->i_flags & NVFUSE_INODE_FLAG_INLINE)
+		return 1;
+
+	return NVFUSE_SIZE_TO_BLK(dir_inode->i_size);
+}
+
+/* records the room left in a directory block after its dentries changed */
+void nvfuse_dir_space_set(struct nvfuse_inode_ctx *dir_ictx, lbno_t lblock, u32 used)
+{
+	if (dir_ictx->ictx_dir_space == NULL || lblock >= dir_ictx->ictx_dir_space_nr)
+		return;
+
+	dir_ictx->ictx_dir_space[lblock] = CLUSTER_SIZE - used;
+}
+
+/* forgets the blocks cut off the end of the directory */
+void nvfuse_dir_space_trim(struct nvfuse_inode_ctx *dir_ictx, u32 nr_blocks)
+{
+	if (dir_ictx->ictx_dir_space_nr > nr_blocks)
+		dir_ictx->ictx_dir_space_nr = nr_blocks;
+}
+
+void nvfuse_dir_space_free(struct nvfuse_inode_ctx *dir_ictx)
+{
+	free(dir_ictx->ictx_dir_space);
+	dir_ictx->ictx_dir_space = NULL;
+	dir_ictx->ictx_dir_space_nr = 0;
+}
+
+/* inline directories have a single block kept in the inode */
+s32 nvfuse_get_dir_block(struct nvfuse_superblock *sb, struct nvfuse_inode_ctx *dir_ictx,
+			 lbno_t lblock, struct nvfuse_dir_block *db)
+{
+	struct nvfuse_inode *dir_inode = dir_ictx->ictx_inode;
+
+	db->db_ictx = dir_ictx;
+
+	if (dir_inode->i_flags & NVFUSE_INODE_FLAG_INLINE) {
+		assert(lblock == 0);
+		db->db_bh = NULL;
+		db->db_buf = (s8 *)dir_inode->i_inline;
+		db->db_size = NVFUSE_INLINE_DATA_SIZE;
+		return 0;
+	}
+
+	db->db_bh = nvfuse_get_bh(sb, dir_ictx, dir_inode->i_ino, lblock, READ, NVFUSE_TYPE_META);
+	if (db->db_bh == NULL) {
+		dprintf_error(BUFFER, " nvfuse_get_bh() \n");
+		return -1;
+	}
+	db->db_buf = db->db_bh->bh_buf;
+	db->db_size = CLUSTER_SIZE;
+
+	return 0;
+}
+
+void nvfuse_release_dir_block(struct nvfuse_superblock *sb, struct nvfuse_dir_block *db, s32 dirty)
+{
+	if (db->db_bh) {
+		nvfuse_release_bh(sb, db->db_bh, 0, dirty);
+		db->db_bh = NULL;
+	} else if (dirty) {
+		nvfuse_mark_inode_dirty(db->db_ictx);
+	}
+}
+
 s32 nvfuse_dir_is_invalid(struct nvfuse_dir_entry *dir)
 {
 	if (dir->d_flag == DIR_EMPTY || dir->d_flag == DIR_DELETED)
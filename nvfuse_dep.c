@@ -30,6 +30,9 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#if defined(__AVX2__) || defined(__SSE2__)
+#include <immintrin.h>
+#endif
 #include "nvfuse_types.h"
 #include "nvfuse_dep.h"
 
@@ -67,6 +70,147 @@ s32 ext2fs_test_bit(u32 nr, const void *addr)
 	return (mask & *ADDR);
 }
 
+/*
+ * Word-at-a-time bitmap helpers
+ *
+ * The bitmaps keep the ext2fs bit order, so bit nr is bit (nr & 7) of byte
+ * (nr >> 3) and a little endian 64bit load puts bit nr at position nr % 64.
+ * addr must be 8-byte aligned and padded to a multiple of 64 bits, which
+ * holds for the block-sized bitmap buffers.
+ */
+static inline u64 bitmap_load(const u64 *w)
+{
+#if __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+	return __builtin_bswap64(*w);
+#else
+	return *w;
+#endif
+}
+
+static inline void bitmap_store(u64 *w, u64 v)
+{
+#if __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+	*w = __builtin_bswap64(v);
+#else
+	*w = v;
+#endif
+}
+
+/* index of the first word from i on which differs from pattern (0 or ~0) */
+static inline u32 bitmap_skip_words(const u64 *w, u32 i, u32 nwords, u64 pattern)
+{
+#if defined(__AVX2__)
+	__m256i p = _mm256_set1_epi64x(pattern);
+
+	for (; i + 4 <= nwords; i += 4) {
+		__m256i v = _mm256_loadu_si256((const __m256i *)(w + i));
+		if (_mm256_movemask_epi8(_mm256_cmpeq_epi64(v, p)) != -1)
+			break;
+	}
+#elif defined(__SSE2__)
+	__m128i p = _mm_set1_epi64x(pattern);
+
+	for (; i + 2 <= nwords; i += 2) {
+		__m128i v = _mm_loadu_si128((const __m128i *)(w + i));
+		if (_mm_movemask_epi8(_mm_cmpeq_epi32(v, p)) != 0xffff)
+			break;
+	}
+#endif
+	while (i < nwords && w[i] == pattern)
+		i++;
+
+	return i;
+}
+
+static u32 bitmap_find_next(const void *addr, u32 size, u32 offset, u64 invert)
+{
+	const u64 *w = (const u64 *)addr;
+	u32 nwords = (size + 63) / 64;
+	u32 i = offset / 64;
+	u64 word;
+	u32 bit;
+
+	if (offset >= size)
+		return size;
+
+	word = (bitmap_load(w + i) ^ invert) & (~0ULL << (offset % 64));
+	while (!word) {
+		i = bitmap_skip_words(w, i + 1, nwords, invert);
+		if (i >= nwords)
+			return size;
+		word = bitmap_load(w + i) ^ invert;
+	}
+
+	bit = i * 64 + __builtin_ctzll(word);
+
+	return bit < size ? bit : size;
+}
+
+/* first clear bit in [offset, size), size if there is none */
+u32 nvfuse_bitmap_find_next_zero(const void *addr, u32 size, u32 offset)
+{
+	return bitmap_find_next(addr, size, offset, ~0ULL);
+}
+
+/* first set bit in [offset, size), size if there is none */
+u32 nvfuse_bitmap_find_next_set(const void *addr, u32 size, u32 offset)
+{
+	return bitmap_find_next(addr, size, offset, 0);
+}
+
+/* length of the longest run of clear bits, which starts at *start */
+u32 nvfuse_bitmap_longest_zero_run(const void *addr, u32 size, u32 *start)
+{
+	u32 pos, end;
+	u32 best = 0;
+
+	*start = size;
+
+	pos = nvfuse_bitmap_find_next_zero(addr, size, 0);
+	while (pos < size) {
+		end = nvfuse_bitmap_find_next_set(addr, size, pos);
+		if (end - pos > best) {
+			best = end - pos;
+			*start = pos;
+		}
+		pos = nvfuse_bitmap_find_next_zero(addr, size, end);
+	}
+
+	return best;
+}
+
+static void bitmap_update_range(void *addr, u32 start, u32 len, s32 set)
+{
+	u64 *w = (u64 *)addr + start / 64;
+	u32 bit = start % 64;
+	u64 mask;
+	u32 n;
+
+	while (len) {
+		n = (64 - bit < len) ? 64 - bit : len;
+		mask = (n == 64) ? ~0ULL : ((1ULL << n) - 1) << bit;
+
+		if (set)
+			bitmap_store(w, bitmap_load(w) | mask);
+		else
+			bitmap_store(w, bitmap_load(w) & ~mask);
+
+		len -= n;
+		bit = 0;
+		w++;
+	}
+}
+
+void nvfuse_bitmap_set_range(void *addr, u32 start, u32 len)
+{
+	bitmap_update_range(addr, start, len, 1);
+}
+
+void nvfuse_bitmap_clear_range(void *addr, u32 start, u32 len)
+{
+	bitmap_update_range(addr, start, len, 0);
+}
+
 s32 fat_dirname(const s8 *path, s8 *dest)
 {
 	s8 *slash;
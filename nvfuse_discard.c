@@ -0,0 +1,427 @@
+/*
+*	NVFUSE (NVMe based File System in Userspace)
+*	Copyright (C) 2016 Yongseok Oh <yongseok.oh@sk.com>
+*	First Writing: 30/10/2016
+*
+* This program is free software; you can redistribute it and/or modify it
+* under the terms and conditions of the GNU General Public License,
+* version 2, as published by the Free Software Foundation.
+*
+* This program is distributed in the hope it will be useful, but WITHOUT
+* ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+* FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License for
+* more details.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+//#define NDEBUG
+#include <assert.h>
+
+#include "nvfuse_core.h"
+#include "nvfuse_config.h"
+#include "nvfuse_dep.h"
+#include "nvfuse_buffer_cache.h"
+#include "nvfuse_reactor.h"
+#include "nvfuse_discard.h"
+#include "nvfuse_debug.h"
+
+#define DRANGE(node)	rb_entry(node, struct nvfuse_discard_range, dr_node)
+#define DRANGE_END(dr)	((dr)->dr_start + (dr)->dr_len)
+
+static void nvfuse_discard_update_count(struct nvfuse_discard_ctx *dc)
+{
+	rte_atomic32_set(&dc->dc_count, dc->dc_nr_ranges + dc->dc_issue_nr);
+}
+
+static void nvfuse_discard_link(struct nvfuse_discard_ctx *dc, struct nvfuse_discard_range *dr)
+{
+	struct rb_node **new = &dc->dc_pending.rb_node, *parent = NULL;
+
+	while (*new) {
+		parent = *new;
+		if (dr->dr_start < DRANGE(parent)->dr_start)
+			new = &parent->rb_left;
+		else
+			new = &parent->rb_right;
+	}
+
+	rb_link_node(&dr->dr_node, parent, new);
+	rb_insert_color(&dr->dr_node, &dc->dc_pending);
+	dc->dc_nr_ranges++;
+}
+
+static void nvfuse_discard_del(struct nvfuse_discard_ctx *dc, struct nvfuse_discard_range *dr)
+{
+	rb_erase(&dr->dr_node, &dc->dc_pending);
+	dc->dc_nr_ranges--;
+	free(dr);
+}
+
+/* the last range starting at or before block */
+static struct nvfuse_discard_range *nvfuse_discard_lookup(struct nvfuse_discard_ctx *dc, u32 block)
+{
+	struct rb_node *node = dc->dc_pending.rb_node;
+	struct nvfuse_discard_range *dr, *found = NULL;
+
+	while (node) {
+		dr = DRANGE(node);
+		if (block < dr->dr_start) {
+			node = node->rb_left;
+		} else {
+			found = dr;
+			node = node->rb_right;
+		}
+	}
+
+	return found;
+}
+
+s32 nvfuse_discard_init(struct nvfuse_superblock *sb)
+{
+	struct nvfuse_discard_ctx *dc;
+
+	sb->sb_discard = NULL;
+
+	if (!reactor_unmap_supported(sb->target)) {
+		dprintf_info(MOUNT, " device does not support unmap, online discard is disabled \n");
+		return 0;
+	}
+
+	dc = (struct nvfuse_discard_ctx *)malloc(sizeof(struct nvfuse_discard_ctx));
+	if (dc == NULL) {
+		dprintf_error(MOUNT, " malloc error \n");
+		return -1;
+	}
+	memset(dc, 0x00, sizeof(struct nvfuse_discard_ctx));
+
+	rte_spinlock_init(&dc->dc_lock);
+	dc->dc_pending = RB_ROOT;
+	rte_atomic32_init(&dc->dc_count);
+
+	sb->sb_discard = dc;
+
+	return 0;
+}
+
+void nvfuse_discard_deinit(struct nvfuse_superblock *sb)
+{
+	struct nvfuse_discard_ctx *dc = sb->sb_discard;
+	struct rb_node *node;
+
+	if (dc == NULL)
+		return;
+
+	if (dc->dc_nr_ranges)
+		dprintf_info(MOUNT, " %lu blocks left undiscarded \n", (unsigned long)dc->dc_pending_blocks);
+
+	while ((node = rb_first(&dc->dc_pending)) != NULL)
+		nvfuse_discard_del(dc, DRANGE(node));
+
+	dprintf_info(MOUNT, " %lu blocks discarded \n", (unsigned long)dc->dc_discarded);
+
+	free(dc);
+	sb->sb_discard = NULL;
+}
+
+/*
+ * queue [start, start + len) for discard, merging it with the ranges it
+ * overlaps or touches. the caller holds the bitmap buffer and the lock of
+ * the group (see nvfuse_lock_bg_blocks()).
+ */
+void nvfuse_discard_add(struct nvfuse_superblock *sb, u32 start, u32 len)
+{
+	struct nvfuse_discard_ctx *dc = sb->sb_discard;
+	struct nvfuse_discard_range *prev, *dr = NULL, *next;
+	struct rb_node *node;
+	u32 end = start + len;
+
+	if (dc == NULL || !len)
+		return;
+
+	SPINLOCK_LOCK(&dc->dc_lock);
+
+	prev = nvfuse_discard_lookup(dc, start);
+	if (prev && DRANGE_END(prev) >= start) {
+		dr = prev;
+		dc->dc_pending_blocks -= dr->dr_len;
+		start = dr->dr_start;
+		if (DRANGE_END(dr) > end)
+			end = DRANGE_END(dr);
+	}
+
+	node = prev ? rb_next(&prev->dr_node) : rb_first(&dc->dc_pending);
+	while (node && DRANGE(node)->dr_start <= end) {
+		next = DRANGE(node);
+		node = rb_next(node);
+
+		dc->dc_pending_blocks -= next->dr_len;
+		if (DRANGE_END(next) > end)
+			end = DRANGE_END(next);
+
+		if (dr == NULL) {
+			/* it stays between prev and its successor */
+			dr = next;
+			continue;
+		}
+		if (next->dr_seq > dr->dr_seq)
+			dr->dr_seq = next->dr_seq;
+		nvfuse_discard_del(dc, next);
+	}
+
+	if (dr == NULL) {
+		dr = (struct nvfuse_discard_range *)malloc(sizeof(struct nvfuse_discard_range));
+		if (dr == NULL) {
+			/* losing a discard only costs the SSD some free space */
+			dprintf_warn(BLOCK, " malloc error, blocks %u-%u are not discarded \n", start, end - 1);
+			SPINLOCK_UNLOCK(&dc->dc_lock);
+			return;
+		}
+		dr->dr_start = start;
+		nvfuse_discard_link(dc, dr);
+	}
+
+	dr->dr_start = start;
+	dr->dr_len = end - start;
+	dr->dr_seq = dc->dc_seq;
+	dc->dc_pending_blocks += dr->dr_len;
+	nvfuse_discard_update_count(dc);
+
+	SPINLOCK_UNLOCK(&dc->dc_lock);
+}
+
+static s32 nvfuse_discard_inflight(struct nvfuse_discard_ctx *dc, u32 start, u32 end)
+{
+	s32 i;
+
+	for (i = 0; i < dc->dc_issue_nr; i++) {
+		if (dc->dc_issue_start[i] < end &&
+		    dc->dc_issue_start[i] + dc->dc_issue_len[i] > start)
+			return 1;
+	}
+
+	return 0;
+}
+
+/*
+ * take [start, start + len) out of the pending ranges before the blocks are
+ * reused, and wait until no discard covering them is in flight. the caller
+ * has just marked the blocks in use in the DBITMAP and nvfuse_free_dbitmap()
+ * queues a range before it drops the lock of the group, so no range of these
+ * blocks can be queued meanwhile.
+ */
+void nvfuse_discard_cancel(struct nvfuse_superblock *sb, u32 start, u32 len)
+{
+	struct nvfuse_discard_ctx *dc = sb->sb_discard;
+	struct nvfuse_discard_range *dr, *split;
+	struct rb_node *node;
+	u32 end = start + len;
+	u32 dr_end;
+
+	if (dc == NULL || !len || rte_atomic32_read(&dc->dc_count) == 0)
+		return;
+
+	SPINLOCK_LOCK(&dc->dc_lock);
+
+	while (nvfuse_discard_inflight(dc, start, end)) {
+		SPINLOCK_UNLOCK(&dc->dc_lock);
+		usleep(1);
+		SPINLOCK_LOCK(&dc->dc_lock);
+	}
+
+	dr = nvfuse_discard_lookup(dc, start);
+	if (dr == NULL || DRANGE_END(dr) <= start) {
+		node = dr ? rb_next(&dr->dr_node) : rb_first(&dc->dc_pending);
+		dr = node ? DRANGE(node) : NULL;
+	}
+
+	while (dr && dr->dr_start < end) {
+		node = rb_next(&dr->dr_node);
+		dr_end = DRANGE_END(dr);
+
+		if (dr->dr_start < start && dr_end > end) {
+			/* the blocks are in the middle of the range */
+			split = (struct nvfuse_discard_range *)malloc(sizeof(struct nvfuse_discard_range));
+			if (split) {
+				split->dr_start = end;
+				split->dr_len = dr_end - end;
+				split->dr_seq = dr->dr_seq;
+				nvfuse_discard_link(dc, split);
+			} else {
+				dc->dc_pending_blocks -= dr_end - end;
+			}
+			dc->dc_pending_blocks -= end - start;
+			dr->dr_len = start - dr->dr_start;
+		} else if (dr->dr_start < start) {
+			dc->dc_pending_blocks -= dr_end - start;
+			dr->dr_len = start - dr->dr_start;
+		} else if (dr_end > end) {
+			dc->dc_pending_blocks -= end - dr->dr_start;
+			dr->dr_len = dr_end - end;
+			dr->dr_start = end;
+		} else {
+			dc->dc_pending_blocks -= dr->dr_len;
+			nvfuse_discard_del(dc, dr);
+		}
+
+		dr = node ? DRANGE(node) : NULL;
+	}
+
+	nvfuse_discard_update_count(dc);
+
+	SPINLOCK_UNLOCK(&dc->dc_lock);
+}
+
+/*
+ * start a new flush sequence. ranges queued so far may be discarded once
+ * the flush that follows has written their bitmaps.
+ */
+u64 nvfuse_discard_seal(struct nvfuse_superblock *sb)
+{
+	struct nvfuse_discard_ctx *dc = sb->sb_discard;
+	u64 seq;
+
+	if (dc == NULL)
+		return 0;
+
+	SPINLOCK_LOCK(&dc->dc_lock);
+	seq = dc->dc_seq++;
+	SPINLOCK_UNLOCK(&dc->dc_lock);
+
+	return seq;
+}
+
+/*
+ * discard the ranges sealed up to seq, NVFUSE_DISCARD_BATCH requests of at
+ * most NVFUSE_DISCARD_MAX_LEN blocks at a time. only one thread issues, the
+ * others leave their ranges to it. returns the number of blocks discarded.
+ */
+u64 nvfuse_discard_issue(struct nvfuse_superblock *sb, u64 seq)
+{
+	struct nvfuse_discard_ctx *dc = sb->sb_discard;
+	struct nvfuse_discard_range *dr;
+	struct rb_node *node;
+	u64 total = 0, blocks;
+	u32 len;
+	s32 nr;
+	s32 ret;
+
+	if (dc == NULL || rte_atomic32_read(&dc->dc_count) == 0)
+		return 0;
+
+	SPINLOCK_LOCK(&dc->dc_lock);
+	if (dc->dc_issuing) {
+		SPINLOCK_UNLOCK(&dc->dc_lock);
+		return 0;
+	}
+	dc->dc_issuing = 1;
+
+	while (1) {
+		nr = 0;
+		blocks = 0;
+		node = rb_first(&dc->dc_pending);
+		while (node && nr < NVFUSE_DISCARD_BATCH) {
+			dr = DRANGE(node);
+			if (dr->dr_seq > seq) {
+				node = rb_next(node);
+				continue;
+			}
+
+			len = dr->dr_len < NVFUSE_DISCARD_MAX_LEN ? dr->dr_len : NVFUSE_DISCARD_MAX_LEN;
+			dc->dc_issue_start[nr] = dr->dr_start;
+			dc->dc_issue_len[nr] = len;
+			nr++;
+			blocks += len;
+
+			if (len == dr->dr_len) {
+				node = rb_next(node);
+				nvfuse_discard_del(dc, dr);
+			} else {
+				dr->dr_start += len;
+				dr->dr_len -= len;
+			}
+		}
+
+		if (!nr)
+			break;
+
+		dc->dc_issue_nr = nr;
+		dc->dc_pending_blocks -= blocks;
+		nvfuse_discard_update_count(dc);
+		SPINLOCK_UNLOCK(&dc->dc_lock);
+
+		ret = reactor_sync_unmap_blks(sb->target, dc->dc_issue_start, dc->dc_issue_len, nr);
+
+		SPINLOCK_LOCK(&dc->dc_lock);
+		dc->dc_issue_nr = 0;
+		nvfuse_discard_update_count(dc);
+
+		if (ret) {
+			/* the blocks are just left undiscarded */
+			dprintf_warn(BLOCK, " unmap of %d ranges failed (ret = %d) \n", nr, ret);
+			continue;
+		}
+		dc->dc_discarded += blocks;
+		total += blocks;
+	}
+
+	dc->dc_issuing = 0;
+	SPINLOCK_UNLOCK(&dc->dc_lock);
+
+	return total;
+}
+
+/*
+ * queue the runs of at least minlen free blocks within [start, end) of the
+ * groups this process owns. they are discarded by the next flush. returns
+ * the number of blocks queued.
+ */
+s64 nvfuse_discard_trim(struct nvfuse_superblock *sb, u64 start, u64 end, u32 minlen)
+{
+	struct nvfuse_bg_descriptor *bd;
+	struct nvfuse_buffer_head *bd_bh, *bh;
+	struct bg_node *node;
+	u32 nr_blocks = sb->sb_no_of_blocks_per_bg;
+	u32 pos, run_end, limit;
+	u64 bg_start;
+	s64 queued = 0;
+
+	if (sb->sb_discard == NULL)
+		return 0;
+
+	if (!minlen)
+		minlen = 1;
+
+	list_for_each_entry(node, &sb->sb_bg_list, list) {
+		bg_start = (u64)node->bg_id * nr_blocks;
+		if (bg_start + nr_blocks <= start || bg_start >= end)
+			continue;
+
+		bd_bh = nvfuse_get_bh(sb, NULL, BD_INO, node->bg_id, READ, NVFUSE_TYPE_META);
+		bd = (struct nvfuse_bg_descriptor *)bd_bh->bh_buf;
+		assert(bd->bd_id == node->bg_id);
+
+		bh = nvfuse_get_bh(sb, NULL, DBITMAP_INO, node->bg_id, READ, NVFUSE_TYPE_META);
+
+		pos = bd->bd_dtable_start % nr_blocks;
+		if (start > bg_start && start - bg_start > pos)
+			pos = start - bg_start;
+		limit = end - bg_start < nr_blocks ? end - bg_start : nr_blocks;
+
+		while ((pos = nvfuse_bitmap_find_next_zero(bh->bh_buf, limit, pos)) < limit) {
+			run_end = nvfuse_bitmap_find_next_set(bh->bh_buf, limit, pos);
+			if (run_end - pos >= minlen) {
+				nvfuse_discard_add(sb, bg_start + pos, run_end - pos);
+				queued += run_end - pos;
+			}
+			pos = run_end;
+		}
+
+		nvfuse_release_bh(sb, bh, 0, NVF_CLEAN);
+		nvfuse_release_bh(sb, bd_bh, 0, NVF_CLEAN);
+	}
+
+	return queued;
+}
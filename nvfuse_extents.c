@@ -0,0 +1,625 @@
+/*
+*	NVFUSE (NVMe based File System in Userspace)
+*	Copyright (C) 2016 Yongseok Oh <yongseok.oh@sk.com>
+*	First Writing: 30/10/2016
+*
+* This program is free software; you can redistribute it and/or modify it
+* under the terms and conditions of the GNU General Public License,
+* version 2, as published by the Free Software Foundation.
+*
+* This program is distributed in the hope it will be useful, but WITHOUT
+* ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+* FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License for
+* more details.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+//#define NDEBUG
+#include <assert.h>
+#include "spdk/env.h"
+
+#include "nvfuse_core.h"
+#include "nvfuse_config.h"
+#include "nvfuse_buffer_cache.h"
+#include "nvfuse_inode_cache.h"
+#include "nvfuse_indirect.h"
+#include "nvfuse_extents.h"
+#include "nvfuse_debug.h"
+
+#define EXT_HDR(buf)		((struct nvfuse_extent_header *)(buf))
+#define EXT_FIRST(hdr)		((struct nvfuse_extent *)((hdr) + 1))
+#define EXT_FIRST_IDX(hdr)	((struct nvfuse_extent_idx *)((hdr) + 1))
+#define EXT_ENTRY(hdr, i)	((u8 *)((hdr) + 1) + (i) * NVFUSE_EXT_ENTRY_SIZE)
+#define EXT_KEY(hdr, i)		(*(u32 *)EXT_ENTRY(hdr, i))
+#define EXT_LEN(ex)		((ex)->ee_len & ~NVFUSE_EXT_UNWRITTEN)
+#define EXT_UNWRITTEN(ex)	((ex)->ee_len & NVFUSE_EXT_UNWRITTEN)
+
+/* a node on the way from the root to a leaf */
+struct nvfuse_ext_path {
+	struct nvfuse_buffer_head *p_bh;	/* NULL for the root in the inode */
+	struct nvfuse_extent_header *p_hdr;
+	s32 p_pos;	/* entry followed, -1 in a leaf if the key is left of all extents */
+};
+
+void nvfuse_ext_init_inode(struct nvfuse_inode *inode)
+{
+	struct nvfuse_extent_header *hdr = EXT_HDR(inode->i_blocks);
+
+	memset(inode->i_blocks, 0x00, sizeof(inode->i_blocks));
+	hdr->eh_magic = NVFUSE_EXT_MAGIC;
+	hdr->eh_max = NVFUSE_EXT_ROOT_MAX;
+	hdr->eh_depth = 0;
+	hdr->eh_entries = 0;
+
+	inode->i_flags |= NVFUSE_INODE_FLAG_EXTENTS;
+}
+
+static s32 nvfuse_ext_check_node(struct nvfuse_extent_header *hdr, u32 depth)
+{
+	if (hdr->eh_magic != NVFUSE_EXT_MAGIC || hdr->eh_depth != depth ||
+	    hdr->eh_entries > hdr->eh_max) {
+		dprintf_error(INODE, " corrupted extent node (magic = %x depth = %d entries = %d)\n",
+			      hdr->eh_magic, hdr->eh_depth, hdr->eh_entries);
+		return -1;
+	}
+
+	return 0;
+}
+
+/* index of the last entry whose key is not larger than lblk, -1 if there is none */
+static s32 nvfuse_ext_search(struct nvfuse_extent_header *hdr, u32 lblk)
+{
+	s32 lo = 0, hi = (s32)hdr->eh_entries - 1;
+	s32 mid, pos = -1;
+
+	while (lo <= hi) {
+		mid = (lo + hi) / 2;
+		if (EXT_KEY(hdr, mid) <= lblk) {
+			pos = mid;
+			lo = mid + 1;
+		} else {
+			hi = mid - 1;
+		}
+	}
+
+	return pos;
+}
+
+static void nvfuse_ext_release_path(struct nvfuse_superblock *sb, struct nvfuse_ext_path *path,
+				    s32 depth)
+{
+	while (depth > 0) {
+		nvfuse_release_bh(sb, path[depth].p_bh, 0, NVF_CLEAN);
+		depth--;
+	}
+}
+
+/* walk from the root to the leaf covering lblk, return the depth of the tree */
+static s32 nvfuse_ext_find_path(struct nvfuse_superblock *sb, struct nvfuse_inode_ctx *ictx,
+				u32 lblk, struct nvfuse_ext_path *path)
+{
+	struct nvfuse_extent_header *hdr = EXT_HDR(ictx->ictx_inode->i_blocks);
+	struct nvfuse_buffer_head *bh;
+	s32 depth = hdr->eh_depth;
+	s32 level;
+	s32 pos;
+
+	if (depth > NVFUSE_EXT_MAX_DEPTH || nvfuse_ext_check_node(hdr, depth))
+		return -1;
+
+	path[0].p_bh = NULL;
+	path[0].p_hdr = hdr;
+
+	for (level = 0; level < depth; level++) {
+		/* the first child also covers the keys left of it */
+		pos = nvfuse_ext_search(hdr, lblk);
+		if (pos < 0)
+			pos = 0;
+		path[level].p_pos = pos;
+
+		bh = nvfuse_get_bh(sb, ictx, BLOCK_IO_INO, EXT_FIRST_IDX(hdr)[pos].ei_leaf, READ,
+				   NVFUSE_TYPE_META);
+		if (bh == NULL) {
+			dprintf_error(INODE, " failed to read extent node %d\n",
+				      EXT_FIRST_IDX(hdr)[pos].ei_leaf);
+			nvfuse_ext_release_path(sb, path, level);
+			return -1;
+		}
+
+		hdr = EXT_HDR(bh->bh_buf);
+		path[level + 1].p_bh = bh;
+		path[level + 1].p_hdr = hdr;
+		if (nvfuse_ext_check_node(hdr, depth - level - 1)) {
+			nvfuse_ext_release_path(sb, path, level + 1);
+			return -1;
+		}
+	}
+	path[depth].p_pos = nvfuse_ext_search(hdr, lblk);
+
+	return depth;
+}
+
+/* first key right of the path, ~0 if the path ends at the last extent */
+static u32 nvfuse_ext_next_key(struct nvfuse_ext_path *path, s32 depth)
+{
+	s32 level;
+
+	for (level = depth; level >= 0; level--) {
+		if (path[level].p_pos + 1 < path[level].p_hdr->eh_entries)
+			return EXT_KEY(path[level].p_hdr, path[level].p_pos + 1);
+	}
+
+	return ~0U;
+}
+
+static void nvfuse_ext_dirty(struct nvfuse_superblock *sb, struct nvfuse_inode_ctx *ictx,
+			     struct nvfuse_ext_path *path, s32 level)
+{
+	if (path[level].p_bh)
+		nvfuse_mark_dirty_bh(sb, path[level].p_bh);
+	else
+		nvfuse_mark_inode_dirty(ictx);
+}
+
+/* a new first entry of a leaf lowers the keys of the nodes above it */
+static void nvfuse_ext_fix_keys(struct nvfuse_superblock *sb, struct nvfuse_inode_ctx *ictx,
+				struct nvfuse_ext_path *path, s32 level, u32 key)
+{
+	while (--level >= 0) {
+		if (EXT_KEY(path[level].p_hdr, path[level].p_pos) <= key)
+			break;
+
+		EXT_KEY(path[level].p_hdr, path[level].p_pos) = key;
+		nvfuse_ext_dirty(sb, ictx, path, level);
+	}
+}
+
+static void nvfuse_ext_put_entry(struct nvfuse_extent_header *hdr, s32 pos, const void *entry)
+{
+	assert(hdr->eh_entries < hdr->eh_max);
+
+	memmove(EXT_ENTRY(hdr, pos + 1), EXT_ENTRY(hdr, pos),
+		(hdr->eh_entries - pos) * NVFUSE_EXT_ENTRY_SIZE);
+	memcpy(EXT_ENTRY(hdr, pos), entry, NVFUSE_EXT_ENTRY_SIZE);
+	hdr->eh_entries++;
+}
+
+static struct nvfuse_buffer_head *nvfuse_ext_new_node(struct nvfuse_superblock *sb,
+		struct nvfuse_inode_ctx *ictx, u32 depth, u32 *blk)
+{
+	struct nvfuse_extent_header *hdr;
+	struct nvfuse_buffer_head *bh;
+
+	if (nvfuse_alloc_free_block(sb, ictx->ictx_inode, blk, 1) != 1)
+		return NULL;
+
+	bh = nvfuse_get_bh(sb, ictx, BLOCK_IO_INO, *blk, WRITE, NVFUSE_TYPE_META);
+	if (bh == NULL) {
+		nvfuse_free_blocks(sb, *blk, 1);
+		return NULL;
+	}
+
+	memset(bh->bh_buf, 0x00, CLUSTER_SIZE);
+	hdr = EXT_HDR(bh->bh_buf);
+	hdr->eh_magic = NVFUSE_EXT_MAGIC;
+	hdr->eh_max = NVFUSE_EXT_BLOCK_MAX;
+	hdr->eh_depth = depth;
+	nvfuse_mark_dirty_bh(sb, bh);
+
+	return bh;
+}
+
+/*
+ * insert an entry right of path[level].p_pos. A full node is split and the
+ * new node is inserted into the parent, a full root is moved into a new
+ * block so that the tree grows by a level.
+ */
+static s32 nvfuse_ext_insert(struct nvfuse_superblock *sb, struct nvfuse_inode_ctx *ictx,
+			     struct nvfuse_ext_path *path, s32 level, const void *entry)
+{
+	struct nvfuse_extent_header *hdr = path[level].p_hdr;
+	struct nvfuse_extent_header *nhdr;
+	struct nvfuse_extent_idx idx;
+	struct nvfuse_buffer_head *bh;
+	s32 pos = path[level].p_pos + 1;
+	s32 split;
+	u32 blk;
+
+	if (pos == 0)
+		nvfuse_ext_fix_keys(sb, ictx, path, level, *(const u32 *)entry);
+
+	if (hdr->eh_entries < hdr->eh_max) {
+		nvfuse_ext_put_entry(hdr, pos, entry);
+		nvfuse_ext_dirty(sb, ictx, path, level);
+		return 0;
+	}
+
+	bh = nvfuse_ext_new_node(sb, ictx, hdr->eh_depth, &blk);
+	if (bh == NULL) {
+		dprintf_error(INODE, " failed to allocate an extent node\n");
+		return -1;
+	}
+	nhdr = EXT_HDR(bh->bh_buf);
+
+	if (level == 0) {
+		memcpy(EXT_ENTRY(nhdr, 0), EXT_ENTRY(hdr, 0), hdr->eh_entries * NVFUSE_EXT_ENTRY_SIZE);
+		nhdr->eh_entries = hdr->eh_entries;
+		nvfuse_ext_put_entry(nhdr, pos, entry);
+
+		EXT_FIRST_IDX(hdr)->ei_block = EXT_KEY(nhdr, 0);
+		EXT_FIRST_IDX(hdr)->ei_leaf = blk;
+		EXT_FIRST_IDX(hdr)->ei_unused = 0;
+		hdr->eh_entries = 1;
+		hdr->eh_depth++;
+		nvfuse_mark_inode_dirty(ictx);
+
+		nvfuse_release_bh(sb, bh, 0, NVF_CLEAN);
+		return 0;
+	}
+
+	if (pos == hdr->eh_entries) {
+		/* appending, keep the full node as it is */
+		nvfuse_ext_put_entry(nhdr, 0, entry);
+	} else {
+		split = hdr->eh_entries / 2;
+		memcpy(EXT_ENTRY(nhdr, 0), EXT_ENTRY(hdr, split),
+		       (hdr->eh_entries - split) * NVFUSE_EXT_ENTRY_SIZE);
+		nhdr->eh_entries = hdr->eh_entries - split;
+		hdr->eh_entries = split;
+
+		if (pos <= split)
+			nvfuse_ext_put_entry(hdr, pos, entry);
+		else
+			nvfuse_ext_put_entry(nhdr, pos - split, entry);
+		nvfuse_ext_dirty(sb, ictx, path, level);
+	}
+
+	idx.ei_block = EXT_KEY(nhdr, 0);
+	idx.ei_leaf = blk;
+	idx.ei_unused = 0;
+	nvfuse_release_bh(sb, bh, 0, NVF_CLEAN);
+
+	return nvfuse_ext_insert(sb, ictx, path, level - 1, &idx);
+}
+
+/* map len blocks from lblk to pblk, lblk must be unmapped */
+static s32 nvfuse_ext_add(struct nvfuse_superblock *sb, struct nvfuse_inode_ctx *ictx,
+			  u32 lblk, u32 pblk, u32 len, u32 unwritten)
+{
+	struct nvfuse_ext_path path[NVFUSE_EXT_MAX_DEPTH + 1];
+	struct nvfuse_extent new_ex;
+	struct nvfuse_extent *ex;
+	s32 depth;
+	s32 ret = 0;
+
+	depth = nvfuse_ext_find_path(sb, ictx, lblk, path);
+	if (depth < 0)
+		return -1;
+
+	/* grow the extent on the left if the new blocks follow it */
+	if (path[depth].p_pos >= 0) {
+		ex = EXT_FIRST(path[depth].p_hdr) + path[depth].p_pos;
+		assert(ex->ee_block + EXT_LEN(ex) <= lblk);
+		if (ex->ee_block + EXT_LEN(ex) == lblk && ex->ee_start + EXT_LEN(ex) == pblk &&
+		    EXT_UNWRITTEN(ex) == unwritten) {
+			ex->ee_len += len;
+			nvfuse_ext_dirty(sb, ictx, path, depth);
+			goto RELEASE_PATH;
+		}
+	}
+
+	new_ex.ee_block = lblk;
+	new_ex.ee_start = pblk;
+	new_ex.ee_len = len | unwritten;
+	ret = nvfuse_ext_insert(sb, ictx, path, depth, &new_ex);
+
+RELEASE_PATH:
+	nvfuse_ext_release_path(sb, path, depth);
+
+	return ret;
+}
+
+/*
+ * make [lblk, lblk + len) of an unwritten extent written. The blocks in
+ * front are split off first; the converted head then joins a written
+ * extent on its left, so that a file written in order after fallocate
+ * keeps a single written extent ahead of the unwritten rest.
+ */
+static s32 nvfuse_ext_convert(struct nvfuse_superblock *sb, struct nvfuse_inode_ctx *ictx,
+			      u32 lblk, u32 len)
+{
+	struct nvfuse_ext_path path[NVFUSE_EXT_MAX_DEPTH + 1];
+	struct nvfuse_extent_header *hdr;
+	struct nvfuse_extent new_ex;
+	struct nvfuse_extent *ex, *left;
+	u32 ex_len;
+	s32 depth, pos;
+	s32 ret = 0;
+
+AGAIN:
+	depth = nvfuse_ext_find_path(sb, ictx, lblk, path);
+	if (depth < 0)
+		return -1;
+
+	hdr = path[depth].p_hdr;
+	pos = path[depth].p_pos;
+	ex = EXT_FIRST(hdr) + pos;
+	ex_len = EXT_LEN(ex);
+	assert(pos >= 0 && EXT_UNWRITTEN(ex));
+	assert(lblk >= ex->ee_block && lblk + len <= ex->ee_block + ex_len);
+
+	if (lblk > ex->ee_block) {
+		new_ex.ee_block = lblk;
+		new_ex.ee_start = ex->ee_start + (lblk - ex->ee_block);
+		new_ex.ee_len = (ex_len - (lblk - ex->ee_block)) | NVFUSE_EXT_UNWRITTEN;
+		ex->ee_len = (lblk - ex->ee_block) | NVFUSE_EXT_UNWRITTEN;
+		ret = nvfuse_ext_insert(sb, ictx, path, depth, &new_ex);
+		if (ret < 0)
+			ex->ee_len = ex_len | NVFUSE_EXT_UNWRITTEN;
+		else
+			nvfuse_ext_dirty(sb, ictx, path, depth);
+		nvfuse_ext_release_path(sb, path, depth);
+		if (ret < 0)
+			return ret;
+		goto AGAIN;
+	}
+
+	/* the first entry keeps its key, so only a left neighbour in the same leaf is used */
+	left = NULL;
+	if (pos > 0) {
+		left = ex - 1;
+		if (EXT_UNWRITTEN(left) || left->ee_block + EXT_LEN(left) != lblk ||
+		    left->ee_start + EXT_LEN(left) != ex->ee_start)
+			left = NULL;
+	}
+
+	if (left) {
+		left->ee_len += len;
+		if (len == ex_len) {
+			memmove(ex, ex + 1, (hdr->eh_entries - pos - 1) * NVFUSE_EXT_ENTRY_SIZE);
+			hdr->eh_entries--;
+		} else {
+			ex->ee_block += len;
+			ex->ee_start += len;
+			ex->ee_len = (ex_len - len) | NVFUSE_EXT_UNWRITTEN;
+		}
+	} else if (len == ex_len) {
+		ex->ee_len = ex_len;
+	} else {
+		new_ex.ee_block = lblk + len;
+		new_ex.ee_start = ex->ee_start + len;
+		new_ex.ee_len = (ex_len - len) | NVFUSE_EXT_UNWRITTEN;
+		ex->ee_len = len;
+		ret = nvfuse_ext_insert(sb, ictx, path, depth, &new_ex);
+		if (ret < 0)
+			ex->ee_len = ex_len | NVFUSE_EXT_UNWRITTEN;
+	}
+
+	if (ret == 0)
+		nvfuse_ext_dirty(sb, ictx, path, depth);
+	nvfuse_ext_release_path(sb, path, depth);
+
+	return ret;
+}
+
+/*
+ * same contract as nvfuse_get_block(): returns 0 with *pblock = 0 for a hole
+ * when create is not set, otherwise maps or allocates up to max_blocks
+ * blocks from lblock. A hole, or an unwritten range, is looked up with its
+ * length in *num_alloc_blocks; NVFUSE_GET_BLOCK_CREATE makes it written, unless
+ * NVFUSE_GET_BLOCK_UNWRITTEN is given, which also allocates unwritten blocks.
+ */
+s32 nvfuse_ext_get_block(struct nvfuse_superblock *sb, struct nvfuse_inode_ctx *ictx, s32 lblock,
+			 u32 max_blocks, u32 *num_alloc_blocks, u32 *pblock, u32 create)
+{
+	struct nvfuse_ext_path path[NVFUSE_EXT_MAX_DEPTH + 1];
+	struct nvfuse_extent *ex;
+	u32 *blocks;
+	u32 count, next;
+	u32 unwritten;
+	u32 pblk;
+	u32 i, j;
+	s32 depth;
+	s32 ret = 0;
+
+	if (pblock)
+		*pblock = 0;
+
+	if (num_alloc_blocks)
+		*num_alloc_blocks = 0;
+
+	if (lblock < 0)
+		return -1;
+
+	if (max_blocks == 0)
+		max_blocks = 1;
+
+	depth = nvfuse_ext_find_path(sb, ictx, lblock, path);
+	if (depth < 0)
+		return -1;
+
+	if (path[depth].p_pos >= 0) {
+		ex = EXT_FIRST(path[depth].p_hdr) + path[depth].p_pos;
+		if ((u32)lblock < ex->ee_block + EXT_LEN(ex)) {
+			count = ex->ee_block + EXT_LEN(ex) - lblock;
+			if (count > max_blocks)
+				count = max_blocks;
+			pblk = ex->ee_start + (lblock - ex->ee_block);
+			unwritten = EXT_UNWRITTEN(ex);
+			nvfuse_ext_release_path(sb, path, depth);
+
+			if (unwritten && !create) {
+				pblk = 0;
+			} else if (unwritten && !(create & NVFUSE_GET_BLOCK_UNWRITTEN)) {
+				/* the caller is about to write the range */
+				if (nvfuse_ext_convert(sb, ictx, lblock, count) < 0)
+					return -1;
+			}
+
+			if (pblock)
+				*pblock = pblk;
+			if (num_alloc_blocks)
+				*num_alloc_blocks = count;
+
+			return 0;
+		}
+	}
+
+	next = nvfuse_ext_next_key(path, depth);
+	nvfuse_ext_release_path(sb, path, depth);
+
+	/* the hole lasts up to the next extent */
+	count = next - lblock;
+	if (count > max_blocks)
+		count = max_blocks;
+
+	if (!create) {
+		if (num_alloc_blocks)
+			*num_alloc_blocks = count;
+		return 0;
+	}
+
+	if (count > NVFUSE_EXT_MAX_ALLOC)
+		count = NVFUSE_EXT_MAX_ALLOC;
+
+	blocks = spdk_dma_zmalloc(sizeof(u32) * count, 0, NULL);
+	assert(blocks != NULL);
+
+	i = nvfuse_alloc_inode_blocks(sb, ictx, blocks, count);
+	if (i != count) {
+		dprintf_error(INODE, " Warning: it runs out of free blocks.\n");
+		nvfuse_return_free_blocks(sb, blocks, i);
+		ret = -1;
+		goto FREE;
+	}
+
+	unwritten = (create & NVFUSE_GET_BLOCK_UNWRITTEN) ? NVFUSE_EXT_UNWRITTEN : 0;
+
+	/* an extent per physically contiguous run */
+	for (i = 0; i < count; i = j) {
+		for (j = i + 1; j < count && blocks[j] == blocks[j - 1] + 1; j++)
+			;
+
+		if (nvfuse_ext_add(sb, ictx, lblock + i, blocks[i], j - i, unwritten) < 0) {
+			nvfuse_return_free_blocks(sb, blocks + i, count - i);
+			count = i;
+			ret = -1;
+			break;
+		}
+	}
+
+	if (pblock && count)
+		*pblock = blocks[0];
+	if (num_alloc_blocks)
+		*num_alloc_blocks = count;
+
+	nvfuse_mark_inode_dirty(ictx);
+FREE:
+	spdk_dma_free(blocks);
+
+	return ret;
+}
+
+/* drop the extents at and beyond from, and the nodes left empty */
+static void nvfuse_ext_truncate_node(struct nvfuse_superblock *sb, struct nvfuse_inode_ctx *ictx,
+				     struct nvfuse_extent_header *hdr, u32 from)
+{
+	struct nvfuse_extent_header *chdr;
+	struct nvfuse_extent_idx *idx;
+	struct nvfuse_extent *ex;
+	struct nvfuse_buffer_head *bh;
+	u32 keep;
+
+	if (hdr->eh_depth == 0) {
+		while (hdr->eh_entries) {
+			ex = EXT_FIRST(hdr) + hdr->eh_entries - 1;
+			if (ex->ee_block >= from) {
+				nvfuse_free_blocks(sb, ex->ee_start, EXT_LEN(ex));
+				hdr->eh_entries--;
+				continue;
+			}
+
+			if (ex->ee_block + EXT_LEN(ex) > from) {
+				keep = from - ex->ee_block;
+				nvfuse_free_blocks(sb, ex->ee_start + keep, EXT_LEN(ex) - keep);
+				ex->ee_len = keep | EXT_UNWRITTEN(ex);
+			}
+			break;
+		}
+		return;
+	}
+
+	while (hdr->eh_entries) {
+		idx = EXT_FIRST_IDX(hdr) + hdr->eh_entries - 1;
+
+		bh = nvfuse_get_bh(sb, ictx, BLOCK_IO_INO, idx->ei_leaf, READ, NVFUSE_TYPE_META);
+		if (bh == NULL) {
+			dprintf_warn(INODE, " Read failure, inode=%d, block=%d\n",
+				     ictx->ictx_inode->i_ino, idx->ei_leaf);
+			break;
+		}
+
+		chdr = EXT_HDR(bh->bh_buf);
+		if (nvfuse_ext_check_node(chdr, hdr->eh_depth - 1)) {
+			nvfuse_release_bh(sb, bh, 0, NVF_CLEAN);
+			break;
+		}
+
+		nvfuse_ext_truncate_node(sb, ictx, chdr, from);
+		if (chdr->eh_entries) {
+			/* the child keeps blocks below from, so do its left siblings */
+			nvfuse_mark_dirty_bh(sb, bh);
+			nvfuse_release_bh(sb, bh, 0, NVF_CLEAN);
+			break;
+		}
+
+		nvfuse_release_bh(sb, bh, 0, NVF_CLEAN);
+		nvfuse_free_blocks(sb, idx->ei_leaf, 1);
+		hdr->eh_entries--;
+
+		if (idx->ei_block < from)
+			break;
+	}
+}
+
+void nvfuse_ext_truncate_blocks(struct nvfuse_superblock *sb, struct nvfuse_inode_ctx *ictx,
+				u64 offset)
+{
+	struct nvfuse_extent_header *hdr = EXT_HDR(ictx->ictx_inode->i_blocks);
+	struct nvfuse_extent_header *chdr;
+	struct nvfuse_buffer_head *bh;
+	u32 from = NVFUSE_SIZE_TO_BLK(offset + CLUSTER_SIZE - 1);
+	u32 blk;
+
+	if (nvfuse_ext_check_node(hdr, hdr->eh_depth))
+		return;
+
+	nvfuse_ext_truncate_node(sb, ictx, hdr, from);
+	if (!hdr->eh_entries)
+		hdr->eh_depth = 0;
+
+	/* pull a lone child back into the inode */
+	while (hdr->eh_depth && hdr->eh_entries == 1) {
+		blk = EXT_FIRST_IDX(hdr)->ei_leaf;
+		bh = nvfuse_get_bh(sb, ictx, BLOCK_IO_INO, blk, READ, NVFUSE_TYPE_META);
+		if (bh == NULL)
+			break;
+
+		chdr = EXT_HDR(bh->bh_buf);
+		if (chdr->eh_entries > NVFUSE_EXT_ROOT_MAX) {
+			nvfuse_release_bh(sb, bh, 0, NVF_CLEAN);
+			break;
+		}
+
+		memcpy(EXT_ENTRY(hdr, 0), EXT_ENTRY(chdr, 0), chdr->eh_entries * NVFUSE_EXT_ENTRY_SIZE);
+		hdr->eh_entries = chdr->eh_entries;
+		hdr->eh_depth = chdr->eh_depth;
+
+		nvfuse_release_bh(sb, bh, 0, NVF_CLEAN);
+		nvfuse_free_blocks(sb, blk, 1);
+	}
+
+	nvfuse_mark_inode_dirty(ictx);
+}
@@ -0,0 +1,336 @@
+/*
+*	NVFUSE (NVMe based File System in Userspace)
+*	Copyright (C) 2016 Yongseok Oh <yongseok.oh@sk.com>
+*	First Writing: 30/10/2016
+*
+* This program is free software; you can redistribute it and/or modify it
+* under the terms and conditions of the GNU General Public License,
+* version 2, as published by the Free Software Foundation.
+*
+* This program is distributed in the hope it will be useful, but WITHOUT
+* ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+* FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License for
+* more details.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+//#define NDEBUG
+#include <assert.h>
+
+#include "nvfuse_core.h"
+#include "nvfuse_config.h"
+#include "nvfuse_dep.h"
+#include "nvfuse_free_extents.h"
+#include "nvfuse_debug.h"
+
+#define FEXT_BY_START(node)	rb_entry(node, struct nvfuse_free_extent, fe_start_node)
+#define FEXT_BY_LEN(node)	rb_entry(node, struct nvfuse_free_extent, fe_len_node)
+#define FEXT_END(fe)		((fe)->fe_start + (fe)->fe_len)
+
+static void nvfuse_fext_link_start(struct nvfuse_free_extent_tree *tree,
+				   struct nvfuse_free_extent *fe)
+{
+	struct rb_node **new = &tree->ft_by_start.rb_node, *parent = NULL;
+
+	while (*new) {
+		parent = *new;
+		if (fe->fe_start < FEXT_BY_START(parent)->fe_start)
+			new = &parent->rb_left;
+		else
+			new = &parent->rb_right;
+	}
+
+	rb_link_node(&fe->fe_start_node, parent, new);
+	rb_insert_color(&fe->fe_start_node, &tree->ft_by_start);
+}
+
+static void nvfuse_fext_link_len(struct nvfuse_free_extent_tree *tree,
+				 struct nvfuse_free_extent *fe)
+{
+	struct rb_node **new = &tree->ft_by_len.rb_node, *parent = NULL;
+	struct nvfuse_free_extent *this;
+
+	while (*new) {
+		parent = *new;
+		this = FEXT_BY_LEN(parent);
+		if (fe->fe_len < this->fe_len ||
+		    (fe->fe_len == this->fe_len && fe->fe_start < this->fe_start))
+			new = &parent->rb_left;
+		else
+			new = &parent->rb_right;
+	}
+
+	rb_link_node(&fe->fe_len_node, parent, new);
+	rb_insert_color(&fe->fe_len_node, &tree->ft_by_len);
+}
+
+static s32 nvfuse_fext_add(struct nvfuse_free_extent_tree *tree, u32 start, u32 len)
+{
+	struct nvfuse_free_extent *fe;
+
+	fe = (struct nvfuse_free_extent *)malloc(sizeof(struct nvfuse_free_extent));
+	if (fe == NULL) {
+		dprintf_error(BLOCK, " malloc error \n");
+		return -1;
+	}
+
+	fe->fe_start = start;
+	fe->fe_len = len;
+	nvfuse_fext_link_start(tree, fe);
+	nvfuse_fext_link_len(tree, fe);
+	tree->ft_count++;
+
+	return 0;
+}
+
+static void nvfuse_fext_del(struct nvfuse_free_extent_tree *tree, struct nvfuse_free_extent *fe)
+{
+	rb_erase(&fe->fe_start_node, &tree->ft_by_start);
+	rb_erase(&fe->fe_len_node, &tree->ft_by_len);
+	tree->ft_count--;
+	free(fe);
+}
+
+/*
+ * the new range of fe never overlaps its neighbours, so its place in the
+ * start tree does not change and only the length tree is updated.
+ */
+static void nvfuse_fext_resize(struct nvfuse_free_extent_tree *tree,
+			       struct nvfuse_free_extent *fe, u32 start, u32 len)
+{
+	rb_erase(&fe->fe_len_node, &tree->ft_by_len);
+	fe->fe_start = start;
+	fe->fe_len = len;
+	nvfuse_fext_link_len(tree, fe);
+}
+
+/* drop all extents, the tree is rebuilt from the bitmap on next use */
+static void nvfuse_fext_drop(struct nvfuse_free_extent_tree *tree)
+{
+	struct rb_node *node;
+
+	while ((node = rb_first(&tree->ft_by_start)) != NULL)
+		nvfuse_fext_del(tree, FEXT_BY_START(node));
+
+	tree->ft_loaded = 0;
+}
+
+/* the last extent starting at or before block */
+static struct nvfuse_free_extent *nvfuse_fext_lookup(struct nvfuse_free_extent_tree *tree,
+		u32 block)
+{
+	struct rb_node *node = tree->ft_by_start.rb_node;
+	struct nvfuse_free_extent *fe, *found = NULL;
+
+	while (node) {
+		fe = FEXT_BY_START(node);
+		if (block < fe->fe_start) {
+			node = node->rb_left;
+		} else {
+			found = fe;
+			node = node->rb_right;
+		}
+	}
+
+	return found;
+}
+
+/* the shortest extent of at least want blocks, or the longest one */
+static struct nvfuse_free_extent *nvfuse_fext_best_fit(struct nvfuse_free_extent_tree *tree,
+		u32 want)
+{
+	struct rb_node *node = tree->ft_by_len.rb_node;
+	struct nvfuse_free_extent *fe, *found = NULL;
+
+	while (node) {
+		fe = FEXT_BY_LEN(node);
+		if (fe->fe_len >= want) {
+			found = fe;
+			node = node->rb_left;
+		} else {
+			node = node->rb_right;
+		}
+	}
+
+	if (found == NULL && (node = rb_last(&tree->ft_by_len)) != NULL)
+		found = FEXT_BY_LEN(node);
+
+	return found;
+}
+
+/* take [start, start + len) out of fe */
+static void nvfuse_fext_carve(struct nvfuse_free_extent_tree *tree,
+			      struct nvfuse_free_extent *fe, u32 start, u32 len)
+{
+	u32 end = FEXT_END(fe);
+
+	assert(start >= fe->fe_start && start + len <= end);
+
+	if (len == fe->fe_len) {
+		nvfuse_fext_del(tree, fe);
+	} else if (start == fe->fe_start) {
+		nvfuse_fext_resize(tree, fe, start + len, fe->fe_len - len);
+	} else if (start + len == end) {
+		nvfuse_fext_resize(tree, fe, fe->fe_start, start - fe->fe_start);
+	} else {
+		nvfuse_fext_resize(tree, fe, fe->fe_start, start - fe->fe_start);
+		if (nvfuse_fext_add(tree, start + len, end - start - len) < 0)
+			nvfuse_fext_drop(tree);
+	}
+}
+
+/* reserved, if not NULL, marks blocks that are free but must stay out of the tree */
+static s32 nvfuse_fext_load(struct nvfuse_free_extent_tree *tree, void *dbitmap, void *reserved,
+			    u32 dtable_start, u32 nr_blocks)
+{
+	u32 pos = dtable_start, end;
+
+	while ((pos = nvfuse_bitmap_find_next_zero(dbitmap, nr_blocks, pos)) < nr_blocks) {
+		end = nvfuse_bitmap_find_next_set(dbitmap, nr_blocks, pos);
+		if (reserved) {
+			pos = nvfuse_bitmap_find_next_zero(reserved, end, pos);
+			if (pos == end)
+				continue;
+			end = nvfuse_bitmap_find_next_set(reserved, end, pos);
+		}
+		if (nvfuse_fext_add(tree, pos, end - pos) < 0) {
+			nvfuse_fext_drop(tree);
+			return -1;
+		}
+		pos = end;
+	}
+
+	tree->ft_loaded = 1;
+
+	return 0;
+}
+
+s32 nvfuse_fext_init(struct nvfuse_superblock *sb)
+{
+	u32 size = sizeof(struct nvfuse_free_extent_tree) * sb->sb_bg_num;
+
+	sb->sb_fext = (struct nvfuse_free_extent_tree *)malloc(size);
+	if (sb->sb_fext == NULL) {
+		dprintf_error(MOUNT, " malloc error \n");
+		return -1;
+	}
+	memset(sb->sb_fext, 0x00, size);
+
+	return 0;
+}
+
+void nvfuse_fext_deinit(struct nvfuse_superblock *sb)
+{
+	s32 i;
+
+	if (sb->sb_fext == NULL)
+		return;
+
+	for (i = 0; i < sb->sb_bg_num; i++)
+		nvfuse_fext_drop(sb->sb_fext + i);
+
+	free(sb->sb_fext);
+	sb->sb_fext = NULL;
+}
+
+/* forget the extents of a group whose bitmap was rewritten */
+void nvfuse_fext_invalidate(struct nvfuse_superblock *sb, u32 bg_id)
+{
+	if (sb->sb_fext)
+		nvfuse_fext_drop(sb->sb_fext + bg_id);
+}
+
+/*
+ * the free extent tree of a group, built from its DBITMAP on first use.
+ * the caller holds the bitmap buffer and the lock of the group. returns
+ * NULL if the tree cannot be built, the caller then falls back to scanning
+ * the bitmap.
+ */
+struct nvfuse_free_extent_tree *nvfuse_fext_get_tree(struct nvfuse_superblock *sb, u32 bg_id,
+		void *dbitmap, u32 dtable_start)
+{
+	struct nvfuse_free_extent_tree *tree;
+	void *reserved = NULL;
+
+	if (sb->sb_fext == NULL)
+		return NULL;
+
+#ifdef NVFUSE_USE_PREALLOC_WINDOW
+	/* runs reserved by preallocation windows are handed out by their inodes */
+	if (sb->sb_pa_map && sb->sb_pa_map[bg_id].pm_count)
+		reserved = sb->sb_pa_map[bg_id].pm_bitmap;
+#endif
+
+	tree = sb->sb_fext + bg_id;
+	if (!tree->ft_loaded &&
+	    nvfuse_fext_load(tree, dbitmap, reserved, dtable_start, sb->sb_no_of_blocks_per_bg) < 0)
+		return NULL;
+
+	return tree;
+}
+
+/*
+ * take up to want blocks out of the tree. blocks right from goal are taken
+ * if enough of them are free, otherwise the best fitting extent is used,
+ * or the longest one if none is long enough. returns the number of blocks
+ * taken, *start is the first one. the caller marks them in the bitmap.
+ */
+u32 nvfuse_fext_alloc(struct nvfuse_free_extent_tree *tree, u32 goal, u32 want, u32 *start)
+{
+	struct nvfuse_free_extent *fe = NULL;
+	u32 len;
+
+	if (!tree->ft_loaded || !want)
+		return 0;
+
+	if (goal != NVFUSE_FEXT_NO_GOAL) {
+		fe = nvfuse_fext_lookup(tree, goal);
+		if (fe && goal < FEXT_END(fe) && FEXT_END(fe) - goal >= want) {
+			*start = goal;
+			nvfuse_fext_carve(tree, fe, goal, want);
+			return want;
+		}
+	}
+
+	fe = nvfuse_fext_best_fit(tree, want);
+	if (fe == NULL)
+		return 0;
+
+	len = fe->fe_len < want ? fe->fe_len : want;
+	*start = fe->fe_start;
+	nvfuse_fext_carve(tree, fe, fe->fe_start, len);
+
+	return len;
+}
+
+/* return [start, start + len) to the tree, merging it with its neighbours */
+void nvfuse_fext_free(struct nvfuse_free_extent_tree *tree, u32 start, u32 len)
+{
+	struct nvfuse_free_extent *prev, *next = NULL;
+	struct rb_node *node;
+
+	if (!tree->ft_loaded || !len)
+		return;
+
+	prev = nvfuse_fext_lookup(tree, start);
+	node = prev ? rb_next(&prev->fe_start_node) : rb_first(&tree->ft_by_start);
+	if (node)
+		next = FEXT_BY_START(node);
+
+	assert(prev == NULL || FEXT_END(prev) <= start);
+	assert(next == NULL || next->fe_start >= start + len);
+
+	if (prev && FEXT_END(prev) == start) {
+		if (next && next->fe_start == start + len) {
+			len += next->fe_len;
+			nvfuse_fext_del(tree, next);
+		}
+		nvfuse_fext_resize(tree, prev, prev->fe_start, prev->fe_len + len);
+	} else if (next && next->fe_start == start + len) {
+		nvfuse_fext_resize(tree, next, start, next->fe_len + len);
+	} else if (nvfuse_fext_add(tree, start, len) < 0) {
+		nvfuse_fext_drop(tree);
+	}
+}
@@ -54,10 +54,12 @@
 #include "nvfuse_core.h"
 #include "nvfuse_io_manager.h"
 #include "nvfuse_buffer_cache.h"
+#include "nvfuse_inode_cache.h"
 #include "nvfuse_dirhash.h"
 #include "nvfuse_gettimeofday.h"
 #include "nvfuse_ipc_ring.h"
 #include "nvfuse_indirect.h"
+#include "nvfuse_extents.h"
 #include "nvfuse_debug.h"
 #include "nvfuse_malloc.h"
 
@@ -223,6 +225,7 @@ u32 nvfuse_alloc_free_block(struct nvfuse_superblock *sb, struct nvfuse_inode *i
 	u32 next_id;
 	u32 cnt = 0;
 	u32 once = 1;
+	struct nvfuse_alloc_group *ag;
 
 	//dprintf_info(INODE, " current free blocks = %ld \n", sb->asb.asb_free_blocks);
 
@@ -241,7 +244,12 @@ u32 nvfuse_alloc_free_block(struct nvfuse_superblock *sb, struct nvfuse_inode *i
 	}
 
 	bg_id = inode->i_ino / sb->sb_no_of_inodes_per_bg;
-	if (bg_id != sb->sb_last_allocated_bgid && inode->i_ino == sb->sb_last_allocated_bgid_by_ino) {
+	/* blocks come from the slice of the inode, whichever core writes them back */
+	ag = nvfuse_get_bg_alloc_group(sb, bg_id);
+	if (nvfuse_process_model_is_standalone()) {
+		if (bg_id != ag->ag_last_allocated_bgid && inode->i_ino == ag->ag_last_allocated_bgid_by_ino)
+			bg_id = ag->ag_last_allocated_bgid;
+	} else if (bg_id != sb->sb_last_allocated_bgid && inode->i_ino == sb->sb_last_allocated_bgid_by_ino) {
 		bg_id = sb->sb_last_allocated_bgid;
 	}
 
@@ -254,8 +262,13 @@ u32 nvfuse_alloc_free_block(struct nvfuse_superblock *sb, struct nvfuse_inode *i
 			cnt += ret;
 
 			/* retain hint information to rapidly find free blocks */
-			sb->sb_last_allocated_bgid = bg_id;
-			sb->sb_last_allocated_bgid_by_ino = inode->i_ino;
+			if (nvfuse_process_model_is_standalone()) {
+				ag->ag_last_allocated_bgid = bg_id;
+				ag->ag_last_allocated_bgid_by_ino = inode->i_ino;
+			} else {
+				sb->sb_last_allocated_bgid = bg_id;
+				sb->sb_last_allocated_bgid_by_ino = inode->i_ino;
+			}
 
 			if (!num_blocks) {
 				break;
@@ -274,7 +287,7 @@ u32 nvfuse_alloc_free_block(struct nvfuse_superblock *sb, struct nvfuse_inode *i
 		if (nvfuse_process_model_is_dataplane())
 			bg_id = nvfuse_get_next_bg_id(sb, 0 /* data type */);
 		else
-			bg_id = (bg_id + 1) % sb->sb_bg_num;
+			bg_id = nvfuse_get_next_alloc_bg_id(sb, ag, next_id, bg_id);
 		//dprintf_info(INODE, "3. alloc block: cur bg = %d, next_bg = %d \n", bg_id, next_id);
 	} while (bg_id != next_id);
 
@@ -298,7 +311,136 @@ void nvfuse_return_free_blocks(struct nvfuse_superblock *sb, u32 *blks, u32 num)
 	}
 }
 
-u32 nvfuse_alloc_free_blocks(struct nvfuse_superblock *sb, struct nvfuse_inode *inode, u32 *blocks,
+#ifdef NVFUSE_USE_PREALLOC_WINDOW
+/*
+ * Per-inode preallocation windows
+ *
+ * Blocks of a regular file are handed out from a window of contiguous
+ * blocks reserved by a single bitmap operation right after the last block
+ * of the file. The window doubles on every refill up to
+ * NVFUSE_PREALLOC_MAX_BLOCKS, so streaming writers get long runs even when
+ * they append in turns. A window is only reserved in memory (see
+ * nvfuse_reserve_dbitmap_run()), its blocks are marked in the bitmap one
+ * write at a time as they are handed out, so a crash cannot leak the rest.
+ * The unused part goes back on the last close, truncate, delete and when
+ * the inode context is evicted.
+ */
+static u32 nvfuse_refill_prealloc(struct nvfuse_superblock *sb, struct nvfuse_inode_ctx *ictx,
+				  u32 num_blocks)
+{
+	u32 goal = ictx->ictx_pa_goal;
+	u32 bg_id, want, len, start;
+
+	/* the first block of a file is placed by the regular allocator */
+	if (!goal)
+		return 0;
+
+	want = ictx->ictx_pa_window ? ictx->ictx_pa_window * 2 : NVFUSE_PREALLOC_MIN_BLOCKS;
+	if (want < num_blocks)
+		want = num_blocks;
+	if (want > NVFUSE_PREALLOC_MAX_BLOCKS)
+		want = NVFUSE_PREALLOC_MAX_BLOCKS;
+
+	bg_id = goal / sb->sb_no_of_blocks_per_bg;
+	if (bg_id >= sb->sb_bg_num || !nvfuse_get_free_blocks(sb, bg_id))
+		return 0;
+
+	len = nvfuse_reserve_dbitmap_run(sb, bg_id, goal, want, &start);
+	if (!len)
+		return 0;
+
+	ictx->ictx_pa_start = start;
+	ictx->ictx_pa_len = len;
+	ictx->ictx_pa_window = want;
+
+	return len;
+}
+#endif
+
+/*
+ * take the preallocation window off ictx without touching the bitmap, for
+ * callers holding locks under which it cannot be given back. the window is
+ * returned later with nvfuse_free_prealloc().
+ */
+void nvfuse_detach_prealloc(struct nvfuse_inode_ctx *ictx, u32 *start, u32 *len)
+{
+	*start = 0;
+	*len = 0;
+#ifdef NVFUSE_USE_PREALLOC_WINDOW
+	*start = ictx->ictx_pa_start;
+	*len = ictx->ictx_pa_len;
+
+	ictx->ictx_pa_len = 0;
+	ictx->ictx_pa_window = 0;
+#endif
+}
+
+void nvfuse_free_prealloc(struct nvfuse_superblock *sb, u32 start, u32 len)
+{
+#ifdef NVFUSE_USE_PREALLOC_WINDOW
+	if (len)
+		nvfuse_unreserve_dbitmap_run(sb, start, len);
+#endif
+}
+
+/* return the unused part of the preallocation window of ictx */
+void nvfuse_release_prealloc(struct nvfuse_superblock *sb, struct nvfuse_inode_ctx *ictx)
+{
+	u32 start, len;
+
+	nvfuse_detach_prealloc(ictx, &start, &len);
+	nvfuse_free_prealloc(sb, start, len);
+}
+
+void nvfuse_release_all_prealloc(struct nvfuse_superblock *sb)
+{
+	struct nvfuse_inode_ctx *ictx;
+	s32 i;
+
+	for (i = 0; i < NVFUSE_ICTXC_SIZE; i++) {
+		ictx = ((struct nvfuse_inode_ctx *)sb->sb_ictxc->ictx_buf) + i;
+		nvfuse_release_prealloc(sb, ictx);
+	}
+}
+
+/* allocate blocks for ictx, from its preallocation window first */
+u32 nvfuse_alloc_inode_blocks(struct nvfuse_superblock *sb, struct nvfuse_inode_ctx *ictx,
+			      u32 *alloc_blks, u32 num_blocks)
+{
+	struct nvfuse_inode *inode = ictx->ictx_inode;
+	u32 cnt = 0;
+#ifdef NVFUSE_USE_PREALLOC_WINDOW
+	u32 n, i;
+
+	if (inode->i_type == NVFUSE_TYPE_FILE && !S_ISLNK(inode->i_mode)) {
+		while (cnt < num_blocks) {
+			if (!ictx->ictx_pa_len && !nvfuse_refill_prealloc(sb, ictx, num_blocks - cnt))
+				break;
+
+			n = ictx->ictx_pa_len < num_blocks - cnt ? ictx->ictx_pa_len : num_blocks - cnt;
+			nvfuse_claim_dbitmap_run(sb, ictx->ictx_pa_start, n);
+			for (i = 0; i < n; i++)
+				alloc_blks[cnt + i] = ictx->ictx_pa_start + i;
+
+			ictx->ictx_pa_start += n;
+			ictx->ictx_pa_len -= n;
+			cnt += n;
+		}
+	}
+#endif
+
+	if (cnt < num_blocks)
+		cnt += nvfuse_alloc_free_block(sb, inode, alloc_blks + cnt, num_blocks - cnt);
+
+#ifdef NVFUSE_USE_PREALLOC_WINDOW
+	if (cnt)
+		ictx->ictx_pa_goal = alloc_blks[cnt - 1] + 1;
+#endif
+
+	return cnt;
+}
+
+u32 nvfuse_alloc_free_blocks(struct nvfuse_superblock *sb, struct nvfuse_inode_ctx *ictx, u32 *blocks,
 			     u32 num_indirect_blocks, u32 num_blocks, u32 *direct_map, s32 *error)
 {
 	u32 new_blocks[2] = { 0, 0 };
@@ -308,7 +450,7 @@ u32 nvfuse_alloc_free_blocks(struct nvfuse_superblock *sb, struct nvfuse_inode *
 	total_blocks = num_indirect_blocks + 1;
 
 	if (total_blocks) {
-		new_blocks[0] = nvfuse_alloc_free_block(sb, inode, blocks, total_blocks);
+		new_blocks[0] = nvfuse_alloc_inode_blocks(sb, ictx, blocks, total_blocks);
 		if (new_blocks[0] != total_blocks) {
 			dprintf_error(INODE, " Warning: it runs out of free blocks.\n");
 			nvfuse_print_bg_list(sb);
@@ -326,7 +468,7 @@ u32 nvfuse_alloc_free_blocks(struct nvfuse_superblock *sb, struct nvfuse_inode *
 
 	total_blocks =  num_blocks - 1;
 	if (total_blocks) {
-		new_blocks[1] = nvfuse_alloc_free_block(sb, inode, direct_map, total_blocks);
+		new_blocks[1] = nvfuse_alloc_inode_blocks(sb, ictx, direct_map, total_blocks);
 		if (new_blocks[1] != total_blocks) {
 			dprintf_warn(INODE, " Warning: it runs out of free blocks. (requested = %d, allocated = %d)\n",
 			       total_blocks, new_blocks[1]);
@@ -435,7 +577,7 @@ static int nvfuse_alloc_branch(struct nvfuse_superblock *sb, struct nvfuse_inode
 	u32 new_blocks[4] = { 0, };
 	u32 current_block;
 
-	num = nvfuse_alloc_free_blocks(sb, inode, new_blocks, indirect_blks, *blks, direct_map, &err);
+	num = nvfuse_alloc_free_blocks(sb, ictx, new_blocks, indirect_blks, *blks, direct_map, &err);
 	if (err) {
 		return err;
 	}
@@ -584,6 +726,10 @@ s32 nvfuse_get_block(struct nvfuse_superblock *sb, struct nvfuse_inode_ctx *ictx
 	int count = 0;
 	int blocks_to_boundary = 0;
 
+	if (ictx->ictx_inode->i_flags & NVFUSE_INODE_FLAG_EXTENTS)
+		return nvfuse_ext_get_block(sb, ictx, lblock, maxblocks, num_alloc_blocks, pblock,
+					    create);
+
 	if (pblock)
 		*pblock = 0;
 
@@ -965,6 +1111,9 @@ void nvfuse_truncate_blocks(struct nvfuse_superblock *sb, struct nvfuse_inode_ct
 		return;*/
 
 	//dax_sem_down_write(EXT2_I(inode));
-	__nvfuse_truncate_blocks(sb, ictx, offset);
+	if (ictx->ictx_inode->i_flags & NVFUSE_INODE_FLAG_EXTENTS)
+		nvfuse_ext_truncate_blocks(sb, ictx, offset);
+	else
+		__nvfuse_truncate_blocks(sb, ictx, offset);
 	//dax_sem_up_write(EXT2_I(inode));
 }
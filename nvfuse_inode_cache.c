@@ -28,6 +28,7 @@
 #include "nvfuse_dep.h"
 #include "nvfuse_buffer_cache.h"
 #include "nvfuse_inode_cache.h"
+#include "nvfuse_indirect.h"
 #include "nvfuse_malloc.h"
 #include "nvfuse_ipc_ring.h"
 #include "nvfuse_control_plane.h"
@@ -51,7 +52,13 @@ struct nvfuse_inode_ctx *nvfuse_ictx_hash_lookup(struct nvfuse_ictx_manager *ict
 	return NULL;
 }
 
-struct nvfuse_inode_ctx *nvfuse_replace_ictx(struct nvfuse_superblock *sb)
+/*
+ * the preallocation window of the victim is detached into *pa_start and
+ * *pa_len, the caller gives it back with nvfuse_free_prealloc() once
+ * ictxc_lock is dropped.
+ */
+struct nvfuse_inode_ctx *nvfuse_replace_ictx(struct nvfuse_superblock *sb, u32 *pa_start,
+		u32 *pa_len)
 {
 	struct nvfuse_ictx_manager *ictxc = sb->sb_ictxc;
 	struct nvfuse_inode_ctx *ictx;
@@ -90,6 +97,15 @@ struct nvfuse_inode_ctx *nvfuse_replace_ictx(struct nvfuse_superblock *sb)
 
 VICTIM_FOUND:
 
+	/* drop the cached b+tree master of the evicted directory */
+	bp_free_dir_master(sb, ictx);
+	ictx->ictx_dir_cursor = 0;
+	nvfuse_dir_space_free(ictx);
+
+	/* the unused preallocation window of the evicted file is returned by the caller */
+	nvfuse_detach_prealloc(ictx, pa_start, pa_len);
+	ictx->ictx_pa_goal = 0;
+
 	/* remove list */
 	list_del(&ictx->ictx_cache_list);
 	/* remove hlist */
@@ -108,11 +124,13 @@ struct nvfuse_inode_ctx *nvfuse_alloc_ictx(struct nvfuse_superblock *sb)
 {
 	struct nvfuse_ictx_manager *ictxc = sb->sb_ictxc;
 	struct nvfuse_inode_ctx *ictx;
+	u32 pa_start, pa_len;
 
 	SPINLOCK_LOCK(&ictxc->ictxc_lock);
-	ictx = nvfuse_replace_ictx(sb);
+	ictx = nvfuse_replace_ictx(sb, &pa_start, &pa_len);
 	SPINLOCK_UNLOCK(&ictxc->ictxc_lock);
 
+	nvfuse_free_prealloc(sb, pa_start, pa_len);
 	nvfuse_init_ictx(ictx, 0);
 
 	return ictx;
@@ -167,13 +185,14 @@ struct nvfuse_inode_ctx *nvfuse_get_ictx(struct nvfuse_superblock *sb, inode_t i
 {
 	struct nvfuse_ictx_manager *ictxc = sb->sb_ictxc;
 	struct nvfuse_inode_ctx *ictx;
+	u32 pa_start = 0, pa_len = 0;
 
 	SPINLOCK_LOCK(&ictxc->ictxc_lock);
 
 	ictx = nvfuse_ictx_hash_lookup(sb->sb_ictxc, ino);
 	if (unlikely(!ictx)) { 
 		/* in case of cache misses */
-		ictx = nvfuse_replace_ictx(sb);
+		ictx = nvfuse_replace_ictx(sb, &pa_start, &pa_len);
 		if (ictx) {
 			/* init ictx structure */
 			nvfuse_init_ictx(ictx, ino);
@@ -205,6 +224,9 @@ struct nvfuse_inode_ctx *nvfuse_get_ictx(struct nvfuse_superblock *sb, inode_t i
 OUT:
 	SPINLOCK_UNLOCK(&ictxc->ictxc_lock);
 
+	/* the window of the evicted inode */
+	nvfuse_free_prealloc(sb, pa_start, pa_len);
+
 	return ictx;
 }
 
@@ -306,6 +328,14 @@ int nvfuse_init_ictx_cache(struct nvfuse_superblock *sb)
 		struct nvfuse_inode_ctx *ictx;
 
 		ictx = ((struct nvfuse_inode_ctx *)ictxc->ictx_buf) + i;
+		ictx->ictx_bp_master = NULL;
+		ictx->ictx_dir_cursor = 0;
+		ictx->ictx_dir_space = NULL;
+		ictx->ictx_dir_space_nr = 0;
+		ictx->ictx_pa_start = 0;
+		ictx->ictx_pa_len = 0;
+		ictx->ictx_pa_window = 0;
+		ictx->ictx_pa_goal = 0;
 
 		list_add(&ictx->ictx_cache_list, &ictxc->ictxc_list[BUFFER_TYPE_UNUSED]);
 		hlist_add_head(&ictx->ictx_hash, &ictxc->ictxc_hash[HASH_NUM]);
@@ -0,0 +1,588 @@
+/*
+*	NVFUSE (NVMe based File System in Userspace)
+*	Copyright (C) 2016 Yongseok Oh <yongseok.oh@sk.com>
+*	First Writing: 30/10/2016
+*
+* This program is free software; you can redistribute it and/or modify it
+* under the terms and conditions of the GNU General Public License,
+* version 2, as published by the Free Software Foundation.
+*
+* This program is distributed in the hope it will be useful, but WITHOUT
+* ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+* FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License for
+* more details.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+//#define NDEBUG
+#include <assert.h>
+
+#include "nvfuse_core.h"
+#include "nvfuse_config.h"
+#include "nvfuse_buffer_cache.h"
+#include "nvfuse_inode_cache.h"
+#include "nvfuse_indirect.h"
+#include "nvfuse_bp_tree.h"
+#include "nvfuse_api.h"
+#include "nvfuse_debug.h"
+#include "nvfuse_kv.h"
+
+#define KV_HEAD(buf)		((struct nvfuse_kv_block_head *)(buf))
+#define KV_SLOT(buf, slot)	((struct nvfuse_kv_slot *)((buf) + \
+				 sizeof(struct nvfuse_kv_block_head)) + (slot) - 1)
+
+static void nvfuse_kv_block_init(char *buf)
+{
+	struct nvfuse_kv_block_head *head = KV_HEAD(buf);
+
+	memset(buf, 0x00, CLUSTER_SIZE);
+	head->kb_free = CLUSTER_SIZE;
+}
+
+static s32 nvfuse_kv_block_room(struct nvfuse_kv_block_head *head)
+{
+	return head->kb_free - sizeof(struct nvfuse_kv_block_head) -
+	       head->kb_nr_slots * sizeof(struct nvfuse_kv_slot);
+}
+
+/* pack the live values at the end of the block, slot numbers do not change */
+static void nvfuse_kv_block_compact(char *buf)
+{
+	struct nvfuse_kv_block_head *head = KV_HEAD(buf);
+	struct nvfuse_kv_slot *ks;
+	char tmp[CLUSTER_SIZE];
+	u32 free = CLUSTER_SIZE;
+	u32 slot;
+
+	for (slot = 1; slot <= head->kb_nr_slots; slot++) {
+		ks = KV_SLOT(buf, slot);
+		if (!ks->ks_off)
+			continue;
+
+		free -= ks->ks_len;
+		memcpy(tmp + free, buf + ks->ks_off, ks->ks_len);
+		ks->ks_off = free;
+	}
+
+	memcpy(buf + free, tmp + free, CLUSTER_SIZE - free);
+	head->kb_free = free;
+	head->kb_dead = 0;
+}
+
+/* returns the slot holding len bytes or 0 if the block has no room */
+static u32 nvfuse_kv_block_alloc(char *buf, u32 len)
+{
+	struct nvfuse_kv_block_head *head = KV_HEAD(buf);
+	struct nvfuse_kv_slot *ks;
+	u32 need = len;
+	u32 slot;
+
+	for (slot = 1; slot <= head->kb_nr_slots; slot++) {
+		if (!KV_SLOT(buf, slot)->ks_off)
+			break;
+	}
+
+	if (slot > head->kb_nr_slots) {
+		if (slot > NVFUSE_KV_MAX_SLOTS)
+			return 0;
+		need += sizeof(struct nvfuse_kv_slot);
+	}
+
+	if (nvfuse_kv_block_room(head) < need) {
+		if (nvfuse_kv_block_room(head) + head->kb_dead < need)
+			return 0;
+		nvfuse_kv_block_compact(buf);
+	}
+
+	if (slot > head->kb_nr_slots)
+		head->kb_nr_slots++;
+
+	head->kb_free -= len;
+	head->kb_live++;
+
+	ks = KV_SLOT(buf, slot);
+	ks->ks_off = head->kb_free;
+	ks->ks_len = len;
+
+	return slot;
+}
+
+static void nvfuse_kv_block_free(char *buf, u32 slot)
+{
+	struct nvfuse_kv_block_head *head = KV_HEAD(buf);
+	struct nvfuse_kv_slot *ks = KV_SLOT(buf, slot);
+
+	assert(slot && slot <= head->kb_nr_slots && ks->ks_off);
+
+	if (ks->ks_off == head->kb_free)
+		head->kb_free += ks->ks_len;
+	else
+		head->kb_dead += ks->ks_len;
+
+	ks->ks_off = 0;
+	ks->ks_len = 0;
+	head->kb_live--;
+
+	/* trailing unused slots give their room back */
+	while (head->kb_nr_slots && !KV_SLOT(buf, head->kb_nr_slots)->ks_off)
+		head->kb_nr_slots--;
+
+	if (head->kb_live == 0) {
+		head->kb_free = CLUSTER_SIZE;
+		head->kb_dead = 0;
+	}
+}
+
+static s32 nvfuse_kv_put_block(struct nvfuse_superblock *sb, struct nvfuse_inode_ctx *ictx,
+			       u32 lblk, const void *value, u32 len, bitem_t *item)
+{
+	struct nvfuse_buffer_head *bh;
+	u32 slot;
+
+	bh = nvfuse_get_bh(sb, ictx, ictx->ictx_ino, lblk, READ, NVFUSE_TYPE_META);
+	slot = nvfuse_kv_block_alloc(bh->bh_buf, len);
+	if (!slot) {
+		nvfuse_release_bh(sb, bh, 0, NVF_CLEAN);
+		return -1;
+	}
+
+	memcpy(bh->bh_buf + KV_SLOT(bh->bh_buf, slot)->ks_off, value, len);
+	nvfuse_release_bh(sb, bh, 0, DIRTY);
+
+	*item = NVFUSE_KV_ITEM(lblk, slot);
+	return 0;
+}
+
+/*
+ * store a value in a value block. i_ptr remembers the block which had room
+ * freed last, then the last block is tried and a new block is appended
+ * when both are full.
+ */
+static s32 nvfuse_kv_alloc_value(struct nvfuse_superblock *sb, struct nvfuse_inode_ctx *ictx,
+				 const void *value, u32 len, bitem_t *item)
+{
+	struct nvfuse_inode *inode = ictx->ictx_inode;
+	struct nvfuse_buffer_head *bh;
+	u32 nr_blocks = NVFUSE_SIZE_TO_BLK(inode->i_size);
+	s32 ret;
+
+	if (nr_blocks) {
+		if (inode->i_ptr < nr_blocks - 1 &&
+		    nvfuse_kv_put_block(sb, ictx, inode->i_ptr, value, len, item) == 0)
+			return 0;
+
+		if (nvfuse_kv_put_block(sb, ictx, nr_blocks - 1, value, len, item) == 0)
+			return 0;
+	}
+
+	if (nr_blocks >= NVFUSE_KV_MAX_BLOCKS || inode->i_size + CLUSTER_SIZE > MAX_FILE_SIZE) {
+		dprintf_error(API, " key-value store (ino = %d) is full\n", inode->i_ino);
+		return -1;
+	}
+
+	ret = nvfuse_get_block(sb, ictx, nr_blocks, 1/* num block */, NULL, NULL, 1);
+	if (ret) {
+		dprintf_error(BLOCK, " value block allocation fails.");
+		return -1;
+	}
+
+	bh = nvfuse_get_new_bh(sb, ictx, inode->i_ino, nr_blocks, NVFUSE_TYPE_META);
+	nvfuse_kv_block_init(bh->bh_buf);
+	nvfuse_release_bh(sb, bh, INSERT_HEAD, DIRTY);
+	inode->i_size += CLUSTER_SIZE;
+
+	return nvfuse_kv_put_block(sb, ictx, nr_blocks, value, len, item);
+}
+
+static void nvfuse_kv_free_value(struct nvfuse_superblock *sb, struct nvfuse_inode_ctx *ictx,
+				 bitem_t item)
+{
+	struct nvfuse_inode *inode = ictx->ictx_inode;
+	struct nvfuse_buffer_head *bh;
+	u32 lblk = NVFUSE_KV_ITEM_BLOCK(item);
+	u32 nr_blocks;
+	s32 empty;
+
+	bh = nvfuse_get_bh(sb, ictx, inode->i_ino, lblk, READ, NVFUSE_TYPE_META);
+	nvfuse_kv_block_free(bh->bh_buf, NVFUSE_KV_ITEM_SLOT(item));
+	empty = KV_HEAD(bh->bh_buf)->kb_live == 0;
+	nvfuse_release_bh(sb, bh, 0, DIRTY);
+
+	inode->i_ptr = lblk;
+
+	/* free empty blocks at the end of the store */
+	nr_blocks = NVFUSE_SIZE_TO_BLK(inode->i_size);
+	while (empty && nr_blocks && lblk == nr_blocks - 1) {
+		nvfuse_free_inode_size(sb, ictx, (u64)lblk * CLUSTER_SIZE);
+		inode->i_size -= CLUSTER_SIZE;
+		nr_blocks--;
+		if (!nr_blocks)
+			break;
+
+		lblk = nr_blocks - 1;
+		bh = nvfuse_get_bh(sb, ictx, inode->i_ino, lblk, READ, NVFUSE_TYPE_META);
+		empty = KV_HEAD(bh->bh_buf)->kb_live == 0;
+		nvfuse_release_bh(sb, bh, 0, NVF_CLEAN);
+	}
+
+	if (inode->i_ptr >= nr_blocks)
+		inode->i_ptr = 0;
+}
+
+static u32 nvfuse_kv_copy_value(char *buf, bitem_t item, void *dst, u32 size)
+{
+	struct nvfuse_kv_slot *ks = KV_SLOT(buf, NVFUSE_KV_ITEM_SLOT(item));
+
+	assert(ks->ks_off);
+	memcpy(dst, buf + ks->ks_off, ks->ks_len < size ? ks->ks_len : size);
+
+	return ks->ks_len;
+}
+
+/* read and check the inode of a key-value store */
+static struct nvfuse_inode_ctx *nvfuse_kv_read_inode(struct nvfuse_superblock *sb, inode_t kv_ino)
+{
+	struct nvfuse_inode_ctx *ictx;
+
+	ictx = nvfuse_read_inode(sb, NULL, kv_ino);
+	if (ictx->ictx_inode->i_type != NVFUSE_TYPE_KV || !ictx->ictx_inode->i_bpino) {
+		dprintf_error(API, " ino = %d is not a key-value store\n", kv_ino);
+		nvfuse_release_inode(sb, ictx, NVF_CLEAN);
+		return NULL;
+	}
+
+	return ictx;
+}
+
+/* create an empty key-value store and return its inode number */
+s32 nvfuse_kv_create(struct nvfuse_handle *nvh, const char *path, mode_t mode)
+{
+	struct nvfuse_dir_entry dir_entry;
+	struct nvfuse_inode_ctx *ictx;
+	struct nvfuse_inode *inode;
+	struct nvfuse_superblock *sb;
+	s8 filename[FNAME_SIZE];
+	inode_t ino;
+	s32 res;
+
+	nvfuse_lock();
+
+	res = nvfuse_path_resolve(nvh, path, filename, &dir_entry);
+	if (res < 0)
+		goto RET;
+
+	if (dir_entry.d_ino == 0) {
+		printf(" %s: invalid path\n", __FUNCTION__);
+		res = -1;
+		goto RET;
+	}
+
+	sb = nvfuse_read_super(nvh);
+
+	if (!nvfuse_lookup(sb, NULL, NULL, filename, dir_entry.d_ino)) {
+		dprintf_error(API, "exist file or directory\n");
+		res = NVFUSE_ERROR;
+		goto RELEASE_SUPER;
+	}
+
+	res = nvfuse_createfile(sb, dir_entry.d_ino, filename, &ino, (mode & 0777) | S_IFREG, 0);
+	if (res < 0)
+		goto RELEASE_SUPER;
+
+	ictx = nvfuse_read_inode(sb, NULL, ino);
+	inode = ictx->ictx_inode;
+
+	if (nvfuse_create_bptree(sb, inode)) {
+		dprintf_error(BPTREE, " bptree allocation fails.");
+		nvfuse_release_inode(sb, ictx, DIRTY);
+		res = NVFUSE_ERROR;
+		goto RELEASE_SUPER;
+	}
+
+	inode->i_type = NVFUSE_TYPE_KV;
+	inode->i_ptr = 0;
+	nvfuse_release_inode(sb, ictx, DIRTY);
+
+	nvfuse_check_flush_dirty(sb, sb->sb_dirty_sync_policy);
+	res = ino;
+
+RELEASE_SUPER:
+	nvfuse_release_super(sb);
+RET:
+	nvfuse_unlock();
+
+	return res;
+}
+
+/* return the inode number of the key-value store at path */
+s32 nvfuse_kv_open(struct nvfuse_handle *nvh, const char *path)
+{
+	struct nvfuse_superblock *sb = nvfuse_read_super(nvh);
+	struct nvfuse_dir_entry dir_entry;
+	struct nvfuse_inode_ctx *ictx;
+	s8 filename[FNAME_SIZE];
+	s32 res;
+
+	res = nvfuse_path_resolve(nvh, path, filename, &dir_entry);
+	if (res < 0)
+		return res;
+
+	if (nvfuse_lookup(sb, NULL, &dir_entry, filename, dir_entry.d_ino) < 0)
+		return NVFUSE_ERROR;
+
+	ictx = nvfuse_kv_read_inode(sb, dir_entry.d_ino);
+	if (ictx == NULL)
+		return NVFUSE_ERROR;
+
+	nvfuse_release_inode(sb, ictx, NVF_CLEAN);
+
+	return dir_entry.d_ino;
+}
+
+/*
+ * insert or replace the value of key. the new value is written before the
+ * b+tree is updated and the old value is freed afterwards, so the pair is
+ * found and replaced in a single descent.
+ */
+s32 nvfuse_kv_put(struct nvfuse_handle *nvh, inode_t kv_ino, u64 key, const void *value, u32 len)
+{
+	struct nvfuse_superblock *sb;
+	struct nvfuse_inode_ctx *ictx;
+	master_node_t *master;
+	bkey_t bkey = key;
+	bitem_t item, old_item = 0;
+	s32 res = 0;
+
+	if (key == NVFUSE_KV_NULL_KEY) {
+		dprintf_error(API, " key %lu is reserved\n", (unsigned long)key);
+		return -1;
+	}
+
+	if (len > NVFUSE_KV_MAX_VALUE) {
+		dprintf_error(API, " value size %d is greater than %d\n", len, NVFUSE_KV_MAX_VALUE);
+		return -1;
+	}
+
+	nvfuse_lock();
+
+	sb = nvfuse_read_super(nvh);
+	ictx = nvfuse_kv_read_inode(sb, kv_ino);
+	if (ictx == NULL) {
+		res = NVFUSE_ERROR;
+		goto RELEASE_SUPER;
+	}
+
+	master = bp_get_dir_master(sb, ictx);
+	if (master == NULL) {
+		nvfuse_release_inode(sb, ictx, NVF_CLEAN);
+		res = NVFUSE_ERROR;
+		goto RELEASE_SUPER;
+	}
+
+	if (nvfuse_kv_alloc_value(sb, ictx, value, len, &item) < 0) {
+		B_RELEASE_BH(master, master->m_bh);
+		res = NVFUSE_ERROR;
+	} else if (B_INSERT(master, &bkey, &item, &old_item, 1) < 0) {
+		/* the tree still points at the old value, drop the new one */
+		dprintf_error(API, " b+tree insert of key %lu failed\n", (unsigned long)key);
+		bp_write_master(master);
+		nvfuse_kv_free_value(sb, ictx, item);
+		res = NVFUSE_ERROR;
+	} else {
+		bp_write_master(master);
+
+		/* slot 0 is never used, so an old item is never 0 */
+		if (old_item)
+			nvfuse_kv_free_value(sb, ictx, old_item);
+	}
+	bp_put_dir_master(ictx, master);
+
+	ictx->ictx_inode->i_mtime = time(NULL);
+	nvfuse_release_inode(sb, ictx, DIRTY);
+
+	nvfuse_check_flush_dirty(sb, sb->sb_dirty_sync_policy);
+
+RELEASE_SUPER:
+	nvfuse_release_super(sb);
+	nvfuse_unlock();
+
+	return res;
+}
+
+/*
+ * copy the value of key into buf up to size bytes and return the length of
+ * the value, or -1 if the key does not exist.
+ */
+s32 nvfuse_kv_get(struct nvfuse_handle *nvh, inode_t kv_ino, u64 key, void *buf, u32 size)
+{
+	struct nvfuse_superblock *sb;
+	struct nvfuse_inode_ctx *ictx;
+	struct nvfuse_buffer_head *bh;
+	master_node_t *master;
+	bkey_t bkey = key;
+	bitem_t item;
+	s32 res = -1;
+
+	if (key == NVFUSE_KV_NULL_KEY)
+		return -1;
+
+	nvfuse_lock();
+
+	sb = nvfuse_read_super(nvh);
+	ictx = nvfuse_kv_read_inode(sb, kv_ino);
+	if (ictx == NULL)
+		goto RELEASE_SUPER;
+
+	master = bp_get_dir_master(sb, ictx);
+	if (master == NULL) {
+		nvfuse_release_inode(sb, ictx, NVF_CLEAN);
+		goto RELEASE_SUPER;
+	}
+
+	if (bp_find_key(master, &bkey, &item) >= 0) {
+		bh = nvfuse_get_bh(sb, ictx, kv_ino, NVFUSE_KV_ITEM_BLOCK(item), READ,
+				   NVFUSE_TYPE_META);
+		res = nvfuse_kv_copy_value(bh->bh_buf, item, buf, size);
+		nvfuse_release_bh(sb, bh, 0, NVF_CLEAN);
+	}
+
+	B_RELEASE_BH(master, master->m_bh);
+	bp_put_dir_master(ictx, master);
+
+	nvfuse_release_inode(sb, ictx, NVF_CLEAN);
+
+RELEASE_SUPER:
+	nvfuse_release_super(sb);
+	nvfuse_unlock();
+
+	return res;
+}
+
+s32 nvfuse_kv_delete(struct nvfuse_handle *nvh, inode_t kv_ino, u64 key)
+{
+	struct nvfuse_superblock *sb;
+	struct nvfuse_inode_ctx *ictx;
+	master_node_t *master;
+	bkey_t bkey = key;
+	bitem_t item;
+	s32 res = -1;
+
+	if (key == NVFUSE_KV_NULL_KEY)
+		return -1;
+
+	nvfuse_lock();
+
+	sb = nvfuse_read_super(nvh);
+	ictx = nvfuse_kv_read_inode(sb, kv_ino);
+	if (ictx == NULL)
+		goto RELEASE_SUPER;
+
+	master = bp_get_dir_master(sb, ictx);
+	if (master == NULL) {
+		nvfuse_release_inode(sb, ictx, NVF_CLEAN);
+		goto RELEASE_SUPER;
+	}
+
+	if (bp_find_key(master, &bkey, &item) < 0) {
+		B_RELEASE_BH(master, master->m_bh);
+		bp_put_dir_master(ictx, master);
+		nvfuse_release_inode(sb, ictx, NVF_CLEAN);
+		goto RELEASE_SUPER;
+	}
+
+	B_REMOVE(master, &bkey);
+	bp_write_master(master);
+	bp_put_dir_master(ictx, master);
+
+	nvfuse_kv_free_value(sb, ictx, item);
+
+	ictx->ictx_inode->i_mtime = time(NULL);
+	nvfuse_release_inode(sb, ictx, DIRTY);
+
+	nvfuse_check_flush_dirty(sb, sb->sb_dirty_sync_policy);
+	res = 0;
+
+RELEASE_SUPER:
+	nvfuse_release_super(sb);
+	nvfuse_unlock();
+
+	return res;
+}
+
+/*
+ * call fn for the records with start_key <= key <= end_key in key order and
+ * return the number of records visited. the leaves are walked with a b+tree
+ * cursor and the value block is kept across records stored in the same
+ * block, fn must not modify the store.
+ */
+s32 nvfuse_kv_scan(struct nvfuse_handle *nvh, inode_t kv_ino, u64 start_key, u64 end_key,
+		   nvfuse_kv_scan_fn fn, void *arg)
+{
+	struct nvfuse_superblock *sb;
+	struct nvfuse_inode_ctx *ictx;
+	struct nvfuse_buffer_head *bh = NULL;
+	master_node_t *master;
+	bp_iter_t it;
+	bkey_t bkey = start_key;
+	bitem_t item;
+	char value[NVFUSE_KV_MAX_VALUE];
+	u32 lblk = 0;
+	u32 len;
+	s32 count = 0;
+
+	nvfuse_lock();
+
+	sb = nvfuse_read_super(nvh);
+	ictx = nvfuse_kv_read_inode(sb, kv_ino);
+	if (ictx == NULL) {
+		count = NVFUSE_ERROR;
+		goto RELEASE_SUPER;
+	}
+
+	master = bp_get_dir_master(sb, ictx);
+	if (master == NULL) {
+		nvfuse_release_inode(sb, ictx, NVF_CLEAN);
+		count = NVFUSE_ERROR;
+		goto RELEASE_SUPER;
+	}
+
+	bp_iter_open(master, &it, &bkey);
+	while (bp_iter_next(&it, &bkey, &item) == 0) {
+		if (bkey > end_key)
+			break;
+
+		if (bh && lblk != NVFUSE_KV_ITEM_BLOCK(item)) {
+			nvfuse_release_bh(sb, bh, 0, NVF_CLEAN);
+			bh = NULL;
+		}
+
+		if (bh == NULL) {
+			lblk = NVFUSE_KV_ITEM_BLOCK(item);
+			bh = nvfuse_get_bh(sb, ictx, kv_ino, lblk, READ, NVFUSE_TYPE_META);
+		}
+
+		len = nvfuse_kv_copy_value(bh->bh_buf, item, value, NVFUSE_KV_MAX_VALUE);
+		count++;
+
+		if (fn && fn(bkey, value, len, arg))
+			break;
+	}
+	bp_iter_close(&it);
+
+	if (bh)
+		nvfuse_release_bh(sb, bh, 0, NVF_CLEAN);
+
+	B_RELEASE_BH(master, master->m_bh);
+	bp_put_dir_master(ictx, master);
+
+	nvfuse_release_inode(sb, ictx, NVF_CLEAN);
+
+RELEASE_SUPER:
+	nvfuse_release_super(sb);
+	nvfuse_unlock();
+
+	return count;
+}
@@ -141,16 +141,13 @@ s32 nvfuse_alloc_root_inode_direct(struct io_target *target,
 	nvfuse_read_cluster(buf, bd->bd_dtable_start, target);
 
 	memset(buf, 0x0, CLUSTER_SIZE);
-	d_entry = (struct nvfuse_dir_entry *)buf;
 
 	//root directory
-	strcpy(d_entry[0].d_filename, ".");
-	d_entry[0].d_ino = ROOT_INO;
-	d_entry[0].d_flag = DIR_USED;
+	d_entry = nvfuse_dentry_append(buf, CLUSTER_SIZE, ROOT_INO, 0, ".");
+	assert(d_entry != NULL);
 
-	strcpy(d_entry[1].d_filename, "..");
-	d_entry[1].d_ino = ROOT_INO;
-	d_entry[1].d_flag = DIR_USED;
+	d_entry = nvfuse_dentry_append(buf, CLUSTER_SIZE, ROOT_INO, 0, "..");
+	assert(d_entry != NULL);
 
 	nvfuse_write_cluster(buf, bd->bd_dtable_start, target);
 	nvfuse_write_cluster(bd_buf, bg_id * bg_size + NVFUSE_BD_OFFSET, target);
@@ -183,6 +180,7 @@ void nvfuse_make_bg_descriptor(struct nvfuse_bg_descriptor *bd, u32 bg_id, u32 b
 	bd->bd_free_inodes = bd->bd_max_inodes;
 	/* reserve metadata blocks including sb, inode, and bitmaps. */
 	bd->bd_free_blocks = bd->bd_max_blocks - bd->bd_dtable_start;
+	bd->bd_orphan_count = 0;
 
 	bd->bd_bg_start	+= bg_start;
 	bd->bd_bd_start	+= bg_start;
@@ -462,6 +460,7 @@ s32 nvfuse_format(struct nvfuse_handle *nvh)
 	nvfuse_sb_disk->sb_no_of_blocks = num_clu;
 
 	nvfuse_sb_disk->sb_signature = NVFUSE_SB_SIGNATURE;
+	nvfuse_sb_disk->sb_dentry_format = NVFUSE_DENTRY_FORMAT;
 
 	nvfuse_sb_disk->sb_no_of_inodes_per_bg = NVFUSE_INODE_PER_BG;
 	nvfuse_sb_disk->sb_no_of_blocks_per_bg = NVFUSE_DATA_PER_BG;
@@ -433,6 +433,51 @@ int reactor_sync_flush(struct io_target *target)
 	return ret;
 }
 
+int reactor_unmap_supported(struct io_target *target)
+{
+#ifndef NVFUSE_USE_CEPH_SPDK
+	return spdk_bdev_io_type_supported(target->bdev, SPDK_BDEV_IO_TYPE_UNMAP);
+#else
+	return 0;
+#endif
+}
+
+/* deallocate nr ranges of blocks with a single batch of requests */
+int reactor_sync_unmap_blks(struct io_target *target, long *blocks, int *counts, int nr)
+{
+	struct reactor_task *task;
+	struct io_job *reqs[REACTOR_MAX_REQUEST];
+	int ptr;
+	int ret = 0;
+	int i;
+
+	task = reactor_alloc_task(target, nr);
+	if (task == NULL)
+		return -1;
+
+	for (i = 0; i < nr; i++) {
+		reqs[i] = reactor_make_single_req(target, blocks[i] * NV_BLOCK_SIZE,
+										counts[i] * NV_BLOCK_SIZE, NULL,
+										SPDK_BDEV_IO_TYPE_UNMAP);
+	}
+
+	reactor_submit_reqs(target, task, reqs, nr);
+
+	ptr = 0;
+	while (ptr < nr) {
+		ptr += reactor_cq_get_reqs(task, reqs + ptr, 1, nr - ptr);
+	}
+
+	for (i = 0; i < nr; i++) {
+		if (reqs[i]->ret)
+			ret = reqs[i]->ret;
+	}
+	reactor_free_reqs(target, reqs, ptr);
+	reactor_free_task(target, task);
+
+	return ret;
+}
+
 struct io_target *reactor_construct_targets(void)
 {
 	int index = 0;
@@ -556,6 +601,9 @@ void reactor_submit_on_core(void *arg1, void *arg2)
 		} else if (req->req_type == SPDK_BDEV_IO_TYPE_FLUSH) {
 			rc = spdk_bdev_flush(target->desc, target->ch, req->offset, 
 					req->bytes, req->cb, req);
+		} else if (req->req_type == SPDK_BDEV_IO_TYPE_UNMAP) {
+			rc = spdk_bdev_unmap(target->desc, target->ch, req->offset,
+					req->bytes, req->cb, req);
 #else
 		if (req->req_type == SPDK_BDEV_IO_TYPE_READ) {
 			bdev_io = spdk_bdev_readv(target->desc, target->ch, req->iov, req->iovcnt, req->offset, 
@@ -0,0 +1,309 @@
+/*
+*	NVFUSE (NVMe based File System in Userspace)
+*	Copyright (C) 2016 Yongseok Oh <yongseok.oh@sk.com>
+*	First Writing: 30/10/2016
+*
+* This program is free software; you can redistribute it and/or modify it
+* under the terms and conditions of the GNU General Public License,
+* version 2, as published by the Free Software Foundation.
+*
+* This program is distributed in the hope it will be useful, but WITHOUT
+* ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+* FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License for
+* more details.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+//#define NDEBUG
+#include <assert.h>
+
+#include "nvfuse_core.h"
+#include "nvfuse_config.h"
+#include "nvfuse_dep.h"
+#include "nvfuse_buffer_cache.h"
+#include "nvfuse_indirect.h"
+#include "nvfuse_reclaim.h"
+#include "nvfuse_debug.h"
+
+void nvfuse_reclaim_init(struct nvfuse_superblock *sb)
+{
+	INIT_LIST_HEAD(&sb->sb_orphan_list);
+	SPINLOCK_INIT(&sb->sb_orphan_lock);
+	sb->sb_orphan_count = 0;
+	sb->sb_reclaiming = 0;
+}
+
+static s32 nvfuse_orphan_track(struct nvfuse_superblock *sb, inode_t ino)
+{
+	struct nvfuse_orphan *o;
+
+	o = (struct nvfuse_orphan *)malloc(sizeof(struct nvfuse_orphan));
+	if (o == NULL) {
+		dprintf_error(INODE, " malloc error \n");
+		return -1;
+	}
+	o->o_ino = ino;
+
+	SPINLOCK_LOCK(&sb->sb_orphan_lock);
+	list_add_tail(&o->o_list, &sb->sb_orphan_list);
+	sb->sb_orphan_count++;
+	SPINLOCK_UNLOCK(&sb->sb_orphan_lock);
+
+	return 0;
+}
+
+static void nvfuse_orphan_untrack(struct nvfuse_superblock *sb, inode_t ino)
+{
+	struct nvfuse_orphan *o;
+
+	SPINLOCK_LOCK(&sb->sb_orphan_lock);
+	list_for_each_entry(o, &sb->sb_orphan_list, o_list) {
+		if (o->o_ino == ino) {
+			list_del(&o->o_list);
+			sb->sb_orphan_count--;
+			free(o);
+			break;
+		}
+	}
+	SPINLOCK_UNLOCK(&sb->sb_orphan_lock);
+}
+
+/* adjust the number of orphans recorded in the bg descriptor of ino */
+static void nvfuse_orphan_count(struct nvfuse_superblock *sb, inode_t ino, s32 delta)
+{
+	struct nvfuse_buffer_head *bd_bh;
+	struct nvfuse_bg_descriptor *bd;
+	u32 bg_id = ino / sb->sb_no_of_inodes_per_bg;
+
+	bd_bh = nvfuse_get_bh(sb, NULL, BD_INO, bg_id, READ, NVFUSE_TYPE_META);
+	bd = (struct nvfuse_bg_descriptor *)bd_bh->bh_buf;
+	assert(bd->bd_id == bg_id);
+	assert(delta > 0 || bd->bd_orphan_count > 0);
+	bd->bd_orphan_count += delta;
+	nvfuse_release_bh(sb, bd_bh, 0, DIRTY);
+}
+
+/*
+ * find the orphans of the bgs owned by this process, left by an earlier
+ * mount. only the bgs whose descriptor counts orphans are scanned.
+ */
+s32 nvfuse_reclaim_load(struct nvfuse_superblock *sb)
+{
+	struct nvfuse_buffer_head *bh;
+	struct nvfuse_inode_ctx *ictx;
+	struct bg_node *node;
+	u32 nr_inodes = sb->sb_no_of_inodes_per_bg;
+	u32 pos, found;
+	inode_t ino;
+
+	list_for_each_entry(node, &sb->sb_bg_list, list) {
+		if (!sb->sb_bd[node->bg_id].bd_orphan_count)
+			continue;
+
+		found = 0;
+		bh = nvfuse_get_bh(sb, NULL, IBITMAP_INO, node->bg_id, READ, NVFUSE_TYPE_META);
+		for (pos = nvfuse_bitmap_find_next_set(bh->bh_buf, nr_inodes, 0); pos < nr_inodes;
+		     pos = nvfuse_bitmap_find_next_set(bh->bh_buf, nr_inodes, pos + 1)) {
+			ino = node->bg_id * nr_inodes + pos;
+			if (ino < ROOT_INO)
+				continue;
+
+			ictx = nvfuse_read_inode(sb, NULL, ino);
+			if (ictx->ictx_inode->i_flags & NVFUSE_INODE_FLAG_ORPHAN) {
+				if (nvfuse_orphan_track(sb, ino) < 0) {
+					nvfuse_release_inode(sb, ictx, NVF_CLEAN);
+					nvfuse_release_bh(sb, bh, 0, NVF_CLEAN);
+					return -1;
+				}
+				found++;
+			}
+			nvfuse_release_inode(sb, ictx, NVF_CLEAN);
+		}
+		nvfuse_release_bh(sb, bh, 0, NVF_CLEAN);
+
+		if (found != sb->sb_bd[node->bg_id].bd_orphan_count)
+			dprintf_warn(MOUNT, " bg %d has %d orphans, %d expected \n", node->bg_id, found,
+				     sb->sb_bd[node->bg_id].bd_orphan_count);
+	}
+
+	if (sb->sb_orphan_count)
+		dprintf_info(MOUNT, " %d orphan inodes are reclaimed in the background \n",
+			     sb->sb_orphan_count);
+
+	return 0;
+}
+
+/* orphans not reclaimed yet stay on disk for the next mount */
+void nvfuse_reclaim_deinit(struct nvfuse_superblock *sb)
+{
+	struct nvfuse_orphan *o, *temp;
+
+	list_for_each_entry_safe(o, temp, &sb->sb_orphan_list, o_list) {
+		list_del(&o->o_list);
+		free(o);
+	}
+	sb->sb_orphan_count = 0;
+}
+
+/* the number of leading blocks of an inode the reclaimer leaves alone */
+u32 nvfuse_reclaim_live_blocks(struct nvfuse_inode *inode)
+{
+	if (!(inode->i_flags & NVFUSE_INODE_FLAG_ORPHAN))
+		return (u32)-1;
+
+	if (inode->i_links_count == 0)
+		return 0;
+
+	return NVFUSE_SIZE_TO_BLK(inode->i_size + CLUSTER_SIZE - 1);
+}
+
+/*
+ * drop the buffers and free the blocks of up to budget blocks at the end
+ * of an orphan. returns 1 once nothing is left to reclaim, the inode is
+ * then no longer an orphan.
+ */
+static s32 nvfuse_reclaim_step(struct nvfuse_superblock *sb, struct nvfuse_inode_ctx *ictx,
+			       u32 budget)
+{
+	struct nvfuse_inode *inode = ictx->ictx_inode;
+	u32 live, from;
+
+	live = nvfuse_reclaim_live_blocks(inode);
+	if (inode->i_reclaim_blocks > live) {
+		if (inode->i_reclaim_blocks - live > budget)
+			from = inode->i_reclaim_blocks - budget;
+		else
+			from = live;
+
+		nvfuse_invalidate_bcs(sb, inode->i_ino, from, inode->i_reclaim_blocks, 0);
+		nvfuse_truncate_blocks(sb, ictx, (u64)from * CLUSTER_SIZE);
+		inode->i_reclaim_blocks = from;
+	}
+
+	if (inode->i_reclaim_blocks > live)
+		return 0;
+
+	inode->i_flags &= ~NVFUSE_INODE_FLAG_ORPHAN;
+	inode->i_reclaim_blocks = 0;
+	nvfuse_orphan_count(sb, inode->i_ino, -1);
+	nvfuse_orphan_untrack(sb, inode->i_ino);
+
+	return 1;
+}
+
+/*
+ * free the blocks of ictx past size, leaving large ranges to the reclaimer.
+ * returns 1 if ictx became (or stays) an orphan, then an unlinked inode is
+ * freed by the reclaimer as well. the caller holds ictx and releases it
+ * dirty.
+ */
+s32 nvfuse_reclaim_inode_size(struct nvfuse_superblock *sb, struct nvfuse_inode_ctx *ictx,
+			      s64 size)
+{
+	struct nvfuse_inode *inode = ictx->ictx_inode;
+#ifdef NVFUSE_USE_DEFERRED_RECLAIM
+	u32 num_block, trun_num_block;
+#endif
+
+	/* a file growing again first gets rid of the blocks of an earlier truncate */
+	if (size > inode->i_size)
+		nvfuse_reclaim_finish(sb, ictx);
+
+#ifdef NVFUSE_USE_DEFERRED_RECLAIM
+	if (inode->i_flags & NVFUSE_INODE_FLAG_INLINE)
+		goto FREE_NOW;
+
+	num_block = NVFUSE_SIZE_TO_BLK(inode->i_size + CLUSTER_SIZE - 1);
+	trun_num_block = NVFUSE_SIZE_TO_BLK(size + CLUSTER_SIZE - 1);
+
+	if (inode->i_flags & NVFUSE_INODE_FLAG_ORPHAN) {
+		/* the reclaimer now also takes the blocks up to the new size */
+		if (num_block > inode->i_reclaim_blocks)
+			inode->i_reclaim_blocks = num_block;
+		nvfuse_release_prealloc(sb, ictx);
+		return 1;
+	}
+
+	if (num_block <= trun_num_block || num_block - trun_num_block <= NVFUSE_RECLAIM_BATCH)
+		goto FREE_NOW;
+
+	if (nvfuse_orphan_track(sb, inode->i_ino) < 0)
+		goto FREE_NOW;
+
+	inode->i_flags |= NVFUSE_INODE_FLAG_ORPHAN;
+	inode->i_reclaim_blocks = num_block;
+	nvfuse_orphan_count(sb, inode->i_ino, 1);
+	nvfuse_release_prealloc(sb, ictx);
+
+	return 1;
+FREE_NOW:
+#endif
+	nvfuse_free_inode_size(sb, ictx, size);
+
+	return 0;
+}
+
+/* reclaim everything left of an orphan the caller is about to extend */
+void nvfuse_reclaim_finish(struct nvfuse_superblock *sb, struct nvfuse_inode_ctx *ictx)
+{
+	if (!(ictx->ictx_inode->i_flags & NVFUSE_INODE_FLAG_ORPHAN))
+		return;
+
+	assert(ictx->ictx_inode->i_links_count);
+	while (!nvfuse_reclaim_step(sb, ictx, NVFUSE_RECLAIM_BATCH))
+		;
+}
+
+/*
+ * take one step on the oldest orphan that nobody holds. called where the
+ * caller holds no inode or buffer, so unlink and truncate return at once
+ * and the work is spread over later operations.
+ */
+void nvfuse_reclaim_orphans(struct nvfuse_superblock *sb)
+{
+	struct nvfuse_inode_ctx *ictx;
+	struct nvfuse_orphan *o;
+	inode_t ino = 0;
+
+	if (!sb->sb_orphan_count)
+		return;
+
+	SPINLOCK_LOCK(&sb->sb_orphan_lock);
+	if (sb->sb_reclaiming) {
+		SPINLOCK_UNLOCK(&sb->sb_orphan_lock);
+		return;
+	}
+
+	list_for_each_entry(o, &sb->sb_orphan_list, o_list) {
+		if (!nvfuse_ictx_is_locked(sb, o->o_ino)) {
+			ino = o->o_ino;
+			/* the others get their turn before this one again */
+			list_move_tail(&o->o_list, &sb->sb_orphan_list);
+			break;
+		}
+	}
+
+	if (!ino) {
+		SPINLOCK_UNLOCK(&sb->sb_orphan_lock);
+		return;
+	}
+	sb->sb_reclaiming = 1;
+	SPINLOCK_UNLOCK(&sb->sb_orphan_lock);
+
+	ictx = nvfuse_read_inode(sb, NULL, ino);
+	if (!(ictx->ictx_inode->i_flags & NVFUSE_INODE_FLAG_ORPHAN)) {
+		/* finished by a writer meanwhile */
+		nvfuse_release_inode(sb, ictx, NVF_CLEAN);
+	} else if (nvfuse_reclaim_step(sb, ictx, NVFUSE_RECLAIM_BATCH) &&
+		   ictx->ictx_inode->i_links_count == 0) {
+		nvfuse_relocate_delete_inode(sb, ictx);
+	} else {
+		nvfuse_release_inode(sb, ictx, DIRTY);
+	}
+
+	SPINLOCK_LOCK(&sb->sb_orphan_lock);
+	sb->sb_reclaiming = 0;
+	SPINLOCK_UNLOCK(&sb->sb_orphan_lock);
+}
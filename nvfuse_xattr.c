@@ -25,7 +25,7 @@
 //#define PRINT_SCREEN
 //#define BUFFER_FLUSH
 
-#define NVFUSE_XATTR_MAX_SIZE 3968 //MAX EA space size limits 3972
+#define NVFUSE_XATTR_MAX_SIZE (NVFUSE_INODE_XATTR_SIZE - 4) //MAX EA space size limits NVFUSE_INODE_XATTR_SIZE
 #define NVFUSE_XATTR_NAME_MAX_LEN 256 // MAX name length limits 256
 #define NVFUSE_XATTR_VALUE_MAX_LEN 512	// Max value length limits 512
 #define XATTR_ENTRY(ptr)	((struct nvfuse_xattr_entry *)(ptr))